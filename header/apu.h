@@ -0,0 +1,347 @@
+#ifndef APU__H
+#define APU__H
+
+#include "definitions.h"
+#include "audio_sink.h"
+#include "blip_buffer.h"
+#include <limits>
+#include <mutex>
+
+class bus;
+
+typedef struct apu_envelope {
+	bool start;
+	bool loop;
+	bool constant;
+	u8 period;
+	u8 divider;
+	u8 decay;
+
+	apu_envelope() :
+		start(false),
+		loop(false),
+		constant(false),
+		period(0),
+		divider(0),
+		decay(0)
+	{}
+
+	void write(const u8 value) {
+		this->loop = value & 0x20;
+		this->constant = value & 0x10;
+		this->period = value & 0x0F;
+	}
+	// Quarter frame
+	void clock() {
+		if (this->start) {
+			this->start = false;
+			this->decay = 15;
+			this->divider = this->period;
+		}
+		else if (this->divider > 0) this->divider--;
+		else {
+			this->divider = this->period;
+			if (this->decay > 0) this->decay--;
+			else if (this->loop) this->decay = 15;
+		}
+	}
+	u8 volume() const { return this->constant ? this->period : this->decay; }
+} apu_envelope;
+
+typedef struct apu_pulse {
+	// Waveforms of the 4 duty cycles, first step in the top bit
+	constexpr static u8 DUTY[4] = { 0b01000000_u8, 0b01100000_u8, 0b01111000_u8, 0b10011111_u8 };
+
+	apu_envelope envelope;
+	// The first pulse negates its sweep in ones' complement, the second in two's
+	bool ones_complement;
+	u8 duty;
+	u8 phase;
+	u16 timer;
+	u8 length;
+	bool sweep_enabled;
+	bool sweep_negate;
+	bool sweep_reload;
+	u8 sweep_period;
+	u8 sweep_shift;
+	u8 sweep_divider;
+	u64 next;
+
+	explicit apu_pulse(const bool ones_complement) :
+		envelope(),
+		ones_complement(ones_complement),
+		duty(0),
+		phase(0),
+		timer(0),
+		length(0),
+		sweep_enabled(false),
+		sweep_negate(false),
+		sweep_reload(false),
+		sweep_period(0),
+		sweep_shift(0),
+		sweep_divider(0),
+		next(0)
+	{}
+
+	u16 sweep_target() const {
+		u16 change = this->timer >> this->sweep_shift;
+		if (!this->sweep_negate) return this->timer + change;
+		return this->timer - change - (this->ones_complement ? 1 : 0);
+	}
+	// Silenced by the sweep unit even when the sweep is disabled
+	bool muted() const { return this->timer < 8 || (!this->sweep_negate && this->sweep_target() > 0x7FF); }
+	bool audible() const { return this->length > 0 && !this->muted() && this->envelope.volume() > 0; }
+	u64 period() const { return (static_cast<u64>(this->timer) + 1) * 2; }
+	u8 level() const { return (this->audible() && ((DUTY[this->duty] >> (7 - this->phase)) & 1)) ? this->envelope.volume() : 0; }
+	// Half frame
+	void clock_sweep() {
+		if (this->sweep_divider == 0 && this->sweep_enabled && this->sweep_shift > 0 && !this->muted()) this->timer = this->sweep_target();
+		if (this->sweep_divider == 0 || this->sweep_reload) {
+			this->sweep_divider = this->sweep_period;
+			this->sweep_reload = false;
+		}
+		else this->sweep_divider--;
+	}
+} apu_pulse;
+
+typedef struct apu_triangle {
+	// Also halts the length counter
+	bool control;
+	bool linear_reload;
+	u8 linear_reload_value;
+	u8 linear;
+	u8 step;
+	u16 timer;
+	u8 length;
+	u64 next;
+
+	apu_triangle() :
+		control(false),
+		linear_reload(false),
+		linear_reload_value(0),
+		linear(0),
+		step(0),
+		timer(0),
+		length(0),
+		next(0)
+	{}
+
+	// Periods under 2 are ultrasonic, the sequencer is held like most emulators do instead of popping
+	bool audible() const { return this->linear > 0 && this->length > 0 && this->timer >= 2; }
+	u64 period() const { return static_cast<u64>(this->timer) + 1; }
+	u8 level() const { return (this->step < 16) ? 15 - this->step : this->step - 16; }
+	// Quarter frame
+	void clock_linear() {
+		if (this->linear_reload) this->linear = this->linear_reload_value;
+		else if (this->linear > 0) this->linear--;
+		if (!this->control) this->linear_reload = false;
+	}
+} apu_triangle;
+
+typedef struct apu_noise {
+	apu_envelope envelope;
+	bool short_mode;
+	u8 period_index;
+	u16 shift;
+	u8 length;
+	u64 next;
+
+	apu_noise() :
+		envelope(),
+		short_mode(false),
+		period_index(0),
+		shift(1),
+		length(0),
+		next(0)
+	{}
+
+	bool audible() const { return this->length > 0 && this->envelope.volume() > 0; }
+	u8 level() const { return (this->length > 0 && (this->shift & 1) == 0) ? this->envelope.volume() : 0; }
+	void clock() {
+		u16 feedback = (this->shift ^ (this->shift >> (this->short_mode ? 6 : 1))) & 1;
+		this->shift = static_cast<u16>((this->shift >> 1) | (feedback << 14));
+	}
+} apu_noise;
+
+typedef struct apu_dmc {
+	bool irq_enabled;
+	bool loop;
+	u16 period;
+	u8 level;
+	u16 sample_address;
+	u16 sample_length;
+	u16 address;
+	u16 bytes_remaining;
+	u8 buffer;
+	bool buffer_full;
+	u8 shift;
+	u8 bits_remaining;
+	bool silence;
+	u64 next;
+
+	apu_dmc() :
+		irq_enabled(false),
+		loop(false),
+		period(428),
+		level(0),
+		sample_address(0xC000),
+		sample_length(1),
+		address(0xC000),
+		bytes_remaining(0),
+		buffer(0),
+		buffer_full(false),
+		shift(0),
+		bits_remaining(8),
+		silence(true),
+		next(0)
+	{}
+
+	void restart() {
+		this->address = this->sample_address;
+		this->bytes_remaining = this->sample_length;
+	}
+} apu_dmc;
+
+// The channels and the frame counter for a snapshot; not the samples in flight, they belong to the real timeline
+typedef struct apu_state {
+	std::array<apu_pulse, 2> pulses;
+	apu_triangle triangle;
+	apu_noise noise;
+	apu_dmc dmc;
+	u8 enabled;
+	bool five_step;
+	bool irq_inhibit;
+	bool frame_irq;
+	bool dmc_irq;
+	u64 frame_start;
+	usize frame_step;
+	u64 time;
+	u64 frame_time;
+	u64 event;
+	usize stall;
+	float amplitude;
+
+	apu_state() :
+		pulses({ apu_pulse(true), apu_pulse(false) }),
+		triangle(),
+		noise(),
+		dmc(),
+		enabled(0),
+		five_step(false),
+		irq_inhibit(false),
+		frame_irq(false),
+		dmc_irq(false),
+		frame_start(0),
+		frame_step(0),
+		time(0),
+		frame_time(0),
+		event(0),
+		stall(0),
+		amplitude(0.f)
+	{}
+} apu_state;
+
+/* The 2A03 sound channels and frame counter, NTSC rates. Nothing runs per cycle: the apu sleeps until a register
+ * access, an event it posted or the end of a frame, then catches up to the bus clock in one go, jumping from one
+ * channel timer edge to the next. Every change of the mixed level (through the nonlinear mixer tables) becomes a
+ * band-limited step, and end_frame turns the frame's steps into samples for the sinks.
+ * Events are the cycles the cpu has to see the apu at: a frame counter IRQ, or a DMC fetch, which steals cpu
+ * cycles and can raise the DMC IRQ; the bus runs the apu once its clock passes get_next_event().
+ */
+class apu {
+
+private:
+	static constexpr u64 NEVER = std::numeric_limits<u64>::max();
+	static constexpr double CLOCK_RATE = 1789773.0;
+	static constexpr u32 DEFAULT_SAMPLE_RATE = 48000;
+	// Mixer output is 0 to 1, leave headroom for the high-pass overshoot
+	static constexpr float VOLUME = 30000.f;
+	// Flushed even without an end_frame, so that the blip buffer never overflows
+	static constexpr u64 MAX_FRAME_CYCLES = 1789773 / 20;
+	// A DMC fetch halts the cpu for up to 4 cycles, the average is close to that
+	static constexpr usize DMC_STALL = 4;
+
+	bus* cpu_bus;
+	std::array<apu_pulse, 2> pulses;
+	apu_triangle triangle;
+	apu_noise noise;
+	apu_dmc dmc;
+	// $4015 channel enables, a disabled channel does not take length counter loads
+	u8 enabled;
+
+	bool five_step;
+	bool irq_inhibit;
+	bool frame_irq;
+	bool dmc_irq;
+	u64 frame_start;
+	usize frame_step;
+
+	// Bus clock the apu is caught up to, and where the current blip frame started
+	u64 time;
+	u64 frame_time;
+	u64 event;
+	usize stall;
+
+	float amplitude;
+	// Run-ahead frames are never heard: no steps are made and end_frame drops the frame
+	bool silent;
+	blip_buffer blip;
+	std::vector<i16> samples;
+	std::mutex sinks_mutex;
+	std::vector<audio_sink*> sinks;
+
+	void run_channels(const u64 until);
+	void clock_dmc(const u64 now);
+	void fetch_sample();
+	void clock_frame(const u8 actions, const u64 now);
+	// After anything that can start, stop or change a channel
+	void refresh(const u64 now);
+	void mix(const u64 now);
+	void update_event();
+	void set_frame_irq(const bool asserted);
+	void set_dmc_irq(const bool asserted);
+
+public:
+	apu();
+	apu(apu& to_copy) = delete;
+	apu(apu&& to_move) noexcept = delete;
+
+	void connect(bus* cpu_bus) { this->cpu_bus = cpu_bus; }
+
+	// Power clears everything, the reset line only silences the channels and restarts the frame counter
+	void reset(const u64 now, const bool power);
+	// Emulation stopped; the sinks get the new rate with the next samples
+	void set_sample_rate(const u32 sample_rate);
+	u32 get_sample_rate() const { return this->blip.get_sample_rate(); }
+	// Dynamic rate control: samples made per nominal sample, from the next end_frame on
+	void set_rate_adjust(const double ratio) { this->blip.set_rate_adjust(ratio); }
+	double get_rate_adjust() const { return this->blip.get_rate_adjust(); }
+
+	void run_until(const u64 now);
+	// Bus clock at which the apu has to run, 0 while it owes the cpu stolen cycles
+	u64 get_next_event() const { return (this->stall > 0) ? 0 : this->event; }
+	// Cycles the DMC took from the cpu since the last call
+	usize take_stall() {
+		usize stall = this->stall;
+		this->stall = 0;
+		return stall;
+	}
+
+	// $4000-$4013, $4015, $4017, with the apu caught up to the access
+	void write(const u16 address, const u8 value);
+	// $4015, clears the frame IRQ
+	u8 read_status();
+
+	// Turns everything up to the last run into samples and hands them to the sinks
+	void end_frame();
+
+	void add_sink(audio_sink* sink);
+	void remove_sink(audio_sink* sink);
+
+	void set_silent(const bool silent) { this->silent = silent; }
+	// The IRQ lines are restored with the cpu
+	void save_state(apu_state& out) const;
+	void load_state(const apu_state& in);
+};
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef ARCHIVE__H
+#define ARCHIVE__H
+
+#include "definitions.h"
+#include "checksum.h"
+#include "inflater.h"
+#include "mapped_file.h"
+#include <algorithm>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+
+typedef struct archive_member {
+	std::string name;
+	u64 size;
+	u64 compressed_size;
+	u32 crc32;
+	// 0 stored, 8 deflated, anything else cannot be read
+	u16 method;
+	bool encrypted;
+	// Zip: the local header, the data starts after it; gzip: the data itself
+	u64 offset;
+} archive_member;
+
+/* A .zip or .gz file, mapped and read in place. A gzip file is one member named after the file. Members are read
+ * either whole, inflated straight into the buffer that becomes the rom image, or as a stream for hashing.
+ * A member of an archive is named "archive|member" wherever a rom path goes; "archive" alone is its first rom.
+ */
+class archive {
+
+private:
+	mapped_file file;
+	std::vector<archive_member> members;
+
+	void read_zip_directory();
+	void read_gzip_header();
+	std::span<const u8> member_data(const archive_member& member) const;
+
+public:
+	static constexpr char MEMBER_SEPARATOR = '|';
+	// The largest member extract inflates; well past any rom, far short of what a forged size could ask for
+	static constexpr u64 MAX_EXTRACTED_SIZE = 16 * 1024 * 1024;
+
+	// Throws std::runtime_error if the file cannot be mapped or is not an archive this reads
+	explicit archive(const std::string& path);
+	archive(archive& to_copy) = delete;
+	archive(archive&& to_move) noexcept = delete;
+
+	const std::vector<archive_member>& get_members() const { return this->members; }
+	// nullptr if there is no member with that name; an empty name is the first .nes member
+	const archive_member* find(const std::string& name) const;
+
+	// The whole member, checked against its CRC-32; throws std::runtime_error, also for sizes over MAX_EXTRACTED_SIZE
+	std::vector<u8> extract(const archive_member& member) const;
+	/* Calls consume with consecutive pieces of the member, at most chunk bytes each, without holding more than
+	 * one piece. Returns the CRC-32 of what went by; throws std::runtime_error on damage or a CRC mismatch.
+	 */
+	template <typename C>
+	u32 stream(const archive_member& member, usize chunk, C&& consume) const;
+
+	// .zip or .gz, by extension
+	static bool is_archive(const std::filesystem::path& path);
+	// "set.zip|Game.nes" -> { "set.zip", "Game.nes" }; a path without a member of an archive gives { path, "" }
+	static std::pair<std::string, std::string> split(const std::string& path);
+};
+
+template <typename C>
+u32 archive::stream(const archive_member& member, usize chunk, C&& consume) const {
+	std::span<const u8> data = this->member_data(member);
+	u32 crc = 0;
+	u64 total = 0;
+	if (member.method == 0) {
+		for (usize offset = 0; offset < data.size(); offset += chunk) {
+			std::span<const u8> piece = data.subspan(offset, std::min(chunk, data.size() - offset));
+			crc = checksum::crc32(piece, crc);
+			consume(piece);
+		}
+		total = data.size();
+	}
+	else {
+		inflater decoder(data);
+		std::vector<u8> buffer(chunk);
+		usize count;
+		while ((count = decoder.read(buffer)) > 0) {
+			std::span<const u8> piece(buffer.data(), count);
+			crc = checksum::crc32(piece, crc);
+			total += count;
+			consume(piece);
+		}
+	}
+	// Sizes compare modulo 2^32, all gzip keeps
+	if (static_cast<u32>(total) != static_cast<u32>(member.size) || crc != member.crc32) throw std::runtime_error("CRC mismatch in " + member.name);
+	return crc;
+}
+
+#endif
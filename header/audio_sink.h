@@ -0,0 +1,64 @@
+#ifndef AUDIO_SINK__H
+#define AUDIO_SINK__H
+
+#include "definitions.h"
+#include "ring_buffer.h"
+#include <atomic>
+
+// Receives the apu's output on the emulation thread, mono signed 16 bit, about a frame's worth per call
+class audio_sink {
+public:
+	virtual ~audio_sink() = default;
+	virtual void submit_audio(std::span<const i16> samples, u32 sample_rate) = 0;
+};
+
+/* Hands the samples to a consumer on another thread through a lock free ring, e.g. the SDL audio callback.
+ * Neither side waits: samples that do not fit are dropped, and a read the ring cannot fill is padded with the
+ * last sample played, which is quieter than a jump to zero.
+ */
+class audio_ring_sink : public audio_sink {
+
+private:
+	static constexpr usize CAPACITY = 0x4000;
+
+	spsc_ring<i16, CAPACITY> ring;
+	i16 last;
+	std::atomic<u32> sample_rate;
+	std::atomic<usize> dropped;
+	std::atomic<usize> underruns;
+
+public:
+	audio_ring_sink() :
+		ring(),
+		last(0),
+		sample_rate(0),
+		dropped(0),
+		underruns(0)
+	{}
+	audio_ring_sink(audio_ring_sink& to_copy) = delete;
+	audio_ring_sink(audio_ring_sink&& to_move) noexcept = delete;
+
+	void submit_audio(std::span<const i16> samples, u32 sample_rate) override {
+		this->sample_rate.store(sample_rate, std::memory_order_relaxed);
+		usize pushed = this->ring.push(samples);
+		if (pushed < samples.size()) this->dropped.fetch_add(samples.size() - pushed, std::memory_order_relaxed);
+	}
+
+	// Consumer side, always fills out
+	void read(std::span<i16> out) {
+		usize count = this->ring.pop(out);
+		if (count > 0) this->last = out[count - 1];
+		if (count < out.size()) {
+			std::fill(out.begin() + static_cast<std::ptrdiff_t>(count), out.end(), this->last);
+			this->underruns.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
+	usize get_queued() const { return this->ring.size(); }
+	constexpr usize get_capacity() const { return CAPACITY; }
+	u32 get_sample_rate() const { return this->sample_rate.load(std::memory_order_relaxed); }
+	usize get_dropped() const { return this->dropped.load(std::memory_order_relaxed); }
+	usize get_underruns() const { return this->underruns.load(std::memory_order_relaxed); }
+};
+
+#endif
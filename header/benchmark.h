@@ -0,0 +1,136 @@
+#ifndef BENCHMARK__H
+#define BENCHMARK__H
+
+#include "definitions.h"
+#include "cartridge.h"
+#include "ppu.h"
+#include "upscaler.h"
+#include "ntsc_filter.h"
+#include "latency_probe.h"
+#include <chrono>
+
+typedef struct benchmark_result {
+	const char* name;
+	usize frames;
+	double seconds;
+
+	benchmark_result() :
+		name(""),
+		frames(0),
+		seconds(0.0)
+	{}
+	benchmark_result(const char* name, usize frames, double seconds) :
+		name(name),
+		frames(frames),
+		seconds(seconds)
+	{}
+
+	double frames_per_second() const { return this->seconds > 0.0 ? static_cast<double>(this->frames) / this->seconds : 0.0; }
+	double ms_per_frame() const { return this->frames > 0 ? (this->seconds * 1000.0) / static_cast<double>(this->frames) : 0.0; }
+} benchmark_result;
+
+typedef struct frameskip_check {
+	usize frames;
+	usize compared;
+	usize mismatches;
+	usize first_mismatch;
+
+	frameskip_check() :
+		frames(0),
+		compared(0),
+		mismatches(0),
+		first_mismatch(0)
+	{}
+
+	bool passed() const { return this->compared > 0 && this->mismatches == 0; }
+} frameskip_check;
+
+typedef struct irq_check {
+	usize frames;
+	usize irqs;
+	usize mismatches;
+	usize first_mismatch;
+
+	irq_check() :
+		frames(0),
+		irqs(0),
+		mismatches(0),
+		first_mismatch(0)
+	{}
+
+	bool passed() const { return this->frames > 0 && this->irqs > 0 && this->mismatches == 0; }
+} irq_check;
+
+typedef struct snapshot_check {
+	usize bytes;
+	double save_us;
+	double load_us;
+	usize compared;
+	usize mismatches;
+
+	snapshot_check() :
+		bytes(0),
+		save_us(0.0),
+		load_us(0.0),
+		compared(0),
+		mismatches(0)
+	{}
+
+	bool passed() const { return this->compared > 0 && this->mismatches == 0; }
+} snapshot_check;
+
+namespace benchmarks {
+	// Runs a private copy of the rom headless (no pacing, no UI) for the given amount of frames
+	benchmark_result run_frames(const cartridge& rom, usize frames, ppu_timing timing, usize skip_interval = 0, a12_mode a12 = a12_mode::predicted);
+
+	// Scanline vs dot renderer, same rom and frame count
+	std::array<benchmark_result, 2> ppu_timing_modes(const cartridge& rom, usize frames);
+
+	/* Inline rendering vs deferred rendering on a second thread, timed until the last frame is rendered, and the
+	 * emulation thread alone: what pipelining reaches when the render thread keeps up on a core of its own
+	 */
+	std::array<benchmark_result, 2> run_frames_pipelined(const cartridge& rom, usize frames);
+	std::array<benchmark_result, 3> pipelined_rendering(const cartridge& rom, usize frames);
+
+	// Every frame vs one frame out of (interval + 1) drawn
+	std::array<benchmark_result, 2> frameskip_rendering(const cartridge& rom, usize frames, usize interval);
+
+	/* Runs a reference and a frame skipping instance in lockstep and compares every frame the skipping one draws,
+	 * the pixels must be identical since skipped frames still keep v, scroll and status up to date
+	 */
+	frameskip_check verify_frameskip(const cartridge& rom, usize frames, usize interval, ppu_timing timing);
+
+	// Every upscale filter over the same emulated frames, rows split over the given amount of helper threads
+	std::array<benchmark_result, upscale::FILTER_COUNT> upscale_filters(const cartridge& rom, usize frames, usize helpers);
+
+	// Composite filter over emulated frames, only the filtering is timed
+	benchmark_result ntsc_composite(const cartridge& rom, usize frames, usize helpers);
+
+	/* Synthetic boards running a loop that switches a PRG and a CHR bank and reads through the new bank, against
+	 * the same loop storing to PRG-RAM instead; needs no rom
+	 */
+	std::array<benchmark_result, 3> bank_switching(usize frames);
+
+	/* Times cpu::save_state / cpu::load_state halfway through the given frames, then runs the second half again
+	 * from the snapshot, once on the same machine and once on a fresh one, and compares the frame hashes
+	 */
+	snapshot_check machine_snapshots(const cartridge& rom, usize frames);
+
+	/* No run-ahead, one and two frames ahead, and one frame ahead on a second instance; frames of the source machine.
+	 * The second instance counts the time of both threads, as if they ran on one core, and never drops a handoff
+	 */
+	std::array<benchmark_result, 4> run_ahead_overhead(const cartridge& rom, usize frames);
+
+	/* Input to swap with a fake display instead of a window: a 60 Hz refresh loop that delivers a press of A every
+	 * so many refreshes, uploads nothing and swaps by sleeping to the next refresh. The synthetic game reads pad 1
+	 * in its NMI and paints the backdrop with it, so every press changes the next frame; needs no rom
+	 */
+	latency_report input_latency(usize presses, usize run_ahead_frames, bool frame_delay);
+
+	// A synthetic MMC3 board taking a scanline IRQ every 8 lines, predicted counter vs every pattern fetch filtered
+	std::array<benchmark_result, 2> mmc3_irq(usize frames);
+	// Both modes of the same board in lockstep, the IRQ count and the cpu cycles must agree after every frame
+	irq_check verify_mmc3_irq(usize frames);
+};
+
+#endif
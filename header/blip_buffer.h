@@ -0,0 +1,128 @@
+#ifndef BLIP_BUFFER__H
+#define BLIP_BUFFER__H
+
+#include "definitions.h"
+#include <algorithm>
+#include <cmath>
+#include <numbers>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BLIP_SSE2
+#endif
+
+/* Band-limited step synthesis: instead of sampling the signal at the clock rate and filtering it down, every
+ * change of the output level is added as a band-limited step at its exact clock time, then the sample rate
+ * stream is the running sum of those steps. The cost follows the number of changes, not the clock rate.
+ * A step is the integral of a windowed sinc; the table holds its derivative at PHASES sub-sample offsets, which
+ * makes this a polyphase resampler from the clock rate straight to the output rate. That ratio can be nudged
+ * between frames to keep a consumer with its own clock fed (dynamic rate control).
+ * The sum goes through a DC blocking high-pass, the NES output is AC coupled too.
+ */
+class blip_buffer {
+
+private:
+	static constexpr usize TAPS = 16;
+	static constexpr usize PHASE_BITS = 5;
+	static constexpr usize PHASES = 1_usize << PHASE_BITS;
+	static constexpr usize FRACTION_BITS = 32;
+	static constexpr double CUTOFF = 0.45;
+	static constexpr double HIGH_PASS_HZ = 90.0;
+
+	alignas(16) std::array<std::array<float, TAPS>, PHASES> kernel;
+	std::vector<float> deltas;
+	// Sample position of clock 0 of the current frame, in 1 / 2^32 samples
+	u64 offset;
+	// Samples per clock, in 1 / 2^32 samples: nominal, in use, and from the next frame on
+	double nominal_factor;
+	u64 factor;
+	u64 next_factor;
+	u32 sample_rate;
+	float integrator;
+	float high_pass;
+	float high_pass_factor;
+
+	void build_kernel() {
+		constexpr double HALF = static_cast<double>(TAPS / 2);
+		for (usize phase = 0; phase < PHASES; ++phase) {
+			double sum = 0.0;
+			std::array<double, TAPS> taps;
+			for (usize tap = 0; tap < TAPS; ++tap) {
+				double x = static_cast<double>(tap) - (HALF - 1.0) - static_cast<double>(phase) / PHASES;
+				double sinc = (x == 0.0) ? 1.0 : std::sin(std::numbers::pi * 2.0 * CUTOFF * x) / (std::numbers::pi * 2.0 * CUTOFF * x);
+				double window = 0.42 + 0.5 * std::cos(std::numbers::pi * x / HALF) + 0.08 * std::cos(2.0 * std::numbers::pi * x / HALF);
+				taps[tap] = sinc * std::max(window, 0.0);
+				sum += taps[tap];
+			}
+			// Every step has to settle at exactly its height
+			for (usize tap = 0; tap < TAPS; ++tap) this->kernel[phase][tap] = static_cast<float>(taps[tap] / sum);
+		}
+	}
+
+public:
+	// Holds up to max_samples samples between two reads
+	blip_buffer(u32 sample_rate, double clock_rate, usize max_samples) :
+		kernel(),
+		deltas(max_samples + TAPS, 0.f),
+		offset(0),
+		nominal_factor(static_cast<double>(sample_rate) / clock_rate * static_cast<double>(1_usize << FRACTION_BITS)),
+		factor(static_cast<u64>(nominal_factor + 0.5)),
+		next_factor(factor),
+		sample_rate(sample_rate),
+		integrator(0.f),
+		high_pass(0.f),
+		high_pass_factor(static_cast<float>(std::exp(-2.0 * std::numbers::pi * HIGH_PASS_HZ / sample_rate)))
+	{
+		this->build_kernel();
+	}
+
+	// A change of delta at the given clock of the current frame; changes past the buffer are lost
+	void add_delta(const u64 clock, const float delta) {
+		u64 position = this->offset + clock * this->factor;
+		usize index = static_cast<usize>(position >> FRACTION_BITS);
+		if (index + TAPS > this->deltas.size()) return;
+		const std::array<float, TAPS>& taps = this->kernel[(position >> (FRACTION_BITS - PHASE_BITS)) & (PHASES - 1)];
+		float* out = this->deltas.data() + index;
+#ifdef BLIP_SSE2
+		__m128 scale = _mm_set1_ps(delta);
+		for (usize tap = 0; tap < TAPS; tap += 4) {
+			_mm_storeu_ps(out + tap, _mm_add_ps(_mm_loadu_ps(out + tap), _mm_mul_ps(_mm_load_ps(taps.data() + tap), scale)));
+		}
+#else
+		for (usize tap = 0; tap < TAPS; ++tap) out[tap] += taps[tap] * delta;
+#endif
+	}
+
+	// Closes the frame after the given number of clocks, the next frame's clocks count from there
+	void end_frame(const u64 clocks) {
+		this->offset += clocks * this->factor;
+		this->factor = this->next_factor;
+	}
+
+	// Output samples per nominal sample from the next frame on, 1 is the exact rate
+	void set_rate_adjust(const double ratio) { this->next_factor = static_cast<u64>(this->nominal_factor * ratio + 0.5); }
+	double get_rate_adjust() const { return static_cast<double>(this->factor) / this->nominal_factor; }
+
+	// Samples that are complete, a step only is once the sample it starts in is
+	usize get_available() const { return std::min(static_cast<usize>(this->offset >> FRACTION_BITS), this->deltas.size() - TAPS); }
+
+	// Takes every available sample, scaled by volume and clamped to 16 bits
+	usize read(std::vector<i16>& out, const float volume) {
+		usize count = this->get_available();
+		out.resize(count);
+		for (usize i = 0; i < count; ++i) {
+			float previous = this->integrator;
+			this->integrator += this->deltas[i];
+			this->high_pass = this->high_pass * this->high_pass_factor + (this->integrator - previous);
+			out[i] = static_cast<i16>(std::clamp(this->high_pass * volume, -32768.f, 32767.f));
+		}
+		std::copy(this->deltas.begin() + static_cast<std::ptrdiff_t>(count), this->deltas.end(), this->deltas.begin());
+		std::fill(this->deltas.end() - static_cast<std::ptrdiff_t>(count), this->deltas.end(), 0.f);
+		this->offset -= static_cast<u64>(count) << FRACTION_BITS;
+		return count;
+	}
+
+	u32 get_sample_rate() const { return this->sample_rate; }
+};
+
+#endif
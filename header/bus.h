@@ -2,7 +2,16 @@
 #define BUS__H
 
 #include "cartridge.h"
+#include "mapper.h"
 #include "ppu.h"
+#include "cheat.h"
+#include "apu.h"
+#include "controller.h"
+#include "machine_state.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
 
 class cpu;
 
@@ -10,28 +19,71 @@ class bus {
 
 private:
 
-	static constexpr u16 MIRRORS_PRG[2] = { 0x3FFF, 0x7FFF };
-
 	std::array<u8, 0x0800_usize> cpu_wram;
-	std::span<u8> prg_rom;
-	usize mirror_index;
+	// 8 KiB pages over $8000-$FFFF, pointed at PRG banks by the mapper
+	std::array<const u8*, 4> prg_pages;
+	u8* prg_ram;
+	bool prg_ram_writable;
+	std::array<u8, 0x2000_usize> unmapped_page;
 	usize cycles;
 
 	ppu* _ppu;
 	cpu* _cpu;
+	std::unique_ptr<mapper> _mapper;
+	cartridge* rom;
 
 	u8 last_read;
+	apu audio;
+	controller_ports pads;
+
+	/* Cheats stay off the read path. A page holding a PRG-ROM cheat address points at a patched copy of the bank
+	 * mapped there, made the first time that bank shows up in that page; all other pages point at the ROM as usual.
+	 * RAM cheats are written back at the start of every vblank.
+	 */
+	std::array<const u8*, 4> prg_banks;
+	u8 cheat_pages;
+	std::vector<cheat> rom_cheats;
+	std::vector<cheat> ram_cheats;
+	// Per page, bank -> patched copy; empty when no cheat applies to that bank
+	std::array<std::unordered_map<const u8*, std::vector<u8>>, 4> overlays;
+	// set_cheats may come from any thread, the list is taken over on the emulation thread
+	std::mutex cheats_mutex;
+	std::vector<cheat> pending_cheats;
+	std::atomic<bool> cheats_pending;
+
+	const u8* overlay(const usize page, const u8* bank);
+	void apply_cheats();
+	// Catches the apu up to the bus clock and hands the cpu the cycles DMC fetches took
+	void run_apu();
 
 public:
 	bus() :
 		cpu_wram({}),
-		prg_rom({}),
+		prg_pages({}),
+		prg_ram(nullptr),
+		prg_ram_writable(false),
+		unmapped_page({}),
 		cycles(0),
-		mirror_index(0),
 		last_read(0),
+		audio(),
+		pads(),
 		_ppu(nullptr),
-		_cpu(nullptr)
-	{ }
+		_cpu(nullptr),
+		_mapper(nullptr),
+		rom(nullptr),
+		prg_banks({}),
+		cheat_pages(0),
+		rom_cheats(),
+		ram_cheats(),
+		overlays(),
+		cheats_mutex(),
+		pending_cheats(),
+		cheats_pending(false)
+	{
+		this->prg_pages.fill(this->unmapped_page.data());
+		this->prg_banks.fill(this->unmapped_page.data());
+		this->audio.connect(this);
+	}
 	bus(bus& to_copy) = delete;
 	bus(bus&& to_move) noexcept = delete;
 	~bus() {}
@@ -39,30 +91,82 @@ public:
 	void connect(ppu* _ppu) { this->_ppu = _ppu; }
 	void connect(cpu* _cpu) { this->_cpu = _cpu; }
 
+	// Throws std::runtime_error if the board is not supported, the previous game stays loaded then
 	void load(cartridge* rom) { 
-		this->prg_rom = rom->get_prg_rom(); 
-		this->mirror_index = (this->prg_rom.size() == 0x4000) ? 0_usize : 1_usize;
+		std::unique_ptr<mapper> board = mapper::create(rom->get_mapper());
+		// Unloading is a save checkpoint
+		this->flush_save();
+		this->rom = rom;
+		// Overlays are keyed by bank address, those belong to the previous game
+		for (auto& page : this->overlays) page.clear();
+		if (this->cheats_pending.load(std::memory_order_acquire)) this->apply_cheats();
 		this->_ppu->load(rom);
+		this->_ppu->connect(board.get());
+		this->_mapper = std::move(board);
+		this->_mapper->attach(this, this->_ppu, rom);
+		this->_mapper->reset();
+		this->audio.reset(this->cycles, true);
+	}
+	// The reset line, of everything on the bus only the apu listens to it
+	void reset() { this->audio.reset(this->cycles, false); }
+
+	// Everything on the bus and the cartridge's RAM, the cpu registers are cpu::save_state's
+	void save_state(machine_state& out) const;
+	void load_state(const machine_state& in);
+
+	// Mapper side; a null bank leaves the page unmapped
+	void map_prg(const usize page, const u8* bank) {
+		const u8* target = (bank != nullptr) ? bank : this->unmapped_page.data();
+		this->prg_banks[page] = target;
+		this->prg_pages[page] = ((this->cheat_pages >> page) & 1) ? this->overlay(page, target) : target;
+	}
+	void map_prg_ram(u8* ram, const bool writable) {
+		this->prg_ram = ram;
+		this->prg_ram_writable = (ram != nullptr) && writable;
 	}
+	void set_irq(const bool asserted);
+	void set_irq(const u8 source, const bool asserted);
+
+	// Replaces the active cheats from any thread, they take effect at the next vblank or game load
+	void set_cheats(std::vector<cheat> cheats) {
+		{
+			std::lock_guard<std::mutex> lock(this->cheats_mutex);
+			this->pending_cheats = std::move(cheats);
+		}
+		this->cheats_pending.store(true, std::memory_order_release);
+	}
+	// Ppu side, once per frame
+	void vblank_started();
+
+	// Battery save checkpoint for the loaded game, PRG-RAM stores themselves never wait on the file
+	void flush_save() {
+		if (this->rom != nullptr) this->rom->flush_save();
+	}
+
 	void tick(usize cycles) { 
 		this->cycles += cycles;
 		this->_ppu->tick(cycles * 3);
+		if (this->cycles >= this->audio.get_next_event()) this->run_apu();
 	}
 
 	u8 read_u8(const u16 address) {
-		if (address >= 0x8000) { this->last_read = this->prg_rom[(address - 0x8000) & bus::MIRRORS_PRG[this->mirror_index]]; }
+		if (address >= 0x8000) { this->last_read = this->prg_pages[(address >> 13) & 3][address & 0x1FFF]; }
 		else if (address <= 0x1FFF) { this->last_read = this->cpu_wram[address & 0x07FF]; }
 		else if (address <= 0x3FFF) { this->last_read = this->_ppu->read(address & 7, this->last_read); } // [ppu, update or nah
-		else if (address <= 0x4017) { this->last_read = 0; } // apu and io
-		else if (address >= 0x6000 && address <= 0x7FFF) { this->last_read = 0; } // expansion rom
+		else if (address == 0x4015) { this->run_apu(); this->last_read = this->audio.read_status(); } // apu status
+		else if (address == 0x4016 || address == 0x4017) { this->last_read = this->pads.read(address & 1, this->last_read); } // controllers
+		else if (address >= 0x6000 && address <= 0x7FFF) { this->last_read = (this->prg_ram != nullptr) ? this->prg_ram[address & 0x1FFF] : 0; } // prg ram
 
 		return this->last_read;
 	}
 	void write_u8(const u16 address, const u8 value) {
 		if (address <= 0x1FFF) { this->cpu_wram[address & 0x07FF] = value; }
 		else if (address <= 0x3FFF) { this->_ppu->write(address & 7, value); } // ppu
-		else if (address <= 0x4017) { return; } // apu and io
-		else if (address >= 0x6000 && address <= 0x7FFF) { return; } // expansion rom
+		else if (address == 0x4014) { this->oam_dma(value); } // oam dma
+		else if (address == 0x4016) { this->pads.write(value); } // controller strobe
+		else if (address <= 0x4017) { this->run_apu(); this->audio.write(address, value); } // apu
+		else if (address >= 0x6000 && address <= 0x7FFF) { if (this->prg_ram_writable) this->prg_ram[address & 0x1FFF] = value; } // prg ram
+		else if (address >= 0x8000 && this->_mapper != nullptr) { this->_mapper->write(address, value); } // mapper registers
 	}
 	u16 read_u16(const u16 address) {
 		return this->read_u8(address) | (this->read_u8(address + 1) << 8);
@@ -73,8 +177,13 @@ public:
 	}
 
 	void request_nmi();
+	void oam_dma(const u8 page);
 
 	const std::span<u8> get_wram() { return std::span<u8>(cpu_wram); }
+	apu& get_apu() { return this->audio; }
+	controller_ports& get_controllers() { return this->pads; }
+	const controller_ports& get_controllers() const { return this->pads; }
+	usize get_frames() const { return this->_ppu->get_frames(); }
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,148 @@
+#ifndef CAPTURE__H
+#define CAPTURE__H
+
+#include "definitions.h"
+#include "frame_sink.h"
+#include "audio_sink.h"
+#include "ring_buffer.h"
+#include <atomic>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+
+typedef enum capture_format {
+	y4m = 0,
+	raw_rgba = 1
+} capture_format;
+
+/* Records every submitted frame on a writer thread. The emulation thread only copies the pixels into a free
+ * slot and queues it (two lock free rings of slot numbers); when every slot is still queued the frame is dropped
+ * and counted instead of waiting for the disk. Y4M is 4:4:4 BT.601 at the NES frame rate, raw is the RGBA bytes.
+ * A target starting with '|' is run as a command and fed through a pipe, e.g. "|ffmpeg -i - out.mp4".
+ * Audio samples (mono, signed 16 bit) go through their own ring into "<target>.wav" when the target is a file;
+ * the sink has to be added to the apu as well for that.
+ */
+class capture_sink : public frame_sink, public audio_sink {
+
+private:
+	static constexpr u8 STOP = 0xFF;
+
+	std::string target;
+	capture_format format;
+	std::FILE* output;
+	bool piped;
+	std::FILE* audio_output;
+	std::atomic<u32> audio_rate;
+	usize audio_bytes;
+
+	std::vector<std::vector<u32>> slots;
+	spsc_ring<u8, 32> free_slots;
+	spsc_ring<u8, 32> queued_slots;
+	spsc_ring<i16, 0x10000> audio;
+	std::vector<u8> conversion;
+
+	std::atomic<usize> written;
+	std::atomic<usize> dropped;
+	std::atomic<usize> audio_dropped;
+	std::atomic<usize> peak_queued;
+	std::atomic<u64> bytes;
+	std::atomic<double> average_ms;
+	std::atomic<bool> failed;
+
+	std::jthread writer;
+
+	void writer_loop();
+	void write_frame(const std::vector<u32>& pixels);
+	void drain_audio();
+	void finish_audio();
+	bool put(const void* data, usize size);
+
+public:
+	static constexpr usize WIDTH = 256;
+	static constexpr usize HEIGHT = 240;
+	static constexpr usize MAX_SLOTS = 16;
+
+	// Opens the target right away, throws std::runtime_error if it cannot be opened
+	capture_sink(const std::string& target, capture_format format, usize slot_count = 8);
+	capture_sink(capture_sink& to_copy) = delete;
+	capture_sink(capture_sink&& to_move) noexcept = delete;
+	// Writes whatever is still queued, then closes; remove the sink from the ppu first
+	~capture_sink();
+
+	void submit(std::span<const u32> pixels, const frame_digest& digest, usize frame) override;
+	// From the emulation thread, also when the frames come from a rendering thread
+	void submit_audio(std::span<const i16> samples, u32 sample_rate) override;
+
+	const std::string& get_target() const { return this->target; }
+	usize get_written() const { return this->written.load(); }
+	usize get_dropped() const { return this->dropped.load(); }
+	usize get_audio_dropped() const { return this->audio_dropped.load(); }
+	// Back-pressure: frames waiting for the writer now, and the most that ever waited
+	usize get_queued() const { return this->queued_slots.size(); }
+	usize get_peak_queued() const { return this->peak_queued.load(); }
+	usize get_slot_count() const { return this->slots.size(); }
+	u64 get_bytes() const { return this->bytes.load(); }
+	double get_ms_per_frame() const { return this->average_ms.load(); }
+	// The target stopped accepting data (disk full, pipe closed), frames are dropped from then on
+	bool has_failed() const { return this->failed.load(); }
+};
+
+/* Writes the apu output straight to a WAV file on the emulation thread, for headless runs that do not have to
+ * keep up with real time. The header gets its sizes when the sink is destroyed.
+ */
+class wav_sink : public audio_sink {
+
+private:
+	std::string path;
+	std::FILE* output;
+	u32 sample_rate;
+	u64 data_bytes;
+	bool failed;
+
+public:
+	// Throws std::runtime_error if the file cannot be created
+	explicit wav_sink(const std::string& path);
+	wav_sink(wav_sink& to_copy) = delete;
+	wav_sink(wav_sink&& to_move) noexcept = delete;
+	~wav_sink();
+
+	void submit_audio(std::span<const i16> samples, u32 sample_rate) override;
+
+	u64 get_samples() const { return this->data_bytes / sizeof(i16); }
+	bool has_failed() const { return this->failed; }
+};
+
+/* Saves the next submitted frame as a PNG on its own thread; stays attached to the ppu and costs nothing
+ * until a screenshot is requested.
+ */
+class screenshot_sink : public frame_sink {
+
+private:
+	std::mutex mtx;
+	std::string path;
+	std::string status;
+	std::vector<u32> pixels;
+	std::atomic<bool> requested;
+	std::atomic<bool> pending;
+	std::atomic<bool> stopping;
+
+	std::jthread writer;
+
+	void writer_loop();
+
+public:
+	screenshot_sink();
+	screenshot_sink(screenshot_sink& to_copy) = delete;
+	screenshot_sink(screenshot_sink&& to_move) noexcept = delete;
+	~screenshot_sink();
+
+	// False while the previous screenshot is still being taken
+	bool request(const std::string& path);
+	void submit(std::span<const u32> pixels, const frame_digest& digest, usize frame) override;
+
+	// What happened to the last screenshot
+	std::string get_status();
+};
+
+#endif
@@ -5,80 +5,125 @@
 #include <ranges>
 #include <algorithm>
 #include "definitions.h"
+#include "mapped_file.h"
+#include "rom_image.h"
+#include "rom_header.h"
 #include <iostream>
-typedef enum mirroring {
-	vertical = 0_u8,
-	horizontal = 1_u8,
-	four_screen = 2_u8
-} mirroring;
+#include <memory>
 
 class cartridge {
 
 public:
-	constexpr static const char* SCREEN_MIRRORING_NAMES[3] = {
-		"Vertical", "Horizontal", "Four Screen"
+	constexpr static const char* SCREEN_MIRRORING_NAMES[5] = {
+		"Vertical", "Horizontal", "Four Screen", "Single Screen (lower)", "Single Screen (upper)"
 	};
+	// Smallest PRG-RAM allocated, the $6000-$7FFF window
+	constexpr static usize prg_ram_size = 0x2000_usize;
 
 private:
-	std::vector<u8> prg_rom;
-	std::vector<u8> chr_rom;
-	u8 mapper;
+	// PRG and CHR-ROM point into the shared image, everything writable belongs to this cartridge
+	std::shared_ptr<const rom_image> image;
+	std::span<const u8> prg_rom;
+	std::span<const u8> chr_rom;
+	// CHR-RAM on boards without CHR-ROM, 8 KiB unless a NES 2.0 header asks for more
+	std::vector<u8> chr_memory;
+	// $6000-$7FFF on the boards that have it, the mapper decides whether it is mapped
+	std::vector<u8> prg_ram;
+	bool chr_ram;
+	bool battery;
+	u16 mapper;
 	enum mirroring screen_mirroring;
+	// As the cartridge was built, after any correction
+	nes_header header;
+	// Battery boards: PRG-RAM is this shared mapping instead of prg_ram, stores land in the file's page cache
+	std::unique_ptr<mapped_file> save;
 
 
 public:
-	cartridge(std::vector<u8>& raw) :
+	/* An invalid header, or sizes that do not fit the file, leave the cartridge empty. A corrected header, from the
+	 * game database or the library index, is used in place of the one in the file.
+	 */
+	explicit cartridge(std::shared_ptr<const rom_image> rom, const nes_header* corrected = nullptr) :
+		image(std::move(rom)),
+		prg_rom(),
+		chr_rom(),
+		chr_memory(),
+		prg_ram(prg_ram_size),
+		chr_ram(false),
+		battery(false),
 		mapper(0),
 		screen_mirroring(mirroring::vertical),
-		prg_rom(),
-		chr_rom()
+		header(),
+		save()
 	{
-		constexpr std::array<const u8, 4> nes_tag({ 0x4e_u8, 0x45_u8, 0x53_u8, 0x1a_u8 });
-		constexpr usize prg_rom_size = 0x4000_usize;
-		constexpr usize chr_rom_size = 0x2000_usize;
-
-		std::span<const u8, 4> tag(raw.begin(), raw.begin() + 4);
-
-		if (!std::ranges::equal(tag, nes_tag)) { return; }
-
-		u8 mapper = (raw[7] & 0b11110000) | (raw[6] >> 4);
-		if (((raw[7] >> 2) & 0b11) != 0) { return; }
-
-		bool four_screen = 0 != (raw[6] & 0b1000);
-		bool vertical_mirroring = 0 != (raw[6] & 0b1);
-		enum mirroring screen_mirroring =
-			four_screen ? (mirroring::four_screen)
-			: (vertical_mirroring ? mirroring::vertical
-				: mirroring::horizontal
-				);
-
-		usize prg_size = static_cast<usize>(raw[4]) * prg_rom_size;
-		usize chr_size = static_cast<usize>(raw[5]) * chr_rom_size;
-		bool skip_trainter = 0 != (raw[6] & 0b100);
-
-		usize prg_start = 16 + (skip_trainter ? 512 : 0);
-		usize chr_start = prg_start + prg_size;
-
-		this->prg_rom = std::vector<u8>{ raw.begin() + prg_start, raw.begin() + prg_start + prg_size };
-		this->chr_rom = std::vector<u8>{ raw.begin() + chr_start, raw.begin() + chr_start + chr_size };
-		this->mapper = mapper;
-		this->screen_mirroring = screen_mirroring;
-		//std::cout << ": [ prg:" << prg_rom.size() << " - chr:" << chr_rom.size() << " - mapper:" << static_cast<uint32_t>(mapper) << " - mirroring:" << static_cast<int>(screen_mirroring) << " ]" << std::endl;
+		std::span<const u8> raw = this->image->bytes();
+		nes_header parsed;
+		if (!nes_header::parse(raw, parsed)) { return; }
+		const nes_header& header = corrected != nullptr ? *corrected : parsed;
+
+		if (header.file_size() > raw.size()) { return; }
+
+		this->prg_rom = raw.subspan(header.data_offset(), header.prg_rom_size);
+		this->chr_rom = raw.subspan(header.data_offset() + header.prg_rom_size, header.chr_rom_size);
+		if (header.chr_rom_size == 0) { // no CHR-ROM, the board has CHR-RAM instead
+			this->chr_memory = std::vector<u8>(std::max(header.chr_ram_size, nes_header::CHR_ROM_UNIT));
+			this->chr_ram = true;
+		}
+		this->prg_ram.resize(std::max(header.prg_ram_size + header.prg_nvram_size, prg_ram_size));
+		this->battery = header.battery;
+		this->mapper = header.mapper;
+		this->screen_mirroring = header.screen_mirroring;
+		this->header = header;
 	}
+	// The bytes are copied into an image of their own, rom_image::open is the way to share one
+	explicit cartridge(const std::vector<u8>& raw) : cartridge(std::make_shared<const rom_image>(raw)) {}
+
+	// Shares the image; the copy gets its own RAM, with the current PRG-RAM contents but not the save file
 	cartridge(const cartridge& to_copy) : 
+		image(to_copy.image),
+		prg_rom(to_copy.prg_rom),
+		chr_rom(to_copy.chr_rom),
+		chr_memory(to_copy.chr_memory),
+		prg_ram(to_copy.prg_ram),
+		chr_ram(to_copy.chr_ram),
+		battery(to_copy.battery),
 		mapper(to_copy.mapper),
 		screen_mirroring(to_copy.screen_mirroring),
-		prg_rom(to_copy.prg_rom),
-		chr_rom(to_copy.chr_rom)
-	{}
+		header(to_copy.header),
+		save()
+	{
+		if (to_copy.save) {
+			std::span<const u8> saved = to_copy.save->bytes();
+			std::copy(saved.begin(), saved.begin() + this->prg_ram.size(), this->prg_ram.begin());
+		}
+	}
 	cartridge(const cartridge&& to_move) noexcept = delete;
 
-	std::span<u8> get_prg_rom() { return std::span<u8>(this->prg_rom); }
-	std::span<u8> get_chr_rom() { return std::span<u8>(this->chr_rom); }
-	u8 get_mapper() { return this->mapper;  }
-	enum mirroring get_mirroring() { return this->screen_mirroring; }
+	std::span<const u8> get_prg_rom() const { return this->prg_rom; }
+	// CHR-RAM on boards that have it instead
+	std::span<const u8> get_chr_rom() const { return this->chr_ram ? std::span<const u8>(this->chr_memory) : this->chr_rom; }
+	std::span<u8> get_chr_ram() { return std::span<u8>(this->chr_memory); }
+	const std::shared_ptr<const rom_image>& get_image() const { return this->image; }
+	std::span<u8> get_prg_ram() { return this->save ? this->save->writable_bytes().first(this->prg_ram.size()) : std::span<u8>(this->prg_ram); }
+	bool has_chr_ram() const { return this->chr_ram; }
+	bool has_battery() const { return this->battery; }
+	u16 get_mapper() const { return this->mapper; }
+	enum mirroring get_mirroring() const { return this->screen_mirroring; }
+	const nes_header& get_header() const { return this->header; }
+
+	/* Backs PRG-RAM with the save file, created zero filled if missing, so that a save survives a crash without
+	 * any copying. Call before the cartridge is loaded, mappers keep pointers into PRG-RAM. Throws std::runtime_error.
+	 */
+	void attach_save(const std::string& path) {
+		this->save = std::make_unique<mapped_file>(path, mapped_file_mode::read_write, this->prg_ram.size());
+	}
+	// Checkpoint: the OS writes the mapping back on its own, this makes it happen now
+	void flush_save() {
+		if (this->save) this->save->flush();
+	}
+	const mapped_file* get_save() const { return this->save.get(); }
 
-	~cartridge() { }
+	~cartridge() { this->flush_save(); }
 };
 
 #endif
\ No newline at end of file
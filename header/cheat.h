@@ -0,0 +1,32 @@
+#ifndef CHEAT__H
+#define CHEAT__H
+
+#include "definitions.h"
+#include <string>
+#include <string_view>
+
+/* A byte the game sees instead of what is there. At $8000 and up it patches PRG-ROM, as a Game Genie does, and
+ * with a compare value only banks holding that value at the address get patched. Below $8000 (work RAM and
+ * PRG-RAM) the value is written back once per frame, with a compare value only while the RAM holds it.
+ */
+typedef struct cheat {
+	u16 address;
+	u8 value;
+	u8 compare;
+	bool has_compare;
+
+	bool operator==(const cheat& other) const = default;
+} cheat;
+
+namespace cheats {
+	constexpr const char* GAME_GENIE_LETTERS = "APZLGITYEOXUKSVN";
+
+	/* Game Genie codes (6 letters, or 8 with a compare value) or raw hex: AAAA=VV, or AAAA?CC=VV to compare
+	 * first. Throws std::runtime_error for anything else, or for an address that is neither RAM nor PRG-ROM.
+	 */
+	cheat parse(std::string_view code);
+	// The raw form, AAAA=VV or AAAA?CC=VV
+	std::string format(const cheat& code);
+};
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef CHECKSUM__H
+#define CHECKSUM__H
+
+#include "definitions.h"
+#include <algorithm>
+
+/* CRC-32 (IEEE, the one zip, gzip and PNG use) and Adler-32 (zlib streams); pass the previous value to continue.
+ * CRC-32 folds 64 bytes at a time with carry-less multiplies on CPUs that have them, slicing by 8 otherwise.
+ */
+namespace checksum {
+	u32 crc32(std::span<const u8> data, u32 crc = 0);
+
+	inline u32 adler32(std::span<const u8> data, u32 adler = 1) {
+		u32 a = adler & 0xFFFF, b = adler >> 16;
+		usize i = 0;
+		while (i < data.size()) {
+			// 5552 bytes is the most that can be summed before b could overflow
+			usize end = std::min(data.size(), i + 5552);
+			for (; i < end; ++i) {
+				a += data[i];
+				b += a;
+			}
+			a %= 65521;
+			b %= 65521;
+		}
+		return (b << 16) | a;
+	}
+
+	typedef std::array<u8, 20> sha1_digest;
+
+	// SHA-1 over data that arrives in pieces, like an archive member inflated a chunk at a time
+	class sha1_hasher {
+
+	private:
+		std::array<u32, 5> state;
+		std::array<u8, 64> buffer;
+		usize buffered;
+		u64 length;
+
+		void block(const u8* chunk);
+
+	public:
+		sha1_hasher();
+		void update(std::span<const u8> data);
+		// Pads and returns the digest, the hasher is spent afterwards
+		sha1_digest finish();
+	};
+
+	// SHA-1 of a whole buffer, what rom databases key dumps by next to the CRC
+	inline sha1_digest sha1(std::span<const u8> data) {
+		sha1_hasher hasher;
+		hasher.update(data);
+		return hasher.finish();
+	}
+};
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef CHR_TILE_CACHE__H
+#define CHR_TILE_CACHE__H
+
+#include "definitions.h"
+#include "frame_hash.h"
+#include <algorithm>
+#include <cstring>
+
+/* Content hash of every 16 byte tile in CHR, computed the first time the tile is looked at and kept until a
+ * CHR-RAM write touches it. Bank switches only change which tiles are looked at, so they cost nothing here.
+ */
+class chr_tile_cache {
+
+private:
+	std::span<const u8> chr;
+	std::vector<u64> hashes;
+	std::vector<u8> valid;
+
+public:
+	static constexpr usize TILE_SIZE = 16;
+
+	chr_tile_cache() :
+		chr(),
+		hashes(),
+		valid()
+	{}
+
+	// Same function HD pack tools have to key their tiles with: both 8 byte planes, mixed
+	static u64 tile_hash(const u8* tile) {
+		u64 plane0, plane1;
+		std::memcpy(&plane0, tile, 8);
+		std::memcpy(&plane1, tile + 8, 8);
+		return frame_hash::mix(plane0 ^ frame_hash::mix(plane1 ^ frame_hash::SEED));
+	}
+
+	void attach(std::span<const u8> chr) {
+		this->chr = chr;
+		this->hashes.assign(chr.size() / TILE_SIZE, 0);
+		this->valid.assign(chr.size() / TILE_SIZE, 0);
+	}
+
+	// Tile number is the offset into CHR divided by 16
+	u64 hash(const usize tile) {
+		if (!this->valid[tile]) {
+			this->hashes[tile] = tile_hash(this->chr.data() + tile * TILE_SIZE);
+			this->valid[tile] = 1;
+		}
+		return this->hashes[tile];
+	}
+	void invalidate(const usize offset) {
+		if (offset < this->chr.size()) this->valid[offset / TILE_SIZE] = 0;
+	}
+	void invalidate_all() { std::fill(this->valid.begin(), this->valid.end(), 0); }
+	usize tile_count() const { return this->hashes.size(); }
+};
+
+#endif
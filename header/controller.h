@@ -0,0 +1,130 @@
+#ifndef CONTROLLER__H
+#define CONTROLLER__H
+
+#include "definitions.h"
+#include "latency_probe.h"
+#include <atomic>
+
+typedef enum controller_button {
+	button_a = 0b00000001,
+	button_b = 0b00000010,
+	button_select = 0b00000100,
+	button_start = 0b00001000,
+	button_up = 0b00010000,
+	button_down = 0b00100000,
+	button_left = 0b01000000,
+	button_right = 0b10000000
+} controller_button;
+
+// The latch side only, a snapshot never brings back old buttons
+typedef struct controller_state {
+	bool strobe;
+	u32 shift[2];
+	u32 fill;
+} controller_state;
+
+/* Standard controllers on $4016/$4017, optionally behind a Four Score.
+ * The host writes button states from its own thread into one atomic word, all four pads at once; nothing else is
+ * shared. The pads only look at it when the game strobes $4016, which is when real pads latch their buttons, so a
+ * press lands in the very next poll instead of waiting for a UI frame, and reads stay free of locks.
+ * While the strobe is high the latch follows the buttons, each read returns A.
+ */
+class controller_ports {
+public:
+	static constexpr usize PORTS = 4;
+
+private:
+	// Reads 17 to 24 of the Four Score: 0,0,0,1,0,0,0,0 on $4016 and 0,0,1,0,0,0,0,0 on $4017
+	static constexpr u32 FOUR_SCORE_SIGNATURE[2] = { 1u << 19, 1u << 18 };
+
+	// Host side: pad n in bits 8n to 8n+7, A in the lowest
+	std::atomic<u32> host;
+	std::atomic<bool> four_score;
+	// Told about every latch while set
+	std::atomic<latency_probe*> probe;
+
+	bool strobe;
+	// Per port, the next bit to read is bit 0
+	u32 shift[2];
+	// Bits that were shifted in, 1s for a standard pad, a Four Score reads 0 once its 24 bits are out
+	u32 fill;
+
+	void latch() {
+		u32 buttons = this->host.load(std::memory_order_acquire);
+		latency_probe* watching = this->probe.load(std::memory_order_relaxed);
+		if (watching != nullptr) watching->latched(buttons);
+		if (this->four_score.load(std::memory_order_relaxed)) {
+			this->shift[0] = (buttons & 0xFF) | ((buttons >> 8) & 0xFF00) | FOUR_SCORE_SIGNATURE[0];
+			this->shift[1] = ((buttons >> 8) & 0xFF) | ((buttons >> 16) & 0xFF00) | FOUR_SCORE_SIGNATURE[1];
+			this->fill = 0;
+		}
+		else {
+			this->shift[0] = (buttons & 0xFF) | 0xFFFFFF00u;
+			this->shift[1] = ((buttons >> 8) & 0xFF) | 0xFFFFFF00u;
+			this->fill = 0x80000000u;
+		}
+	}
+
+public:
+	controller_ports() :
+		host(0),
+		four_score(false),
+		probe(nullptr),
+		strobe(false),
+		shift{ 0, 0 },
+		fill(0)
+	{}
+	controller_ports(controller_ports& to_copy) = delete;
+	controller_ports(controller_ports&& to_move) noexcept = delete;
+
+	// Any thread
+	void set_buttons(const usize port, const u8 buttons) {
+		if (port >= PORTS) return;
+		u32 shift = static_cast<u32>(port * 8);
+		u32 current = this->host.load(std::memory_order_relaxed);
+		u32 next;
+		do {
+			next = (current & ~(0xFFu << shift)) | (static_cast<u32>(buttons) << shift);
+		} while (!this->host.compare_exchange_weak(current, next, std::memory_order_release, std::memory_order_relaxed));
+	}
+	// All pads in one store, pad n in bits 8n to 8n+7
+	void set_all_buttons(const u32 buttons) { this->host.store(buttons, std::memory_order_release); }
+	u32 get_all_buttons() const { return this->host.load(std::memory_order_acquire); }
+	u8 get_buttons(const usize port) const { return (port < PORTS) ? static_cast<u8>(this->host.load(std::memory_order_relaxed) >> (port * 8)) : 0; }
+
+	// Pads 3 and 4 only exist behind a Four Score
+	void set_four_score(const bool enabled) { this->four_score.store(enabled, std::memory_order_relaxed); }
+	bool get_four_score() const { return this->four_score.load(std::memory_order_relaxed); }
+
+	void set_probe(latency_probe* probe) { this->probe.store(probe, std::memory_order_relaxed); }
+	latency_probe* get_probe() const { return this->probe.load(std::memory_order_relaxed); }
+
+	void save_state(controller_state& out) const {
+		out.strobe = this->strobe;
+		out.shift[0] = this->shift[0];
+		out.shift[1] = this->shift[1];
+		out.fill = this->fill;
+	}
+	void load_state(const controller_state& in) {
+		this->strobe = in.strobe;
+		this->shift[0] = in.shift[0];
+		this->shift[1] = in.shift[1];
+		this->fill = in.fill;
+	}
+
+	// Emulation thread, $4016 write: bit 0 is the strobe, the latch takes the buttons while it is high
+	void write(const u8 value) {
+		bool was_high = this->strobe;
+		this->strobe = value & 1;
+		if (this->strobe || was_high) this->latch();
+	}
+	// Emulation thread, $4016 / $4017 read: the serial bit of port 0 / 1 in bit 0, open bus above
+	u8 read(const usize port, const u8 open_bus) {
+		if (this->strobe) this->latch();
+		u8 bit = static_cast<u8>(this->shift[port] & 1);
+		if (!this->strobe) this->shift[port] = (this->shift[port] >> 1) | this->fill;
+		return static_cast<u8>((open_bus & 0xE0) | bit);
+	}
+};
+
+#endif
@@ -2,11 +2,13 @@
 #define CPU__H
 
 #include "bus.h"
+#include "frame_pacer.h"
 #include <string>
 #include "interrupt.h"
 #include <iostream>
 #include <mutex>
 #include <condition_variable>
+#include <functional>
 #include <thread>
 #include <atomic>
 #include <future>
@@ -40,6 +42,7 @@ private:
 	std::atomic<bool> halted;
 	std::atomic<bool> paused;
 	std::atomic<bool> nmi_requested;
+	u8 irq_lines;
 
 	bool rom_loaded;
 	const instruction* decoded;
@@ -47,6 +50,13 @@ private:
 	std::mutex mtx;
 	std::condition_variable cv;
 	std::jthread runner;
+	// Under mtx: the runner waits in its pause or has ended, nothing of the machine is in use
+	bool idle;
+	std::condition_variable idle_cv;
+	// Real time pacing of run_async
+	frame_pacer pacer;
+	// Runs on the emulation thread of run_async once per frame, right after vblank starts
+	std::function<void(cpu&)> frame_callback;
 
 	bus* cpu_bus;
 
@@ -84,6 +94,7 @@ private:
 
 public:
 	std::span<u8> get_wram() { return this->cpu_bus->get_wram(); }
+	void set_cheats(std::vector<cheat> cheats) { this->cpu_bus->set_cheats(std::move(cheats)); }
 	u8 get_a() const { return this->a; }
 	u8 get_x() const { return this->x; }
 	u8 get_y() const { return this->y; }
@@ -95,10 +106,39 @@ public:
 	bool get_halted() const { return this->halted.load(); }
 	bool get_paused() const { return this->paused.load(); }
 	bool get_rom_loaded() const { return this->rom_loaded; }
+	frame_pacer& get_pacer() { return this->pacer; }
 	const instruction* get_decoded() { return this->decoded; }
 
 	void request_nmi() { this->nmi_requested.store(true); }
+	void stall(const usize cycles) { this->tick(cycles); }
 	bool is_nmi_requested() const { return this->nmi_requested.load(); }
+	// Emulation thread only, unlike the nmi
+	void set_irq(const u8 source, const bool asserted) { asserted ? this->irq_lines |= source : this->irq_lines &= ~source; }
+	u8 get_irq_lines() const { return this->irq_lines; }
+
+	// The whole machine, between two instructions; a halt is not undone by loading
+	void save_state(machine_state& out) const {
+		out.processor = cpu_state{ this->a, this->p, this->sp, this->x, this->y, this->pc, this->opcode, this->cycles, this->nmi_requested.load(), this->irq_lines, this->decoded };
+		this->cpu_bus->save_state(out);
+	}
+	void load_state(const machine_state& in) {
+		this->a = in.processor.a;
+		this->p = in.processor.p;
+		this->sp = in.processor.sp;
+		this->x = in.processor.x;
+		this->y = in.processor.y;
+		this->pc = in.processor.pc;
+		this->opcode = in.processor.opcode;
+		this->cycles = in.processor.cycles;
+		this->nmi_requested.store(in.processor.nmi_requested);
+		this->irq_lines = in.processor.irq_lines;
+		this->decoded = in.processor.decoded;
+		this->cpu_bus->load_state(in);
+	}
+
+	// Set while run_async is not running
+	template <typename C>
+	void set_frame_callback(C&& callback) { this->frame_callback = callback; }
 
 	std::pair<u16, bool> get_absolute_address(const u16 address);
 	std::pair<u16, bool> get_absolute_x_address(const u16 address);
@@ -207,7 +247,11 @@ public:
 		halted(false),
 		paused(true),
 		nmi_requested(0),
+		irq_lines(0),
+		idle(true),
 
+		pacer(),
+		frame_callback(nullptr),
 		cpu_bus(nullptr)
 	{
 		//this->pc = 0xc000; // for testnes
@@ -234,6 +278,7 @@ public:
 		this->cycles = 7_usize;
 		this->halted = false;
 		this->paused = true;
+		this->cpu_bus->reset();
 		this->pc = this->read_u16(0xFFFC_u16);
 		//this->pc = 0xC000; // for testnes
 	}
@@ -258,12 +303,7 @@ public:
 	void run_with_callbacks(F&& first, L&& last) {
 		while (!this->halted) {
 			first(*this);
-
-			if (this->nmi_requested.load()) this->handle_nmi();
-			this->fetch();
-			this->decode();
-			this->execute();
-
+			this->step();
 			last(*this);
 		}
 	}
@@ -272,51 +312,64 @@ public:
 	template <typename F, typename L>
 	void run_async(F&& first, L&& last) {
 		if (halted.load()) return;
-		this->paused.store(false);
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			this->paused.store(false);
+			this->idle = false;
+		}
 
 		runner = std::jthread([this, first, last](std::stop_token st) {
 
-			using clock = std::chrono::steady_clock;
-
-			double framerate_target = 60.0988;
-			auto start = clock::now();
-			double accumulator = 0.0;
-			double threshold = 1.0 / framerate_target;
+			usize frame = this->cpu_bus->get_frames();
+			this->pacer.restart();
 
 			while (!st.stop_requested()) {
+				if (this->paused.load()) this->pacer.restart();
 				{
 					std::unique_lock<std::mutex> lock(mtx);
+					if (paused || halted) {
+						this->idle = true;
+						idle_cv.notify_all();
+					}
 					cv.wait(
 						lock, [this, &st] {
 							return st.stop_requested() || (!paused && !halted);
 						}
 					);
+					this->idle = false;
 				}
 				if (st.stop_requested()) break;
-				
-				auto now = clock::now();
-				std::chrono::duration<double> delta = now - start;
-				start = now;
-				accumulator += delta.count();
-
-				//while (accumulator >= threshold) {
-					first(*this);
-					if (this->nmi_requested.load()) this->handle_nmi();
-					this->fetch();
-					this->decode();
-					this->execute();
-					last(*this);
-
-					accumulator -= threshold;
-				//}
+
+				first(*this);
+				this->step();
+				last(*this);
+
+				// Paced once per frame, the ratio steers the apu's output rate to what the speaker drains
+				if (this->cpu_bus->get_frames() != frame) {
+					if (this->frame_callback) this->frame_callback(*this);
+					frame = this->cpu_bus->get_frames();
+					this->cpu_bus->get_apu().set_rate_adjust(this->pacer.frame_done());
+				}
 
 				if (halted.load()) break;
 			}
+			{
+				std::lock_guard<std::mutex> lock(mtx);
+				this->idle = true;
+			}
+			idle_cv.notify_all();
 		});
 	}
+	// Also a battery save checkpoint
 	void pause() {
 		if (halted.load()) return;
 		paused.store(true);
+		if (this->cpu_bus != nullptr) this->cpu_bus->flush_save();
+	}
+	// After pause() or a halt: returns once the runner has finished its instruction, the machine may then be changed
+	void wait_idle() {
+		std::unique_lock<std::mutex> lock(mtx);
+		idle_cv.wait(lock, [this] { return this->idle; });
 	}
 	void resume() {
 		if (!paused.load() || halted.load()) return;
@@ -337,6 +390,13 @@ public:
 	}
 	void decode();
 	void execute();
+	void step() {
+		if (this->nmi_requested.load()) this->handle_nmi();
+		else if (this->irq_lines != 0 && !this->get_interrupt_disable()) this->handle_irq();
+		this->fetch();
+		this->decode();
+		this->execute();
+	}
 
 	void interrupt(const interrupt *cpu_int) {
 		this->push_u16(this->pc);
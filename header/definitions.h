@@ -12,6 +12,7 @@ typedef int16_t i16;
 typedef uint8_t u8;
 typedef uint16_t u16;
 typedef uint32_t u32;
+typedef uint64_t u64;
 typedef size_t usize;
 
 constexpr u8 operator"" _u8(unsigned long long v) { return static_cast<u8>(v); }
@@ -0,0 +1,125 @@
+#ifndef EMULATION_SERVER__H
+#define EMULATION_SERVER__H
+
+#include "cpu.h"
+#include "ppu.h"
+#include "cartridge.h"
+#include "ring_buffer.h"
+#include "shared_frame_ring.h"
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <stop_token>
+
+typedef enum server_command_type {
+	pause_emulation = 0,
+	resume_emulation = 1,
+	reset_machine = 2,
+	step_frame = 3,
+	quit_server = 4
+} server_command_type;
+
+typedef struct server_command {
+	server_command_type type;
+} server_command;
+
+/* Headless emulation: the core runs on the thread calling run(), paced to 60.0988 fps, and every frame goes to the
+ * shared frame ring called name together with the cpu registers. Viewers map the ring and show whatever is newest,
+ * a viewer that falls behind skips frames instead of holding the emulator back.
+ * Control goes through the local stream socket socket_path(name), one command per line, one reply line each:
+ *
+ *   input <port> <buttons in hex>     pause     resume     reset     step (one frame while paused)     status     quit
+ *   cheat <Game Genie or raw code>    cheat clear
+ *
+ * Replies are "ok", "ok <frame> running|paused|halted" for status, or "error <reason>".
+ * Input goes straight to the controller ports, the game sees it at its next strobe; ports 2 and 3 are behind a
+ * Four Score, plugged in by the first input sent to them.
+ */
+class emulation_server : public frame_sink {
+
+private:
+	std::string name;
+	std::vector<u32> pixel_buffer1;
+	std::vector<u32> pixel_buffer2;
+
+	cartridge game;
+	bus machine_bus;
+	cpu machine_cpu;
+	ppu machine_ppu;
+	shared_frame_ring ring;
+
+	// Only the control thread pushes, only the emulation thread pops
+	spsc_ring<server_command, 64> commands;
+	std::atomic<u64> frames;
+	std::atomic<u32> status;
+	std::atomic<bool> stopping;
+	// Only the control thread touches the list, the bus takes over a copy at the next vblank
+	std::vector<cheat> cheat_list;
+
+#ifdef _WIN32
+	std::uintptr_t listener;
+#else
+	int listener;
+#endif
+	std::jthread control;
+
+	void control_loop(std::stop_token st);
+	std::string execute(const std::string& line);
+	void push(server_command_type type);
+	void run_frame();
+	void update_status(u32 status);
+
+public:
+	/* Loads the game and starts listening, throws std::runtime_error if the ring, the socket or the save cannot be
+	 * created. A save path backs PRG-RAM with that file; pausing and stopping are checkpoints.
+	 */
+	emulation_server(const std::string& name, const cartridge& rom, const std::string& save_path = "", usize slot_count = 4);
+	emulation_server(emulation_server& to_copy) = delete;
+	emulation_server(emulation_server&& to_move) noexcept = delete;
+	~emulation_server();
+
+	// Emulates until a quit command or stop(); starts running, not paused
+	void run();
+	// Only sets a flag, safe from a signal handler
+	void stop() { this->stopping.store(true); }
+
+	void submit(std::span<const u32> pixels, const frame_digest& digest, usize frame) override;
+
+	// Buttons as last sent by a client: A, B, Select, Start, Up, Down, Left, Right from bit 0
+	u8 get_input(usize port) const { return this->machine_bus.get_controllers().get_buttons(port); }
+	u64 get_frames() const { return this->frames.load(); }
+	const std::string& get_name() const { return this->name; }
+
+	static std::string socket_path(const std::string& name);
+};
+
+// Viewer side: the frames come from the shared ring, commands and input go over the socket
+class emulation_client {
+
+private:
+#ifdef _WIN32
+	std::uintptr_t connection;
+#else
+	int connection;
+#endif
+	std::string pending;
+	std::array<i16, 4> sent_input;
+	shared_frame_reader frames;
+
+public:
+	// Throws std::runtime_error if no server with this name is running
+	explicit emulation_client(const std::string& name);
+	emulation_client(emulation_client& to_copy) = delete;
+	emulation_client(emulation_client&& to_move) noexcept = delete;
+	~emulation_client();
+
+	// Sends one command and waits for its reply line, throws std::runtime_error once the server is gone
+	std::string request(const std::string& command);
+	// Only talks to the server when the buttons changed
+	void set_input(usize port, u8 buttons);
+
+	shared_frame_reader& get_frames() { return this->frames; }
+};
+
+#endif
@@ -0,0 +1,161 @@
+#ifndef FRAME_DELAY__H
+#define FRAME_DELAY__H
+
+#include "definitions.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <thread>
+
+/* Frame delay: starts each frame as late as the display allows, so the input the game polls is as fresh as it can
+ * be when the picture goes up. The display thread reports every moment it takes a frame for the screen; from those
+ * the next one is predicted, and a frame that may start now instead starts so that it ends the margin before that
+ * moment. The frame is shown on the same refresh either way, only later input went into it.
+ * The work a frame takes is a peak that decays slowly. A frame that still ends after its refresh counts as a miss;
+ * with auto-tuning each miss adds to the margin, which is given back slowly while no frame misses.
+ */
+class frame_delay {
+private:
+	using clock = std::chrono::steady_clock;
+
+	static constexpr double FRAME_SECONDS = 1.0 / 60.0988;
+	// Without a report for this long the display is taken as gone and frames start right away
+	static constexpr double STALE_SECONDS = 0.25;
+	static constexpr double MAX_MARGIN = 0.008;
+	static constexpr double TUNE_STEP = 0.0005;
+	// Frames in a row without a miss before one step of margin is given back
+	static constexpr usize RELAX_FRAMES = 600;
+	// How fast the work peak follows shorter frames, and the display period its reports
+	static constexpr double WORK_DECAY = 0.02;
+	static constexpr double PERIOD_SMOOTHING = 0.1;
+
+	std::atomic<bool> enabled;
+	std::atomic<bool> auto_tune;
+	std::atomic<double> margin;
+
+	// Display thread
+	std::atomic<clock::time_point> latched;
+	std::atomic<double> period;
+	clock::time_point previous_latch;
+
+	// Emulation thread, the atomics are stats
+	clock::time_point frame_start;
+	bool has_start;
+	clock::time_point target;
+	bool has_target;
+	usize clean_frames;
+	std::atomic<double> work;
+	std::atomic<double> extra_margin;
+	std::atomic<double> delay;
+	std::atomic<usize> misses;
+
+	static double seconds(const clock::duration duration) { return std::chrono::duration<double>(duration).count(); }
+	static clock::duration duration(const double seconds) { return std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(seconds)); }
+
+public:
+	frame_delay() :
+		enabled(false),
+		auto_tune(true),
+		margin(0.002),
+		latched(clock::time_point()),
+		period(0.0),
+		previous_latch(),
+		frame_start(),
+		has_start(false),
+		target(),
+		has_target(false),
+		clean_frames(0),
+		work(0.0),
+		extra_margin(0.0),
+		delay(0.0),
+		misses(0)
+	{}
+	frame_delay(frame_delay& to_copy) = delete;
+	frame_delay(frame_delay&& to_move) noexcept = delete;
+
+	// Display thread, right before it takes the newest frame for the screen
+	void display_latched() {
+		clock::time_point now = clock::now();
+		double interval = seconds(now - this->previous_latch);
+		double current = this->period.load(std::memory_order_relaxed);
+		// Stalls (a minimized window, a dialog) are not periods
+		if (current == 0.0) {
+			if (interval < STALE_SECONDS) this->period.store(interval, std::memory_order_relaxed);
+		}
+		else if (interval > current * 0.5 && interval < current * 1.5) {
+			this->period.store(current + (interval - current) * PERIOD_SMOOTHING, std::memory_order_relaxed);
+		}
+		this->previous_latch = now;
+		this->latched.store(now, std::memory_order_release);
+	}
+
+	// Emulation thread, when a frame is done: measures it and checks it against the refresh it was aimed at
+	void frame_finished() {
+		if (!this->has_start) return;
+		clock::time_point now = clock::now();
+		double took = seconds(now - this->frame_start);
+		double peak = this->work.load(std::memory_order_relaxed);
+		this->work.store(took > peak ? took : peak + (took - peak) * WORK_DECAY, std::memory_order_relaxed);
+		if (!this->has_target) return;
+
+		double extra = this->extra_margin.load(std::memory_order_relaxed);
+		if (now > this->target) {
+			this->misses.fetch_add(1, std::memory_order_relaxed);
+			this->clean_frames = 0;
+			if (this->auto_tune.load(std::memory_order_relaxed)) extra = std::min(extra + TUNE_STEP, MAX_MARGIN);
+		}
+		else if (++this->clean_frames >= RELAX_FRAMES) {
+			this->clean_frames = 0;
+			extra = std::max(extra - TUNE_STEP, 0.0);
+		}
+		this->extra_margin.store(extra, std::memory_order_relaxed);
+	}
+	// Emulation thread, when the next frame may start: holds it back if that brings its end closer to the display
+	void wait() {
+		clock::time_point now = clock::now();
+		clock::time_point last = this->latched.load(std::memory_order_acquire);
+		double display = this->period.load(std::memory_order_relaxed);
+		this->has_target = false;
+		this->delay.store(0.0, std::memory_order_relaxed);
+
+		if (this->enabled.load(std::memory_order_relaxed) && display > 0.0 && seconds(now - last) < STALE_SECONDS) {
+			double ahead = this->work.load(std::memory_order_relaxed) + this->get_margin();
+			// The first display latch this frame can still make when it starts right now
+			double refreshes = std::ceil(seconds(now - last + duration(ahead)) / display);
+			clock::time_point latch = last + duration(std::max(refreshes, 0.0) * display);
+			// Never so late that the frame rate cannot be held
+			double hold = std::clamp(seconds(latch - now) - ahead, 0.0, std::max(FRAME_SECONDS - ahead, 0.0));
+			if (hold > 0.0) std::this_thread::sleep_until(now + duration(hold));
+			this->target = latch;
+			this->has_target = true;
+			this->delay.store(hold, std::memory_order_relaxed);
+		}
+		this->frame_start = clock::now();
+		this->has_start = true;
+	}
+	// Emulation thread, after a pause: the time spent in it was no work
+	void restart() {
+		this->has_start = false;
+		this->has_target = false;
+	}
+
+	void set_enabled(const bool enabled) { this->enabled.store(enabled, std::memory_order_relaxed); }
+	bool get_enabled() const { return this->enabled.load(std::memory_order_relaxed); }
+	void set_auto_tune(const bool auto_tune) {
+		this->auto_tune.store(auto_tune, std::memory_order_relaxed);
+		if (!auto_tune) this->extra_margin.store(0.0, std::memory_order_relaxed);
+	}
+	bool get_auto_tune() const { return this->auto_tune.load(std::memory_order_relaxed); }
+	// Seconds the frame should end before the display takes it, auto-tuning adds to it
+	void set_margin(const double margin) { this->margin.store(std::clamp(margin, 0.0, MAX_MARGIN), std::memory_order_relaxed); }
+	double get_base_margin() const { return this->margin.load(std::memory_order_relaxed); }
+	double get_margin() const { return this->margin.load(std::memory_order_relaxed) + this->extra_margin.load(std::memory_order_relaxed); }
+
+	double get_work() const { return this->work.load(std::memory_order_relaxed); }
+	double get_delay() const { return this->delay.load(std::memory_order_relaxed); }
+	double get_display_period() const { return this->period.load(std::memory_order_relaxed); }
+	usize get_misses() const { return this->misses.load(std::memory_order_relaxed); }
+};
+
+#endif
@@ -0,0 +1,108 @@
+#ifndef FRAME_HASH__H
+#define FRAME_HASH__H
+
+#include "definitions.h"
+#include <bitset>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FRAME_HASH_SSE2
+#endif
+
+typedef std::bitset<240> row_bitmap;
+
+typedef struct frame_digest {
+	u64 hash;
+	std::array<u64, 240> rows;
+
+	frame_digest() :
+		hash(0),
+		rows({})
+	{}
+} frame_digest;
+
+/* 64 bit content hash of a 256x240 frame, one hash per row folded into the frame hash.
+ * Rows go through four two-lane multiply / accumulate streams (xxh3 style); the SSE2 and the scalar path give
+ * the same result, so hashes can be compared across machines.
+ */
+namespace frame_hash {
+	constexpr usize ROW_PIXELS = 256;
+	constexpr usize ROWS = 240;
+
+	constexpr u64 KEYS[8] = {
+		0xbe4ba423396cfeb8, 0x1cad21f72c81017c, 0xdb979083e96dd4de, 0x1f67b3b7a4a44072,
+		0x78e5c0cc4ee679cb, 0x2172ffcc7dd05a82, 0x8e2443f7744608b8, 0x4c263a81e69035e0
+	};
+	constexpr u64 SEED = 0x9e3779b97f4a7c15;
+
+	inline u64 mix(u64 h) {
+		h ^= h >> 33;
+		h *= 0xff51afd7ed558ccd;
+		h ^= h >> 33;
+		h *= 0xc4ceb9fe1a85ec53;
+		h ^= h >> 33;
+		return h;
+	}
+
+	inline u64 hash_row(const u32* row) {
+		alignas(16) u64 accumulators[8] = {};
+		const u8* data = reinterpret_cast<const u8*>(row);
+
+#ifdef FRAME_HASH_SSE2
+		__m128i acc[4];
+		__m128i keys[4];
+		for (usize i = 0; i < 4; ++i) {
+			acc[i] = _mm_setzero_si128();
+			keys[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&KEYS[i * 2]));
+		}
+		for (usize offset = 0; offset < ROW_PIXELS * 4; offset += 64) {
+			for (usize i = 0; i < 4; ++i) {
+				__m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + offset + i * 16));
+				__m128i keyed = _mm_xor_si128(block, keys[i]);
+				__m128i product = _mm_mul_epu32(keyed, _mm_shuffle_epi32(keyed, _MM_SHUFFLE(0, 3, 0, 1)));
+				__m128i swapped = _mm_shuffle_epi32(block, _MM_SHUFFLE(1, 0, 3, 2));
+				acc[i] = _mm_add_epi64(acc[i], _mm_add_epi64(product, swapped));
+			}
+		}
+		for (usize i = 0; i < 4; ++i) {
+			_mm_store_si128(reinterpret_cast<__m128i*>(&accumulators[i * 2]), acc[i]);
+		}
+#else
+		for (usize offset = 0; offset < ROW_PIXELS * 4; offset += 64) {
+			for (usize i = 0; i < 4; ++i) {
+				u64 block[2];
+				std::memcpy(block, data + offset + i * 16, 16);
+				for (usize lane = 0; lane < 2; ++lane) {
+					u64 keyed = block[lane] ^ KEYS[i * 2 + lane];
+					accumulators[i * 2 + lane] += (keyed & 0xFFFFFFFF) * (keyed >> 32) + block[lane ^ 1];
+				}
+			}
+		}
+#endif
+
+		u64 h = SEED;
+		for (u64 accumulator : accumulators) h = mix(h ^ accumulator);
+		return h;
+	}
+
+	inline void digest(std::span<const u32> pixels, frame_digest& out) {
+		u64 h = SEED;
+		for (usize row = 0; row < ROWS; ++row) {
+			out.rows[row] = hash_row(pixels.data() + row * ROW_PIXELS);
+			h = mix(h ^ out.rows[row]);
+		}
+		out.hash = h;
+	}
+
+	// Rows whose content differs between two frames
+	inline row_bitmap dirty_rows(const frame_digest& before, const frame_digest& after) {
+		row_bitmap dirty;
+		for (usize row = 0; row < ROWS; ++row) {
+			dirty[row] = before.rows[row] != after.rows[row];
+		}
+		return dirty;
+	}
+};
+
+#endif
@@ -0,0 +1,152 @@
+#ifndef FRAME_PACER__H
+#define FRAME_PACER__H
+
+#include "definitions.h"
+#include "audio_sink.h"
+#include "frame_delay.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+typedef enum pacing_mode {
+	unthrottled = 0,
+	video_clock = 1,
+	audio_clock = 2
+} pacing_mode;
+
+/* Holds the emulation to real time, once per frame.
+ * The video clock sleeps until the next 60.0988 Hz deadline. The audio clock sleeps until the speaker's ring is
+ * back down to the target latency, so the sound card's clock sets the pace and the ring can neither run dry nor
+ * overflow; a ring that stops draining (device paused) hands the pace back to the video clock.
+ * Either way the ring fill also steers the resampling ratio by up to MAX_RATE_ADJUST, which takes up the drift
+ * between the emulated and the real clocks without audible pitch changes.
+ * Once the clock lets a frame start, the frame delay may still hold it back to just before the display takes it.
+ */
+class frame_pacer {
+public:
+	static constexpr const char* MODE_NAMES[3] = { "Unthrottled", "Video", "Audio" };
+
+private:
+	using clock = std::chrono::steady_clock;
+
+	static constexpr double FRAME_SECONDS = 1.0 / 60.0988;
+	static constexpr double MAX_RATE_ADJUST = 0.005;
+	// Ring fill the rate control steers to
+	static constexpr double TARGET_LATENCY = 0.05;
+	// The ring has to drain within this long to count as a clock
+	static constexpr double STALL_SECONDS = 0.1;
+
+	std::atomic<pacing_mode> mode;
+	std::atomic<audio_ring_sink*> speaker;
+	std::atomic<double> rate_adjust;
+	std::atomic<bool> audio_clocked;
+
+	clock::time_point deadline;
+	bool started;
+	// Ring fill at which the audio clock gave up, 0 while it is fine
+	usize stalled_at;
+	frame_delay delay;
+
+	void pace_video() {
+		const auto frame_time = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(FRAME_SECONDS));
+		clock::time_point now = clock::now();
+		if (!this->started) this->restart(now);
+		this->deadline += frame_time;
+		// After a stall start over instead of running a burst of frames to catch up
+		if (now > this->deadline + frame_time) this->deadline = now;
+		else std::this_thread::sleep_until(this->deadline);
+	}
+	bool pace_audio(audio_ring_sink& sink, const usize target) {
+		usize queued = sink.get_queued();
+		if (this->stalled_at != 0 && queued >= this->stalled_at) return false;
+		this->stalled_at = 0;
+
+		double rate = static_cast<double>(sink.get_sample_rate());
+		clock::time_point give_up = clock::now() + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(STALL_SECONDS));
+		while (queued > target) {
+			clock::time_point now = clock::now();
+			if (now > give_up) {
+				this->stalled_at = queued;
+				return false;
+			}
+			// The time it takes to play the excess, in slices short enough to notice a stall
+			double excess = static_cast<double>(queued - target) / rate;
+			std::this_thread::sleep_for(std::chrono::duration<double>(std::clamp(excess, 0.0005, 0.005)));
+			usize left = sink.get_queued();
+			if (left < queued) give_up = clock::now() + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(STALL_SECONDS));
+			queued = left;
+		}
+		this->restart(clock::now());
+		return true;
+	}
+	void restart(const clock::time_point now) {
+		this->deadline = now;
+		this->started = true;
+	}
+
+public:
+	frame_pacer() :
+		mode(pacing_mode::video_clock),
+		speaker(nullptr),
+		rate_adjust(1.0),
+		audio_clocked(false),
+		deadline(),
+		started(false),
+		stalled_at(0),
+		delay()
+	{}
+	frame_pacer(frame_pacer& to_copy) = delete;
+	frame_pacer(frame_pacer&& to_move) noexcept = delete;
+
+	// Emulation thread, after every frame: waits for real time to catch up, returns the resampling ratio to use
+	double frame_done() {
+		this->delay.frame_finished();
+		audio_ring_sink* sink = this->speaker.load(std::memory_order_acquire);
+		usize target = 0;
+		double ratio = 1.0;
+		if (sink != nullptr && sink->get_sample_rate() != 0) {
+			target = static_cast<usize>(sink->get_sample_rate() * TARGET_LATENCY);
+			double fill = static_cast<double>(sink->get_queued()) / static_cast<double>(target);
+			// An emptier ring than the target asks for more samples per frame, a fuller one for less
+			ratio = 1.0 + std::clamp(1.0 - fill, -1.0, 1.0) * MAX_RATE_ADJUST;
+		}
+		this->rate_adjust.store(ratio, std::memory_order_relaxed);
+
+		bool by_audio = false;
+		switch (this->mode.load(std::memory_order_relaxed)) {
+		case pacing_mode::unthrottled:
+			this->started = false;
+			this->delay.restart();
+			break;
+		case pacing_mode::audio_clock:
+			by_audio = sink != nullptr && target != 0 && this->pace_audio(*sink, target);
+			if (!by_audio) this->pace_video();
+			this->delay.wait();
+			break;
+		default:
+			this->pace_video();
+			this->delay.wait();
+			break;
+		}
+		this->audio_clocked.store(by_audio, std::memory_order_relaxed);
+		return ratio;
+	}
+	// Emulation thread, after a pause: the time spent in it is not owed
+	void restart() {
+		this->started = false;
+		this->delay.restart();
+	}
+
+	void set_mode(const pacing_mode mode) { this->mode.store(mode, std::memory_order_relaxed); }
+	pacing_mode get_mode() const { return this->mode.load(std::memory_order_relaxed); }
+	// The ring the audio clock and the rate control watch, null for none
+	void set_speaker(audio_ring_sink* speaker) { this->speaker.store(speaker, std::memory_order_release); }
+	frame_delay& get_frame_delay() { return this->delay; }
+
+	double get_rate_adjust() const { return this->rate_adjust.load(std::memory_order_relaxed); }
+	// Whether the last frame waited on the audio clock
+	bool is_audio_clocked() const { return this->audio_clocked.load(std::memory_order_relaxed); }
+};
+
+#endif
@@ -0,0 +1,106 @@
+#ifndef FRAME_SINK__H
+#define FRAME_SINK__H
+
+#include "definitions.h"
+#include "frame_hash.h"
+#include "triple_buffer.h"
+#include <algorithm>
+#include <atomic>
+
+// A post-processed picture, the pixel vector may be larger than width * height
+typedef struct video_frame {
+	std::vector<u32> pixels;
+	usize width;
+	usize height;
+
+	video_frame() :
+		pixels(),
+		width(0),
+		height(0)
+	{}
+} video_frame;
+
+/* One background tile as the ppu fetched it: CHR content hash, the 4 NES colors of its palette (backdrop first,
+ * one per byte), the screen x of its left column (negative when scrolled in) and which of its 8 rows this is.
+ * Every line has TILES_PER_LINE of them, lines that were not drawn from tiles are left empty.
+ */
+typedef struct hd_tile {
+	static constexpr usize TILES_PER_LINE = 33;
+
+	u64 tile;
+	u32 palette;
+	i16 x;
+	u8 row;
+	u8 valid;
+} hd_tile;
+
+/* Receives every frame the ppu draws, on the emulation thread, right after the buffers are swapped.
+ * The pixels stay untouched until the ppu finishes its next frame; a sink that needs them longer copies them.
+ * Sinks asking for indices also get the 9 bit color indices (palette color | emphasis << 6) and, per line, the
+ * dot position modulo 3 the line started at, before submit is called for the same frame. Sinks asking for tiles get
+ * the background tile of every 8 pixel column, also before submit.
+ */
+class frame_sink {
+public:
+	virtual ~frame_sink() = default;
+	virtual void submit(std::span<const u32> pixels, const frame_digest& digest, usize frame) = 0;
+
+	virtual bool wants_indices() const { return false; }
+	virtual void submit_indices(std::span<const u16>, std::span<const u8>, usize) {}
+
+	virtual bool wants_tiles() const { return false; }
+	virtual void submit_tiles(std::span<const hd_tile>, usize) {}
+};
+
+// What latest_frame_sink hands over, all of one frame; the pixels are its own copy
+typedef struct latest_frame {
+	std::vector<u32> pixels;
+	frame_digest digest;
+	usize frame;
+
+	latest_frame() :
+		pixels(),
+		digest(),
+		frame(0)
+	{}
+} latest_frame;
+
+// Keeps only the newest frame for a consumer polling from another thread, e.g. the screen window
+class latest_frame_sink : public frame_sink {
+
+private:
+	triple_buffer<latest_frame> frames;
+	std::atomic<usize> frame;
+
+public:
+	latest_frame_sink() :
+		frames(),
+		frame(0)
+	{}
+
+	void submit(std::span<const u32> pixels, const frame_digest& digest, usize frame) override {
+		latest_frame& next = this->frames.back();
+		// The ppu draws over its buffer a frame later, while the consumer may still read; rows whose hash equals
+		// what this slot held last are already in it
+		if (next.pixels.size() != pixels.size()) {
+			next.pixels.assign(pixels.begin(), pixels.end());
+		}
+		else {
+			row_bitmap dirty = frame_hash::dirty_rows(next.digest, digest);
+			for (usize row = 0; row < frame_hash::ROWS; ++row) {
+				if (dirty[row]) std::copy_n(pixels.data() + row * frame_hash::ROW_PIXELS, frame_hash::ROW_PIXELS, next.pixels.data() + row * frame_hash::ROW_PIXELS);
+			}
+		}
+		next.digest = digest;
+		next.frame = frame;
+		this->frames.publish();
+		this->frame.store(frame, std::memory_order_relaxed);
+	}
+
+	// False if nothing new was submitted since the last take, the frame stays as it is until the next take
+	bool take(const latest_frame*& latest) { return this->frames.take(latest); }
+	// The newest frame submitted
+	usize get_frame() const { return this->frame.load(std::memory_order_relaxed); }
+};
+
+#endif
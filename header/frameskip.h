@@ -0,0 +1,111 @@
+#ifndef FRAMESKIP__H
+#define FRAMESKIP__H
+
+#include "definitions.h"
+#include <atomic>
+#include <chrono>
+
+typedef enum frameskip_mode {
+	off = 0,
+	fixed = 1,
+	adaptive = 2
+} frameskip_mode;
+
+/* Decides, once per frame, whether the ppu produces pixels for it.
+ * fixed renders one frame out of every (interval + 1), adaptive skips while the emulation is behind real time,
+ * but never more than max_skip frames in a row so the screen keeps moving.
+ * The settings may change from any thread, next() picks them up on the emulation thread at the following frame.
+ */
+class frameskip {
+public:
+	static constexpr const char* MODE_NAMES[3] = { "Off", "Fixed", "Adaptive" };
+
+private:
+	using clock = std::chrono::steady_clock;
+
+	static constexpr double FRAME_SECONDS = 1.0 / 60.0988;
+	// Further behind than this and the controller gives up catching up and restarts from now
+	static constexpr double RESYNC_SECONDS = 0.25;
+
+	std::atomic<frameskip_mode> mode;
+	std::atomic<usize> interval;
+	std::atomic<usize> max_skip;
+	// Set by set_mode, next() then starts counting and timing over
+	std::atomic<bool> mode_changed;
+	usize consecutive;
+	std::atomic<usize> skipped;
+
+	clock::time_point origin;
+	usize origin_frame;
+	bool started;
+
+	bool behind(const usize frame) {
+		clock::time_point now = clock::now();
+		if (!this->started) {
+			this->restart(now, frame);
+			return false;
+		}
+		std::chrono::duration<double> elapsed = now - this->origin;
+		double lag = elapsed.count() - static_cast<double>(frame - this->origin_frame) * FRAME_SECONDS;
+		if (lag > RESYNC_SECONDS || lag < -RESYNC_SECONDS) {
+			this->restart(now, frame);
+			return false;
+		}
+		return lag > FRAME_SECONDS;
+	}
+	void restart(const clock::time_point now, const usize frame) {
+		this->origin = now;
+		this->origin_frame = frame;
+		this->started = true;
+	}
+
+public:
+	frameskip() :
+		mode(frameskip_mode::off),
+		interval(1),
+		max_skip(4),
+		mode_changed(false),
+		consecutive(0),
+		skipped(0),
+		origin(),
+		origin_frame(0),
+		started(false)
+	{}
+
+	// Called by the ppu at the start of every frame, true if the frame must not be drawn
+	bool next(const usize frame) {
+		if (this->mode_changed.exchange(false, std::memory_order_relaxed)) {
+			this->consecutive = 0;
+			this->started = false;
+		}
+		bool skip = false;
+		switch (this->mode.load(std::memory_order_relaxed)) {
+		case frameskip_mode::fixed: skip = this->consecutive < this->interval.load(std::memory_order_relaxed); break;
+		case frameskip_mode::adaptive: skip = this->behind(frame) && this->consecutive < this->max_skip.load(std::memory_order_relaxed); break;
+		default: break;
+		}
+
+		if (skip) {
+			this->consecutive++;
+			this->skipped.fetch_add(1, std::memory_order_relaxed);
+		}
+		else {
+			this->consecutive = 0;
+		}
+		return skip;
+	}
+
+	void set_mode(const frameskip_mode mode) {
+		this->mode.store(mode, std::memory_order_relaxed);
+		this->mode_changed.store(true, std::memory_order_relaxed);
+	}
+	void set_interval(const usize interval) { this->interval.store(interval, std::memory_order_relaxed); }
+	void set_max_skip(const usize max_skip) { this->max_skip.store(max_skip, std::memory_order_relaxed); }
+
+	frameskip_mode get_mode() const { return this->mode.load(std::memory_order_relaxed); }
+	usize get_interval() const { return this->interval.load(std::memory_order_relaxed); }
+	usize get_max_skip() const { return this->max_skip.load(std::memory_order_relaxed); }
+	usize get_skipped() const { return this->skipped.load(std::memory_order_relaxed); }
+};
+
+#endif
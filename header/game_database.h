@@ -0,0 +1,34 @@
+#ifndef GAME_DATABASE__H
+#define GAME_DATABASE__H
+
+#include "definitions.h"
+#include "rom_header.h"
+
+/* Known dumps, keyed by the CRC-32 of everything after the header (the trainer, PRG and CHR-ROM), so a dump is
+ * found whatever its header says. An entry holds the board as it really is; correct() puts it over a header
+ * that a bad ripper or an old iNES 1 writer got wrong. Only dumps that have been checked go in here.
+ */
+typedef struct game_database_entry {
+	u32 crc32;
+	const char* title;
+	u16 mapper;
+	u8 submapper;
+	enum mirroring screen_mirroring;
+	bool battery;
+	enum console_timing timing;
+	u32 prg_ram_size;
+	u32 prg_nvram_size;
+	u32 chr_ram_size;
+} game_database_entry;
+
+namespace game_database {
+	// nullptr for a dump the database does not know
+	const game_database_entry* find(u32 crc32);
+	// The header with the board fields of the entry; ROM sizes and the trainer stay, they describe the file
+	nes_header correct(const nes_header& header, const game_database_entry& entry);
+	// Whether correct() would change anything
+	bool differs(const nes_header& header, const game_database_entry& entry);
+	std::span<const game_database_entry> entries();
+};
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef HD_COMPOSITOR__H
+#define HD_COMPOSITOR__H
+
+#include "definitions.h"
+#include "frame_sink.h"
+#include "hd_pack.h"
+#include "worker_pool.h"
+#include "triple_buffer.h"
+#include <atomic>
+#include <thread>
+
+/* Frame sink drawing the picture at the pack's scale: every line starts as the original pixels scaled up
+ * (nearest), then the background tiles the pack has art for are drawn over it, transparent art pixels let the
+ * original through. Tiles are looked up once per line here, on the compositor's thread, so the ppu only pays
+ * for the tile identity. Like the upscaler, a frame arriving while the previous one is composed is dropped.
+ * Art is drawn without any sprite priority check, which holds only while the ppu's lines are background alone:
+ * once sprites are mixed in, hd_tile has to carry which of its pixels the background won, and only those get art.
+ */
+class hd_compositor : public frame_sink {
+
+private:
+	hd_pack pack;
+	worker_pool pool;
+	std::vector<u32> pixels;
+	std::vector<hd_tile> tiles;
+	bool accepted;
+	triple_buffer<video_frame> outputs;
+
+	std::atomic<bool> pending;
+	std::atomic<bool> stopping;
+	std::atomic<double> average_ms;
+	std::atomic<usize> composed;
+	std::atomic<usize> dropped;
+	std::atomic<usize> replaced;
+
+	std::jthread worker;
+
+	usize compose_lines(std::span<const u32> pixels, std::span<const hd_tile> tiles, u32* out, usize first, usize last) const;
+	void compose_loop();
+
+public:
+	// Throws std::runtime_error if the pack cannot be loaded
+	hd_compositor(const std::string& pack_path, usize helpers);
+	hd_compositor(hd_compositor& to_copy) = delete;
+	hd_compositor(hd_compositor&& to_move) noexcept = delete;
+	~hd_compositor();
+
+	bool wants_tiles() const override { return true; }
+	void submit_tiles(std::span<const hd_tile> tiles, usize frame) override;
+	void submit(std::span<const u32> pixels, const frame_digest& digest, usize frame) override;
+
+	// Synchronous, rows split over the pool; out must hold 256 * 240 * scale^2 pixels, returns the tile rows replaced
+	usize compose(std::span<const u32> pixels, std::span<const hd_tile> tiles, u32* out);
+
+	bool take(const video_frame*& frame) { return this->outputs.take(frame); }
+
+	const hd_pack& get_pack() const { return this->pack; }
+	usize get_scale() const { return this->pack.get_scale(); }
+	double get_ms_per_frame() const { return this->average_ms.load(); }
+	usize get_composed() const { return this->composed.load(); }
+	usize get_dropped() const { return this->dropped.load(); }
+	// Tile rows (one tile on one line) drawn from the pack in the last composed frame
+	usize get_replaced() const { return this->replaced.load(); }
+};
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef HD_PACK__H
+#define HD_PACK__H
+
+#include "definitions.h"
+#include "mapped_file.h"
+#include <string>
+
+/* Pack file, little endian, used in place through a read-only mapping:
+ *
+ *   hd_pack_header                      at offset 0
+ *   slot_count x hd_pack_slot           at slot_offset, an open addressing table (linear probing)
+ *   image_count x (8 * scale)^2 RGBA    at image_offset, rows top to bottom
+ *
+ * A slot is keyed by the tile's content hash (chr_tile_cache::tile_hash) and its 4 NES colors, image is the
+ * image number + 1 and 0 marks an empty slot. slot_count is a power of two and never full.
+ */
+typedef struct hd_pack_header {
+	static constexpr u32 MAGIC = 0x4B50484E; // "NHPK"
+	static constexpr u32 VERSION = 1;
+
+	u32 magic;
+	u32 version;
+	u32 scale;
+	u32 slot_count;
+	u32 image_count;
+	u32 reserved;
+	u64 slot_offset;
+	u64 image_offset;
+} hd_pack_header;
+
+typedef struct hd_pack_slot {
+	u64 tile;
+	u32 palette;
+	u32 image;
+} hd_pack_slot;
+
+// One replacement as a tool hands it to hd_pack::write, image is (8 * scale)^2 RGBA pixels
+typedef struct hd_pack_entry {
+	u64 tile;
+	u32 palette;
+	std::vector<u32> image;
+} hd_pack_entry;
+
+class hd_pack {
+
+private:
+	mapped_file file;
+	const hd_pack_header* header;
+	const hd_pack_slot* slots;
+	const u32* images;
+	usize image_pixels;
+
+	static usize slot_of(u64 tile, u32 palette, usize slot_count);
+
+public:
+	static constexpr usize MAX_SCALE = 8;
+
+	// Maps the pack, throws std::runtime_error on a missing file or a bad layout
+	explicit hd_pack(const std::string& path);
+	hd_pack(hd_pack& to_copy) = delete;
+	hd_pack(hd_pack&& to_move) noexcept = delete;
+
+	// Replacement image for a tile with the given palette, nullptr if the pack has none
+	const u32* find(u64 tile, u32 palette) const;
+
+	usize get_scale() const { return this->header->scale; }
+	usize get_image_count() const { return this->header->image_count; }
+	const std::string& get_path() const { return this->file.get_path(); }
+
+	// Builds a pack file, throws std::runtime_error if it cannot be written or an image has the wrong size
+	static void write(const std::string& path, usize scale, std::span<const hd_pack_entry> entries);
+};
+
+#endif
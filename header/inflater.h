@@ -0,0 +1,73 @@
+#ifndef INFLATER__H
+#define INFLATER__H
+
+#include "definitions.h"
+
+typedef enum inflater_state {
+	block_header = 0,
+	stored_block = 1,
+	huffman_block = 2,
+	stream_end = 3
+} inflater_state;
+
+/* Canonical Huffman code of a DEFLATE block. Codes up to FAST_BITS long decode with one lookup in fast (symbol
+ * << 4 | length, 0 for longer codes), the rest walk counts / symbols a bit at a time.
+ */
+typedef struct inflater_table {
+	static constexpr usize FAST_BITS = 10;
+
+	std::array<u16, 1 << FAST_BITS> fast;
+	std::array<u16, 16> counts;
+	std::array<u16, 288> symbols;
+} inflater_table;
+
+/* Raw DEFLATE (RFC 1951) decoder over a stream that is all in memory, usually a mapping of the archive. Output is
+ * pulled with read() in pieces of any size through a 64 KiB window, so a member can be hashed or have its header
+ * looked at without inflating all of it anywhere. Throws std::runtime_error on a damaged stream.
+ */
+class inflater {
+
+private:
+	static constexpr usize WINDOW_SIZE = 0x10000;
+	// Longest match and farthest distance DEFLATE can produce
+	static constexpr usize MAX_MATCH = 258;
+	static constexpr usize MAX_DISTANCE = 0x8000;
+
+	std::span<const u8> input;
+	usize position;
+	u64 bits;
+	usize bit_count;
+	// Zero bytes fed in past the end of the input, decoding into them means the stream is truncated
+	usize padding;
+
+	inflater_state state;
+	bool last_block;
+	usize stored_remaining;
+	inflater_table literals;
+	inflater_table distances;
+
+	std::vector<u8> window;
+	u64 written;
+	u64 consumed;
+
+	void refill();
+	u32 take(const usize count);
+	u16 decode(const inflater_table& table);
+	static void build(inflater_table& table, const u8* lengths, const usize count);
+	void read_block_header();
+	void read_dynamic_tables();
+	void fill();
+
+public:
+	explicit inflater(std::span<const u8> compressed);
+	inflater(inflater& to_copy) = delete;
+	inflater(inflater&& to_move) noexcept = default;
+
+	// Fills out as far as the stream goes, returns the byte count, less than out.size() only at the end
+	usize read(std::span<u8> out);
+	bool finished() const { return this->state == inflater_state::stream_end && this->written == this->consumed; }
+	// Compressed bytes used so far, where the trailer of a gzip member starts once finished
+	usize get_input_used() const { return this->position - this->bit_count / 8; }
+};
+
+#endif
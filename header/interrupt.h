@@ -20,6 +20,11 @@ namespace interrupts {
 	constexpr static interrupt nmi_interrupt{ 7_usize, 0b00000000_u8, 0xFFFA_u16 };
 	constexpr static interrupt irq_interrupt{ 7_usize, 0b00000000_u8, 0xFFFE_u16 };
 	constexpr static interrupt brk_interrupt{ 0_usize, 0b00010000_u8, 0xFFFE_u16 };
+
+	// /IRQ is level triggered and shared, every source holds its own bit until it is acknowledged
+	constexpr static u8 IRQ_MAPPER = 0b00000001_u8;
+	constexpr static u8 IRQ_FRAME_COUNTER = 0b00000010_u8;
+	constexpr static u8 IRQ_DMC = 0b00000100_u8;
 };
 
 #endif
\ No newline at end of file
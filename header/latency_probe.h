@@ -0,0 +1,184 @@
+#ifndef LATENCY_PROBE__H
+#define LATENCY_PROBE__H
+
+#include "definitions.h"
+#include "frame_sink.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+
+typedef enum latency_stage {
+	input_to_read = 0,
+	read_to_frame = 1,
+	frame_to_upload = 2,
+	upload_to_swap = 3,
+	input_to_swap = 4
+} latency_stage;
+
+// 1 ms buckets, the last one takes everything above
+typedef struct latency_histogram {
+	static constexpr usize BUCKETS = 100;
+
+	std::array<usize, BUCKETS> counts;
+	usize samples;
+	double total_ms;
+	double max_ms;
+
+	latency_histogram() :
+		counts({}),
+		samples(0),
+		total_ms(0.0),
+		max_ms(0.0)
+	{}
+
+	void add(const double ms) {
+		this->counts[std::min(static_cast<usize>(std::max(ms, 0.0)), BUCKETS - 1)]++;
+		this->samples++;
+		this->total_ms += ms;
+		this->max_ms = std::max(this->max_ms, ms);
+	}
+	double mean_ms() const { return this->samples > 0 ? this->total_ms / static_cast<double>(this->samples) : 0.0; }
+	// Upper edge of the bucket holding that fraction of the samples
+	double percentile_ms(const double fraction) const {
+		usize wanted = static_cast<usize>(fraction * static_cast<double>(this->samples));
+		usize seen = 0;
+		for (usize bucket = 0; bucket < BUCKETS; ++bucket) {
+			seen += this->counts[bucket];
+			if (seen > wanted) return static_cast<double>(bucket + 1);
+		}
+		return static_cast<double>(BUCKETS);
+	}
+} latency_histogram;
+
+typedef struct latency_report {
+	static constexpr usize STAGES = 5;
+	static constexpr const char* STAGE_NAMES[STAGES] = { "Input to $4016", "$4016 to frame", "Frame to upload", "Upload to swap", "Input to swap" };
+
+	std::array<latency_histogram, STAGES> stages;
+	// Presses whose effect never reached the screen: no poll, no visible change, or a newer press came first
+	usize lost;
+
+	latency_report() :
+		stages(),
+		lost(0)
+	{}
+} latency_report;
+
+/* Input-to-photon instrumentation, one press at a time. The host timestamps a change of the pads as it delivers it,
+ * the pads report the first strobe that latches that state, and the probe, as a frame sink of whichever ppu
+ * produces the pictures, takes the first frame after that whose content differs from the one before the latch as
+ * the frame showing the effect. The display then reports when it uploads that frame and when the swap returns.
+ * Every step moves the one press in flight on with a compare-exchange, so the threads never wait on each other;
+ * changes while a press is in flight are not followed.
+ */
+class latency_probe : public frame_sink {
+private:
+	using clock = std::chrono::steady_clock;
+
+	typedef enum probe_state {
+		idle = 0,
+		wait_read = 1,
+		wait_frame = 2,
+		wait_upload = 3,
+		wait_swap = 4
+	} probe_state;
+
+	// A press nothing happens to for this long is given up
+	static constexpr double GIVE_UP_SECONDS = 1.0;
+
+	std::atomic<bool> enabled;
+	std::atomic<probe_state> state;
+	std::atomic<u32> expected;
+	std::atomic<u64> last_hash;
+	std::atomic<u64> baseline;
+	std::atomic<usize> effect_frame;
+	std::array<std::atomic<clock::time_point>, 5> marks;
+
+	mutable std::mutex report_mutex;
+	latency_report report;
+
+	bool advance(probe_state from, probe_state to, const usize mark) {
+		if (!this->state.compare_exchange_strong(from, to, std::memory_order_acq_rel)) return false;
+		this->marks[mark].store(clock::now(), std::memory_order_relaxed);
+		return true;
+	}
+	double between(const usize from, const usize to) const {
+		return std::chrono::duration<double, std::milli>(this->marks[to].load(std::memory_order_relaxed) - this->marks[from].load(std::memory_order_relaxed)).count();
+	}
+
+public:
+	latency_probe() :
+		enabled(false),
+		state(probe_state::idle),
+		expected(0),
+		last_hash(0),
+		baseline(0),
+		effect_frame(0),
+		marks(),
+		report_mutex(),
+		report()
+	{}
+	latency_probe(latency_probe& to_copy) = delete;
+	latency_probe(latency_probe&& to_move) noexcept = delete;
+
+	void set_enabled(const bool enabled) {
+		this->state.store(probe_state::idle, std::memory_order_release);
+		this->enabled.store(enabled, std::memory_order_release);
+	}
+	bool get_enabled() const { return this->enabled.load(std::memory_order_relaxed); }
+
+	// Host thread, right after the pads were given a new state: all pads, as controller_ports::get_all_buttons
+	void input(const u32 buttons) {
+		if (!this->enabled.load(std::memory_order_acquire)) return;
+		probe_state current = this->state.load(std::memory_order_acquire);
+		if (current != probe_state::idle) {
+			double waited = std::chrono::duration<double>(clock::now() - this->marks[0].load(std::memory_order_relaxed)).count();
+			if (waited < GIVE_UP_SECONDS) return;
+			if (!this->state.compare_exchange_strong(current, probe_state::idle, std::memory_order_acq_rel)) return;
+			std::lock_guard<std::mutex> lock(this->report_mutex);
+			this->report.lost++;
+		}
+		this->expected.store(buttons, std::memory_order_relaxed);
+		this->advance(probe_state::idle, probe_state::wait_read, 0);
+	}
+	// Emulation thread, a strobe latched the pads
+	void latched(const u32 buttons) {
+		if (this->state.load(std::memory_order_acquire) != probe_state::wait_read || buttons != this->expected.load(std::memory_order_relaxed)) return;
+		this->baseline.store(this->last_hash.load(std::memory_order_relaxed), std::memory_order_relaxed);
+		this->advance(probe_state::wait_read, probe_state::wait_frame, 1);
+	}
+	void submit(std::span<const u32>, const frame_digest& digest, usize frame) override {
+		this->last_hash.store(digest.hash, std::memory_order_relaxed);
+		if (this->state.load(std::memory_order_acquire) != probe_state::wait_frame || digest.hash == this->baseline.load(std::memory_order_relaxed)) return;
+		this->effect_frame.store(frame, std::memory_order_relaxed);
+		this->advance(probe_state::wait_frame, probe_state::wait_upload, 2);
+	}
+	// Display thread, after uploading the frame the screen sink had
+	void uploaded(const usize frame) {
+		if (this->state.load(std::memory_order_acquire) != probe_state::wait_upload || frame < this->effect_frame.load(std::memory_order_relaxed)) return;
+		this->advance(probe_state::wait_upload, probe_state::wait_swap, 3);
+	}
+	// Display thread, when the swap returned
+	void swapped() {
+		if (!this->advance(probe_state::wait_swap, probe_state::wait_swap, 4)) return;
+		{
+			std::lock_guard<std::mutex> lock(this->report_mutex);
+			for (usize stage = 0; stage < 4; ++stage) this->report.stages[stage].add(this->between(stage, stage + 1));
+			this->report.stages[latency_stage::input_to_swap].add(this->between(0, 4));
+		}
+		this->state.store(probe_state::idle, std::memory_order_release);
+	}
+
+	latency_report get_report() const {
+		std::lock_guard<std::mutex> lock(this->report_mutex);
+		return this->report;
+	}
+	void clear() {
+		std::lock_guard<std::mutex> lock(this->report_mutex);
+		this->report = latency_report();
+	}
+};
+
+#endif
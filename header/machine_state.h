@@ -0,0 +1,63 @@
+#ifndef MACHINE_STATE__H
+#define MACHINE_STATE__H
+
+#include "definitions.h"
+#include "apu.h"
+#include "controller.h"
+#include "mapper.h"
+#include "ppu.h"
+#include <limits>
+
+struct instruction;
+
+typedef struct cpu_state {
+	u8 a, p, sp, x, y;
+	u16 pc;
+	u8 opcode;
+	usize cycles;
+	bool nmi_requested;
+	u8 irq_lines;
+	const instruction* decoded;
+} cpu_state;
+
+typedef struct bus_state {
+	// PRG banks as offsets into PRG-ROM, cheat overlays are picked again on load
+	static constexpr usize UNMAPPED = std::numeric_limits<usize>::max();
+
+	std::array<u8, 0x0800> wram;
+	std::array<usize, 4> prg_banks;
+	bool prg_ram_mapped;
+	bool prg_ram_writable;
+	usize cycles;
+	u8 last_read;
+} bus_state;
+
+/* The whole machine at one instruction boundary, made and applied with cpu::save_state / cpu::load_state.
+ * Nothing in it points into the machine it came from, so it can also be loaded into a second machine running the
+ * same game. Plain copies only: after the first save, the RAM vectors keep their size and nothing is allocated.
+ */
+typedef struct machine_state {
+	cpu_state processor;
+	bus_state memory;
+	apu_state audio;
+	controller_state pads;
+	ppu_state video;
+	mapper::state board;
+	std::vector<u8> prg_ram;
+	std::vector<u8> chr_ram;
+
+	machine_state() :
+		processor(),
+		memory(),
+		audio(),
+		pads(),
+		video(),
+		board(),
+		prg_ram(),
+		chr_ram()
+	{}
+
+	usize size() const { return sizeof(machine_state) + this->prg_ram.size() + this->chr_ram.size(); }
+} machine_state;
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef MAPPED_FILE__H
+#define MAPPED_FILE__H
+
+#include "definitions.h"
+#include <string>
+
+typedef enum mapped_file_mode {
+	read_only = 0,
+	// Created if missing and grown (zero filled) to the requested size, writes go straight to the file
+	read_write = 1
+} mapped_file_mode;
+
+// A whole file mapped into memory, throws std::runtime_error when it cannot be opened or mapped
+class mapped_file {
+
+private:
+	std::string path;
+	u8* mapping;
+	usize mapping_size;
+	mapped_file_mode mode;
+
+#ifdef _WIN32
+	void* file_handle;
+	void* mapping_handle;
+#else
+	int descriptor;
+#endif
+
+	void release();
+
+public:
+	mapped_file(const std::string& path, mapped_file_mode mode, usize size = 0);
+	mapped_file(mapped_file& to_copy) = delete;
+	mapped_file(mapped_file&& to_move) noexcept = delete;
+	~mapped_file();
+
+	// Asks the OS to write dirty pages back now instead of whenever it likes
+	void flush();
+
+	const std::string& get_path() const { return this->path; }
+	std::span<const u8> bytes() const { return std::span<const u8>(this->mapping, this->mapping_size); }
+	std::span<u8> writable_bytes() { return this->mode == mapped_file_mode::read_write ? std::span<u8>(this->mapping, this->mapping_size) : std::span<u8>(); }
+	usize size() const { return this->mapping_size; }
+};
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef MAPPER__H
+#define MAPPER__H
+
+#include "definitions.h"
+#include "cartridge.h"
+#include <cstring>
+#include <memory>
+
+class bus;
+class ppu;
+
+/* Cartridge board logic. Reads never come here: the bus and the ppu read through page pointers, and a mapper
+ * only runs when the cpu writes one of its registers, retargeting those pointers (8 KiB PRG pages on the bus,
+ * 1 KiB CHR pages and the nametables on the ppu). Boards with a scanline counter predict when it fires and post
+ * that as a timed event on the ppu, or have the ppu report every filtered A12 rise when it cannot be predicted.
+ */
+class mapper {
+
+protected:
+	static constexpr usize PRG_PAGE_SIZE = 0x2000_usize;
+
+	bus* cpu_bus;
+	ppu* video;
+	cartridge* rom;
+	usize prg_pages;
+	usize chr_pages;
+
+	// 8 KiB page at $8000 + page * $2000; banks count in 8 KiB and wrap on the PRG size
+	void map_prg(const usize page, const usize bank);
+	// size_kib sized window at page * $0400, made of consecutive 1 KiB banks starting at bank * size_kib
+	void map_chr(const usize page, const usize bank, const usize size_kib);
+	void map_nametables(const enum mirroring mirroring);
+	void map_prg_ram(const bool enabled, const bool writable);
+	void set_irq(const bool asserted);
+
+	usize last_prg_bank() const { return this->prg_pages - 1; }
+
+public:
+	// Board registers in a machine snapshot, the banks they select are restored on the bus and the ppu
+	static constexpr usize STATE_SIZE = 64;
+	typedef std::array<u8, STATE_SIZE> state;
+
+protected:
+	template <typename... T>
+	static void pack(state& out, const T&... fields) {
+		static_assert((sizeof(T) + ... + 0) <= STATE_SIZE, "mapper state does not fit");
+		usize offset = 0;
+		((std::memcpy(out.data() + offset, &fields, sizeof(T)), offset += sizeof(T)), ...);
+	}
+	template <typename... T>
+	static void unpack(const state& in, T&... fields) {
+		usize offset = 0;
+		((std::memcpy(&fields, in.data() + offset, sizeof(T)), offset += sizeof(T)), ...);
+	}
+
+public:
+	constexpr static const char* NAMES[8] = {
+		"NROM", "MMC1", "UxROM", "CNROM", "MMC3", "", "", "AxROM"
+	};
+
+	mapper() :
+		cpu_bus(nullptr),
+		video(nullptr),
+		rom(nullptr),
+		prg_pages(0),
+		chr_pages(0)
+	{}
+	mapper(mapper& to_copy) = delete;
+	mapper(mapper&& to_move) noexcept = delete;
+	virtual ~mapper() = default;
+
+	// Throws std::runtime_error for boards that are not implemented
+	static std::unique_ptr<mapper> create(const u16 number);
+	static bool is_supported(const u16 number);
+
+	void attach(bus* cpu_bus, ppu* video, cartridge* rom);
+
+	// Power-on banking
+	virtual void reset() = 0;
+	// Any cpu write to $8000-$FFFF
+	virtual void write(const u16 address, const u8 value) = 0;
+	// A filtered rise of pattern table A12, only while the ppu tracks fetches
+	virtual void a12_rise() {}
+	// The ppu reached the dot clock posted with ppu::schedule
+	virtual void timed_event() {}
+	// A $2000 / $2001 write changed something a prediction depends on
+	virtual void ppu_changed() {}
+
+	// Boards without registers have nothing to save
+	virtual void save_state(state&) const {}
+	virtual void load_state(const state&) {}
+};
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef NTSC_FILTER__H
+#define NTSC_FILTER__H
+
+#include "definitions.h"
+#include "frame_sink.h"
+#include "worker_pool.h"
+#include "triple_buffer.h"
+#include <atomic>
+#include <thread>
+
+/* Composite video from the ppu's 9 bit color indices: every dot becomes 8 samples of the square wave the PPU
+ * puts on the wire (12 samples per color subcarrier cycle, emphasis attenuating parts of it), then each output
+ * pixel is demodulated over one subcarrier period into YIQ. The samples only depend on (phase, index), so they
+ * come precomputed premultiplied by the demodulation carriers; the window sums are differences of prefix sums.
+ * Lines start at the phase the ppu recorded for them, which gives dot crawl and artifact colors.
+ */
+class ntsc_filter : public frame_sink {
+
+public:
+	static constexpr usize OUTPUT_WIDTH = 602;
+	static constexpr usize OUTPUT_HEIGHT = 240;
+	static constexpr usize SAMPLES_PER_DOT = 8;
+	static constexpr usize LINE_SAMPLES = 256 * SAMPLES_PER_DOT;
+
+private:
+	static constexpr usize PHASES = 12;
+	static constexpr usize INDICES = 512;
+	static constexpr usize KERNEL = 3 * SAMPLES_PER_DOT;
+
+	typedef struct line_scratch {
+		std::vector<float> y, i, q;
+
+		line_scratch() :
+			y(LINE_SAMPLES + 1),
+			i(LINE_SAMPLES + 1),
+			q(LINE_SAMPLES + 1)
+		{}
+	} line_scratch;
+
+	// [phase][index] -> 8 luma samples, 8 samples times cos, 8 samples times sin
+	std::vector<float> kernels;
+	std::array<u16, OUTPUT_WIDTH> window_begin;
+	std::array<u16, OUTPUT_WIDTH> window_end;
+	std::array<float, OUTPUT_WIDTH> window_scale;
+
+	worker_pool pool;
+	std::vector<line_scratch> scratch;
+
+	std::vector<u16> indices;
+	std::array<u8, 240> line_phases;
+	triple_buffer<video_frame> outputs;
+
+	std::atomic<bool> pending;
+	std::atomic<bool> stopping;
+	std::atomic<double> average_ms;
+	std::atomic<usize> filtered;
+	std::atomic<usize> dropped;
+
+	std::jthread worker;
+
+	void build_kernels();
+	void render_line(const u16* indices, u8 line_phase, u32* out, line_scratch& scratch) const;
+	void filter_loop();
+
+public:
+	explicit ntsc_filter(usize helpers);
+	ntsc_filter(ntsc_filter& to_copy) = delete;
+	ntsc_filter(ntsc_filter&& to_move) noexcept = delete;
+	~ntsc_filter();
+
+	bool wants_indices() const override { return true; }
+	void submit_indices(std::span<const u16> indices, std::span<const u8> line_phases, usize frame) override;
+	void submit(std::span<const u32>, const frame_digest&, usize) override {}
+
+	// Synchronous, rows split over the pool; out must hold OUTPUT_WIDTH * OUTPUT_HEIGHT pixels
+	void render(std::span<const u16> indices, std::span<const u8> line_phases, u32* out);
+
+	bool take(const video_frame*& frame) { return this->outputs.take(frame); }
+
+	double get_ms_per_frame() const { return this->average_ms.load(); }
+	usize get_filtered() const { return this->filtered.load(); }
+	usize get_dropped() const { return this->dropped.load(); }
+	usize get_bands() const { return this->pool.get_bands(); }
+};
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef PNG_WRITER__H
+#define PNG_WRITER__H
+
+#include "definitions.h"
+#include <string>
+
+/* Minimal PNG encoder: 8 bit RGB, every row filtered with whichever of None / Sub / Up has the smallest sum,
+ * then one deflate block with the fixed Huffman codes and a single candidate hash LZ77. Pixel art shrinks well
+ * with that; it is not meant to compete with zlib -9.
+ */
+namespace png {
+	// Input pixels are RGBA in memory (red in the low byte), alpha is dropped
+	std::vector<u8> encode(std::span<const u32> pixels, usize width, usize height);
+	// Throws std::runtime_error if the file cannot be written
+	void write_file(const std::string& path, std::span<const u32> pixels, usize width, usize height);
+
+	// Raw deflate and zlib streams, exposed for the capture code and tests
+	std::vector<u8> deflate(std::span<const u8> data);
+	std::vector<u8> zlib(std::span<const u8> data);
+};
+
+#endif
@@ -4,31 +4,192 @@
 #include "definitions.h"
 #include "ppu_registers.h"
 #include "cartridge.h"
+#include "mapper.h"
 #include <iostream>
 #include <functional>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <cstring>
+#include <limits>
 #include "palette.h"
+#include "ring_buffer.h"
+#include "frameskip.h"
+#include "frame_hash.h"
+#include "frame_sink.h"
+#include "chr_tile_cache.h"
 class bus;
 
+/* Scanline renders a whole line once 341 dots have been accumulated (fast),
+ * dot steps the PPU one pixel clock at a time (accurate mid-line writes, odd-frame skip, vblank/NMI on dot 1).
+ */
+typedef enum ppu_timing {
+	scanline = 0_u8,
+	dot = 1_u8
+} ppu_timing;
+
+typedef enum ppu_log_kind {
+	write_register = 0_u8,
+	read_register = 1_u8,
+	frame_sync = 2_u8,
+	stop_replay = 3_u8,
+	map_chr = 4_u8,
+	map_nametables = 5_u8,
+	oam_dma = 6_u8
+} ppu_log_kind;
+
+/* One CPU-side access to the PPU, stamped with the PPU dot clock it happened at. Mapper bank switches are logged
+ * too: map_chr carries the page in address and the 1 KiB bank in data (256 KiB of CHR), map_nametables the mirroring.
+ * oam_dma is followed by OAM_DMA_ENTRIES entries carrying the page, 8 bytes in the payload of each; those have no
+ * timestamp, the payload shares its space with dot so the entry stays 16 bytes.
+ */
+typedef struct ppu_log_entry {
+	union {
+		u64 dot;
+		std::array<u8, 8> payload;
+	};
+	ppu_log_kind kind;
+	u8 address;
+	u8 data;
+} ppu_log_entry;
+
+typedef spsc_ring<ppu_log_entry, 0x10000_usize> ppu_log;
+constexpr usize OAM_DMA_ENTRIES = 256 / sizeof(ppu_log_entry::payload);
+
+/* How a scanline counting board learns about pattern table A12 rises: predicted from $2000 / $2001 and posted as
+ * one timed event per IRQ, or per_fetch, every pattern fetch run through the A12 filter (exact, slow, for checking).
+ */
+typedef enum a12_mode {
+	predicted = 0_u8,
+	per_fetch = 1_u8
+} a12_mode;
+
+/* The filtered A12 rises of a rendered line while the configuration stays put: dot gets one every rendered line,
+ * first_dot one more on the pre-render line only (the first fetch from $1000 after vblank), -1 for none.
+ * Not predictable with 8x16 sprites, each sprite picks its own table.
+ */
+typedef struct a12_pattern {
+	bool predictable;
+	i16 dot;
+	i16 first_dot;
+	// Odd frames drop a dot of the pre-render line
+	bool odd_skip;
+} a12_pattern;
+
+// A point of the frame and the dot clock it was reached at
+typedef struct ppu_position {
+	u64 dot_clock;
+	usize line;
+	usize cycle;
+	bool odd_frame;
+} ppu_position;
+
+// Everything a snapshot needs from the ppu: no pointers, the pages are rebuilt from the banks and the mirroring
+typedef struct ppu_state {
+	usize scanlines;
+	usize cycles;
+	usize frames;
+	bool odd_frame;
+	u64 dot_clock;
+	bool skipping;
+	u8 line_phase;
+
+	ppu_ctrl control;
+	ppu_mask mask;
+	ppu_status status;
+	u16 vram_address, vram_address_temp;
+	u8 fine_x;
+	bool address_latch;
+	u8 oam_address;
+	u8 data_buffer;
+
+	u64 mapper_event;
+	bool a12_tracking;
+	usize a12_low_dots;
+	u8 a12_sprite_tables;
+
+	bool sprite_zero_line;
+	u8 sprite_zero_lo, sprite_zero_hi;
+	u8 latch_attribute, latch_nametable, latch_pattern_lo, latch_pattern_hi;
+	u16 bg_shift_pattern_lo, bg_shift_pattern_hi;
+	u16 bg_shift_attrib_lo, bg_shift_attrib_hi;
+
+	enum mirroring mirroring_type;
+	std::array<usize, 8> chr_banks;
+	std::array<u8, 32> palette_table;
+	std::array<u8, 256> oam_memory;
+	std::array<u8, 4096> vram;
+} ppu_state;
+
 class ppu {
 
+public:
+	constexpr static const char* TIMING_NAMES[2] = {
+		"Scanline", "Dot"
+	};
+	constexpr static const char* A12_MODE_NAMES[2] = {
+		"Predicted", "Per fetch"
+	};
+	static constexpr u64 NO_EVENT = std::numeric_limits<u64>::max();
+
 private:
 
 	std::function<void(ppu&)> tick_callback;
 	void request_nmi();
+	void vblank_started();
 
-	static constexpr u16 MIRRORED_ADDRESSES[3][4] = {
-		{ 0x0000, 0x0400, 0x0000, 0x0400 }, //{ 0x0000, 0x0400, 0x0400, 0x0800 }, // Vertical
-		{ 0x0000, 0x0000, 0x0400, 0x0400 }, //{ 0x0000, 0x0000, 0x0800, 0x0800 }, // Horizontal
-		{ 0x0000, 0x0000, 0x0000, 0x0000 }//{ 0x0000, 0x0000, 0x0000, 0x0000 }  // Four Screen
+	ppu_timing timing;
+
+	// Offset into vram of each of the 4 nametables
+	static constexpr u16 NAMETABLE_OFFSETS[5][4] = {
+		{ 0x0000, 0x0400, 0x0000, 0x0400 }, // Vertical
+		{ 0x0000, 0x0000, 0x0400, 0x0400 }, // Horizontal
+		{ 0x0000, 0x0400, 0x0800, 0x0C00 }, // Four Screen
+		{ 0x0000, 0x0000, 0x0000, 0x0000 }, // Single Screen, lower bank
+		{ 0x0400, 0x0400, 0x0400, 0x0400 }  // Single Screen, upper bank
 	};
+	static constexpr usize PAGE_SIZE = 0x0400_usize;
+	static constexpr usize PAGE_COUNT = 16_usize;
 
 	usize scanlines;
 	usize cycles;
+	std::atomic<usize> frames;
+	bool odd_frame;
+	u64 dot_clock;
+
+	bool deferred;
+	frameskip skipper;
+	bool skipping;
+	bool hidden;
+	ppu_log* log;
+	usize logged_frames;
+	// Deferred mode hands entries to the log in bulk, when the batch is full and at every frame
+	static constexpr usize LOG_BATCH = 64;
+	std::array<ppu_log_entry, LOG_BATCH> log_batch;
+	usize log_batched;
+	// The last entry was a $2002 read: a polling loop only needs its first one replayed
+	bool log_status_read;
+
+	bool sprite_zero_line;
+	u8 sprite_zero_lo, sprite_zero_hi;
 	ppu_ctrl control;
 	ppu_mask mask;
 	ppu_status status;
 
 	std::atomic<bool> frame_ready;
+	frame_digest digest;
+	row_bitmap dirty;
+	std::vector<frame_sink*> sinks;
+	std::mutex sinks_mutex;
+	// 9 bit color indices next to the pixels, only written while a sink asks for them
+	std::atomic<bool> index_output;
+	std::vector<u16> indices_current, indices_last;
+	std::array<u8, 240> line_phases_current, line_phases_last;
+	u8 line_phase;
+	// Background tile identities for HD packs, same deal
+	std::atomic<bool> tile_output;
+	std::vector<hd_tile> tiles_current, tiles_last;
+	chr_tile_cache tile_cache;
 
 	u16 vram_address, vram_address_temp;
 	u8 fine_x;
@@ -38,15 +199,32 @@ private:
 	u8 data_buffer;
 
 	bus* cpu_bus;
+	mapper* _mapper;
+	// Dot clock of the event the mapper posted
+	u64 mapper_event;
+	std::atomic<a12_mode> a12;
+	bool a12_tracking;
+	usize a12_low_dots;
+	u8 a12_sprite_tables;
 
 	std::span<u32> pixel_buffer_last;
 	std::span<u32> pixel_buffer_current;
 
 	enum mirroring mirroring_type;
-	std::span<u8> chr_rom;
+	std::span<const u8> chr_rom;
+	std::span<u8> chr_ram;
+	bool chr_writable;
 	std::array<u8, 32> palette_table;
 	std::array<u8, 256> oam_memory;
-	std::array<u8, 2048> vram;
+	std::array<u8, 4096> vram;
+
+	/* 1 KiB pages over $0000-$3FFF: 0-7 are CHR banks, 8-11 the nametables and 12-15 their $3000 mirror.
+	 * Mappers retarget them on bank or mirroring changes, so a fetch is a single indexed load.
+	 */
+	std::array<const u8*, PAGE_COUNT> pages;
+	std::array<usize, 8> chr_banks;
+	u16 writable_pages;
+	std::array<u8, PAGE_SIZE> open_bus_page;
 
 	u8 latch_attribute;
 	u8 latch_nametable;
@@ -56,17 +234,8 @@ private:
 	u16 bg_shift_attrib_lo, bg_shift_attrib_hi;
 
 
-	u16 mirror_address(const u16 address) const {
-		u16 vram_index = address - 0x2000;
-		u16 name_table = vram_index >> 10;
-		u16 offset = vram_index & 0x03FF;
-		u16 base = MIRRORED_ADDRESSES[this->mirroring_type][name_table];
-		return base + offset;
-	}
-
 	u8 read_ppu_bus(const u16 address) const {
-		if (address <= 0x1FFF) { return this->chr_rom.empty() ? 0 : this->chr_rom[address & (this->chr_rom.size() - 1)]; }
-		if (address <= 0x3EFF) { return this->vram[this->mirror_address(address & 0x2FFF)]; }
+		if (address <= 0x3EFF) { return this->pages[address >> 10][address & 0x03FF]; }
 		if (address <= 0x3FFF) {
 			u16 palette_address = address & 0x001F;
 			if ((palette_address & 0x0003) == 0) {
@@ -76,15 +245,23 @@ private:
 		}
 		return 0;
 	}
+	// Offset into CHR of a pattern table address, through the current banking
+	usize chr_offset(const u16 address) const {
+		return (this->chr_banks[address >> 10] * PAGE_SIZE) % this->chr_rom.size() + (address & 0x03FF);
+	}
 	void write_ppu_bus(const u16 address, const u8 data) {
-		if (address <= 0x1FFF) { 
-			if (this->chr_rom.empty()) 
-				return; 
-			//std::cout << "SCRITTURA CHR-RAM: Addr=" << std::hex << address
-			//	<< " Data=" << (int)data << std::dec << std::endl;
-			this->chr_rom[address & (this->chr_rom.size() - 1)] = data; 
-		}
-		else if (address <= 0x3EFF) { this->vram[this->mirror_address(address & 0x2FFF)] = data; }
+		if (address <= 0x3EFF) {
+			if (this->writable_pages & (1 << (address >> 10))) {
+				// Pages are read-only views, writes go to the memory behind them
+				if (address <= 0x1FFF) {
+					this->chr_ram[this->chr_offset(address)] = data;
+					this->tile_cache.invalidate(this->chr_offset(address));
+				}
+				else {
+					this->vram[NAMETABLE_OFFSETS[this->mirroring_type][(address >> 10) & 3] + (address & 0x03FF)] = data;
+				}
+			}
+		}
 		else if (address <= 0x3FFF) {
 			u16 palette_address = address & 0x001F;
 			if ((palette_address & 0x0003) == 0) {
@@ -96,13 +273,20 @@ private:
 
 	void write_control(const u8 data) {
 		bool was_nmi_enabled = this->control.generate_nmi();
+		u8 tables = this->control.snapshot() & 0b00111000_u8;
 		this->control.update(data);
 		bool is_nmi_enabled = this->control.generate_nmi();
 		if (this->status.is_in_vblank() && !was_nmi_enabled && is_nmi_enabled) {
 			this->request_nmi();
 		}
+		// Pattern tables and sprite size decide where A12 rises
+		if (tables != (data & 0b00111000_u8) && this->_mapper != nullptr) this->_mapper->ppu_changed();
+	}
+	void write_mask(const u8 data) {
+		bool was_rendering = this->mask.is_rendering_enabled();
+		this->mask.update(data);
+		if (was_rendering != this->mask.is_rendering_enabled() && this->_mapper != nullptr) this->_mapper->ppu_changed();
 	}
-	void write_mask(const u8 data) { this->mask.update(data); }
 	void write_oam_address(const u8 data) { this->oam_address = data; }
 	void write_oam_data(const u8 data) { this->oam_memory[this->oam_address++] = data; }
 	void write_scroll(const u8 data) { 
@@ -156,7 +340,7 @@ private:
 		return this->oam_memory[this->oam_address];
 	}
 	u8 read_data() {
-		u16 address = this->vram_address = 0x3FFF;
+		u16 address = this->vram_address & 0x3FFF;
 		this->vram_address += this->control.vram_address_increment();
 
 		u8 data_to_return{ 0 }, data_from_vram{ 0 };
@@ -180,14 +364,22 @@ private:
 		this->cycles -= 341;
 		
 		if (this->scanlines <= 239) { // draw
-			auto offset = 256 * this->scanlines;
-			this->draw_line(this->pixel_buffer_current.subspan(offset, 256));
+			if (this->mask.is_rendering_enabled()) this->evaluate_sprite_zero();
+
+			if (this->deferred || this->skipping) {
+				this->skip_line();
+			}
+			else {
+				auto offset = 256 * this->scanlines;
+				this->line_phases_current[this->scanlines] = this->line_phase;
+				this->draw_line(this->pixel_buffer_current.subspan(offset, 256));
+			}
 		}
 		else if (this->scanlines == 241) { // Generate NMI
 			this->status.set_vblank(true);
 			
-			this->swap_buffers();
-			this->frame_ready = true;
+			this->finish_frame();
+			this->vblank_started();
 
 			if (this->control.generate_nmi()) {
 				this->request_nmi();
@@ -201,16 +393,276 @@ private:
 				this->vram_address = this->vram_address_temp;
 		}
 
+		if (this->a12_tracking) this->track_a12_line();
+
+		this->line_phase = (this->line_phase + 341) % 3;
 		this->scanlines++;
 		if (this->scanlines > 261) {
 			this->scanlines = 0;
+			this->skipping = this->skipper.next(this->frames) || this->hidden;
 		}
 	}
 
+	void update_dot() {
+		bool visible_line = this->scanlines <= 239;
+		bool prerender_line = this->scanlines == 261;
+
+		if (visible_line || prerender_line) {
+			if (this->mask.is_rendering_enabled()) { this->fetch_dot(); }
+
+			if (visible_line && this->cycles == 1) {
+				this->sprite_zero_line = this->sprite_zero_row(this->scanlines, this->sprite_zero_lo, this->sprite_zero_hi);
+				this->line_phases_current[this->scanlines] = this->line_phase;
+				if (!this->mask.is_rendering_enabled()) this->clear_tiles(this->scanlines);
+			}
+			if (visible_line && this->cycles >= 1 && this->cycles <= 256) {
+				u8 final_palette_index = this->mask.is_rendering_enabled() ? this->background_pixel() : 0;
+				if (this->sprite_zero_line && (final_palette_index & 3) != 0 && this->sprite_zero_opaque_at(this->cycles - 1)) {
+					this->status.set_sprite_zero_hit(true);
+				}
+				if (!this->skipping) {
+					usize pixel = 256 * this->scanlines + (this->cycles - 1);
+					this->pixel_buffer_current[pixel] = this->get_color_from_palette(final_palette_index);
+					if (this->index_output.load(std::memory_order_relaxed)) this->indices_current[pixel] = this->get_color_index(final_palette_index);
+				}
+			}
+			if (prerender_line && this->cycles == 1) {
+				this->status.update(0);
+			}
+		}
+		else if (this->scanlines == 241 && this->cycles == 1) {
+			this->status.set_vblank(true);
+
+			this->finish_frame();
+			this->vblank_started();
+
+			if (this->control.generate_nmi()) {
+				this->request_nmi();
+			}
+		}
+
+		if (this->a12_tracking) {
+			bool fetching = (visible_line || prerender_line) && this->mask.is_rendering_enabled();
+			if (fetching && this->cycles == 257) this->a12_sprite_tables = this->sprite_fetch_tables(this->scanlines);
+			this->filter_a12(fetching && this->a12_high(this->cycles));
+		}
+
+		this->cycles++;
+		// Odd frames skip the last dot of the pre-render line when rendering is on
+		if (prerender_line && this->cycles == 340 && this->odd_frame && this->mask.is_rendering_enabled()) {
+			this->cycles = 341;
+			this->line_phase = (this->line_phase + 2) % 3;
+		}
+		if (this->cycles >= 341) {
+			this->cycles = 0;
+			this->line_phase = (this->line_phase + 341) % 3;
+			this->scanlines++;
+			if (this->scanlines > 261) {
+				this->scanlines = 0;
+				this->odd_frame = !this->odd_frame;
+				this->skipping = this->skipper.next(this->frames) || this->hidden;
+			}
+		}
+	}
+
+	void fetch_dot() {
+		usize dot = this->cycles;
+
+		if ((dot >= 2 && dot <= 257) || (dot >= 322 && dot <= 337)) {
+			this->shift_background_registers();
+		}
+		if ((dot >= 1 && dot <= 256) || (dot >= 321 && dot <= 336)) {
+			this->fetch_background(dot - 1);
+			if (((dot - 1) & 7) == 6 && this->tile_output.load(std::memory_order_relaxed)) {
+				// Dots 321-336 fetch the first two tiles of the next line
+				if (dot <= 256) this->record_tile(this->scanlines, (dot - 1) / 8 + 2);
+				else this->record_tile(this->scanlines == 261 ? 0 : this->scanlines + 1, (dot - 321) / 8);
+			}
+		}
+
+		if (dot == 256) { this->increment_y(this->vram_address); }
+		else if (dot == 257) {
+			this->load_shift_registers(this->latch_attribute);
+			this->recreate_x(this->vram_address, this->vram_address_temp);
+		}
+		else if (this->scanlines == 261 && dot >= 280 && dot <= 304) {
+			this->recreate_y(this->vram_address, this->vram_address_temp);
+		}
+	}
+
+	// Keeps v exactly where draw_line would leave it, without fetching or producing pixels
+	void skip_line() {
+		if (!this->mask.is_rendering_enabled()) return;
+		this->increment_y(this->vram_address);
+		this->recreate_x(this->vram_address, this->vram_address_temp);
+	}
+
+	// The MMC3 filter only counts a rise after A12 stayed low this long, which drops the 9 dot gap around dot 0
+	static constexpr usize A12_FILTER_DOTS = 10;
+
+	// A12 of the eight sprite pattern fetches of a line as bits, slots without a sprite fetch tile $FF
+	u8 sprite_fetch_tables(const usize line) const {
+		if (this->control.sprite_size() == 8) return this->control.sprite_pattern_address() ? 0xFF : 0x00;
+		if (line > 239) return 0xFF;
+
+		u8 tables = 0xFF;
+		usize found = 0;
+		for (usize sprite = 0; sprite < 64 && found < 8; ++sprite) {
+			usize top = this->oam_memory[sprite * 4];
+			if (line < top || line >= top + 16) continue;
+			if ((this->oam_memory[sprite * 4 + 1] & 1) == 0) tables &= ~(1 << found);
+			found++;
+		}
+		return tables;
+	}
+	// A12 while the given dot of a rendered line fetches: pattern bytes sit on the last 4 dots of each 8 dot group
+	bool a12_high(const usize dot) const {
+		if ((dot >= 1 && dot <= 256) || (dot >= 321 && dot <= 336)) {
+			return ((dot - 1) & 7) >= 4 && this->control.background_pattern_address() != 0;
+		}
+		if (dot >= 257 && dot <= 320) {
+			return ((dot - 257) & 7) >= 4 && ((this->a12_sprite_tables >> ((dot - 257) >> 3)) & 1);
+		}
+		return false;
+	}
+	void filter_a12(const bool high) {
+		if (!high) {
+			this->a12_low_dots++;
+			return;
+		}
+		if (this->a12_low_dots >= A12_FILTER_DOTS) this->_mapper->a12_rise();
+		this->a12_low_dots = 0;
+	}
+	// Scanline timing runs the fetches of the whole line at its end
+	void track_a12_line() {
+		if ((this->scanlines > 239 && this->scanlines != 261) || !this->mask.is_rendering_enabled()) {
+			this->a12_low_dots += 341;
+			return;
+		}
+		this->a12_sprite_tables = this->sprite_fetch_tables(this->scanlines);
+		for (usize dot = 0; dot < 341; ++dot) this->filter_a12(this->a12_high(dot));
+	}
+
+	// Sprite 0's pattern row for the given line, horizontal flip already applied
+	bool sprite_zero_row(const usize line, u8& lo, u8& hi) const {
+		if (!this->mask.is_sprite_rendering_enabled() || !this->mask.is_background_rendering_enabled()) return false;
+
+		usize top = static_cast<usize>(this->oam_memory[0]) + 1;
+		usize height = this->control.sprite_size();
+		if (line < top || line >= top + height) return false;
+
+		u8 tile = this->oam_memory[1];
+		u8 attributes = this->oam_memory[2];
+		u16 row = static_cast<u16>(line - top);
+		if (attributes & 0x80) row = static_cast<u16>(height - 1) - row;
+
+		u16 address;
+		if (height == 16) {
+			address = ((tile & 0x01) ? 0x1000 : 0x0000) + (static_cast<u16>(tile & 0xFE) + (row >> 3)) * 16 + (row & 7);
+		}
+		else {
+			address = this->control.sprite_pattern_address() + static_cast<u16>(tile) * 16 + row;
+		}
+		lo = this->read_ppu_bus(address);
+		hi = this->read_ppu_bus(address + 8);
+
+		if (attributes & 0x40) {
+			lo = reverse_bits(lo);
+			hi = reverse_bits(hi);
+		}
+		return true;
+	}
+	bool sprite_zero_opaque_at(const usize x) const {
+		usize left = this->oam_memory[3];
+		if (x < left || x >= left + 8 || x == 255) return false;
+		if (x < 8 && (!this->mask.show_background_in_leftmost_8px() || !this->mask.show_sprites_in_leftmost_8px())) return false;
+		u8 bit = 7 - static_cast<u8>(x - left);
+		return (((this->sprite_zero_lo | this->sprite_zero_hi) >> bit) & 1) != 0;
+	}
+	static u8 reverse_bits(u8 b) {
+		b = static_cast<u8>((b & 0xF0) >> 4 | (b & 0x0F) << 4);
+		b = static_cast<u8>((b & 0xCC) >> 2 | (b & 0x33) << 2);
+		b = static_cast<u8>((b & 0xAA) >> 1 | (b & 0x55) << 1);
+		return b;
+	}
+
+	/* Line-granular sprite 0 hit: only sprite 0's 8 pixels are tested against the background
+	 * fetched from v at the start of the line, so it works the same whether the line is drawn or skipped.
+	 */
+	void evaluate_sprite_zero() {
+		if (this->status.is_sprite_zero_hit()) return;
+
+		this->sprite_zero_line = this->sprite_zero_row(this->scanlines, this->sprite_zero_lo, this->sprite_zero_hi);
+		if (!this->sprite_zero_line) return;
+
+		usize left = this->oam_memory[3];
+		for (usize x = left; x < left + 8 && x < 255; ++x) {
+			if (this->sprite_zero_opaque_at(x) && this->background_opaque_at(x)) {
+				this->status.set_sprite_zero_hit(true);
+				return;
+			}
+		}
+	}
+	bool background_opaque_at(const usize x) {
+		usize pixel = this->fine_x + x;
+		u16 v = this->vram_address;
+		for (usize tile = pixel >> 3; tile > 0; --tile) {
+			this->increment_coarse_x(v);
+		}
+		u8 nametable = this->read_ppu_bus(0x2000 | (v & 0x0FFF));
+		u16 address = this->control.background_pattern_address() + static_cast<u16>(nametable) * 16 + ((v >> 12) & 0x07);
+		u8 pattern = this->read_ppu_bus(address) | this->read_ppu_bus(address + 8);
+		return ((pattern >> (7 - (pixel & 7))) & 1) != 0;
+	}
+
+	void record(const ppu_log_entry& entry) {
+		this->log_status_read = entry.kind == ppu_log_kind::read_register && entry.address == 2;
+		this->log_batch[this->log_batched++] = entry;
+		if (this->log_batched == LOG_BATCH) this->flush_log();
+	}
+	void flush_log() {
+		std::span<const ppu_log_entry> pending(this->log_batch.data(), this->log_batched);
+		while (!pending.empty()) {
+			pending = pending.subspan(this->log->push(pending));
+			if (pending.empty()) break;
+			this->log->notify();
+			std::this_thread::yield();
+		}
+		this->log_batched = 0;
+	}
+
 	void fill_with_backdrop_color(std::span<u32> target_row) {
 		u32 backdrop_color = this->get_color_from_palette(0);
 		for (auto& x : target_row)
 			x = backdrop_color;
+		if (this->index_output.load(std::memory_order_relaxed)) {
+			std::fill_n(this->indices_current.begin() + 256 * this->scanlines, 256, this->get_color_index(0));
+		}
+		if (this->tile_output.load(std::memory_order_relaxed)) this->clear_tiles(this->scanlines);
+	}
+
+	void clear_tiles(const usize line) {
+		for (usize slot = 0; slot < hd_tile::TILES_PER_LINE; ++slot) this->tiles_current[line * hd_tile::TILES_PER_LINE + slot].valid = 0;
+	}
+	// Identifies the background tile whose pattern was just fetched; slot is its 8 pixel column on the line
+	void record_tile(const usize line, const usize slot) {
+		if (line >= 240 || slot >= hd_tile::TILES_PER_LINE) return;
+
+		hd_tile& tile = this->tiles_current[line * hd_tile::TILES_PER_LINE + slot];
+		if (!this->mask.is_background_rendering_enabled() || this->chr_rom.empty()) {
+			tile.valid = 0;
+			return;
+		}
+		u16 address = this->control.background_pattern_address() + static_cast<u16>(this->latch_nametable) * 16;
+		u8 base = this->latch_attribute << 2;
+		tile.tile = this->tile_cache.hash(this->chr_offset(address) / chr_tile_cache::TILE_SIZE);
+		tile.palette = static_cast<u32>(this->palette_table[0] & 0x3F)
+			| static_cast<u32>(this->palette_table[base + 1] & 0x3F) << 8
+			| static_cast<u32>(this->palette_table[base + 2] & 0x3F) << 16
+			| static_cast<u32>(this->palette_table[base + 3] & 0x3F) << 24;
+		tile.x = static_cast<i16>(slot * 8) - static_cast<i16>(this->fine_x);
+		tile.row = static_cast<u8>((this->vram_address >> 12) & 0x07);
+		tile.valid = 1;
 	}
 
 	void draw_line(std::span<u32> target_row) {
@@ -221,77 +673,85 @@ private:
 			return;
 		}
 		
-		for (int z = 0; z < 2; ++z) {
-			this->latch_nametable = this->read_ppu_bus(0x2000 | (this->vram_address & 0x0FFF));
-			this->latch_attribute = this->read_ppu_bus(this->calculate_attr_address(this->vram_address));
-			this->latch_pattern_lo = this->read_ppu_bus(this->calculate_patt_address(this->vram_address, this->latch_nametable, 0));
-			this->latch_pattern_hi = this->read_ppu_bus(this->calculate_patt_address(this->vram_address, this->latch_nametable, 8));
-			this->load_shift_registers();
-			this->increment_coarse_x(this->vram_address);
-		}
+		u16* index_row = this->index_output.load(std::memory_order_relaxed) ? this->indices_current.data() + 256 * this->scanlines : nullptr;
+		bool tiles = this->tile_output.load(std::memory_order_relaxed);
 
+		// Dots 321-336 of the previous line prefetch the first two tiles
+		for (usize phase = 0; phase < 16; ++phase) {
+			if (phase > 0) this->shift_background_registers();
+			this->fetch_background(phase);
+			if (tiles && (phase & 7) == 6) this->record_tile(this->scanlines, phase / 8);
+		}
+		this->shift_background_registers();
 
 		for (usize cycle = 0; cycle < 256; ++cycle) {
-		
-			u8 final_palette_index = 0;
-			if (this->mask.is_background_rendering_enabled()) {
-				u16 bit_selector = 0x8000 >> this->fine_x;
-
-				u8 bit0 = (this->bg_shift_pattern_lo & bit_selector) > 0;
-				u8 bit1 = (this->bg_shift_pattern_hi & bit_selector) > 0;
-				u8 pattern_bits = (bit1 << 1) | bit0;
-
-				u8 bit_attr0 = (this->bg_shift_attrib_lo & bit_selector) > 0;
-				u8 bit_attr1 = (this->bg_shift_attrib_hi & bit_selector) > 0;
-				u8 attribute_bits = (bit_attr1 << 1) | bit_attr0;
+			if (cycle > 0) this->shift_background_registers();
+			this->fetch_background(cycle);
+			if (tiles && (cycle & 7) == 6) this->record_tile(this->scanlines, cycle / 8 + 2);
 
-				final_palette_index = (attribute_bits << 2) | pattern_bits;
-			}
-			auto color = this->get_color_from_palette(final_palette_index);
-			//std::cout << std::hex << "Sto per scrivere " << color << " nel pixel_buffer, alla posizione: " << (this->scanlines * 256 + cycle) << std::dec << std::endl;
-			//std::cout << "PPU Draw: Idx=" << static_cast<int>(final_palette_index)
-			//	<< " -> Color=" << std::hex << color << ", this: ";
-				
-			target_row[cycle] = color;
-			//std:: cout << target_row[cycle] << std::dec << std::endl;
-
-			this->bg_shift_pattern_lo <<= 1;
-			this->bg_shift_pattern_hi <<= 1;
-			this->bg_shift_attrib_lo <<= 1;
-			this->bg_shift_attrib_hi <<= 1;
-
-			switch (cycle & 7) {
-			case 1:
-				this->latch_nametable = this->read_ppu_bus(0x2000 | (this->vram_address & 0x0FFF));
-				break;
-			case 3:
-				this->latch_attribute = this->read_ppu_bus(this->calculate_attr_address(this->vram_address));
-				break;
-			case 5:
-				this->latch_pattern_lo = this->read_ppu_bus(this->calculate_patt_address(this->vram_address, this->latch_nametable, 0));
-				break;
-			case 7:
-				this->latch_pattern_hi = this->read_ppu_bus(this->calculate_patt_address(this->vram_address, this->latch_nametable, 8));
-				break;
-			case 0:
-				this->load_shift_registers();
-				this->increment_coarse_x(this->vram_address);
-				break;
-			}
+			u8 final_palette_index = this->background_pixel();
+			target_row[cycle] = this->get_color_from_palette(final_palette_index);
+			if (index_row != nullptr) index_row[cycle] = this->get_color_index(final_palette_index);
 		}
 		this->increment_y(this->vram_address);
 		this->recreate_x(this->vram_address, this->vram_address_temp);
 	}
 
-	void load_shift_registers() {
+	// One step of the 8-dot background fetch pattern; the attribute is reduced to its 2 palette bits when fetched
+	void fetch_background(const usize phase) {
+		switch (phase & 7) {
+		case 0:
+			this->load_shift_registers(this->latch_attribute);
+			this->latch_nametable = this->read_ppu_bus(0x2000 | (this->vram_address & 0x0FFF));
+			break;
+		case 2:
+			this->latch_attribute = this->attribute_bits(this->read_ppu_bus(this->calculate_attr_address(this->vram_address)), this->vram_address);
+			break;
+		case 4:
+			this->latch_pattern_lo = this->read_ppu_bus(this->calculate_patt_address(this->vram_address, this->latch_nametable, 0));
+			break;
+		case 6:
+			this->latch_pattern_hi = this->read_ppu_bus(this->calculate_patt_address(this->vram_address, this->latch_nametable, 8));
+			break;
+		case 7:
+			this->increment_coarse_x(this->vram_address);
+			break;
+		}
+	}
+
+	void load_shift_registers(const u8 palette_bits) {
 		this->bg_shift_pattern_lo = (this->bg_shift_pattern_lo & 0xFF00) | this->latch_pattern_lo;
 		this->bg_shift_pattern_hi = (this->bg_shift_pattern_hi & 0xFF00) | this->latch_pattern_hi;
-		this->load_attribute_shift_registers(this->latch_attribute);
+		this->load_attribute_shift_registers(palette_bits);
+	}
+	void shift_background_registers() {
+		this->bg_shift_pattern_lo <<= 1;
+		this->bg_shift_pattern_hi <<= 1;
+		this->bg_shift_attrib_lo <<= 1;
+		this->bg_shift_attrib_hi <<= 1;
+	}
+	u8 background_pixel() const {
+		if (!this->mask.is_background_rendering_enabled()) return 0;
+
+		u16 bit_selector = 0x8000 >> this->fine_x;
+
+		u8 bit0 = (this->bg_shift_pattern_lo & bit_selector) > 0;
+		u8 bit1 = (this->bg_shift_pattern_hi & bit_selector) > 0;
+		u8 pattern_bits = (bit1 << 1) | bit0;
+
+		u8 bit_attr0 = (this->bg_shift_attrib_lo & bit_selector) > 0;
+		u8 bit_attr1 = (this->bg_shift_attrib_hi & bit_selector) > 0;
+		u8 attribute_bits = (bit_attr1 << 1) | bit_attr0;
+
+		return (attribute_bits << 2) | pattern_bits;
 	}
 
 	void recreate_x(u16& v, u16 t) {
 		v = (v & 0x7BE0) | (t & 0x041F);
 	}
+	void recreate_y(u16& v, u16 t) {
+		v = (v & 0x041F) | (t & 0x7BE0);
+	}
 
 	void increment_y(u16& v) {
 		if ((v & 0x7000) != 0x7000) {
@@ -314,9 +774,11 @@ private:
 		}
 	}
 
-	void load_attribute_shift_registers(u8& latch_attr) {
-		u8 quadrant_shift = ((this->vram_address >> 4) & 0x04) | (this->vram_address & 0x02);
-		u8 palette_bits = (this->latch_attribute >> quadrant_shift) & 0x03;
+	u8 attribute_bits(const u8 attribute, const u16 v) const {
+		u8 quadrant_shift = ((v >> 4) & 0x04) | (v & 0x02);
+		return (attribute >> quadrant_shift) & 0x03;
+	}
+	void load_attribute_shift_registers(const u8 palette_bits) {
 		if (palette_bits & 0x01) {
 			this->bg_shift_attrib_lo = (this->bg_shift_attrib_lo & 0xFF00) | 0x00FF;
 		}
@@ -363,6 +825,14 @@ private:
 		u8 nes_color_index = this->palette_table[index & 0x1F];
 		return NES_HARDWARE_PALETTE[nes_color_index & 0x3F];
 	}
+	// Palette color plus the emphasis bits, what the video signal is generated from
+	u16 get_color_index(usize index) const {
+		if ((index & 3) == 0)
+			index = 0;
+
+		u16 color = this->palette_table[index & 0x1F] & (this->mask.is_grayscale() ? 0x30 : 0x3F);
+		return color | (static_cast<u16>(this->mask.color_enhancement_r_g_b()) << 6);
+	}
 
 public:
 	ppu() : 
@@ -371,12 +841,33 @@ public:
 		fine_x(0),
 		address_latch(false),
 		cycles(0),
+		frames(0),
+		odd_frame(false),
+		dot_clock(0),
+		deferred(false),
+		skipper(),
+		skipping(false),
+		hidden(false),
+		log(nullptr),
+		logged_frames(0),
+		log_batch(),
+		log_batched(0),
+		log_status_read(false),
+		sprite_zero_line(false),
+		sprite_zero_lo(0),
+		sprite_zero_hi(0),
+		timing(ppu_timing::scanline),
 		control(),
 		mask(),
 		status(),
 		oam_address(0),
 		data_buffer(0),
 		chr_rom({}),
+		chr_writable(false),
+		pages({}),
+		chr_banks({}),
+		writable_pages(0),
+		open_bus_page({}),
 		oam_memory({}),
 		vram({}),
 		scanlines(261),
@@ -386,7 +877,27 @@ public:
 		pixel_buffer_last({}),
 		pixel_buffer_current({}),
 		cpu_bus(nullptr),
+		_mapper(nullptr),
+		mapper_event(NO_EVENT),
+		a12(a12_mode::predicted),
+		a12_tracking(false),
+		a12_low_dots(0),
+		a12_sprite_tables(0),
 		frame_ready(false),
+		digest(),
+		dirty(),
+		sinks(),
+		sinks_mutex(),
+		index_output(false),
+		indices_current(256 * 240),
+		indices_last(256 * 240),
+		line_phases_current({}),
+		line_phases_last({}),
+		line_phase(0),
+		tile_output(false),
+		tiles_current(240 * hd_tile::TILES_PER_LINE),
+		tiles_last(240 * hd_tile::TILES_PER_LINE),
+		tile_cache(),
 
 		latch_attribute(0),
 		latch_nametable(0),
@@ -397,9 +908,11 @@ public:
 		bg_shift_attrib_lo(0),
 		bg_shift_attrib_hi(0)
 	{
+		for (usize page = 0; page < 8; ++page) this->map_chr(page, page);
+		this->map_nametables(mirroring::vertical);
 	}
 
-	void set_pixel_buffers(std::vector<u32> buffer1, std::vector<u32> buffer2) {
+	void set_pixel_buffers(std::vector<u32>& buffer1, std::vector<u32>& buffer2) {
 		this->pixel_buffer_current = std::span<u32>(buffer1);
 		this->pixel_buffer_last = std::span<u32>(buffer2);
 	}
@@ -411,20 +924,250 @@ public:
 
 	void swap_buffers() {
 		std::swap(this->pixel_buffer_current, this->pixel_buffer_last);
+		if (this->index_output.load(std::memory_order_relaxed)) {
+			std::swap(this->indices_current, this->indices_last);
+			std::swap(this->line_phases_current, this->line_phases_last);
+		}
+		if (this->tile_output.load(std::memory_order_relaxed)) std::swap(this->tiles_current, this->tiles_last);
+	}
+	// Dirty rows are relative to the previous drawn frame
+	void hash_frame() {
+		if (this->pixel_buffer_last.size() < 256 * 240) return;
+		frame_digest previous = this->digest;
+		frame_hash::digest(this->pixel_buffer_last, this->digest);
+		this->dirty = frame_hash::dirty_rows(previous, this->digest);
+	}
+	void publish_frame() {
+		std::lock_guard<std::mutex> lock(this->sinks_mutex);
+		for (frame_sink* sink : this->sinks) {
+			if (sink->wants_indices()) sink->submit_indices(this->indices_last, this->line_phases_last, this->frames);
+			if (sink->wants_tiles()) sink->submit_tiles(this->tiles_last, this->frames);
+			sink->submit(this->pixel_buffer_last, this->digest, this->frames);
+		}
+	}
+	// Called with sinks_mutex held
+	void update_sink_outputs() {
+		bool indices = std::any_of(this->sinks.begin(), this->sinks.end(), [](frame_sink* sink) { return sink->wants_indices(); });
+		bool tiles = std::any_of(this->sinks.begin(), this->sinks.end(), [](frame_sink* sink) { return sink->wants_tiles(); });
+		this->index_output.store(indices, std::memory_order_relaxed);
+		this->tile_output.store(tiles, std::memory_order_relaxed);
+	}
+	// A skipped frame has no pixels, the last presented frame stays up and frame_ready is left alone
+	void finish_frame() {
+		if (!this->skipping) {
+			this->swap_buffers();
+			if (!this->deferred) {
+				this->hash_frame();
+				this->publish_frame();
+			}
+			this->frame_ready = true;
+		}
+		this->frames++;
 	}
 
 	void connect(bus* cpu_bus) { this->cpu_bus = cpu_bus; }
+	// The board that hears about A12 and timed events, the replica of a pipeline has none
+	void connect(mapper* _mapper) {
+		this->_mapper = _mapper;
+		this->mapper_event = NO_EVENT;
+		this->a12_tracking = false;
+	}
+
+	void load(cartridge* rom) {
+		this->chr_rom = rom->get_chr_rom();
+		this->chr_ram = rom->get_chr_ram();
+		this->chr_writable = rom->has_chr_ram();
+		this->tile_cache.attach(this->chr_rom);
+		for (usize page = 0; page < 8; ++page) this->map_chr(page, page);
+		this->map_nametables(rom->get_mirroring());
+	}
+
+	// Points the 1 KiB page at (page * $0400) to the given 1 KiB bank of CHR, wrapping on the CHR size
+	void map_chr(const usize page, const usize bank) {
+		if (this->log != nullptr) this->record(ppu_log_entry{ this->dot_clock, ppu_log_kind::map_chr, static_cast<u8>(page), static_cast<u8>(bank) });
+		this->chr_banks[page] = bank;
+		if (this->chr_rom.empty()) {
+			this->pages[page] = this->open_bus_page.data();
+			this->writable_pages &= ~(1 << page);
+			return;
+		}
+		this->pages[page] = this->chr_rom.data() + ((bank * PAGE_SIZE) % this->chr_rom.size());
+		if (this->chr_writable) this->writable_pages |= (1 << page);
+		else this->writable_pages &= ~(1 << page);
+	}
+	void map_nametables(const enum mirroring mirroring) {
+		if (this->log != nullptr) this->record(ppu_log_entry{ this->dot_clock, ppu_log_kind::map_nametables, 0, static_cast<u8>(mirroring) });
+		this->mirroring_type = mirroring;
+		for (usize table = 0; table < 4; ++table) {
+			u8* page = this->vram.data() + NAMETABLE_OFFSETS[mirroring][table];
+			this->pages[8 + table] = page;
+			this->pages[12 + table] = page;
+		}
+		this->writable_pages |= 0xFF00;
+	}
+	enum mirroring get_mirroring() const { return this->mirroring_type; }
+	template <ppu_timing T>
+	void advance_by(usize cycles) {
+		if constexpr (T == ppu_timing::scanline) {
+			this->cycles += cycles;
+			while (this->cycles >= 341) {
+				this->update_scanline();
+			}
+		}
+		else {
+			for (; cycles > 0; --cycles) {
+				this->update_dot();
+			}
+		}
+	}
+	// Emulation thread, or while it is paused: tick reads the mode without a lock
+	void set_timing(const ppu_timing timing) { this->timing = timing; }
+	ppu_timing get_timing() const { return this->timing; }
 
-	void load(cartridge* rom) { this->chr_rom = rom->get_chr_rom(); this->mirroring_type = rom->get_mirroring(); }
+	// Both modes inline here; the branch goes the same way for a whole run, so it predicts perfectly
 	void tick(usize cycles) {
-		this->cycles += cycles;
-		while (this->cycles >= 341) {
-			this->update_scanline();
+		if (this->timing == ppu_timing::dot) this->advance_by<ppu_timing::dot>(cycles);
+		else this->advance_by<ppu_timing::scanline>(cycles);
+		this->dot_clock += cycles;
+		if (this->dot_clock >= this->mapper_event) {
+			this->mapper_event = NO_EVENT;
+			this->_mapper->timed_event();
+		}
+
+		if (this->log != nullptr && this->logged_frames != this->frames) {
+			this->logged_frames = this->frames;
+			this->record(ppu_log_entry{ this->dot_clock, ppu_log_kind::frame_sync, 0, 0 });
+			this->flush_log();
+			this->log->notify();
 		}
 		if (this->tick_callback) this->tick_callback(*this);
 	}
 
+	/* Deferred mode: lines are skipped (timing, v and status are still tracked) and every register access
+	 * is appended to the log, so that a replica ppu can produce the pixels on another thread.
+	 */
+	void set_deferred(ppu_log* log) {
+		if (this->log != nullptr) this->flush_log();
+		this->log = log;
+		this->logged_frames = this->frames;
+		this->deferred = (log != nullptr);
+	}
+	bool is_deferred() const { return this->deferred; }
+
+	frameskip& get_frameskip() { return this->skipper; }
+	bool is_skipping() const { return this->skipping; }
+
+	// Copies everything but the pixel buffers, chr and the log, used to start a replica in lockstep
+	void sync_from(const ppu& other) {
+		this->scanlines = other.scanlines;
+		this->cycles = other.cycles;
+		this->frames = other.frames.load();
+		this->odd_frame = other.odd_frame;
+		this->dot_clock = other.dot_clock;
+		this->control = other.control;
+		this->mask = other.mask;
+		this->status = other.status;
+		this->vram_address = other.vram_address;
+		this->vram_address_temp = other.vram_address_temp;
+		this->fine_x = other.fine_x;
+		this->address_latch = other.address_latch;
+		this->oam_address = other.oam_address;
+		this->data_buffer = other.data_buffer;
+		this->map_nametables(other.mirroring_type);
+		for (usize page = 0; page < 8; ++page) this->map_chr(page, other.chr_banks[page]);
+		this->palette_table = other.palette_table;
+		this->oam_memory = other.oam_memory;
+		this->vram = other.vram;
+		this->set_timing(other.timing);
+	}
+
+	// CHR-RAM is saved with the cartridge
+	void save_state(ppu_state& out) const {
+		out.scanlines = this->scanlines;
+		out.cycles = this->cycles;
+		out.frames = this->frames.load(std::memory_order_relaxed);
+		out.odd_frame = this->odd_frame;
+		out.dot_clock = this->dot_clock;
+		out.skipping = this->skipping;
+		out.line_phase = this->line_phase;
+		out.control = this->control;
+		out.mask = this->mask;
+		out.status = this->status;
+		out.vram_address = this->vram_address;
+		out.vram_address_temp = this->vram_address_temp;
+		out.fine_x = this->fine_x;
+		out.address_latch = this->address_latch;
+		out.oam_address = this->oam_address;
+		out.data_buffer = this->data_buffer;
+		out.mapper_event = this->mapper_event;
+		out.a12_tracking = this->a12_tracking;
+		out.a12_low_dots = this->a12_low_dots;
+		out.a12_sprite_tables = this->a12_sprite_tables;
+		out.sprite_zero_line = this->sprite_zero_line;
+		out.sprite_zero_lo = this->sprite_zero_lo;
+		out.sprite_zero_hi = this->sprite_zero_hi;
+		out.latch_attribute = this->latch_attribute;
+		out.latch_nametable = this->latch_nametable;
+		out.latch_pattern_lo = this->latch_pattern_lo;
+		out.latch_pattern_hi = this->latch_pattern_hi;
+		out.bg_shift_pattern_lo = this->bg_shift_pattern_lo;
+		out.bg_shift_pattern_hi = this->bg_shift_pattern_hi;
+		out.bg_shift_attrib_lo = this->bg_shift_attrib_lo;
+		out.bg_shift_attrib_hi = this->bg_shift_attrib_hi;
+		out.mirroring_type = this->mirroring_type;
+		out.chr_banks = this->chr_banks;
+		out.palette_table = this->palette_table;
+		out.oam_memory = this->oam_memory;
+		out.vram = this->vram;
+	}
+	// Also fine into another ppu with the same game loaded; frame_ready, the sinks and the settings stay
+	void load_state(const ppu_state& in) {
+		this->scanlines = in.scanlines;
+		this->cycles = in.cycles;
+		this->frames.store(in.frames, std::memory_order_relaxed);
+		this->odd_frame = in.odd_frame;
+		this->dot_clock = in.dot_clock;
+		this->skipping = in.skipping;
+		this->line_phase = in.line_phase;
+		this->control = in.control;
+		this->mask = in.mask;
+		this->status = in.status;
+		this->vram_address = in.vram_address;
+		this->vram_address_temp = in.vram_address_temp;
+		this->fine_x = in.fine_x;
+		this->address_latch = in.address_latch;
+		this->oam_address = in.oam_address;
+		this->data_buffer = in.data_buffer;
+		this->mapper_event = in.mapper_event;
+		this->a12_tracking = in.a12_tracking;
+		this->a12_low_dots = in.a12_low_dots;
+		this->a12_sprite_tables = in.a12_sprite_tables;
+		this->sprite_zero_line = in.sprite_zero_line;
+		this->sprite_zero_lo = in.sprite_zero_lo;
+		this->sprite_zero_hi = in.sprite_zero_hi;
+		this->latch_attribute = in.latch_attribute;
+		this->latch_nametable = in.latch_nametable;
+		this->latch_pattern_lo = in.latch_pattern_lo;
+		this->latch_pattern_hi = in.latch_pattern_hi;
+		this->bg_shift_pattern_lo = in.bg_shift_pattern_lo;
+		this->bg_shift_pattern_hi = in.bg_shift_pattern_hi;
+		this->bg_shift_attrib_lo = in.bg_shift_attrib_lo;
+		this->bg_shift_attrib_hi = in.bg_shift_attrib_hi;
+		if (this->mirroring_type != in.mirroring_type) this->map_nametables(in.mirroring_type);
+		for (usize page = 0; page < 8; ++page) {
+			if (this->chr_banks[page] != in.chr_banks[page]) this->map_chr(page, in.chr_banks[page]);
+		}
+		this->palette_table = in.palette_table;
+		this->oam_memory = in.oam_memory;
+		this->vram = in.vram;
+		// CHR-RAM may have changed under the tile hashes
+		if (this->chr_writable) this->tile_cache.invalidate_all();
+	}
+	// Run-ahead: frames starting while hidden run like skipped ones, nothing is drawn or published
+	void set_hidden(const bool hidden) { this->hidden = hidden; }
+
 	void write(u8 address, u8 data) {
+		if (this->log != nullptr) this->record(ppu_log_entry{ this->dot_clock, ppu_log_kind::write_register, address, data });
 		switch (address & 7) {
 		case 0: this->write_control(data); break;
 		case 1: this->write_mask(data); break;
@@ -437,7 +1180,28 @@ public:
 		}
 	}
 
+	// $4014: the whole page lands in OAM starting at oam_address, which wraps back to where it started
+	void write_oam_dma(const u8* page) {
+		if (this->log != nullptr) {
+			this->record(ppu_log_entry{ this->dot_clock, ppu_log_kind::oam_dma, 0, 0 });
+			for (usize i = 0; i < OAM_DMA_ENTRIES; ++i) {
+				ppu_log_entry bytes{ 0, ppu_log_kind::oam_dma, 0, 0 };
+				std::memcpy(bytes.payload.data(), page + i * bytes.payload.size(), bytes.payload.size());
+				this->record(bytes);
+			}
+		}
+		if (this->oam_address == 0) {
+			std::memcpy(this->oam_memory.data(), page, 256);
+			return;
+		}
+		for (usize i = 0; i < 256; ++i) {
+			this->oam_memory[static_cast<u8>(this->oam_address + i)] = page[i];
+		}
+	}
+
 	u8 read(u8 address, u8 last_bus_value) {
+		// Repeated $2002 reads change nothing more for the replica, which draws from v and the write toggle
+		if (this->log != nullptr && (address == 7 || (address == 2 && !this->log_status_read))) this->record(ppu_log_entry{ this->dot_clock, ppu_log_kind::read_register, address, 0 });
 		switch (address & 7) {
 		case 2: return this->read_status();
 		case 4: return this->read_oam_data();
@@ -452,6 +1216,69 @@ public:
 
 	usize get_cycles() { return this->cycles; }
 	usize get_scanlines() { return this->scanlines; }
+	usize get_frames() const { return this->frames.load(); }
+	u64 get_dot_clock() const { return this->dot_clock; }
+	ppu_position get_position() const { return ppu_position{ this->dot_clock, this->scanlines, this->cycles, this->odd_frame }; }
+
+	// Safe from another thread: the mapper picks the mode up at its next sync, at most a frame later
+	// Like set_timing, a switch mid-frame leaves the counter between the two models
+	void set_a12_mode(const a12_mode mode) { this->a12.store(mode, std::memory_order_relaxed); }
+	a12_mode get_a12_mode() const { return this->a12.load(std::memory_order_relaxed); }
+
+	// Runs every pattern fetch through the A12 filter and calls the mapper's a12_rise
+	void track_a12(const bool enabled) {
+		if (enabled && !this->a12_tracking) this->a12_low_dots = A12_FILTER_DOTS;
+		this->a12_tracking = enabled;
+	}
+	// The mapper's timed_event runs after the first tick that reaches dot_clock, NO_EVENT cancels
+	void schedule(const u64 dot_clock) { this->mapper_event = dot_clock; }
+
+	a12_pattern get_a12_pattern() const {
+		a12_pattern pattern = { this->get_a12_mode() == a12_mode::predicted && this->control.sprite_size() == 8, -1, -1, false };
+		if (!this->mask.is_rendering_enabled()) return pattern;
+
+		bool background_high = this->control.background_pattern_address() != 0;
+		bool sprites_high = this->control.sprite_pattern_address() != 0;
+		// Sprite fetches start at 257, background prefetches at 321, both put A12 up on the 5th dot
+		if (!background_high && sprites_high) pattern.dot = 261;
+		if (background_high && !sprites_high) pattern.dot = 325;
+		if (background_high) pattern.first_dot = 5;
+		// Scanline timing runs a line's fetches once it is over
+		if (this->timing == ppu_timing::scanline) {
+			if (pattern.dot >= 0) pattern.dot = 340;
+			if (pattern.first_dot >= 0) pattern.first_dot = 340;
+		}
+		pattern.odd_skip = this->timing == ppu_timing::dot;
+		return pattern;
+	}
+
+	/* Calls visit(dot clock) for each rise the pattern predicts after the given position, up to and including
+	 * until, while visit returns true. The dot clock is the one the tick that performs the rise ends on.
+	 */
+	template <typename F>
+	static void walk_a12_rises(const a12_pattern& pattern, const ppu_position& from, const u64 until, F&& visit) {
+		if (pattern.dot < 0 && pattern.first_dot < 0) return;
+
+		u64 line_start = from.dot_clock - from.cycle;
+		usize line = from.line;
+		usize cycle = from.cycle;
+		bool odd_frame = from.odd_frame;
+		while (line_start <= until) {
+			if (line <= 239 || line == 261) {
+				for (i16 dot : { line == 261 ? pattern.first_dot : static_cast<i16>(-1), pattern.dot }) {
+					if (dot < 0 || static_cast<usize>(dot) < cycle) continue;
+					u64 rise = line_start + static_cast<u64>(dot) + 1;
+					if (rise > until || !visit(rise)) return;
+				}
+			}
+			line_start += (line == 261 && odd_frame && pattern.odd_skip) ? 340 : 341;
+			cycle = 0;
+			if (++line > 261) {
+				line = 0;
+				odd_frame = !odd_frame;
+			}
+		}
+	}
 	ppu_ctrl get_control() { return this->control; }
 	ppu_mask get_mask() { return this->mask; }
 	ppu_status get_status() { return this->status; }
@@ -465,6 +1292,30 @@ public:
 	u8 get_data_buffer() { return this->data_buffer; }
 
 	bool is_frame_ready() { return this->frame_ready.load(); }
+	u64 get_frame_hash() const { return this->digest.hash; }
+	const frame_digest& get_frame_digest() const { return this->digest; }
+	row_bitmap get_dirty_rows() const { return this->dirty; }
+
+	void add_sink(frame_sink* sink) {
+		std::lock_guard<std::mutex> lock(this->sinks_mutex);
+		if (std::find(this->sinks.begin(), this->sinks.end(), sink) == this->sinks.end()) this->sinks.push_back(sink);
+		this->update_sink_outputs();
+	}
+	void remove_sink(frame_sink* sink) {
+		std::lock_guard<std::mutex> lock(this->sinks_mutex);
+		std::erase(this->sinks, sink);
+		this->update_sink_outputs();
+	}
+	// Hands every sink over to the ppu that produces the pixels from now on
+	void move_sinks_to(ppu& other) {
+		std::scoped_lock lock(this->sinks_mutex, other.sinks_mutex);
+		for (frame_sink* sink : this->sinks) {
+			if (std::find(other.sinks.begin(), other.sinks.end(), sink) == other.sinks.end()) other.sinks.push_back(sink);
+		}
+		this->sinks.clear();
+		this->update_sink_outputs();
+		other.update_sink_outputs();
+	}
 	void reset_frame_ready() { this->frame_ready.store(false); }
 	std::span<u32> get_last_screen() { 
 		return this->pixel_buffer_last;
@@ -0,0 +1,53 @@
+#ifndef PPU_PIPELINE__H
+#define PPU_PIPELINE__H
+
+#include "ppu.h"
+#include "cartridge.h"
+#include <thread>
+#include <stop_token>
+
+/* Pipelined rendering: the emulation ppu runs deferred (timing, status and v only) and logs every register
+ * access; a replica ppu on the render thread replays the log at the same dot stamps and produces the pixels.
+ * The replica owns a copy of the cartridge so CHR-RAM is written by the replay, not by the emulation thread.
+ * The source hands entries over in batches and wakes the render thread once per frame, which takes them in bulk.
+ * Frame sinks follow the pixels: they move to the replica on start and back to the source on stop.
+ */
+class ppu_pipeline {
+
+private:
+	ppu renderer;
+	ppu_log log;
+	cartridge* rom;
+	ppu* source;
+
+	std::jthread worker;
+	// Render thread: an oam_dma entry collects its page here
+	std::array<u8, 256> dma_page;
+	usize dma_remaining;
+
+	void replay(const ppu_log_entry& entry);
+
+public:
+	ppu_pipeline() :
+		renderer(),
+		log(),
+		rom(nullptr),
+		source(nullptr),
+		dma_page(),
+		dma_remaining(0)
+	{}
+	ppu_pipeline(ppu_pipeline& to_copy) = delete;
+	ppu_pipeline(ppu_pipeline&& to_move) noexcept = delete;
+	~ppu_pipeline();
+
+	// Must be called while the emulation thread is not running
+	void start(ppu* source, cartridge* game, std::vector<u32>& buffer1, std::vector<u32>& buffer2);
+	void stop();
+
+	bool is_running() const { return this->source != nullptr; }
+	ppu* get_renderer() { return &this->renderer; }
+	usize get_pending() const { return this->log.size(); }
+	usize get_frames_behind() const { return this->source == nullptr ? 0 : this->source->get_frames() - this->renderer.get_frames(); }
+};
+
+#endif
@@ -105,6 +105,7 @@ public:
 
 	void update(const u8 data) { this->bits = 0b11100000 & data; }
 	bool is_in_vblank() const { return this->bits & vblank; }
+	bool is_sprite_zero_hit() const { return this->bits & sprite_zero_hit; }
 	u8 snapshot() const { return this->bits; }
 
 } ppu_status;
@@ -0,0 +1,76 @@
+#ifndef RING_BUFFER__H
+#define RING_BUFFER__H
+
+#include "definitions.h"
+#include <algorithm>
+#include <atomic>
+
+/* Single producer / single consumer ring, lock free.
+ * The producer only writes tail, the consumer only writes head; capacity must be a power of two.
+ */
+template <typename T, usize capacity>
+class spsc_ring {
+
+	static_assert(capacity > 0 && (capacity & (capacity - 1)) == 0, "spsc_ring capacity must be a power of two");
+
+private:
+	static constexpr usize MASK = capacity - 1;
+
+	std::array<T, capacity> slots;
+	alignas(64) std::atomic<usize> head;
+	alignas(64) std::atomic<usize> tail;
+
+public:
+	spsc_ring() :
+		slots(),
+		head(0),
+		tail(0)
+	{}
+	spsc_ring(spsc_ring& to_copy) = delete;
+	spsc_ring(spsc_ring&& to_move) noexcept = delete;
+
+	bool try_push(const T& value) {
+		usize t = this->tail.load(std::memory_order_relaxed);
+		if (t - this->head.load(std::memory_order_acquire) == capacity) return false;
+		this->slots[t & MASK] = value;
+		this->tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+	bool try_pop(T& value) {
+		usize h = this->head.load(std::memory_order_relaxed);
+		if (h == this->tail.load(std::memory_order_acquire)) return false;
+		value = this->slots[h & MASK];
+		this->head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Bulk versions, one pair of atomic operations per call: push as many values as fit, pop as many as there are
+	usize push(std::span<const T> values) {
+		usize t = this->tail.load(std::memory_order_relaxed);
+		usize count = std::min(capacity - (t - this->head.load(std::memory_order_acquire)), values.size());
+		for (usize i = 0; i < count; ++i) this->slots[(t + i) & MASK] = values[i];
+		this->tail.store(t + count, std::memory_order_release);
+		return count;
+	}
+	usize pop(std::span<T> values) {
+		usize h = this->head.load(std::memory_order_relaxed);
+		usize count = std::min(this->tail.load(std::memory_order_acquire) - h, values.size());
+		for (usize i = 0; i < count; ++i) values[i] = this->slots[(h + i) & MASK];
+		this->head.store(h + count, std::memory_order_release);
+		return count;
+	}
+
+	// Consumer side: blocks until something was pushed after the ring was seen empty
+	void wait_for_data() {
+		usize h = this->head.load(std::memory_order_relaxed);
+		this->tail.wait(h, std::memory_order_acquire);
+	}
+	// Producer side: wakes a consumer blocked in wait_for_data
+	void notify() { this->tail.notify_one(); }
+
+	usize size() const { return this->tail.load(std::memory_order_acquire) - this->head.load(std::memory_order_acquire); }
+	bool empty() const { return this->size() == 0; }
+	constexpr usize get_capacity() const { return capacity; }
+};
+
+#endif
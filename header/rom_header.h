@@ -0,0 +1,94 @@
+#ifndef ROM_HEADER__H
+#define ROM_HEADER__H
+
+#include "definitions.h"
+#include <algorithm>
+
+typedef enum mirroring {
+	vertical = 0_u8,
+	horizontal = 1_u8,
+	four_screen = 2_u8,
+	single_screen_lower = 3_u8,
+	single_screen_upper = 4_u8
+} mirroring;
+
+typedef enum console_timing {
+	ntsc = 0,
+	pal = 1,
+	multi_region = 2,
+	dendy = 3
+} console_timing;
+
+/* The 16 byte header of a .nes file, iNES 1 or NES 2.0, with every size in bytes. iNES 1 has no RAM sizes to
+ * speak of: PRG-RAM is byte 8 in 8 KiB units, battery backed if the battery bit is set, and CHR-RAM is 8 KiB
+ * whenever there is no CHR-ROM.
+ */
+typedef struct nes_header {
+	static constexpr usize SIZE = 16;
+	static constexpr usize TRAINER_SIZE = 512;
+	static constexpr usize PRG_ROM_UNIT = 0x4000;
+	static constexpr usize CHR_ROM_UNIT = 0x2000;
+
+	bool nes2;
+	u16 mapper;
+	u8 submapper;
+	enum mirroring screen_mirroring;
+	bool battery;
+	bool trainer;
+	enum console_timing timing;
+	usize prg_rom_size;
+	usize chr_rom_size;
+	usize prg_ram_size;
+	usize prg_nvram_size;
+	usize chr_ram_size;
+
+	// Where PRG-ROM starts in the file, CHR-ROM follows it
+	usize data_offset() const { return SIZE + (this->trainer ? TRAINER_SIZE : 0); }
+	usize file_size() const { return this->data_offset() + this->prg_rom_size + this->chr_rom_size; }
+
+	// False when raw is not a .nes header; the sizes are not checked against the file
+	static bool parse(std::span<const u8> raw, nes_header& header) {
+		if (raw.size() < SIZE || raw[0] != 0x4E || raw[1] != 0x45 || raw[2] != 0x53 || raw[3] != 0x1A) return false;
+
+		header = nes_header{};
+		header.nes2 = ((raw[7] >> 2) & 0b11) == 0b10;
+		header.trainer = 0 != (raw[6] & 0b100);
+		header.battery = 0 != (raw[6] & 0b10);
+		header.screen_mirroring = (raw[6] & 0b1000) ? mirroring::four_screen : (raw[6] & 0b1) ? mirroring::vertical : mirroring::horizontal;
+
+		if (header.nes2) {
+			header.mapper = static_cast<u16>(((raw[8] & 0x0F) << 8) | (raw[7] & 0xF0) | (raw[6] >> 4));
+			header.submapper = raw[8] >> 4;
+			header.prg_rom_size = rom_size(raw[4], raw[9] & 0x0F, PRG_ROM_UNIT);
+			header.chr_rom_size = rom_size(raw[5], raw[9] >> 4, CHR_ROM_UNIT);
+			header.prg_ram_size = ram_size(raw[10] & 0x0F);
+			header.prg_nvram_size = ram_size(raw[10] >> 4);
+			header.chr_ram_size = ram_size(raw[11] & 0x0F) + ram_size(raw[11] >> 4);
+			header.timing = static_cast<enum console_timing>(raw[12] & 0b11);
+			return true;
+		}
+
+		// "DiskDude!" and similar ripper tags sit in bytes 7-15 of old dumps; bytes 12-15 are always 0 in a real iNES 1 header
+		bool garbage = std::any_of(raw.begin() + 12, raw.begin() + 16, [](u8 byte) { return byte != 0; });
+		header.mapper = static_cast<u16>((garbage ? 0 : (raw[7] & 0xF0)) | (raw[6] >> 4));
+		header.prg_rom_size = static_cast<usize>(raw[4]) * PRG_ROM_UNIT;
+		header.chr_rom_size = static_cast<usize>(raw[5]) * CHR_ROM_UNIT;
+		usize ram = static_cast<usize>(std::max<u8>(garbage ? 0 : raw[8], 1)) * 0x2000;
+		(header.battery ? header.prg_nvram_size : header.prg_ram_size) = ram;
+		header.chr_ram_size = header.chr_rom_size == 0 ? CHR_ROM_UNIT : 0;
+		header.timing = (!garbage && (raw[9] & 1)) ? console_timing::pal : console_timing::ntsc;
+		return true;
+	}
+
+private:
+	// NES 2.0: an upper nibble of $F makes the low byte an exponent, 2^E * (M * 2 + 1)
+	static usize rom_size(const u8 low, const u8 high, const usize unit) {
+		if (high != 0x0F) return (static_cast<usize>(high) << 8 | low) * unit;
+		usize exponent = low >> 2;
+		return exponent >= 8 * sizeof(usize) - 3 ? 0 : (1_usize << exponent) * ((low & 0b11) * 2 + 1);
+	}
+	// NES 2.0 RAM sizes are shift counts, 64 << n bytes and 0 for none
+	static usize ram_size(const u8 shift) { return shift == 0 ? 0 : 64_usize << shift; }
+} nes_header;
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef ROM_IMAGE__H
+#define ROM_IMAGE__H
+
+#include "definitions.h"
+#include "mapped_file.h"
+#include <filesystem>
+#include <memory>
+#include <string>
+
+/* The bytes of a .nes file, immutable and shared: every cartridge made from an image points its PRG and CHR-ROM
+ * into it instead of copying. Opened from a file it is a read-only mapping, so processes running the same game
+ * share the physical pages too, and open() hands out the image already open in this process for that file.
+ * A rom inside a .zip or .gz (see archive) is inflated into memory instead, with no temporary file.
+ */
+class rom_image {
+
+private:
+	std::string path;
+	std::unique_ptr<mapped_file> file;
+	std::filesystem::file_time_type modified;
+	std::vector<u8> owned;
+	std::span<const u8> data;
+
+public:
+	// Maps the file, throws std::runtime_error when it cannot be opened
+	explicit rom_image(const std::string& path);
+	// An image that is not backed by a file, synthetic roms and archive members
+	explicit rom_image(std::vector<u8> bytes, const std::string& path = "", std::filesystem::file_time_type modified = {});
+	rom_image(rom_image& to_copy) = delete;
+	rom_image(rom_image&& to_move) noexcept = delete;
+
+	/* The image of this file if one is still alive and the file did not change since, else a new mapping.
+	 * "set.zip|Game.nes" is a member of an archive, an archive path alone its first rom. Throws std::runtime_error.
+	 */
+	static std::shared_ptr<const rom_image> open(const std::string& path);
+	// Where the battery save of a rom goes: next to the file, or next to the archive holding it
+	static std::string save_path(const std::string& path);
+
+	std::span<const u8> bytes() const { return this->data; }
+	const std::string& get_path() const { return this->path; }
+	bool is_mapped() const { return this->file != nullptr; }
+};
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef ROM_LIBRARY__H
+#define ROM_LIBRARY__H
+
+#include "definitions.h"
+#include "checksum.h"
+#include "rom_header.h"
+#include <atomic>
+#include <filesystem>
+#include <optional>
+#include <string>
+
+typedef struct rom_entry {
+	// Relative to the library directory, with / separators; "set.zip|Game.nes" for a member of an archive
+	std::string path;
+	// Of the file, the archive for a member
+	u64 size;
+	// Ticks of std::filesystem::file_time_type, only ever compared for equality
+	u64 modified;
+	// Of everything after the header, what the game database is keyed by
+	u32 crc32;
+	checksum::sha1_digest sha1;
+	// A .nes header whose sizes fit the file
+	bool valid;
+	bool in_database;
+	// The database disagreed with the header, header holds the corrected one
+	bool corrected;
+	nes_header header;
+	// From the database, else the file name without its extension
+	std::string title;
+} rom_entry;
+
+typedef struct rom_scan_stats {
+	usize files;
+	usize reused;
+	usize hashed;
+	u64 hashed_bytes;
+	double seconds;
+} rom_scan_stats;
+
+/* Index file, little endian, kept as .nes_library in the library directory and read through a mapping:
+ *
+ *   rom_index_header                    at offset 0
+ *   entry_count x rom_index_record      right after it
+ *   strings                             at string_offset, paths and titles, not terminated
+ */
+typedef struct rom_index_header {
+	static constexpr u32 MAGIC = 0x42494C4E; // "NLIB"
+	static constexpr u32 VERSION = 1;
+
+	u32 magic;
+	u32 version;
+	u32 entry_count;
+	u32 reserved;
+	u64 string_offset;
+	u64 string_size;
+} rom_index_header;
+
+typedef struct rom_index_record {
+	static constexpr u8 VALID = 0x01;
+	static constexpr u8 IN_DATABASE = 0x02;
+	static constexpr u8 CORRECTED = 0x04;
+	static constexpr u8 NES2 = 0x08;
+	static constexpr u8 BATTERY = 0x10;
+	static constexpr u8 TRAINER = 0x20;
+
+	u64 size;
+	u64 modified;
+	u64 prg_rom_size;
+	u64 chr_rom_size;
+	u32 prg_ram_size;
+	u32 prg_nvram_size;
+	u32 chr_ram_size;
+	u32 crc32;
+	u32 path_offset;
+	u32 path_size;
+	u32 title_offset;
+	u32 title_size;
+	u16 mapper;
+	u8 submapper;
+	u8 mirroring;
+	u8 timing;
+	u8 flags;
+	u8 sha1[20];
+	u8 reserved[6];
+} rom_index_record;
+
+/* Every .nes file under a directory, and every rom inside its .zip and .gz files, with its hashes and its header
+ * corrected from the game database. scan() only hashes files whose size or modification time changed since the
+ * index was written, across a worker pool, so reopening a library of thousands of roms is a directory walk.
+ * Archive members are hashed as they inflate, never held whole. Everyone else asks the index instead of opening
+ * the files.
+ */
+class rom_library {
+
+private:
+	std::filesystem::path directory;
+	std::vector<rom_entry> entries;
+
+public:
+	static constexpr const char* INDEX_NAME = ".nes_library";
+
+	// Reads the index if there is one; a missing, stale or damaged index only means everything gets hashed
+	explicit rom_library(const std::string& directory);
+
+	/* Walks the directory, rehashes what changed with helpers extra threads and writes the index back. progress
+	 * counts files done for a UI to poll. Throws std::runtime_error if the directory cannot be read.
+	 */
+	rom_scan_stats scan(usize helpers, std::atomic<usize>* progress = nullptr);
+	// Writes through a temporary file, a crash leaves the old index; throws std::runtime_error
+	void save() const;
+
+	const std::vector<rom_entry>& get_entries() const { return this->entries; }
+	std::string get_directory() const { return this->directory.string(); }
+	std::string full_path(const rom_entry& entry) const { return (this->directory / std::filesystem::path(entry.path)).string(); }
+	// Whether the file still has the size and modification time it was indexed with
+	bool is_current(const rom_entry& entry) const;
+
+	/* The index entry of one rom in the index next to it, if that entry is still current (same size and
+	 * modification time), without hashing or opening the rom.
+	 */
+	static std::optional<rom_entry> lookup(const std::string& rom_path);
+};
+
+#endif
@@ -0,0 +1,131 @@
+#ifndef RUN_AHEAD__H
+#define RUN_AHEAD__H
+
+#include "definitions.h"
+#include "cpu.h"
+#include "machine_state.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <stop_token>
+
+/* Run-ahead: hides the game's own input lag by showing the frame it would draw some frames from now.
+ * After every real frame the machine is saved, the next frames run silent and undrawn except the last, which goes
+ * to the sinks, and the save is loaded back; the real frames that follow are hidden. Input is the live host state,
+ * so a press shows up that many frames early.
+ * With a second instance the ahead frames run on their own thread instead: every real frame hands its state to a
+ * copy of the machine, which loads it and runs ahead while the emulation thread goes on. The frame sinks move to
+ * that copy, like they move to the replica of ppu_pipeline.
+ */
+class run_ahead {
+public:
+	static constexpr usize MAX_FRAMES = 3;
+
+private:
+	// The copy a second instance runs on, same cartridge image with its own RAM
+	struct ahead_machine {
+		cartridge game;
+		bus BUS;
+		cpu CPU;
+		ppu PPU;
+
+		ahead_machine(const cartridge& rom, const ppu& source, std::vector<u32>& buffer1, std::vector<u32>& buffer2);
+	};
+
+	cpu* source_cpu;
+	bus* source_bus;
+	ppu* source_ppu;
+
+	std::atomic<usize> frames;
+	machine_state saved;
+
+	std::unique_ptr<ahead_machine> second;
+	std::jthread worker;
+	std::mutex handoff_mutex;
+	std::condition_variable handoff;
+	// Written under handoff_mutex, the worker swaps it with its own copy so nothing is allocated per frame
+	machine_state pending;
+	u32 pending_buttons;
+	bool pending_four_score;
+	ppu_timing pending_timing;
+	bool has_pending;
+	std::vector<cheat> cheats;
+
+	// Last frame, in microseconds
+	std::atomic<double> save_us;
+	std::atomic<double> load_us;
+	std::atomic<double> ahead_us;
+	std::atomic<usize> state_size;
+	std::atomic<usize> dropped;
+	// Since start_second: handoffs the second instance ran and its time on them, loading included
+	std::atomic<usize> runs;
+	std::atomic<double> busy_us;
+
+	static void run_frame(cpu& machine, ppu& video);
+	void run_second(std::stop_token st);
+
+public:
+	run_ahead() :
+		source_cpu(nullptr),
+		source_bus(nullptr),
+		source_ppu(nullptr),
+		frames(0),
+		saved(),
+		second(nullptr),
+		worker(),
+		handoff_mutex(),
+		handoff(),
+		pending(),
+		pending_buttons(0),
+		pending_four_score(false),
+		pending_timing(ppu_timing::scanline),
+		has_pending(false),
+		cheats(),
+		save_us(0.0),
+		load_us(0.0),
+		ahead_us(0.0),
+		state_size(0),
+		dropped(0),
+		runs(0),
+		busy_us(0.0)
+	{}
+	run_ahead(run_ahead& to_copy) = delete;
+	run_ahead(run_ahead&& to_move) noexcept = delete;
+	~run_ahead();
+
+	void connect(cpu* machine, bus* cpu_bus, ppu* video) {
+		this->source_cpu = machine;
+		this->source_bus = cpu_bus;
+		this->source_ppu = video;
+	}
+
+	// Emulation thread, once per frame right after vblank starts: cpu::set_frame_callback
+	void frame_done();
+
+	// Any thread, 0 turns it off; does nothing while the ppu runs deferred
+	void set_frames(const usize frames) { this->frames.store(std::min(frames, MAX_FRAMES), std::memory_order_relaxed); }
+	usize get_frames() const { return this->frames.load(std::memory_order_relaxed); }
+
+	// Must be called while the emulation thread is not running, a second instance runs at least one frame ahead
+	void start_second(cartridge* game, std::vector<u32>& buffer1, std::vector<u32>& buffer2);
+	void stop_second();
+	bool is_second_running() const { return this->second != nullptr; }
+	ppu* get_second_ppu() { return this->second != nullptr ? &this->second->PPU : nullptr; }
+
+	// Forwards to the second instance, the source takes them through its own cpu::set_cheats
+	void set_cheats(const std::vector<cheat>& cheats);
+
+	double get_save_us() const { return this->save_us.load(std::memory_order_relaxed); }
+	double get_load_us() const { return this->load_us.load(std::memory_order_relaxed); }
+	double get_ahead_us() const { return this->ahead_us.load(std::memory_order_relaxed); }
+	usize get_state_size() const { return this->state_size.load(std::memory_order_relaxed); }
+	// Handoffs the second instance had no time for, it always runs from the newest state
+	usize get_dropped() const { return this->dropped.load(std::memory_order_relaxed); }
+	usize get_runs() const { return this->runs.load(std::memory_order_acquire); }
+	double get_busy_us() const { return this->busy_us.load(std::memory_order_relaxed); }
+};
+
+#endif
@@ -0,0 +1,137 @@
+#ifndef SHARED_FRAME_RING__H
+#define SHARED_FRAME_RING__H
+
+#include "definitions.h"
+#include "frame_sink.h"
+#include <atomic>
+#include <string>
+
+/* Shared memory layout, so that another local process can map the frames and read them in place:
+ *
+ *   shared_frame_header               at offset 0
+ *   slot_count x shared_frame_slot    from slot_offset, slot_stride bytes apart
+ *   256 * 240 RGBA pixels             pixel_offset bytes into every slot
+ *
+ * Frame sequence numbers start at 1 and go to slot (sequence % slot_count). A slot is a seqlock: its sequence
+ * is 0 while the pixels are written and the frame sequence once they are complete, a reader checks it before
+ * and after using the pixels. `published` is the newest complete sequence; `wake` is bumped on every publish
+ * and doubles as futex word on Linux (consumers bump `waiters` around FUTEX_WAIT). On Windows the wakeup is the
+ * auto-reset event "Local\<name>.wake", elsewhere consumers poll `published`. Every slot also carries the cpu
+ * registers at the end of its frame, and `status` says whether the producer is running, paused or halted.
+ */
+typedef struct shared_frame_header {
+	static constexpr u32 MAGIC = 0x4653454E; // "NESF"
+	static constexpr u32 VERSION = 2;
+
+	static constexpr u32 STATUS_PAUSED = 0b01;
+	static constexpr u32 STATUS_HALTED = 0b10;
+
+	u32 magic;
+	u32 version;
+	u32 width;
+	u32 height;
+	u32 slot_count;
+	u32 slot_offset;
+	u32 slot_stride;
+	u32 pixel_offset;
+
+	alignas(64) std::atomic<u64> published;
+	alignas(64) std::atomic<u32> wake;
+	std::atomic<u32> waiters;
+	std::atomic<u32> status;
+} shared_frame_header;
+
+typedef struct shared_machine_state {
+	u64 cycles;
+	u16 pc;
+	u8 a, x, y, p, sp;
+	u8 reserved;
+} shared_machine_state;
+
+typedef struct shared_frame_slot {
+	std::atomic<u64> sequence;
+	u64 frame;
+	u64 hash;
+	shared_machine_state machine;
+} shared_frame_slot;
+
+// Producer side: owns the shared memory object and publishes every submitted frame into it
+class shared_frame_ring : public frame_sink {
+
+private:
+	std::string name;
+	u8* mapping;
+	usize mapping_size;
+	u64 sequence;
+
+#ifdef _WIN32
+	void* mapping_handle;
+	void* wake_event;
+#else
+	int descriptor;
+#endif
+
+	shared_frame_header* header() { return reinterpret_cast<shared_frame_header*>(this->mapping); }
+	void wake_consumers();
+
+public:
+	static constexpr usize WIDTH = 256;
+	static constexpr usize HEIGHT = 240;
+	static constexpr usize SLOT_OFFSET = 256;
+	static constexpr usize PIXEL_OFFSET = 64;
+
+	// Creates (or takes over) the shared memory object called name, throws std::runtime_error on failure
+	shared_frame_ring(const std::string& name, usize slot_count);
+	shared_frame_ring(shared_frame_ring& to_copy) = delete;
+	shared_frame_ring(shared_frame_ring&& to_move) noexcept = delete;
+	~shared_frame_ring();
+
+	void submit(std::span<const u32> pixels, const frame_digest& digest, usize frame) override;
+	// Same as submit, with the cpu state that goes along with the frame
+	void publish(std::span<const u32> pixels, const frame_digest& digest, usize frame, const shared_machine_state& machine);
+	// Wakes the consumers too, so that they notice a pause without waiting for a frame
+	void set_status(u32 status);
+
+	const std::string& get_name() const { return this->name; }
+	u64 get_published() const { return this->sequence; }
+	usize get_mapping_size() const { return this->mapping_size; }
+
+	static usize slot_stride();
+};
+
+// Consumer side: maps an existing ring and hands out pointers into it, no copies
+class shared_frame_reader {
+
+private:
+	u8* mapping;
+	usize mapping_size;
+
+#ifdef _WIN32
+	void* mapping_handle;
+	void* wake_event;
+#else
+	int descriptor;
+#endif
+
+	shared_frame_header* header() const { return reinterpret_cast<shared_frame_header*>(this->mapping); }
+
+public:
+	// Throws std::runtime_error if the ring does not exist or has an unknown layout
+	explicit shared_frame_reader(const std::string& name);
+	shared_frame_reader(shared_frame_reader& to_copy) = delete;
+	shared_frame_reader(shared_frame_reader&& to_move) noexcept = delete;
+	~shared_frame_reader();
+
+	u64 get_published() const { return this->header()->published.load(std::memory_order_acquire); }
+	u32 get_status() const { return this->header()->status.load(std::memory_order_acquire); }
+
+	// Blocks until a frame with at least this sequence is published, false on timeout
+	bool wait_for(u64 sequence, u32 timeout_ms);
+
+	// Pixels of the given frame in place, empty if the slot was already reused; check still_valid after use
+	std::span<const u32> pixels(u64 sequence) const;
+	const shared_frame_slot* slot(u64 sequence) const;
+	bool still_valid(u64 sequence) const;
+};
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef TRIPLE_BUFFER__H
+#define TRIPLE_BUFFER__H
+
+#include "definitions.h"
+#include <atomic>
+
+/* One producer thread fills back() and publishes it, one consumer takes the newest published slot.
+ * Neither side ever waits and the consumer never sees a slot that is being written.
+ */
+template <typename T>
+class triple_buffer {
+
+private:
+	static constexpr u8 FRESH = 0x4;
+
+	std::array<T, 3> slots;
+	u8 writing;
+	std::atomic<u8> ready;
+	u8 reading;
+
+public:
+	triple_buffer() :
+		slots(),
+		writing(0),
+		ready(1),
+		reading(2)
+	{}
+	triple_buffer(triple_buffer& to_copy) = delete;
+	triple_buffer(triple_buffer&& to_move) noexcept = delete;
+
+	T& back() { return this->slots[this->writing]; }
+	void publish() { this->writing = this->ready.exchange(this->writing | FRESH, std::memory_order_acq_rel) & 3; }
+
+	// False if nothing was published since the last take
+	bool take(const T*& value) {
+		if ((this->ready.load(std::memory_order_acquire) & FRESH) == 0) return false;
+		this->reading = this->ready.exchange(this->reading, std::memory_order_acq_rel) & 3;
+		value = &this->slots[this->reading];
+		return true;
+	}
+
+	std::array<T, 3>& all() { return this->slots; }
+};
+
+#endif
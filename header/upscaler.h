@@ -0,0 +1,92 @@
+#ifndef UPSCALER__H
+#define UPSCALER__H
+
+#include "definitions.h"
+#include "frame_sink.h"
+#include "worker_pool.h"
+#include "triple_buffer.h"
+#include <atomic>
+#include <thread>
+
+typedef enum upscale_filter {
+	nearest2x = 0,
+	nearest3x = 1,
+	scale2x = 2,
+	scale3x = 3,
+	hq2x = 4
+} upscale_filter;
+
+/* Pixel art scalers over a frame padded by one replicated pixel on every side, so neighbours never need bounds
+ * checks. Each call filters the source rows [first, last) into dst, whose stride is width * factor.
+ * Scale2x gives the same picture as EPX; hq2x is a reduced rule set (YUV thresholds, blend towards matching
+ * diagonal neighbours) rather than the full 256 case table. Its YUV comparisons stay scalar: SSE2 only screens four
+ * pixels at a time for the flat ones, equal to all their edge neighbours, and writes those unblended.
+ */
+namespace upscale {
+	constexpr usize FILTER_COUNT = 5;
+	constexpr const char* NAMES[FILTER_COUNT] = { "Nearest 2x", "Nearest 3x", "Scale2x (EPX)", "Scale3x", "HQ2x lite" };
+	constexpr usize FACTORS[FILTER_COUNT] = { 2, 3, 2, 3, 2 };
+
+	typedef struct padded_frame {
+		std::vector<u32> pixels;
+		usize width;
+		usize height;
+
+		padded_frame(usize width, usize height) :
+			pixels((width + 2) * (height + 2)),
+			width(width),
+			height(height)
+		{}
+		usize stride() const { return this->width + 2; }
+		// First real pixel of the given row
+		const u32* row(usize y) const { return this->pixels.data() + (y + 1) * this->stride() + 1; }
+	} padded_frame;
+
+	void pad(std::span<const u32> src, padded_frame& dst);
+	void run(upscale_filter filter, const padded_frame& src, u32* dst, usize first, usize last);
+	// Splits the rows over the pool
+	void run(upscale_filter filter, const padded_frame& src, u32* dst, worker_pool& pool);
+};
+
+/* Frame sink running the selected filter on its own thread, so frame N is filtered while frame N+1 is emulated.
+ * submit() only pads the frame into the input buffer (a frame arriving while the previous one is still being
+ * filtered is dropped), the output is triple buffered so the consumer never sees a half written picture.
+ */
+class upscaler : public frame_sink {
+
+private:
+	std::atomic<upscale_filter> filter;
+	worker_pool pool;
+	upscale::padded_frame input;
+	triple_buffer<video_frame> outputs;
+
+	std::atomic<bool> pending;
+	std::atomic<bool> stopping;
+	std::array<std::atomic<double>, upscale::FILTER_COUNT> average_ms;
+	std::atomic<usize> filtered;
+	std::atomic<usize> dropped;
+
+	std::jthread worker;
+
+	void filter_loop();
+
+public:
+	upscaler(upscale_filter filter, usize helpers);
+	upscaler(upscaler& to_copy) = delete;
+	upscaler(upscaler&& to_move) noexcept = delete;
+	~upscaler();
+
+	void submit(std::span<const u32> pixels, const frame_digest& digest, usize frame) override;
+
+	// Newest filtered frame, false if there is nothing new since the last take
+	bool take(const video_frame*& frame) { return this->outputs.take(frame); }
+
+	void set_filter(upscale_filter filter) { this->filter.store(filter); }
+	upscale_filter get_filter() const { return this->filter.load(); }
+	double get_ms_per_frame(upscale_filter filter) const { return this->average_ms[filter].load(); }
+	usize get_filtered() const { return this->filtered.load(); }
+	usize get_dropped() const { return this->dropped.load(); }
+	usize get_bands() const { return this->pool.get_bands(); }
+};
+
+#endif
@@ -0,0 +1,100 @@
+#ifndef WORKER_POOL__H
+#define WORKER_POOL__H
+
+#include "definitions.h"
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+#include <thread>
+#include <functional>
+#include <condition_variable>
+
+/* Fork / join over a fixed set of threads: run() hands job(band, bands) to every helper thread, does band 0 on
+ * the calling thread and returns once all bands are done. Meant for splitting a frame's rows, one job at a time.
+ */
+class worker_pool {
+
+private:
+	std::vector<std::jthread> workers;
+	std::mutex mtx;
+	std::condition_variable cv;
+	std::function<void(usize, usize)> job;
+	usize generation;
+	bool stopping;
+	std::atomic<usize> remaining;
+
+	void work(const usize band) {
+		usize seen = 0;
+		while (true) {
+			std::function<void(usize, usize)> current;
+			{
+				std::unique_lock<std::mutex> lock(this->mtx);
+				this->cv.wait(lock, [this, seen] { return this->stopping || this->generation != seen; });
+				if (this->stopping) return;
+				seen = this->generation;
+				current = this->job;
+			}
+			current(band, this->workers.size() + 1);
+			if (this->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) this->remaining.notify_one();
+		}
+	}
+
+public:
+	// helpers extra threads besides the caller, 0 runs everything on the calling thread
+	explicit worker_pool(const usize helpers) :
+		workers(),
+		mtx(),
+		cv(),
+		job(),
+		generation(0),
+		stopping(false),
+		remaining(0)
+	{
+		this->workers.reserve(helpers);
+		for (usize band = 1; band <= helpers; ++band) {
+			this->workers.emplace_back([this, band] { this->work(band); });
+		}
+	}
+	worker_pool(worker_pool& to_copy) = delete;
+	worker_pool(worker_pool&& to_move) noexcept = delete;
+	~worker_pool() {
+		{
+			std::lock_guard<std::mutex> lock(this->mtx);
+			this->stopping = true;
+		}
+		this->cv.notify_all();
+		this->workers.clear();
+	}
+
+	template <typename J>
+	void run(J&& job) {
+		if (this->workers.empty()) {
+			job(0_usize, 1_usize);
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lock(this->mtx);
+			this->job = job;
+			this->remaining.store(this->workers.size(), std::memory_order_release);
+			this->generation++;
+		}
+		this->cv.notify_all();
+		job(0_usize, this->workers.size() + 1);
+
+		usize left = this->remaining.load(std::memory_order_acquire);
+		while (left != 0) {
+			this->remaining.wait(left, std::memory_order_acquire);
+			left = this->remaining.load(std::memory_order_acquire);
+		}
+	}
+
+	usize get_bands() const { return this->workers.size() + 1; }
+
+	// Leaves one core to the emulation thread, at most four bands
+	static usize default_helpers() {
+		usize cores = std::thread::hardware_concurrency();
+		return cores <= 2 ? 0 : std::min<usize>(cores - 2, 3);
+	}
+};
+
+#endif
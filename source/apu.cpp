@@ -0,0 +1,410 @@
+#include "../header/apu.h"
+
+#include "../header/bus.h"
+#include "../header/interrupt.h"
+
+static constexpr u8 LENGTHS[32] = {
+	10, 254, 20, 2, 40, 4, 80, 6, 160, 8, 60, 10, 14, 12, 26, 14,
+	12, 16, 24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30
+};
+static constexpr u16 NOISE_PERIODS[16] = { 4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068 };
+static constexpr u16 DMC_PERIODS[16] = { 428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106, 84, 72, 54 };
+
+static constexpr u8 QUARTER = 0b0001;
+static constexpr u8 HALF = 0b0010;
+static constexpr u8 IRQ = 0b0100;
+static constexpr u8 WRAP = 0b1000;
+
+typedef struct sequencer_step {
+	u16 cycle;
+	u8 actions;
+} sequencer_step;
+
+// Cpu cycles after the $4017 write took effect; a wrap makes its own cycle the start of the next sequence
+static constexpr sequencer_step STEPS[2][6] = {
+	{ { 7457, QUARTER }, { 14913, QUARTER | HALF }, { 22371, QUARTER }, { 29828, IRQ }, { 29829, QUARTER | HALF | IRQ }, { 29830, IRQ | WRAP } },
+	{ { 7457, QUARTER }, { 14913, QUARTER | HALF }, { 22371, QUARTER }, { 29829, 0 }, { 37281, QUARTER | HALF }, { 37282, WRAP } }
+};
+static constexpr u64 FRAME_IRQ_CYCLE = 29828;
+static constexpr u64 FOUR_STEP_CYCLES = 29830;
+
+// The mixer is nonlinear: pulses and triangle / noise / DMC go through one table each, summed afterwards
+static const std::array<float, 31> PULSE_TABLE = [] {
+	std::array<float, 31> table = {};
+	for (usize n = 1; n < table.size(); ++n) table[n] = static_cast<float>(95.52 / (8128.0 / static_cast<double>(n) + 100.0));
+	return table;
+}();
+static const std::array<float, 203> TND_TABLE = [] {
+	std::array<float, 203> table = {};
+	for (usize n = 1; n < table.size(); ++n) table[n] = static_cast<float>(163.67 / (24329.0 / static_cast<double>(n) + 100.0));
+	return table;
+}();
+
+apu::apu() :
+	cpu_bus(nullptr),
+	pulses({ apu_pulse(true), apu_pulse(false) }),
+	triangle(),
+	noise(),
+	dmc(),
+	enabled(0),
+	five_step(false),
+	irq_inhibit(false),
+	frame_irq(false),
+	dmc_irq(false),
+	frame_start(0),
+	frame_step(0),
+	time(0),
+	frame_time(0),
+	event(NEVER),
+	stall(0),
+	amplitude(0.f),
+	silent(false),
+	blip(DEFAULT_SAMPLE_RATE, CLOCK_RATE, DEFAULT_SAMPLE_RATE / 10),
+	samples(),
+	sinks_mutex(),
+	sinks()
+{
+	this->reset(0, true);
+}
+
+void apu::reset(const u64 now, const bool power) {
+	this->run_until(now);
+	if (power) {
+		this->pulses = { apu_pulse(true), apu_pulse(false) };
+		this->triangle = apu_triangle();
+		this->noise = apu_noise();
+		this->dmc = apu_dmc();
+		this->five_step = false;
+		this->irq_inhibit = false;
+	}
+	// As if $4015 got 0 and $4017 its last value again
+	this->enabled = 0;
+	for (apu_pulse& pulse : this->pulses) pulse.length = 0;
+	this->triangle.length = 0;
+	this->noise.length = 0;
+	this->dmc.bytes_remaining = 0;
+	this->dmc.next = now + this->dmc.period;
+	this->set_frame_irq(false);
+	this->set_dmc_irq(false);
+	this->frame_start = now;
+	this->frame_step = 0;
+	this->refresh(now);
+	this->update_event();
+}
+
+void apu::set_sample_rate(const u32 sample_rate) {
+	this->blip = blip_buffer(sample_rate, CLOCK_RATE, sample_rate / 10);
+	this->frame_time = this->time;
+}
+
+void apu::set_frame_irq(const bool asserted) {
+	this->frame_irq = asserted;
+	if (this->cpu_bus != nullptr) this->cpu_bus->set_irq(interrupts::IRQ_FRAME_COUNTER, asserted);
+}
+void apu::set_dmc_irq(const bool asserted) {
+	this->dmc_irq = asserted;
+	if (this->cpu_bus != nullptr) this->cpu_bus->set_irq(interrupts::IRQ_DMC, asserted);
+}
+
+void apu::mix(const u64 now) {
+	u8 pulses = this->pulses[0].level() + this->pulses[1].level();
+	u8 tnd = 3 * this->triangle.level() + 2 * this->noise.level() + this->dmc.level;
+	float amplitude = PULSE_TABLE[pulses] + TND_TABLE[tnd];
+	if (amplitude == this->amplitude) return;
+	if (!this->silent) this->blip.add_delta(now - this->frame_time, amplitude - this->amplitude);
+	this->amplitude = amplitude;
+}
+
+/* A channel that cannot be heard has its timer stopped, so that silence costs nothing; it restarts from where its
+ * sequencer stood. The triangle really holds its step, for the others only the phase is off, which is inaudible.
+ */
+void apu::refresh(const u64 now) {
+	for (apu_pulse& pulse : this->pulses) {
+		if (!pulse.audible()) pulse.next = NEVER;
+		else if (pulse.next == NEVER) pulse.next = now + pulse.period();
+	}
+	if (!this->triangle.audible()) this->triangle.next = NEVER;
+	else if (this->triangle.next == NEVER) this->triangle.next = now + this->triangle.period();
+	if (!this->noise.audible()) this->noise.next = NEVER;
+	else if (this->noise.next == NEVER) this->noise.next = now + NOISE_PERIODS[this->noise.period_index];
+	this->mix(now);
+}
+
+void apu::fetch_sample() {
+	if (this->dmc.buffer_full || this->dmc.bytes_remaining == 0) return;
+	this->stall += DMC_STALL;
+	this->dmc.buffer = this->cpu_bus->read_u8(this->dmc.address);
+	this->dmc.buffer_full = true;
+	this->dmc.address = (this->dmc.address == 0xFFFF) ? 0x8000 : this->dmc.address + 1;
+	if (--this->dmc.bytes_remaining > 0) return;
+	if (this->dmc.loop) this->dmc.restart();
+	else if (this->dmc.irq_enabled) this->set_dmc_irq(true);
+}
+
+void apu::clock_dmc(const u64 now) {
+	if (!this->dmc.silence) {
+		if (this->dmc.shift & 1) { if (this->dmc.level <= 125) this->dmc.level += 2; }
+		else if (this->dmc.level >= 2) this->dmc.level -= 2;
+	}
+	this->dmc.shift >>= 1;
+	if (--this->dmc.bits_remaining == 0) {
+		this->dmc.bits_remaining = 8;
+		this->dmc.silence = !this->dmc.buffer_full;
+		if (this->dmc.buffer_full) {
+			this->dmc.shift = this->dmc.buffer;
+			this->dmc.buffer_full = false;
+			this->fetch_sample();
+		}
+	}
+	this->dmc.next = now + this->dmc.period;
+}
+
+// Timer edges of all channels in time order, the mixer has to see the levels of all of them at every change
+void apu::run_channels(const u64 until) {
+	while (true) {
+		u64 now = std::min({ this->pulses[0].next, this->pulses[1].next, this->triangle.next, this->noise.next, this->dmc.next });
+		if (now > until) return;
+
+		for (apu_pulse& pulse : this->pulses) {
+			if (pulse.next != now) continue;
+			pulse.phase = (pulse.phase + 1) & 7;
+			pulse.next = now + pulse.period();
+		}
+		if (this->triangle.next == now) {
+			this->triangle.step = (this->triangle.step + 1) & 31;
+			this->triangle.next = now + this->triangle.period();
+		}
+		if (this->noise.next == now) {
+			this->noise.clock();
+			this->noise.next = now + NOISE_PERIODS[this->noise.period_index];
+		}
+		if (this->dmc.next == now) this->clock_dmc(now);
+		this->mix(now);
+	}
+}
+
+void apu::clock_frame(const u8 actions, const u64 now) {
+	if (actions & QUARTER) {
+		this->pulses[0].envelope.clock();
+		this->pulses[1].envelope.clock();
+		this->noise.envelope.clock();
+		this->triangle.clock_linear();
+	}
+	if (actions & HALF) {
+		for (apu_pulse& pulse : this->pulses) {
+			if (pulse.length > 0 && !pulse.envelope.loop) pulse.length--;
+			pulse.clock_sweep();
+		}
+		if (this->triangle.length > 0 && !this->triangle.control) this->triangle.length--;
+		if (this->noise.length > 0 && !this->noise.envelope.loop) this->noise.length--;
+	}
+	if ((actions & IRQ) && !this->irq_inhibit) this->set_frame_irq(true);
+	if (actions & WRAP) {
+		this->frame_start = now;
+		this->frame_step = 0;
+	}
+	else this->frame_step++;
+	this->refresh(now);
+}
+
+void apu::update_event() {
+	u64 event = NEVER;
+	if (!this->five_step && !this->irq_inhibit && !this->frame_irq) {
+		event = this->frame_start + FRAME_IRQ_CYCLE + (STEPS[0][this->frame_step].cycle > FRAME_IRQ_CYCLE ? FOUR_STEP_CYCLES : 0);
+	}
+	// The fetch happens when the shift register takes the buffer over
+	if (this->dmc.bytes_remaining > 0) {
+		event = std::min(event, this->dmc.next + static_cast<u64>(this->dmc.bits_remaining - 1) * this->dmc.period);
+	}
+	this->event = event;
+}
+
+void apu::run_until(const u64 now) {
+	if (now <= this->time) return;
+	while (true) {
+		const sequencer_step& step = STEPS[this->five_step ? 1 : 0][this->frame_step];
+		u64 at = this->frame_start + step.cycle;
+		if (at > now) break;
+		this->run_channels(at);
+		this->clock_frame(step.actions, at);
+	}
+	this->run_channels(now);
+	this->time = now;
+	this->update_event();
+	if (this->time - this->frame_time >= MAX_FRAME_CYCLES) this->end_frame();
+}
+
+void apu::write(const u16 address, const u8 value) {
+	u64 now = this->time;
+	switch (address) {
+	case 0x4000: case 0x4004: {
+		apu_pulse& pulse = this->pulses[(address >> 2) & 1];
+		pulse.duty = value >> 6;
+		pulse.envelope.write(value);
+		break;
+	}
+	case 0x4001: case 0x4005: {
+		apu_pulse& pulse = this->pulses[(address >> 2) & 1];
+		pulse.sweep_enabled = value & 0x80;
+		pulse.sweep_period = (value >> 4) & 7;
+		pulse.sweep_negate = value & 0x08;
+		pulse.sweep_shift = value & 7;
+		pulse.sweep_reload = true;
+		break;
+	}
+	case 0x4002: case 0x4006: {
+		apu_pulse& pulse = this->pulses[(address >> 2) & 1];
+		pulse.timer = (pulse.timer & 0x0700) | value;
+		break;
+	}
+	case 0x4003: case 0x4007: {
+		apu_pulse& pulse = this->pulses[(address >> 2) & 1];
+		pulse.timer = static_cast<u16>((pulse.timer & 0x00FF) | ((value & 7) << 8));
+		if (this->enabled & (1 << ((address >> 2) & 1))) pulse.length = LENGTHS[value >> 3];
+		pulse.phase = 0;
+		pulse.envelope.start = true;
+		break;
+	}
+	case 0x4008:
+		this->triangle.control = value & 0x80;
+		this->triangle.linear_reload_value = value & 0x7F;
+		break;
+	case 0x400A:
+		this->triangle.timer = (this->triangle.timer & 0x0700) | value;
+		break;
+	case 0x400B:
+		this->triangle.timer = static_cast<u16>((this->triangle.timer & 0x00FF) | ((value & 7) << 8));
+		if (this->enabled & 0x04) this->triangle.length = LENGTHS[value >> 3];
+		this->triangle.linear_reload = true;
+		break;
+	case 0x400C:
+		this->noise.envelope.write(value);
+		break;
+	case 0x400E:
+		this->noise.short_mode = value & 0x80;
+		this->noise.period_index = value & 0x0F;
+		break;
+	case 0x400F:
+		if (this->enabled & 0x08) this->noise.length = LENGTHS[value >> 3];
+		this->noise.envelope.start = true;
+		break;
+	case 0x4010:
+		this->dmc.irq_enabled = value & 0x80;
+		this->dmc.loop = value & 0x40;
+		this->dmc.period = DMC_PERIODS[value & 0x0F];
+		if (!this->dmc.irq_enabled) this->set_dmc_irq(false);
+		break;
+	case 0x4011:
+		this->dmc.level = value & 0x7F;
+		break;
+	case 0x4012:
+		this->dmc.sample_address = static_cast<u16>(0xC000 | (value << 6));
+		break;
+	case 0x4013:
+		this->dmc.sample_length = static_cast<u16>((value << 4) | 1);
+		break;
+	case 0x4015:
+		this->enabled = value & 0x1F;
+		if (!(value & 0x01)) this->pulses[0].length = 0;
+		if (!(value & 0x02)) this->pulses[1].length = 0;
+		if (!(value & 0x04)) this->triangle.length = 0;
+		if (!(value & 0x08)) this->noise.length = 0;
+		this->set_dmc_irq(false);
+		if (!(value & 0x10)) this->dmc.bytes_remaining = 0;
+		else if (this->dmc.bytes_remaining == 0) {
+			this->dmc.restart();
+			this->fetch_sample();
+		}
+		break;
+	case 0x4017:
+		this->five_step = value & 0x80;
+		this->irq_inhibit = value & 0x40;
+		if (this->irq_inhibit) this->set_frame_irq(false);
+		// The sequencer restarts 3 or 4 cycles later, depending on where in the apu cycle the write lands
+		this->frame_start = now + ((now & 1) ? 4 : 3);
+		if (this->five_step) this->clock_frame(QUARTER | HALF, now);
+		this->frame_step = 0;
+		break;
+	default:
+		return;
+	}
+	this->refresh(now);
+	this->update_event();
+}
+
+u8 apu::read_status() {
+	u8 status = static_cast<u8>(
+		(this->pulses[0].length > 0 ? 0x01 : 0) |
+		(this->pulses[1].length > 0 ? 0x02 : 0) |
+		(this->triangle.length > 0 ? 0x04 : 0) |
+		(this->noise.length > 0 ? 0x08 : 0) |
+		(this->dmc.bytes_remaining > 0 ? 0x10 : 0) |
+		(this->frame_irq ? 0x40 : 0) |
+		(this->dmc_irq ? 0x80 : 0));
+	if (this->frame_irq) {
+		this->set_frame_irq(false);
+		this->update_event();
+	}
+	return status;
+}
+
+void apu::end_frame() {
+	if (this->silent) {
+		this->frame_time = this->time;
+		return;
+	}
+	this->blip.end_frame(this->time - this->frame_time);
+	this->frame_time = this->time;
+	this->blip.read(this->samples, VOLUME);
+	if (this->samples.empty()) return;
+
+	std::lock_guard<std::mutex> lock(this->sinks_mutex);
+	for (audio_sink* sink : this->sinks) sink->submit_audio(this->samples, this->blip.get_sample_rate());
+}
+
+void apu::add_sink(audio_sink* sink) {
+	std::lock_guard<std::mutex> lock(this->sinks_mutex);
+	if (std::find(this->sinks.begin(), this->sinks.end(), sink) == this->sinks.end()) this->sinks.push_back(sink);
+}
+void apu::remove_sink(audio_sink* sink) {
+	std::lock_guard<std::mutex> lock(this->sinks_mutex);
+	std::erase(this->sinks, sink);
+}
+
+void apu::save_state(apu_state& out) const {
+	out.pulses = this->pulses;
+	out.triangle = this->triangle;
+	out.noise = this->noise;
+	out.dmc = this->dmc;
+	out.enabled = this->enabled;
+	out.five_step = this->five_step;
+	out.irq_inhibit = this->irq_inhibit;
+	out.frame_irq = this->frame_irq;
+	out.dmc_irq = this->dmc_irq;
+	out.frame_start = this->frame_start;
+	out.frame_step = this->frame_step;
+	out.time = this->time;
+	out.frame_time = this->frame_time;
+	out.event = this->event;
+	out.stall = this->stall;
+	out.amplitude = this->amplitude;
+}
+
+void apu::load_state(const apu_state& in) {
+	this->pulses = in.pulses;
+	this->triangle = in.triangle;
+	this->noise = in.noise;
+	this->dmc = in.dmc;
+	this->enabled = in.enabled;
+	this->five_step = in.five_step;
+	this->irq_inhibit = in.irq_inhibit;
+	this->frame_irq = in.frame_irq;
+	this->dmc_irq = in.dmc_irq;
+	this->frame_start = in.frame_start;
+	this->frame_step = in.frame_step;
+	this->time = in.time;
+	this->frame_time = in.frame_time;
+	this->event = in.event;
+	this->stall = in.stall;
+	this->amplitude = in.amplitude;
+}
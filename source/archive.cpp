@@ -0,0 +1,162 @@
+#include "../header/archive.h"
+
+#include <cctype>
+
+static u32 le16(std::span<const u8> bytes, usize offset) {
+	return static_cast<u32>(bytes[offset]) | (static_cast<u32>(bytes[offset + 1]) << 8);
+}
+static u32 le32(std::span<const u8> bytes, usize offset) {
+	return le16(bytes, offset) | (le16(bytes, offset + 2) << 16);
+}
+
+static std::string lower_extension(const std::filesystem::path& path) {
+	std::string extension = path.extension().string();
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](char c) { return static_cast<char>(std::tolower(static_cast<unsigned char>(c))); });
+	return extension;
+}
+
+archive::archive(const std::string& path) :
+	file(path, mapped_file_mode::read_only),
+	members()
+{
+	if (lower_extension(path) == ".gz") this->read_gzip_header();
+	else this->read_zip_directory();
+}
+
+void archive::read_zip_directory() {
+	constexpr u32 END_SIGNATURE = 0x06054B50;
+	constexpr u32 ENTRY_SIGNATURE = 0x02014B50;
+	constexpr usize END_SIZE = 22;
+	std::span<const u8> bytes = this->file.bytes();
+	const std::string& path = this->file.get_path();
+
+	// The end record sits at the very end unless a comment (up to 64 KiB) follows it
+	if (bytes.size() < END_SIZE) throw std::runtime_error(path + " is not a zip archive");
+	usize end = bytes.size() - END_SIZE;
+	usize lowest = end > 0xFFFF ? end - 0xFFFF : 0;
+	while (le32(bytes, end) != END_SIGNATURE) {
+		if (end == lowest) throw std::runtime_error(path + " is not a zip archive");
+		end--;
+	}
+
+	usize count = le16(bytes, end + 10);
+	u64 directory_size = le32(bytes, end + 12);
+	u64 directory = le32(bytes, end + 16);
+	if (count == 0xFFFF || directory == 0xFFFFFFFF) throw std::runtime_error(path + " is a Zip64 archive, which is not supported");
+	if (directory + directory_size > end) throw std::runtime_error(path + " has a damaged directory");
+
+	usize at = static_cast<usize>(directory);
+	for (usize i = 0; i < count; ++i) {
+		if (at + 46 > end || le32(bytes, at) != ENTRY_SIGNATURE) throw std::runtime_error(path + " has a damaged directory");
+		usize name_size = le16(bytes, at + 28);
+		usize skipped = name_size + le16(bytes, at + 30) + le16(bytes, at + 32);
+		if (at + 46 + skipped > end) throw std::runtime_error(path + " has a damaged directory");
+
+		archive_member member = {};
+		member.name = std::string(reinterpret_cast<const char*>(bytes.data()) + at + 46, name_size);
+		member.encrypted = 0 != (le16(bytes, at + 8) & 1);
+		member.method = static_cast<u16>(le16(bytes, at + 10));
+		member.crc32 = le32(bytes, at + 16);
+		member.compressed_size = le32(bytes, at + 20);
+		member.size = le32(bytes, at + 24);
+		member.offset = le32(bytes, at + 42);
+		if (!member.name.empty() && member.name.back() != '/') this->members.push_back(std::move(member));
+		at += 46 + skipped;
+	}
+}
+
+void archive::read_gzip_header() {
+	constexpr u8 FEXTRA = 0x04, FNAME = 0x08, FCOMMENT = 0x10, FHCRC = 0x02;
+	std::span<const u8> bytes = this->file.bytes();
+	const std::string& path = this->file.get_path();
+	if (bytes.size() < 18 || bytes[0] != 0x1F || bytes[1] != 0x8B || bytes[2] != 8) throw std::runtime_error(path + " is not a gzip file");
+
+	u8 flags = bytes[3];
+	usize at = 10;
+	// Every optional field has to end before the 8-byte trailer
+	usize trailer = bytes.size() - 8;
+	auto skip_string = [&]() {
+		usize start = at;
+		while (at < trailer && bytes[at] != 0) at++;
+		if (at == trailer) throw std::runtime_error(path + " is truncated");
+		return std::string(reinterpret_cast<const char*>(bytes.data()) + start, at++ - start);
+	};
+	if (flags & FEXTRA) {
+		at += 2 + le16(bytes, at);
+		if (at > trailer) throw std::runtime_error(path + " is truncated");
+	}
+	// Without a stored name the member is the file name less .gz
+	std::string name = std::filesystem::path(path).stem().string();
+	if (flags & FNAME) name = skip_string();
+	if (flags & FCOMMENT) skip_string();
+	if (flags & FHCRC) at += 2;
+	if (at > trailer) throw std::runtime_error(path + " is truncated");
+
+	archive_member member = {};
+	member.name = std::filesystem::path(name).filename().string();
+	member.method = 8;
+	member.offset = at;
+	member.compressed_size = trailer - at;
+	member.crc32 = le32(bytes, trailer);
+	member.size = le32(bytes, bytes.size() - 4);
+	this->members.push_back(std::move(member));
+}
+
+std::span<const u8> archive::member_data(const archive_member& member) const {
+	constexpr u32 LOCAL_SIGNATURE = 0x04034B50;
+	std::span<const u8> bytes = this->file.bytes();
+	if (member.encrypted || (member.method != 0 && member.method != 8)) throw std::runtime_error(member.name + " is encrypted or uses an unsupported compression");
+
+	u64 start = member.offset;
+	if (lower_extension(this->file.get_path()) != ".gz") {
+		// The local header repeats the name, and its extra field may differ from the directory's
+		if (start + 30 > bytes.size() || le32(bytes, static_cast<usize>(start)) != LOCAL_SIGNATURE) throw std::runtime_error(member.name + " has a damaged header");
+		start += 30 + le16(bytes, static_cast<usize>(start) + 26) + le16(bytes, static_cast<usize>(start) + 28);
+	}
+	if (start + member.compressed_size > bytes.size()) throw std::runtime_error(member.name + " is truncated");
+	return bytes.subspan(static_cast<usize>(start), static_cast<usize>(member.compressed_size));
+}
+
+const archive_member* archive::find(const std::string& name) const {
+	for (const archive_member& member : this->members) {
+		if (name.empty() ? lower_extension(member.name) == ".nes" : member.name == name) return &member;
+	}
+	// A gzip file holds one rom whatever its stored name
+	if (name.empty() && this->members.size() == 1) return &this->members[0];
+	return nullptr;
+}
+
+// The directory knows the size, so the member inflates straight into its final buffer
+std::vector<u8> archive::extract(const archive_member& member) const {
+	// DEFLATE expands at most 1032:1; a size beyond that, or beyond any rom, is damage and must not be allocated
+	constexpr u64 MAX_RATIO = 1032;
+	std::span<const u8> data = this->member_data(member);
+	u64 largest = member.method == 0 ? data.size() : data.size() * MAX_RATIO;
+	if (member.size > std::min(largest, MAX_EXTRACTED_SIZE)) throw std::runtime_error(member.name + " has an implausible size");
+	std::vector<u8> bytes(static_cast<usize>(member.size));
+	bool whole;
+	if (member.method == 0) {
+		whole = data.size() == bytes.size();
+		if (whole) std::copy(data.begin(), data.end(), bytes.begin());
+	}
+	else {
+		inflater decoder(data);
+		u8 beyond;
+		whole = decoder.read(bytes) == bytes.size() && decoder.read(std::span<u8>(&beyond, 1)) == 0;
+	}
+	if (!whole || checksum::crc32(bytes) != member.crc32) throw std::runtime_error("CRC mismatch in " + member.name);
+	return bytes;
+}
+
+bool archive::is_archive(const std::filesystem::path& path) {
+	std::string extension = lower_extension(path);
+	return extension == ".zip" || extension == ".gz";
+}
+
+std::pair<std::string, std::string> archive::split(const std::string& path) {
+	usize separator = path.rfind(MEMBER_SEPARATOR);
+	if (separator != std::string::npos && is_archive(path.substr(0, separator))) {
+		return { path.substr(0, separator), path.substr(separator + 1) };
+	}
+	return { path, std::string() };
+}
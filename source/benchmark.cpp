@@ -0,0 +1,553 @@
+#include "../header/benchmark.h"
+
+#include "../header/cpu.h"
+#include "../header/ppu_pipeline.h"
+#include "../header/run_ahead.h"
+
+benchmark_result benchmarks::run_frames(const cartridge& rom, usize frames, ppu_timing timing, usize skip_interval, a12_mode a12) {
+	using clock = std::chrono::steady_clock;
+
+	std::vector<u32> pixel_buffer1 = std::vector<u32>(256 * 240);
+	std::vector<u32> pixel_buffer2 = std::vector<u32>(256 * 240);
+
+	cartridge game(rom);
+	bus BUS;
+	cpu CPU;
+	ppu PPU;
+
+	CPU.connect(&BUS);
+	PPU.connect(&BUS);
+	PPU.set_pixel_buffers(pixel_buffer1, pixel_buffer2);
+	PPU.set_timing(timing);
+	PPU.set_a12_mode(a12);
+	if (skip_interval > 0) {
+		PPU.get_frameskip().set_interval(skip_interval);
+		PPU.get_frameskip().set_mode(frameskip_mode::fixed);
+	}
+	BUS.connect(&CPU);
+	BUS.connect(&PPU);
+
+	CPU.load(&game);
+	CPU.reset();
+
+	auto start = clock::now();
+	while (PPU.get_frames() < frames && !CPU.get_halted()) {
+		CPU.step();
+	}
+	std::chrono::duration<double> elapsed = clock::now() - start;
+
+	return benchmark_result(ppu::TIMING_NAMES[timing], PPU.get_frames(), elapsed.count());
+}
+
+std::array<benchmark_result, 2> benchmarks::ppu_timing_modes(const cartridge& rom, usize frames) {
+	return {
+		benchmarks::run_frames(rom, frames, ppu_timing::scanline),
+		benchmarks::run_frames(rom, frames, ppu_timing::dot)
+	};
+}
+
+std::array<benchmark_result, 2> benchmarks::run_frames_pipelined(const cartridge& rom, usize frames) {
+	using clock = std::chrono::steady_clock;
+
+	std::vector<u32> pixel_buffer1 = std::vector<u32>(256 * 240);
+	std::vector<u32> pixel_buffer2 = std::vector<u32>(256 * 240);
+
+	cartridge game(rom);
+	bus BUS;
+	cpu CPU;
+	ppu PPU;
+	ppu_pipeline* PIPELINE = new ppu_pipeline();
+
+	CPU.connect(&BUS);
+	PPU.connect(&BUS);
+	BUS.connect(&CPU);
+	BUS.connect(&PPU);
+
+	CPU.load(&game);
+	CPU.reset();
+	PIPELINE->start(&PPU, &game, pixel_buffer1, pixel_buffer2);
+
+	auto start = clock::now();
+	while (PPU.get_frames() < frames && !CPU.get_halted()) {
+		CPU.step();
+	}
+	usize emulated = PPU.get_frames();
+	std::chrono::duration<double> emulation = clock::now() - start;
+	while (PIPELINE->get_renderer()->get_frames() < emulated) {
+		std::this_thread::yield();
+	}
+	std::chrono::duration<double> elapsed = clock::now() - start;
+
+	PIPELINE->stop();
+	delete PIPELINE;
+
+	return {
+		benchmark_result("Pipelined", emulated, elapsed.count()),
+		benchmark_result("Emulation", emulated, emulation.count())
+	};
+}
+
+std::array<benchmark_result, 3> benchmarks::pipelined_rendering(const cartridge& rom, usize frames) {
+	benchmark_result inline_rendering = benchmarks::run_frames(rom, frames, ppu_timing::scanline);
+	inline_rendering.name = "Inline";
+	std::array<benchmark_result, 2> pipelined = benchmarks::run_frames_pipelined(rom, frames);
+	return { inline_rendering, pipelined[0], pipelined[1] };
+}
+
+std::array<benchmark_result, 2> benchmarks::frameskip_rendering(const cartridge& rom, usize frames, usize interval) {
+	benchmark_result every_frame = benchmarks::run_frames(rom, frames, ppu_timing::scanline);
+	benchmark_result skipping = benchmarks::run_frames(rom, frames, ppu_timing::scanline, interval);
+	every_frame.name = "Every";
+	skipping.name = "Skipping";
+	return { every_frame, skipping };
+}
+
+// A machine of its own for the benchmarks that need more than one
+struct benchmark_instance {
+	std::vector<u32> pixel_buffer1;
+	std::vector<u32> pixel_buffer2;
+	cartridge game;
+	bus BUS;
+	cpu CPU;
+	ppu PPU;
+
+	explicit benchmark_instance(const cartridge& rom, ppu_timing timing = ppu_timing::scanline) :
+		pixel_buffer1(256 * 240),
+		pixel_buffer2(256 * 240),
+		game(rom)
+	{
+		this->CPU.connect(&this->BUS);
+		this->PPU.connect(&this->BUS);
+		this->PPU.set_pixel_buffers(this->pixel_buffer1, this->pixel_buffer2);
+		this->PPU.set_timing(timing);
+		this->BUS.connect(&this->CPU);
+		this->BUS.connect(&this->PPU);
+
+		this->CPU.load(&this->game);
+		this->CPU.reset();
+	}
+	void run_to(usize frame) {
+		while (this->PPU.get_frames() < frame && !this->CPU.get_halted()) {
+			this->CPU.step();
+		}
+	}
+};
+
+frameskip_check benchmarks::verify_frameskip(const cartridge& rom, usize frames, usize interval, ppu_timing timing) {
+	benchmark_instance* reference = new benchmark_instance(rom, timing);
+	benchmark_instance* skipping = new benchmark_instance(rom, timing);
+	skipping->PPU.get_frameskip().set_interval(interval);
+	skipping->PPU.get_frameskip().set_mode(frameskip_mode::fixed);
+
+	frameskip_check check;
+	for (usize frame = 1; frame <= frames; ++frame) {
+		reference->run_to(frame);
+		skipping->run_to(frame);
+		if (reference->PPU.get_frames() < frame || skipping->PPU.get_frames() < frame) break;
+		check.frames = frame;
+
+		reference->PPU.reset_frame_ready();
+		if (!skipping->PPU.is_frame_ready()) continue;
+		skipping->PPU.reset_frame_ready();
+
+		std::span<u32> expected = reference->PPU.get_last_screen();
+		std::span<u32> actual = skipping->PPU.get_last_screen();
+		check.compared++;
+		if (!std::equal(expected.begin(), expected.end(), actual.begin())) {
+			if (check.mismatches == 0) check.first_mismatch = frame;
+			check.mismatches++;
+		}
+	}
+
+	delete skipping;
+	delete reference;
+	return check;
+}
+
+std::array<benchmark_result, upscale::FILTER_COUNT> benchmarks::upscale_filters(const cartridge& rom, usize frames, usize helpers) {
+	using clock = std::chrono::steady_clock;
+
+	std::vector<u32> pixel_buffer1 = std::vector<u32>(256 * 240);
+	std::vector<u32> pixel_buffer2 = std::vector<u32>(256 * 240);
+
+	cartridge game(rom);
+	bus BUS;
+	cpu CPU;
+	ppu PPU;
+
+	CPU.connect(&BUS);
+	PPU.connect(&BUS);
+	PPU.set_pixel_buffers(pixel_buffer1, pixel_buffer2);
+	BUS.connect(&CPU);
+	BUS.connect(&PPU);
+
+	CPU.load(&game);
+	CPU.reset();
+
+	worker_pool pool(helpers);
+	upscale::padded_frame input(256, 240);
+	std::vector<u32> output(256 * 3 * 240 * 3);
+	std::array<double, upscale::FILTER_COUNT> seconds = {};
+
+	for (usize frame = 1; frame <= frames && !CPU.get_halted(); ++frame) {
+		while (PPU.get_frames() < frame && !CPU.get_halted()) {
+			CPU.step();
+		}
+		upscale::pad(PPU.get_last_screen(), input);
+		for (usize filter = 0; filter < upscale::FILTER_COUNT; ++filter) {
+			auto start = clock::now();
+			upscale::run(static_cast<upscale_filter>(filter), input, output.data(), pool);
+			std::chrono::duration<double> elapsed = clock::now() - start;
+			seconds[filter] += elapsed.count();
+		}
+	}
+
+	std::array<benchmark_result, upscale::FILTER_COUNT> results;
+	for (usize filter = 0; filter < upscale::FILTER_COUNT; ++filter) {
+		results[filter] = benchmark_result(upscale::NAMES[filter], PPU.get_frames(), seconds[filter]);
+	}
+	return results;
+}
+
+benchmark_result benchmarks::ntsc_composite(const cartridge& rom, usize frames, usize helpers) {
+	using clock = std::chrono::steady_clock;
+
+	// Filters synchronously inside the ppu's publish, while the indices are valid
+	struct timed_sink : public frame_sink {
+		ntsc_filter filter;
+		std::vector<u32> output;
+		double seconds;
+
+		explicit timed_sink(usize helpers) :
+			filter(helpers),
+			output(ntsc_filter::OUTPUT_WIDTH * ntsc_filter::OUTPUT_HEIGHT),
+			seconds(0.0)
+		{}
+
+		bool wants_indices() const override { return true; }
+		void submit_indices(std::span<const u16> indices, std::span<const u8> line_phases, usize) override {
+			auto start = clock::now();
+			this->filter.render(indices, line_phases, this->output.data());
+			std::chrono::duration<double> elapsed = clock::now() - start;
+			this->seconds += elapsed.count();
+		}
+		void submit(std::span<const u32>, const frame_digest&, usize) override {}
+	};
+
+	std::vector<u32> pixel_buffer1 = std::vector<u32>(256 * 240);
+	std::vector<u32> pixel_buffer2 = std::vector<u32>(256 * 240);
+
+	cartridge game(rom);
+	bus BUS;
+	cpu CPU;
+	ppu PPU;
+
+	CPU.connect(&BUS);
+	PPU.connect(&BUS);
+	PPU.set_pixel_buffers(pixel_buffer1, pixel_buffer2);
+	BUS.connect(&CPU);
+	BUS.connect(&PPU);
+
+	CPU.load(&game);
+	CPU.reset();
+
+	timed_sink sink(helpers);
+	PPU.add_sink(&sink);
+	while (PPU.get_frames() < frames && !CPU.get_halted()) {
+		CPU.step();
+	}
+	PPU.remove_sink(&sink);
+
+	return benchmark_result("Composite", PPU.get_frames(), sink.seconds);
+}
+
+snapshot_check benchmarks::machine_snapshots(const cartridge& rom, usize frames) {
+	using clock = std::chrono::steady_clock;
+	constexpr usize REPEATS = 1000;
+
+	benchmark_instance* original = new benchmark_instance(rom);
+	benchmark_instance* other = new benchmark_instance(rom);
+	machine_state state;
+	snapshot_check check;
+
+	usize half = frames / 2;
+	original->run_to(half);
+	original->CPU.save_state(state);
+	std::vector<u64> expected;
+	for (usize frame = half + 1; frame <= frames; ++frame) {
+		original->run_to(frame);
+		expected.push_back(original->PPU.get_frame_digest().hash);
+	}
+
+	// Saves over the end state, loads the halfway one back
+	machine_state scratch;
+	auto start = clock::now();
+	for (usize i = 0; i < REPEATS; ++i) original->CPU.save_state(scratch);
+	auto saved_at = clock::now();
+	for (usize i = 0; i < REPEATS; ++i) original->CPU.load_state(state);
+	auto loaded_at = clock::now();
+	check.bytes = state.size();
+	check.save_us = std::chrono::duration<double, std::micro>(saved_at - start).count() / REPEATS;
+	check.load_us = std::chrono::duration<double, std::micro>(loaded_at - saved_at).count() / REPEATS;
+
+	other->CPU.load_state(state);
+	for (benchmark_instance* replay : { original, other }) {
+		for (usize frame = half + 1; frame <= frames; ++frame) {
+			replay->run_to(frame);
+			if (replay->PPU.get_frames() < frame) break;
+			check.compared++;
+			if (replay->PPU.get_frame_digest().hash != expected[frame - half - 1]) check.mismatches++;
+		}
+	}
+
+	delete other;
+	delete original;
+	return check;
+}
+
+std::array<benchmark_result, 4> benchmarks::run_ahead_overhead(const cartridge& rom, usize frames) {
+	using clock = std::chrono::steady_clock;
+
+	auto run = [&rom, frames](const char* name, usize ahead, bool second) {
+		benchmark_instance* machine = new benchmark_instance(rom);
+		run_ahead* runner = new run_ahead();
+		runner->connect(&machine->CPU, &machine->BUS, &machine->PPU);
+		runner->set_frames(ahead);
+		if (second) runner->start_second(&machine->game, machine->pixel_buffer1, machine->pixel_buffer2);
+
+		// Waits for the second instance before each handoff, its time is not the source's but none is dropped
+		clock::duration waited = clock::duration::zero();
+		auto wait_second = [runner, &waited](usize handoffs) {
+			auto start = clock::now();
+			while (runner->get_runs() < handoffs) std::this_thread::yield();
+			waited += clock::now() - start;
+		};
+
+		auto start = clock::now();
+		usize handoffs = 0;
+		for (usize frame = 1; frame <= frames && !machine->CPU.get_halted(); ++frame) {
+			machine->run_to(frame);
+			if (second) wait_second(handoffs++);
+			runner->frame_done();
+		}
+		if (second) wait_second(handoffs);
+		std::chrono::duration<double> elapsed = clock::now() - start - waited;
+		// Both threads' work per frame, the source runs hidden and the second instance draws
+		double seconds = elapsed.count() + (second ? runner->get_busy_us() / 1000000.0 : 0.0);
+		benchmark_result result(name, machine->PPU.get_frames(), seconds);
+
+		delete runner;
+		delete machine;
+		return result;
+	};
+
+	return {
+		run("Off", 0, false),
+		run("1 frame", 1, false),
+		run("2 frames", 2, false),
+		run("Second instance", 1, true)
+	};
+}
+
+// iNES image with 128 KiB of PRG and CHR, every 8 KiB PRG bank filled with its number; the program goes in the last one
+static std::vector<u8> synthetic_rom(u8 mapper_number, std::span<const u8> program) {
+	constexpr usize prg_size = 0x20000;
+	constexpr usize chr_size = 0x20000;
+	std::vector<u8> raw(16 + prg_size + chr_size, 0);
+	raw[0] = 'N'; raw[1] = 'E'; raw[2] = 'S'; raw[3] = 0x1A;
+	raw[4] = static_cast<u8>(prg_size / 0x4000);
+	raw[5] = static_cast<u8>(chr_size / 0x2000);
+	raw[6] = static_cast<u8>((mapper_number & 0x0F) << 4);
+	raw[7] = static_cast<u8>(mapper_number & 0xF0);
+	for (usize i = 0; i < prg_size; ++i) raw[16 + i] = static_cast<u8>(i / 0x2000);
+
+	usize code = 16 + prg_size - 0x2000;
+	std::copy(program.begin(), program.end(), raw.begin() + code);
+	// NMI, reset and IRQ all point at $E000
+	for (usize vector = 0; vector < 3; ++vector) {
+		raw[16 + prg_size - 6 + vector * 2] = 0x00;
+		raw[16 + prg_size - 5 + vector * 2] = 0xE0;
+	}
+	return raw;
+}
+
+std::array<benchmark_result, 3> benchmarks::bank_switching(usize frames) {
+	// The loop at $E002: select R6 and write X (PRG at $8000), select R2 and write X (CHR at $1000), read $8000
+	auto mmc3_loop = [](u8 registers_high) {
+		return std::vector<u8>{
+			0xA2, 0x00,							// LDX #$00
+			0xA9, 0x06,							// LDA #$06
+			0x8D, 0x00, registers_high,			// STA $x000
+			0x8E, 0x01, registers_high,			// STX $x001
+			0xA9, 0x02,							// LDA #$02
+			0x8D, 0x00, registers_high,			// STA $x000
+			0x8E, 0x01, registers_high,			// STX $x001
+			0xAD, 0x00, 0x80,					// LDA $8000
+			0x85, 0x00,							// STA $00
+			0xE8,								// INX
+			0x4C, 0x02, 0xE0					// JMP $E002
+		};
+	};
+	// MMC1 takes the PRG bank serially, five writes of X shifted right each time
+	std::vector<u8> mmc1_loop = {
+		0xA2, 0x00,								// LDX #$00
+		0x8A,									// TXA
+		0x8D, 0x00, 0xE0,						// STA $E000
+		0x4A, 0x8D, 0x00, 0xE0,					// LSR A, STA $E000
+		0x4A, 0x8D, 0x00, 0xE0,
+		0x4A, 0x8D, 0x00, 0xE0,
+		0x4A, 0x8D, 0x00, 0xE0,
+		0xAD, 0x00, 0x80,						// LDA $8000
+		0x85, 0x00,								// STA $00
+		0xE8,									// INX
+		0x4C, 0x02, 0xE0						// JMP $E002
+	};
+
+	std::vector<u8> fixed_raw = synthetic_rom(4, mmc3_loop(0x60));
+	std::vector<u8> mmc3_raw = synthetic_rom(4, mmc3_loop(0x80));
+	std::vector<u8> mmc1_raw = synthetic_rom(1, mmc1_loop);
+	cartridge fixed(fixed_raw), mmc3(mmc3_raw), mmc1(mmc1_raw);
+
+	std::array<benchmark_result, 3> results = {
+		benchmarks::run_frames(fixed, frames, ppu_timing::scanline),
+		benchmarks::run_frames(mmc3, frames, ppu_timing::scanline),
+		benchmarks::run_frames(mmc1, frames, ppu_timing::scanline)
+	};
+	results[0].name = "Fixed banks";
+	results[1].name = "MMC3";
+	results[2].name = "MMC1";
+	return results;
+}
+
+// Every vector but IRQ lands on $E000, the IRQ handler counts in $10-$11 and runs the setup again: the counter is
+// reloaded and the IRQ acknowledged
+static std::vector<u8> mmc3_irq_rom() {
+	std::vector<u8> program = {
+		0xA9, 0x88, 0x8D, 0x00, 0x20,			// LDA #$88, STA $2000 (NMI, sprites at $1000)
+		0xA9, 0x18, 0x8D, 0x01, 0x20,			// LDA #$18, STA $2001
+		0xA9, 0x07, 0x8D, 0x00, 0xC0,			// LDA #$07, STA $C000
+		0x8D, 0x01, 0xC0,						// STA $C001
+		0x8D, 0x00, 0xE0,						// STA $E000
+		0x8D, 0x01, 0xE0,						// STA $E001
+		0x58,									// CLI
+		0x4C, 0x19, 0xE0,						// JMP $E019
+		0xE6, 0x10, 0xD0, 0x02, 0xE6, 0x11,		// $E01C: INC $10, BNE +2, INC $11
+		0x4C, 0x00, 0xE0						// JMP $E000
+	};
+	std::vector<u8> raw = synthetic_rom(4, program);
+	// IRQ vector at $FFFE, the last PRG bytes before the 128 KiB of CHR
+	raw[raw.size() - 0x20000 - 2] = 0x1C;
+	return raw;
+}
+
+std::array<benchmark_result, 2> benchmarks::mmc3_irq(usize frames) {
+	cartridge rom(mmc3_irq_rom());
+
+	std::array<benchmark_result, 2> results = {
+		benchmarks::run_frames(rom, frames, ppu_timing::scanline, 0, a12_mode::predicted),
+		benchmarks::run_frames(rom, frames, ppu_timing::scanline, 0, a12_mode::per_fetch)
+	};
+	results[0].name = ppu::A12_MODE_NAMES[a12_mode::predicted];
+	results[1].name = ppu::A12_MODE_NAMES[a12_mode::per_fetch];
+	return results;
+}
+
+irq_check benchmarks::verify_mmc3_irq(usize frames) {
+	cartridge rom(mmc3_irq_rom());
+	benchmark_instance* predicted = new benchmark_instance(rom);
+	benchmark_instance* per_fetch = new benchmark_instance(rom);
+	predicted->PPU.set_a12_mode(a12_mode::predicted);
+	per_fetch->PPU.set_a12_mode(a12_mode::per_fetch);
+
+	auto irqs = [](benchmark_instance* machine) {
+		std::span<u8> wram = machine->CPU.get_wram();
+		return static_cast<usize>(wram[0x10]) | (static_cast<usize>(wram[0x11]) << 8);
+	};
+
+	irq_check check;
+	for (usize frame = 1; frame <= frames; ++frame) {
+		predicted->run_to(frame);
+		per_fetch->run_to(frame);
+		if (predicted->PPU.get_frames() < frame || per_fetch->PPU.get_frames() < frame) break;
+		check.frames = frame;
+		check.irqs = irqs(per_fetch);
+
+		if (irqs(predicted) != check.irqs || predicted->CPU.get_cycles() != per_fetch->CPU.get_cycles()) {
+			if (check.mismatches == 0) check.first_mismatch = frame;
+			check.mismatches++;
+		}
+	}
+
+	delete per_fetch;
+	delete predicted;
+	return check;
+}
+
+latency_report benchmarks::input_latency(usize presses, usize run_ahead_frames, bool frame_delay) {
+	using clock = std::chrono::steady_clock;
+	constexpr usize PRESS_REFRESHES = 11;
+
+	// Reset and NMI alike: read pad 1, backdrop $16 with A held and $0F without, enable the NMI and wait for it
+	std::vector<u8> program = {
+		0xA9, 0x00, 0x8D, 0x01, 0x20,			// LDA #$00, STA $2001 (rendering off, the backdrop fills the screen)
+		0xA9, 0x01, 0x8D, 0x16, 0x40,			// LDA #$01, STA $4016
+		0xA9, 0x00, 0x8D, 0x16, 0x40,			// LDA #$00, STA $4016
+		0xAD, 0x16, 0x40,						// LDA $4016
+		0x29, 0x01, 0xA8,						// AND #$01, TAY
+		0xAD, 0x02, 0x20,						// LDA $2002
+		0xA9, 0x3F, 0x8D, 0x06, 0x20,			// LDA #$3F, STA $2006
+		0xA9, 0x00, 0x8D, 0x06, 0x20,			// LDA #$00, STA $2006
+		0xB9, 0x38, 0xE0,						// LDA $E038,Y
+		0x8D, 0x07, 0x20,						// STA $2007
+		0xA9, 0x00, 0x8D, 0x06, 0x20,			// LDA #$00, STA $2006
+		0x8D, 0x06, 0x20,						// STA $2006
+		0xA9, 0x80, 0x8D, 0x00, 0x20,			// LDA #$80, STA $2000
+		0x4C, 0x35, 0xE0,						// JMP $E035
+		0x0F, 0x16								// backdrops
+	};
+	std::vector<u8> raw = synthetic_rom(4, program);
+	cartridge rom(raw);
+
+	latency_probe probe;
+	latest_frame_sink screen;
+	run_ahead* runner = new run_ahead();
+	benchmark_instance* machine = new benchmark_instance(rom);
+
+	controller_ports& pads = machine->BUS.get_controllers();
+	probe.set_enabled(true);
+	pads.set_probe(&probe);
+	machine->PPU.add_sink(&screen);
+	machine->PPU.add_sink(&probe);
+	runner->connect(&machine->CPU, &machine->BUS, &machine->PPU);
+	runner->set_frames(run_ahead_frames);
+	machine->CPU.set_frame_callback([runner](cpu&) { runner->frame_done(); });
+	frame_pacer& pacer = machine->CPU.get_pacer();
+	pacer.set_mode(pacing_mode::video_clock);
+	pacer.get_frame_delay().set_enabled(frame_delay);
+	machine->CPU.run_async();
+
+	// The display loop of the front end, SDL delivering input when it is polled right after the swap
+	const auto refresh = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(1.0 / 60.0));
+	clock::time_point vsync = clock::now();
+	u8 buttons = 0;
+	usize refreshes = (presses + 4) * PRESS_REFRESHES * 2;
+	for (usize tick = 1; tick <= refreshes && probe.get_report().stages[latency_stage::input_to_swap].samples < presses; ++tick) {
+		if (tick % PRESS_REFRESHES == 0) {
+			buttons ^= button_a;
+			pads.set_buttons(0, buttons);
+			probe.input(pads.get_all_buttons());
+		}
+		pacer.get_frame_delay().display_latched();
+		const latest_frame* latest;
+		if (screen.take(latest)) probe.uploaded(latest->frame);
+		vsync += refresh;
+		std::this_thread::sleep_until(vsync);
+		probe.swapped();
+	}
+
+	latency_report report = probe.get_report();
+	// The emulation thread is joined before the run-ahead and the sinks go
+	delete machine;
+	delete runner;
+	return report;
+}
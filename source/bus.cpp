@@ -1,4 +1,145 @@
 #include "../header/bus.h"
 
 #include "../header/cpu.h"
-void bus::request_nmi() { return this->_cpu->request_nmi(); }
\ No newline at end of file
+void bus::request_nmi() { return this->_cpu->request_nmi(); }
+void bus::set_irq(const bool asserted) { this->_cpu->set_irq(interrupts::IRQ_MAPPER, asserted); }
+void bus::set_irq(const u8 source, const bool asserted) { if (this->_cpu != nullptr) this->_cpu->set_irq(source, asserted); }
+
+void bus::run_apu() {
+	this->audio.run_until(this->cycles);
+	usize stolen = this->audio.take_stall();
+	if (stolen != 0 && this->_cpu != nullptr) this->_cpu->stall(stolen);
+}
+
+const u8* bus::overlay(const usize page, const u8* bank) {
+	auto found = this->overlays[page].find(bank);
+	if (found == this->overlays[page].end()) {
+		std::vector<u8> patched;
+		for (const cheat& code : this->rom_cheats) {
+			usize offset = code.address & 0x1FFF;
+			if (((code.address >> 13) & 3) != page || (code.has_compare && bank[offset] != code.compare)) continue;
+			if (patched.empty()) patched.assign(bank, bank + 0x2000);
+			patched[offset] = code.value;
+		}
+		found = this->overlays[page].emplace(bank, std::move(patched)).first;
+	}
+	return found->second.empty() ? bank : found->second.data();
+}
+
+// Only pages whose cheats changed get remapped, the rest keep their pointers and their overlays
+void bus::apply_cheats() {
+	std::vector<cheat> cheats;
+	{
+		std::lock_guard<std::mutex> lock(this->cheats_mutex);
+		cheats = std::move(this->pending_cheats);
+		this->pending_cheats.clear();
+		this->cheats_pending.store(false, std::memory_order_relaxed);
+	}
+
+	std::vector<cheat> rom_cheats, ram_cheats;
+	for (const cheat& code : cheats) (code.address >= 0x8000 ? rom_cheats : ram_cheats).push_back(code);
+
+	auto on_page = [](const std::vector<cheat>& list, usize page) {
+		std::vector<cheat> found;
+		for (const cheat& code : list) if (((code.address >> 13) & 3) == page) found.push_back(code);
+		return found;
+	};
+	u8 changed = 0, pages = 0;
+	for (usize page = 0; page < 4; ++page) {
+		std::vector<cheat> now = on_page(rom_cheats, page);
+		if (now != on_page(this->rom_cheats, page)) changed |= static_cast<u8>(1 << page);
+		if (!now.empty()) pages |= static_cast<u8>(1 << page);
+	}
+
+	this->rom_cheats = std::move(rom_cheats);
+	this->ram_cheats = std::move(ram_cheats);
+	this->cheat_pages = pages;
+	for (usize page = 0; page < 4; ++page) {
+		if (!((changed >> page) & 1)) continue;
+		this->overlays[page].clear();
+		this->map_prg(page, this->prg_banks[page]);
+	}
+}
+
+void bus::save_state(machine_state& out) const {
+	out.memory.wram = this->cpu_wram;
+	const u8* prg_rom = this->rom->get_prg_rom().data();
+	for (usize page = 0; page < 4; ++page) {
+		const u8* bank = this->prg_banks[page];
+		out.memory.prg_banks[page] = (bank == this->unmapped_page.data()) ? bus_state::UNMAPPED : static_cast<usize>(bank - prg_rom);
+	}
+	out.memory.prg_ram_mapped = this->prg_ram != nullptr;
+	out.memory.prg_ram_writable = this->prg_ram_writable;
+	out.memory.cycles = this->cycles;
+	out.memory.last_read = this->last_read;
+
+	this->audio.save_state(out.audio);
+	this->pads.save_state(out.pads);
+	this->_ppu->save_state(out.video);
+	this->_mapper->save_state(out.board);
+
+	std::span<u8> prg_ram = this->rom->get_prg_ram();
+	out.prg_ram.assign(prg_ram.begin(), prg_ram.end());
+	if (this->rom->has_chr_ram()) {
+		std::span<u8> chr_ram = this->rom->get_chr_ram();
+		out.chr_ram.assign(chr_ram.begin(), chr_ram.end());
+	}
+	else out.chr_ram.clear();
+}
+
+void bus::load_state(const machine_state& in) {
+	this->cpu_wram = in.memory.wram;
+	const u8* prg_rom = this->rom->get_prg_rom().data();
+	for (usize page = 0; page < 4; ++page) {
+		const u8* bank = (in.memory.prg_banks[page] == bus_state::UNMAPPED) ? this->unmapped_page.data() : prg_rom + in.memory.prg_banks[page];
+		if (bank != this->prg_banks[page]) this->map_prg(page, bank);
+	}
+	this->map_prg_ram(in.memory.prg_ram_mapped ? this->rom->get_prg_ram().data() : nullptr, in.memory.prg_ram_writable);
+	this->cycles = in.memory.cycles;
+	this->last_read = in.memory.last_read;
+
+	this->audio.load_state(in.audio);
+	this->pads.load_state(in.pads);
+	this->_ppu->load_state(in.video);
+	this->_mapper->load_state(in.board);
+
+	std::span<u8> prg_ram = this->rom->get_prg_ram();
+	std::copy_n(in.prg_ram.begin(), std::min(in.prg_ram.size(), prg_ram.size()), prg_ram.begin());
+	if (this->rom->has_chr_ram()) {
+		std::span<u8> chr_ram = this->rom->get_chr_ram();
+		std::copy_n(in.chr_ram.begin(), std::min(in.chr_ram.size(), chr_ram.size()), chr_ram.begin());
+	}
+}
+
+void bus::vblank_started() {
+	// Buffer boundary for the apu; the cpu is mid tick here, stolen cycles wait for the next run_apu
+	this->audio.run_until(this->cycles);
+	this->audio.end_frame();
+	if (this->cheats_pending.load(std::memory_order_acquire)) this->apply_cheats();
+	for (const cheat& code : this->ram_cheats) {
+		u8* cell = code.address <= 0x1FFF ? &this->cpu_wram[code.address & 0x07FF]
+			: (this->prg_ram != nullptr ? &this->prg_ram[code.address & 0x1FFF] : nullptr);
+		if (cell != nullptr && (!code.has_compare || *cell == code.compare)) *cell = code.value;
+	}
+}
+
+/* The 256 byte page is handed to the ppu in one go: straight from memory when the page is WRAM, mapped PRG-RAM
+ * or PRG-ROM, byte by byte through read_u8 only when it maps to I/O or to no memory. The CPU is stalled 513 cycles, plus one alignment
+ * cycle when the transfer starts on an odd cycle.
+ */
+void bus::oam_dma(const u8 page) {
+	u16 base = static_cast<u16>(page) << 8;
+
+	if (base <= 0x1FFF) { this->_ppu->write_oam_dma(&this->cpu_wram[base & 0x07FF]); }
+	else if (base >= 0x6000 && base <= 0x7FFF && this->prg_ram != nullptr) { this->_ppu->write_oam_dma(&this->prg_ram[base & 0x1FFF]); }
+	else if (base >= 0x8000) { this->_ppu->write_oam_dma(&this->prg_pages[(base >> 13) & 3][base & 0x1FFF]); }
+	else {
+		std::array<u8, 256> buffer;
+		for (usize i = 0; i < buffer.size(); ++i) {
+			buffer[i] = this->read_u8(base + static_cast<u16>(i));
+		}
+		this->_ppu->write_oam_dma(buffer.data());
+	}
+
+	this->_cpu->stall(513 + (this->cycles & 1));
+}
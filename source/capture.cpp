@@ -0,0 +1,301 @@
+#include "../header/capture.h"
+#include "../header/png_writer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef _WIN32
+#define capture_popen(command) _popen(command, "wb")
+#define capture_pclose _pclose
+#else
+#include <csignal>
+#define capture_popen(command) popen(command, "w")
+#define capture_pclose pclose
+#endif
+
+// 39375000 / 655171 is the NTSC NES frame rate, 60.0988 Hz; NES pixels are 8:7
+static constexpr const char* Y4M_HEADER = "YUV4MPEG2 W256 H240 F39375000:655171 Ip A8:7 C444\n";
+static constexpr const char* Y4M_FRAME = "FRAME\n";
+
+static void put_le(u8* out, u32 value, usize size) {
+	for (usize i = 0; i < size; ++i) out[i] = static_cast<u8>(value >> (8 * i));
+}
+
+// Canonical 44 byte header of a mono 16 bit PCM file
+static std::array<u8, 44> wav_header(u32 sample_rate, u32 data_bytes) {
+	std::array<u8, 44> header = {};
+	std::memcpy(header.data(), "RIFF", 4);
+	put_le(header.data() + 4, 36 + data_bytes, 4);
+	std::memcpy(header.data() + 8, "WAVEfmt ", 8);
+	put_le(header.data() + 16, 16, 4);
+	put_le(header.data() + 20, 1, 2);
+	put_le(header.data() + 22, 1, 2);
+	put_le(header.data() + 24, sample_rate, 4);
+	put_le(header.data() + 28, sample_rate * 2, 4);
+	put_le(header.data() + 32, 2, 2);
+	put_le(header.data() + 34, 16, 2);
+	std::memcpy(header.data() + 36, "data", 4);
+	put_le(header.data() + 40, data_bytes, 4);
+	return header;
+}
+
+capture_sink::capture_sink(const std::string& target, capture_format format, usize slot_count) :
+	target(target),
+	format(format),
+	output(nullptr),
+	piped(!target.empty() && target[0] == '|'),
+	audio_output(nullptr),
+	audio_rate(0),
+	audio_bytes(0),
+	slots(),
+	free_slots(),
+	queued_slots(),
+	audio(),
+	conversion(WIDTH * HEIGHT * 4),
+	written(0),
+	dropped(0),
+	audio_dropped(0),
+	peak_queued(0),
+	bytes(0),
+	average_ms(0.0),
+	failed(false)
+{
+	if (slot_count == 0 || slot_count > MAX_SLOTS) throw std::runtime_error("A capture needs between 1 and 16 slots");
+
+	if (this->piped) {
+#ifndef _WIN32
+		// A reader that goes away must show up as a failed write, not kill the emulator
+		std::signal(SIGPIPE, SIG_IGN);
+#endif
+		this->output = capture_popen(target.c_str() + 1);
+	}
+	else {
+		this->output = std::fopen(target.c_str(), "wb");
+	}
+	if (this->output == nullptr) throw std::runtime_error("Cannot open " + target);
+
+	if (format == capture_format::y4m) this->put(Y4M_HEADER, std::strlen(Y4M_HEADER));
+
+	this->slots.resize(slot_count, std::vector<u32>(WIDTH * HEIGHT));
+	for (usize slot = 0; slot < slot_count; ++slot) this->free_slots.try_push(static_cast<u8>(slot));
+	this->writer = std::jthread([this] { this->writer_loop(); });
+}
+
+capture_sink::~capture_sink() {
+	this->queued_slots.try_push(STOP);
+	this->queued_slots.notify();
+	this->writer.join();
+
+	if (this->piped) capture_pclose(this->output);
+	else std::fclose(this->output);
+}
+
+void capture_sink::submit(std::span<const u32> pixels, const frame_digest&, usize) {
+	u8 slot;
+	if (this->failed.load(std::memory_order_relaxed) || !this->free_slots.try_pop(slot)) {
+		this->dropped++;
+		return;
+	}
+	std::memcpy(this->slots[slot].data(), pixels.data(), std::min(pixels.size(), WIDTH * HEIGHT) * sizeof(u32));
+	this->queued_slots.try_push(slot);
+	this->queued_slots.notify();
+
+	usize queued = this->queued_slots.size();
+	if (queued > this->peak_queued.load(std::memory_order_relaxed)) this->peak_queued.store(queued, std::memory_order_relaxed);
+}
+
+void capture_sink::submit_audio(std::span<const i16> samples, u32 sample_rate) {
+	if (this->piped) return;
+	this->audio_rate = sample_rate;
+	this->audio_dropped += samples.size() - this->audio.push(samples);
+}
+
+bool capture_sink::put(const void* data, usize size) {
+	if (this->failed.load(std::memory_order_relaxed)) return false;
+	if (std::fwrite(data, 1, size, this->output) != size) {
+		this->failed.store(true);
+		return false;
+	}
+	this->bytes += size;
+	return true;
+}
+
+void capture_sink::write_frame(const std::vector<u32>& pixels) {
+	usize count = WIDTH * HEIGHT;
+	if (this->format == capture_format::raw_rgba) {
+		this->put(pixels.data(), count * sizeof(u32));
+		return;
+	}
+
+	// BT.601 studio range, full resolution chroma
+	u8* y_plane = this->conversion.data();
+	u8* u_plane = y_plane + count;
+	u8* v_plane = u_plane + count;
+	for (usize i = 0; i < count; ++i) {
+		int r = static_cast<int>(pixels[i] & 0xFF);
+		int g = static_cast<int>((pixels[i] >> 8) & 0xFF);
+		int b = static_cast<int>((pixels[i] >> 16) & 0xFF);
+		y_plane[i] = static_cast<u8>(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+		u_plane[i] = static_cast<u8>(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+		v_plane[i] = static_cast<u8>(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+	}
+	this->put(Y4M_FRAME, std::strlen(Y4M_FRAME));
+	this->put(this->conversion.data(), count * 3);
+}
+
+void capture_sink::drain_audio() {
+	std::array<i16, 4096> chunk;
+	usize count = 0;
+	i16 sample;
+	while (true) {
+		bool popped = this->audio.try_pop(sample);
+		if (popped) chunk[count++] = sample;
+		if (count == 0) return;
+		if (popped && count < chunk.size()) continue;
+
+		if (this->audio_output == nullptr) {
+			this->audio_output = std::fopen((this->target + ".wav").c_str(), "wb");
+			if (this->audio_output == nullptr) {
+				this->audio_dropped += count;
+				return;
+			}
+			std::array<u8, 44> header = wav_header(this->audio_rate.load(), 0);
+			std::fwrite(header.data(), 1, header.size(), this->audio_output);
+		}
+		this->audio_bytes += std::fwrite(chunk.data(), sizeof(i16), count, this->audio_output) * sizeof(i16);
+		count = 0;
+		if (!popped) return;
+	}
+}
+
+void capture_sink::finish_audio() {
+	if (this->audio_output == nullptr) return;
+	std::array<u8, 44> header = wav_header(this->audio_rate.load(), static_cast<u32>(this->audio_bytes));
+	std::fseek(this->audio_output, 0, SEEK_SET);
+	std::fwrite(header.data(), 1, header.size(), this->audio_output);
+	std::fclose(this->audio_output);
+	this->audio_output = nullptr;
+}
+
+void capture_sink::writer_loop() {
+	using clock = std::chrono::steady_clock;
+
+	while (true) {
+		u8 slot;
+		if (!this->queued_slots.try_pop(slot)) {
+			this->queued_slots.wait_for_data();
+			continue;
+		}
+		if (slot == STOP) break;
+
+		auto start = clock::now();
+		this->write_frame(this->slots[slot]);
+		this->drain_audio();
+		std::chrono::duration<double, std::milli> elapsed = clock::now() - start;
+
+		double average = this->average_ms.load();
+		this->average_ms.store(average == 0.0 ? elapsed.count() : average * 0.9 + elapsed.count() * 0.1);
+		this->written++;
+		this->free_slots.try_push(slot);
+	}
+	this->drain_audio();
+	this->finish_audio();
+	std::fflush(this->output);
+}
+
+wav_sink::wav_sink(const std::string& path) :
+	path(path),
+	output(std::fopen(path.c_str(), "wb")),
+	sample_rate(0),
+	data_bytes(0),
+	failed(false)
+{
+	if (this->output == nullptr) throw std::runtime_error("Cannot open " + path);
+	std::array<u8, 44> header = wav_header(0, 0);
+	std::fwrite(header.data(), 1, header.size(), this->output);
+}
+
+wav_sink::~wav_sink() {
+	std::array<u8, 44> header = wav_header(this->sample_rate, static_cast<u32>(this->data_bytes));
+	std::fseek(this->output, 0, SEEK_SET);
+	std::fwrite(header.data(), 1, header.size(), this->output);
+	std::fclose(this->output);
+}
+
+void wav_sink::submit_audio(std::span<const i16> samples, u32 sample_rate) {
+	if (this->failed) return;
+	this->sample_rate = sample_rate;
+	usize written = std::fwrite(samples.data(), sizeof(i16), samples.size(), this->output);
+	this->data_bytes += written * sizeof(i16);
+	this->failed = written != samples.size();
+}
+
+screenshot_sink::screenshot_sink() :
+	mtx(),
+	path(),
+	status(),
+	pixels(),
+	requested(false),
+	pending(false),
+	stopping(false)
+{
+	this->writer = std::jthread([this] { this->writer_loop(); });
+}
+
+screenshot_sink::~screenshot_sink() {
+	this->stopping.store(true);
+	this->pending.store(true, std::memory_order_release);
+	this->pending.notify_one();
+	this->writer.join();
+}
+
+bool screenshot_sink::request(const std::string& path) {
+	if (this->requested.load() || this->pending.load()) return false;
+	{
+		std::lock_guard<std::mutex> lock(this->mtx);
+		this->path = path;
+	}
+	this->requested.store(true, std::memory_order_release);
+	return true;
+}
+
+void screenshot_sink::submit(std::span<const u32> pixels, const frame_digest&, usize) {
+	if (!this->requested.load(std::memory_order_acquire)) return;
+	this->pixels.assign(pixels.begin(), pixels.end());
+	this->requested.store(false, std::memory_order_relaxed);
+	this->pending.store(true, std::memory_order_release);
+	this->pending.notify_one();
+}
+
+std::string screenshot_sink::get_status() {
+	std::lock_guard<std::mutex> lock(this->mtx);
+	return this->status;
+}
+
+void screenshot_sink::writer_loop() {
+	while (true) {
+		this->pending.wait(false, std::memory_order_acquire);
+		if (this->stopping.load()) return;
+
+		std::string target;
+		{
+			std::lock_guard<std::mutex> lock(this->mtx);
+			target = this->path;
+		}
+		std::string result;
+		try {
+			png::write_file(target, this->pixels, 256, this->pixels.size() / 256);
+			result = "Saved " + target;
+		}
+		catch (const std::runtime_error& error) {
+			result = error.what();
+		}
+		{
+			std::lock_guard<std::mutex> lock(this->mtx);
+			this->status = result;
+		}
+		this->pending.store(false, std::memory_order_release);
+	}
+}
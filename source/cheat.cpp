@@ -0,0 +1,72 @@
+#include "../header/cheat.h"
+
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+static cheat game_genie(std::string_view code) {
+	u8 n[8];
+	for (usize i = 0; i < code.size(); ++i) {
+		const char* letter = std::strchr(cheats::GAME_GENIE_LETTERS, std::toupper(static_cast<unsigned char>(code[i])));
+		if (letter == nullptr || *letter == '\0') throw std::runtime_error("Not a Game Genie letter in " + std::string(code));
+		n[i] = static_cast<u8>(letter - cheats::GAME_GENIE_LETTERS);
+	}
+
+	// The bits of address, value and compare are scattered over the letters; the high bit of each letter
+	// continues the field of the letter before it
+	cheat decoded = {};
+	decoded.address = static_cast<u16>(0x8000 | ((n[3] & 7) << 12) | ((n[5] & 7) << 8) | ((n[4] & 8) << 8)
+		| ((n[2] & 7) << 4) | ((n[1] & 8) << 4) | (n[4] & 7) | (n[3] & 8));
+	decoded.value = static_cast<u8>(((n[1] & 7) << 4) | ((n[0] & 8) << 4) | (n[0] & 7));
+	if (code.size() == 6) {
+		decoded.value |= n[5] & 8;
+	}
+	else {
+		decoded.value |= n[7] & 8;
+		decoded.compare = static_cast<u8>(((n[7] & 7) << 4) | ((n[6] & 8) << 4) | (n[6] & 7) | (n[5] & 8));
+		decoded.has_compare = true;
+	}
+	return decoded;
+}
+
+static u32 hex(std::string_view digits, usize max_digits, std::string_view code) {
+	if (digits.empty() || digits.size() > max_digits) throw std::runtime_error("Bad cheat " + std::string(code));
+	u32 value = 0;
+	for (char digit : digits) {
+		if (!std::isxdigit(static_cast<unsigned char>(digit))) throw std::runtime_error("Bad cheat " + std::string(code));
+		value = (value << 4) | static_cast<u32>(std::isdigit(static_cast<unsigned char>(digit)) ? digit - '0' : std::toupper(static_cast<unsigned char>(digit)) - 'A' + 10);
+	}
+	return value;
+}
+
+cheat cheats::parse(std::string_view code) {
+	while (!code.empty() && std::isspace(static_cast<unsigned char>(code.front()))) code.remove_prefix(1);
+	while (!code.empty() && std::isspace(static_cast<unsigned char>(code.back()))) code.remove_suffix(1);
+
+	usize equals = code.find('=');
+	if (equals == std::string_view::npos) {
+		if (code.size() != 6 && code.size() != 8) throw std::runtime_error("Bad cheat " + std::string(code));
+		return game_genie(code);
+	}
+
+	std::string_view target = code.substr(0, equals);
+	cheat raw = {};
+	usize question = target.find('?');
+	if (question != std::string_view::npos) {
+		raw.compare = static_cast<u8>(hex(target.substr(question + 1), 2, code));
+		raw.has_compare = true;
+		target = target.substr(0, question);
+	}
+	raw.address = static_cast<u16>(hex(target, 4, code));
+	raw.value = static_cast<u8>(hex(code.substr(equals + 1), 2, code));
+	if (raw.address >= 0x2000 && raw.address < 0x6000) throw std::runtime_error("Cheats patch RAM or PRG-ROM, not I/O: " + std::string(code));
+	return raw;
+}
+
+std::string cheats::format(const cheat& code) {
+	char text[16];
+	if (code.has_compare) std::snprintf(text, sizeof(text), "%04X?%02X=%02X", code.address, code.compare, code.value);
+	else std::snprintf(text, sizeof(text), "%04X=%02X", code.address, code.value);
+	return text;
+}
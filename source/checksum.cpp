@@ -0,0 +1,196 @@
+#include "../header/checksum.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <emmintrin.h>
+#include <smmintrin.h>
+#include <wmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define CHECKSUM_TARGET
+#else
+#define CHECKSUM_TARGET __attribute__((target("pclmul,sse4.1")))
+#endif
+#define CHECKSUM_CLMUL
+#endif
+
+static constexpr std::array<std::array<u32, 256>, 8> make_crc32_tables() {
+	std::array<std::array<u32, 256>, 8> tables = {};
+	for (u32 n = 0; n < 256; ++n) {
+		u32 c = n;
+		for (usize k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+		tables[0][n] = c;
+	}
+	// tables[k][n]: the byte n followed by k zero bytes
+	for (usize k = 1; k < 8; ++k) {
+		for (usize n = 0; n < 256; ++n) tables[k][n] = (tables[k - 1][n] >> 8) ^ tables[0][tables[k - 1][n] & 0xFF];
+	}
+	return tables;
+}
+static constexpr std::array<std::array<u32, 256>, 8> CRC32_TABLES = make_crc32_tables();
+
+static u32 load_le32(const u8* data) {
+	return static_cast<u32>(data[0]) | (static_cast<u32>(data[1]) << 8) | (static_cast<u32>(data[2]) << 16) | (static_cast<u32>(data[3]) << 24);
+}
+
+// Works on the inverted register like the folding below
+static u32 crc32_slices(const u8* data, usize size, u32 crc) {
+	const auto& t = CRC32_TABLES;
+	for (; size >= 8; size -= 8, data += 8) {
+		u32 one = crc ^ load_le32(data);
+		u32 two = load_le32(data + 4);
+		crc = t[7][one & 0xFF] ^ t[6][(one >> 8) & 0xFF] ^ t[5][(one >> 16) & 0xFF] ^ t[4][one >> 24]
+			^ t[3][two & 0xFF] ^ t[2][(two >> 8) & 0xFF] ^ t[1][(two >> 16) & 0xFF] ^ t[0][two >> 24];
+	}
+	for (; size > 0; --size) crc = t[0][(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+	return crc;
+}
+
+#ifdef CHECKSUM_CLMUL
+static bool has_clmul() {
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 1);
+	return (info[2] & (1 << 1)) != 0 && (info[2] & (1 << 19)) != 0;
+#else
+	return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+#endif
+}
+
+CHECKSUM_TARGET static inline __m128i load(const u8* at) {
+	return _mm_loadu_si128(reinterpret_cast<const __m128i*>(at));
+}
+
+// lane * x^(distance) mod P, added to the data that far ahead
+CHECKSUM_TARGET static inline __m128i fold(__m128i lane, __m128i k, __m128i next) {
+	__m128i low = _mm_clmulepi64_si128(lane, k, 0x00);
+	__m128i high = _mm_clmulepi64_si128(lane, k, 0x11);
+	return _mm_xor_si128(_mm_xor_si128(high, low), next);
+}
+
+/* Intel's "Fast CRC Computation Using PCLMULQDQ": four 128 bit lanes folded 64 bytes at a time, then into one lane,
+ * then Barrett reduced to 32 bits. Constants are for the bit reflected IEEE polynomial; size is a multiple of 16, >= 64.
+ */
+CHECKSUM_TARGET static u32 crc32_fold(const u8* data, usize size, u32 crc) {
+	alignas(16) static const u64 K1K2[2] = { 0x0154442bd4, 0x01c6e41596 };
+	alignas(16) static const u64 K3K4[2] = { 0x01751997d0, 0x00ccaa009e };
+	alignas(16) static const u64 K5K0[2] = { 0x0163cd6124, 0x0000000000 };
+	alignas(16) static const u64 POLY[2] = { 0x01db710641, 0x01f7011641 };
+
+	__m128i x1 = _mm_xor_si128(load(data), _mm_cvtsi32_si128(static_cast<int>(crc)));
+	__m128i x2 = load(data + 16);
+	__m128i x3 = load(data + 32);
+	__m128i x4 = load(data + 48);
+	data += 64;
+	size -= 64;
+
+	__m128i k = _mm_load_si128(reinterpret_cast<const __m128i*>(K1K2));
+	for (; size >= 64; size -= 64, data += 64) {
+		x1 = fold(x1, k, load(data));
+		x2 = fold(x2, k, load(data + 16));
+		x3 = fold(x3, k, load(data + 32));
+		x4 = fold(x4, k, load(data + 48));
+	}
+
+	k = _mm_load_si128(reinterpret_cast<const __m128i*>(K3K4));
+	x1 = fold(x1, k, x2);
+	x1 = fold(x1, k, x3);
+	x1 = fold(x1, k, x4);
+	for (; size >= 16; size -= 16, data += 16) x1 = fold(x1, k, load(data));
+
+	// 128 to 64 bits
+	__m128i mask = _mm_setr_epi32(~0, 0, ~0, 0);
+	x2 = _mm_clmulepi64_si128(x1, k, 0x10);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+	k = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(K5K0));
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_xor_si128(_mm_clmulepi64_si128(_mm_and_si128(x1, mask), k, 0x00), x2);
+
+	// Barrett reduction
+	k = _mm_load_si128(reinterpret_cast<const __m128i*>(POLY));
+	x2 = _mm_and_si128(_mm_clmulepi64_si128(_mm_and_si128(x1, mask), k, 0x10), mask);
+	x1 = _mm_xor_si128(x1, _mm_clmulepi64_si128(x2, k, 0x00));
+	return static_cast<u32>(_mm_extract_epi32(x1, 1));
+}
+#endif
+
+u32 checksum::crc32(std::span<const u8> data, u32 crc) {
+	crc = ~crc;
+	const u8* at = data.data();
+	usize size = data.size();
+#ifdef CHECKSUM_CLMUL
+	static const bool clmul = has_clmul();
+	if (clmul && size >= 64) {
+		usize folded = size & ~static_cast<usize>(15);
+		crc = crc32_fold(at, folded, crc);
+		at += folded;
+		size -= folded;
+	}
+#endif
+	return ~crc32_slices(at, size, crc);
+}
+
+checksum::sha1_hasher::sha1_hasher() :
+	state({ 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 }),
+	buffer(),
+	buffered(0),
+	length(0)
+{}
+
+void checksum::sha1_hasher::block(const u8* chunk) {
+	auto rotate = [](u32 value, int bits) { return (value << bits) | (value >> (32 - bits)); };
+
+	u32 w[80];
+	for (usize i = 0; i < 16; ++i) {
+		w[i] = (static_cast<u32>(chunk[i * 4]) << 24) | (static_cast<u32>(chunk[i * 4 + 1]) << 16) | (static_cast<u32>(chunk[i * 4 + 2]) << 8) | chunk[i * 4 + 3];
+	}
+	for (usize i = 16; i < 80; ++i) w[i] = rotate(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+	u32 a = this->state[0], b = this->state[1], c = this->state[2], d = this->state[3], e = this->state[4];
+	for (usize i = 0; i < 80; ++i) {
+		u32 f, k;
+		if (i < 20) { f = (b & c) | (~b & d); k = 0x5A827999; }
+		else if (i < 40) { f = b ^ c ^ d; k = 0x6ED9EBA1; }
+		else if (i < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8F1BBCDC; }
+		else { f = b ^ c ^ d; k = 0xCA62C1D6; }
+		u32 next = rotate(a, 5) + f + e + k + w[i];
+		e = d;
+		d = c;
+		c = rotate(b, 30);
+		b = a;
+		a = next;
+	}
+	this->state[0] += a; this->state[1] += b; this->state[2] += c; this->state[3] += d; this->state[4] += e;
+}
+
+void checksum::sha1_hasher::update(std::span<const u8> data) {
+	this->length += data.size();
+	usize offset = 0;
+	if (this->buffered > 0) {
+		usize taken = std::min(data.size(), this->buffer.size() - this->buffered);
+		std::memcpy(this->buffer.data() + this->buffered, data.data(), taken);
+		this->buffered += taken;
+		offset = taken;
+		if (this->buffered < this->buffer.size()) return;
+		this->block(this->buffer.data());
+		this->buffered = 0;
+	}
+	for (; offset + 64 <= data.size(); offset += 64) this->block(data.data() + offset);
+	std::memcpy(this->buffer.data(), data.data() + offset, data.size() - offset);
+	this->buffered = data.size() - offset;
+}
+
+checksum::sha1_digest checksum::sha1_hasher::finish() {
+	// Padding: a 1 bit, zeros, then the length in bits, big endian
+	u64 bits = this->length * 8;
+	u8 tail[128] = {};
+	tail[0] = 0x80;
+	usize padding = (this->buffered < 56 ? 56 : 120) - this->buffered;
+	for (usize i = 0; i < 8; ++i) tail[padding + 7 - i] = static_cast<u8>(bits >> (8 * i));
+	this->update(std::span<const u8>(tail, padding + 8));
+
+	sha1_digest digest;
+	for (usize i = 0; i < 20; ++i) digest[i] = static_cast<u8>(this->state[i / 4] >> (24 - 8 * (i % 4)));
+	return digest;
+}
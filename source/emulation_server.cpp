@@ -0,0 +1,355 @@
+#include "../header/emulation_server.h"
+
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <sstream>
+#include <stdexcept>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <winsock2.h>
+#include <afunix.h>
+#ifdef _MSC_VER
+#pragma comment(lib, "Ws2_32.lib")
+#endif
+typedef SOCKET socket_handle;
+typedef WSAPOLLFD socket_poll;
+#define close_socket closesocket
+#define poll_sockets WSAPoll
+static const socket_handle NO_SOCKET = INVALID_SOCKET;
+#else
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <unistd.h>
+#include <csignal>
+typedef int socket_handle;
+typedef pollfd socket_poll;
+#define close_socket close
+#define poll_sockets poll
+static const socket_handle NO_SOCKET = -1;
+#endif
+
+static constexpr usize MAX_LINE = 256;
+
+// Winsock has to be started once per user, the calls are reference counted
+static void start_sockets() {
+#ifdef _WIN32
+	WSADATA data;
+	if (WSAStartup(MAKEWORD(2, 2), &data) != 0) throw std::runtime_error("Cannot start Winsock");
+#else
+	// A viewer that disconnects mid reply must show up as a failed send, not kill the process
+	std::signal(SIGPIPE, SIG_IGN);
+#endif
+}
+
+static void stop_sockets() {
+#ifdef _WIN32
+	WSACleanup();
+#endif
+}
+
+static sockaddr_un socket_address(const std::string& path) {
+	sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(address.sun_path)) throw std::runtime_error("Socket path too long: " + path);
+	std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+	return address;
+}
+
+static bool send_line(socket_handle socket, const std::string& line) {
+	std::string data = line + "\n";
+	usize sent = 0;
+	while (sent < data.size()) {
+		int result = send(socket, data.c_str() + sent, static_cast<int>(data.size() - sent), 0);
+		if (result <= 0) return false;
+		sent += static_cast<usize>(result);
+	}
+	return true;
+}
+
+std::string emulation_server::socket_path(const std::string& name) {
+	return (std::filesystem::temp_directory_path() / (name + ".sock")).string();
+}
+
+emulation_server::emulation_server(const std::string& name, const cartridge& rom, const std::string& save_path, usize slot_count) :
+	name(name),
+	pixel_buffer1(256 * 240, 0xFF000000),
+	pixel_buffer2(256 * 240, 0xFF000000),
+	game(rom),
+	machine_bus(),
+	machine_cpu(),
+	machine_ppu(),
+	ring(name, slot_count),
+	commands(),
+	frames(0),
+	status(0),
+	stopping(false),
+	listener(NO_SOCKET)
+{
+	this->machine_cpu.connect(&this->machine_bus);
+	this->machine_ppu.connect(&this->machine_bus);
+	this->machine_ppu.set_pixel_buffers(this->pixel_buffer1, this->pixel_buffer2);
+	this->machine_bus.connect(&this->machine_cpu);
+	this->machine_bus.connect(&this->machine_ppu);
+	this->machine_ppu.add_sink(this);
+
+	if (!save_path.empty()) this->game.attach_save(save_path);
+	this->machine_cpu.load(&this->game);
+	this->machine_cpu.reset();
+
+	start_sockets();
+	std::string path = emulation_server::socket_path(name);
+	sockaddr_un address = socket_address(path);
+	// A server that crashed leaves its socket file behind, binding would fail on it
+	std::error_code ignored;
+	std::filesystem::remove(path, ignored);
+
+	socket_handle listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listener == NO_SOCKET) {
+		stop_sockets();
+		throw std::runtime_error("Cannot create the control socket");
+	}
+	if (bind(listener, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 || listen(listener, 8) != 0) {
+		close_socket(listener);
+		stop_sockets();
+		throw std::runtime_error("Cannot listen on " + path);
+	}
+	this->listener = listener;
+	this->control = std::jthread([this](std::stop_token st) { this->control_loop(st); });
+}
+
+emulation_server::~emulation_server() {
+	this->control.request_stop();
+	this->control.join();
+	close_socket(static_cast<socket_handle>(this->listener));
+	std::error_code ignored;
+	std::filesystem::remove(emulation_server::socket_path(this->name), ignored);
+	stop_sockets();
+	this->machine_ppu.remove_sink(this);
+}
+
+void emulation_server::submit(std::span<const u32> pixels, const frame_digest& digest, usize frame) {
+	shared_machine_state machine = {};
+	machine.cycles = this->machine_cpu.get_cycles();
+	machine.pc = this->machine_cpu.get_pc();
+	machine.a = this->machine_cpu.get_a();
+	machine.x = this->machine_cpu.get_x();
+	machine.y = this->machine_cpu.get_y();
+	machine.p = this->machine_cpu.get_p();
+	machine.sp = this->machine_cpu.get_sp();
+	this->ring.publish(pixels, digest, frame, machine);
+	this->frames.store(frame + 1, std::memory_order_relaxed);
+}
+
+void emulation_server::update_status(u32 status) {
+	if (this->status.exchange(status) != status) this->ring.set_status(status);
+}
+
+void emulation_server::run_frame() {
+	usize target = this->machine_ppu.get_frames() + 1;
+	while (this->machine_ppu.get_frames() < target && !this->machine_cpu.get_halted()) {
+		this->machine_cpu.step();
+	}
+}
+
+void emulation_server::run() {
+	using clock = std::chrono::steady_clock;
+	const auto frame_time = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(1.0 / 60.0988));
+
+	bool paused = false;
+	auto deadline = clock::now();
+	while (true) {
+		bool step = false;
+		server_command command;
+		while (this->commands.try_pop(command)) {
+			switch (command.type) {
+			case server_command_type::pause_emulation:
+				paused = true;
+				this->game.flush_save();
+				break;
+			case server_command_type::resume_emulation: paused = false; break;
+			case server_command_type::reset_machine: this->machine_cpu.reset(); break;
+			case server_command_type::step_frame: step = true; break;
+			case server_command_type::quit_server: return;
+			}
+		}
+
+		bool halted = this->machine_cpu.get_halted();
+		this->update_status((paused ? shared_frame_header::STATUS_PAUSED : 0) | (halted ? shared_frame_header::STATUS_HALTED : 0));
+		if (halted || (paused && !step)) {
+			this->commands.wait_for_data();
+			deadline = clock::now();
+			continue;
+		}
+
+		this->run_frame();
+		if (step) continue;
+
+		// Pace to the NES frame rate; after a stall start over instead of running a burst of frames to catch up
+		deadline += frame_time;
+		auto now = clock::now();
+		if (now > deadline + frame_time) deadline = now;
+		else std::this_thread::sleep_until(deadline);
+	}
+}
+
+void emulation_server::push(server_command_type type) {
+	server_command command = { type };
+	while (!this->commands.try_push(command)) std::this_thread::yield();
+	this->commands.notify();
+}
+
+std::string emulation_server::execute(const std::string& line) {
+	std::istringstream words(line);
+	std::string verb;
+	words >> verb;
+
+	if (verb == "input") {
+		usize port;
+		u32 buttons;
+		if (!(words >> port >> std::hex >> buttons) || port >= controller_ports::PORTS || buttons > 0xFF) return "error usage: input <port> <buttons>";
+		controller_ports& pads = this->machine_bus.get_controllers();
+		if (port >= 2) pads.set_four_score(true);
+		pads.set_buttons(port, static_cast<u8>(buttons));
+		return "ok";
+	}
+	if (verb == "cheat") {
+		std::string code;
+		if (!(words >> code)) return "error usage: cheat <code> | cheat clear";
+		if (code == "clear") this->cheat_list.clear();
+		else {
+			try {
+				this->cheat_list.push_back(cheats::parse(code));
+			}
+			catch (const std::runtime_error& error) {
+				return std::string("error ") + error.what();
+			}
+		}
+		this->machine_bus.set_cheats(this->cheat_list);
+		return "ok";
+	}
+	if (verb == "pause") this->push(server_command_type::pause_emulation);
+	else if (verb == "resume") this->push(server_command_type::resume_emulation);
+	else if (verb == "reset") this->push(server_command_type::reset_machine);
+	else if (verb == "step") this->push(server_command_type::step_frame);
+	else if (verb == "quit") this->stop();
+	else if (verb == "status") {
+		u32 status = this->status.load();
+		const char* state = (status & shared_frame_header::STATUS_HALTED) ? "halted" : (status & shared_frame_header::STATUS_PAUSED) ? "paused" : "running";
+		return "ok " + std::to_string(this->frames.load()) + " " + state;
+	}
+	else return "error unknown command " + verb;
+	return "ok";
+}
+
+void emulation_server::control_loop(std::stop_token st) {
+	struct connection {
+		socket_handle socket;
+		std::string pending;
+	};
+	std::vector<connection> connections;
+	std::vector<socket_poll> polled;
+	bool quitting = false;
+
+	while (!st.stop_requested()) {
+		if (this->stopping.load() && !quitting) {
+			this->push(server_command_type::quit_server);
+			quitting = true;
+		}
+
+		polled.assign(1, socket_poll{});
+		polled[0].fd = static_cast<socket_handle>(this->listener);
+		polled[0].events = POLLIN;
+		for (const connection& client : connections) {
+			socket_poll entry = {};
+			entry.fd = client.socket;
+			entry.events = POLLIN;
+			polled.push_back(entry);
+		}
+		// The timeout bounds how long a stop request waits
+		if (poll_sockets(polled.data(), static_cast<unsigned long>(polled.size()), 100) <= 0) continue;
+
+		for (usize i = polled.size() - 1; i >= 1; --i) {
+			if (polled[i].revents == 0) continue;
+			connection& client = connections[i - 1];
+
+			char buffer[MAX_LINE];
+			int received = recv(client.socket, buffer, static_cast<int>(sizeof(buffer)), 0);
+			bool open = received > 0;
+			if (open) client.pending.append(buffer, static_cast<usize>(received));
+
+			usize end;
+			while (open && (end = client.pending.find('\n')) != std::string::npos) {
+				std::string line = client.pending.substr(0, end);
+				client.pending.erase(0, end + 1);
+				if (!line.empty() && line.back() == '\r') line.pop_back();
+				open = send_line(client.socket, this->execute(line));
+			}
+			// A line that never ends is not a command
+			if (!open || client.pending.size() > MAX_LINE) {
+				close_socket(client.socket);
+				connections.erase(connections.begin() + static_cast<std::ptrdiff_t>(i - 1));
+			}
+		}
+
+		if (polled[0].revents & POLLIN) {
+			socket_handle accepted = accept(static_cast<socket_handle>(this->listener), nullptr, nullptr);
+			if (accepted != NO_SOCKET) connections.push_back(connection{ accepted, std::string() });
+		}
+	}
+	for (const connection& client : connections) close_socket(client.socket);
+}
+
+emulation_client::emulation_client(const std::string& name) :
+	connection(NO_SOCKET),
+	pending(),
+	sent_input({ -1, -1, -1, -1 }),
+	frames(name)
+{
+	start_sockets();
+	sockaddr_un address = socket_address(emulation_server::socket_path(name));
+	socket_handle connection = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (connection == NO_SOCKET) {
+		stop_sockets();
+		throw std::runtime_error("Cannot create a socket");
+	}
+	if (connect(connection, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0) {
+		close_socket(connection);
+		stop_sockets();
+		throw std::runtime_error("No emulation server called " + name);
+	}
+	this->connection = connection;
+}
+
+emulation_client::~emulation_client() {
+	close_socket(static_cast<socket_handle>(this->connection));
+	stop_sockets();
+}
+
+std::string emulation_client::request(const std::string& command) {
+	socket_handle connection = static_cast<socket_handle>(this->connection);
+	if (!send_line(connection, command)) throw std::runtime_error("The emulation server went away");
+
+	usize end;
+	while ((end = this->pending.find('\n')) == std::string::npos) {
+		char buffer[MAX_LINE];
+		int received = recv(connection, buffer, static_cast<int>(sizeof(buffer)), 0);
+		if (received <= 0) throw std::runtime_error("The emulation server went away");
+		this->pending.append(buffer, static_cast<usize>(received));
+	}
+	std::string reply = this->pending.substr(0, end);
+	this->pending.erase(0, end + 1);
+	return reply;
+}
+
+void emulation_client::set_input(usize port, u8 buttons) {
+	if (port >= this->sent_input.size() || this->sent_input[port] == buttons) return;
+	std::ostringstream command;
+	command << "input " << port << " " << std::hex << static_cast<u32>(buttons);
+	this->request(command.str());
+	this->sent_input[port] = buttons;
+}
@@ -0,0 +1,42 @@
+#include "../header/game_database.h"
+
+#include <algorithm>
+
+// Sorted by CRC-32 for the binary search in find()
+static constexpr game_database_entry ENTRIES[] = {
+	{ 0x158B0388, "nestest", 0, 0, mirroring::horizontal, false, console_timing::ntsc, 0x2000, 0, 0 },
+	{ 0x9A2DB086, "Super Mario Bros.", 0, 0, mirroring::vertical, false, console_timing::ntsc, 0x2000, 0, 0 },
+	{ 0x9E4E9CC2, "Pac-Man", 0, 0, mirroring::horizontal, false, console_timing::ntsc, 0x2000, 0, 0 },
+};
+
+static_assert(std::ranges::is_sorted(ENTRIES, {}, &game_database_entry::crc32));
+
+const game_database_entry* game_database::find(u32 crc32) {
+	const game_database_entry* found = std::ranges::lower_bound(ENTRIES, crc32, {}, &game_database_entry::crc32);
+	return found != std::end(ENTRIES) && found->crc32 == crc32 ? found : nullptr;
+}
+
+nes_header game_database::correct(const nes_header& header, const game_database_entry& entry) {
+	nes_header corrected = header;
+	corrected.mapper = entry.mapper;
+	corrected.submapper = entry.submapper;
+	corrected.screen_mirroring = entry.screen_mirroring;
+	corrected.battery = entry.battery;
+	corrected.timing = entry.timing;
+	corrected.prg_ram_size = entry.prg_ram_size;
+	corrected.prg_nvram_size = entry.prg_nvram_size;
+	corrected.chr_ram_size = header.chr_rom_size == 0 ? std::max<usize>(entry.chr_ram_size, nes_header::CHR_ROM_UNIT) : entry.chr_ram_size;
+	return corrected;
+}
+
+bool game_database::differs(const nes_header& header, const game_database_entry& entry) {
+	nes_header corrected = correct(header, entry);
+	return corrected.mapper != header.mapper || corrected.submapper != header.submapper
+		|| corrected.screen_mirroring != header.screen_mirroring || corrected.battery != header.battery
+		|| corrected.timing != header.timing || corrected.prg_ram_size != header.prg_ram_size
+		|| corrected.prg_nvram_size != header.prg_nvram_size || corrected.chr_ram_size != header.chr_ram_size;
+}
+
+std::span<const game_database_entry> game_database::entries() {
+	return std::span<const game_database_entry>(ENTRIES);
+}
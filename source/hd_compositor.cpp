@@ -0,0 +1,118 @@
+#include "../header/hd_compositor.h"
+
+#include <chrono>
+#include <algorithm>
+
+hd_compositor::hd_compositor(const std::string& pack_path, usize helpers) :
+	pack(pack_path),
+	pool(helpers),
+	pixels(256 * 240),
+	tiles(240 * hd_tile::TILES_PER_LINE),
+	accepted(false),
+	outputs(),
+	pending(false),
+	stopping(false),
+	average_ms(0.0),
+	composed(0),
+	dropped(0),
+	replaced(0)
+{
+	usize scale = this->pack.get_scale();
+	for (video_frame& out : this->outputs.all()) {
+		out.pixels = std::vector<u32>(256 * scale * 240 * scale);
+	}
+	this->worker = std::jthread([this] { this->compose_loop(); });
+}
+
+hd_compositor::~hd_compositor() {
+	this->stopping.store(true);
+	this->pending.store(true, std::memory_order_release);
+	this->pending.notify_one();
+	this->worker.join();
+}
+
+usize hd_compositor::compose_lines(std::span<const u32> pixels, std::span<const hd_tile> tiles, u32* out, usize first, usize last) const {
+	usize scale = this->pack.get_scale();
+	usize tile_width = 8 * scale;
+	int width = static_cast<int>(256 * scale);
+	usize count = 0;
+
+	std::array<const u32*, hd_tile::TILES_PER_LINE> images;
+	for (usize y = first; y < last; ++y) {
+		const hd_tile* line = tiles.data() + y * hd_tile::TILES_PER_LINE;
+		for (usize slot = 0; slot < hd_tile::TILES_PER_LINE; ++slot) {
+			images[slot] = line[slot].valid ? this->pack.find(line[slot].tile, line[slot].palette) : nullptr;
+			if (images[slot] != nullptr) count++;
+		}
+
+		const u32* source = pixels.data() + y * 256;
+		for (usize sub = 0; sub < scale; ++sub) {
+			u32* row = out + (y * scale + sub) * static_cast<usize>(width);
+			for (usize x = 0; x < 256; ++x) {
+				std::fill_n(row + x * scale, scale, source[x]);
+			}
+			for (usize slot = 0; slot < hd_tile::TILES_PER_LINE; ++slot) {
+				if (images[slot] == nullptr) continue;
+				const u32* art = images[slot] + (line[slot].row * scale + sub) * tile_width;
+				int left = static_cast<int>(line[slot].x) * static_cast<int>(scale);
+				int begin = std::max<int>(0, -left);
+				int end = std::min<int>(static_cast<int>(tile_width), width - left);
+				for (int k = begin; k < end; ++k) {
+					if ((art[k] >> 24) != 0) row[left + k] = art[k];
+				}
+			}
+		}
+	}
+	return count;
+}
+
+usize hd_compositor::compose(std::span<const u32> pixels, std::span<const hd_tile> tiles, u32* out) {
+	std::atomic<usize> count = 0;
+	this->pool.run([this, pixels, tiles, out, &count](usize band, usize bands) {
+		usize first = 240 * band / bands;
+		usize last = 240 * (band + 1) / bands;
+		count += this->compose_lines(pixels, tiles, out, first, last);
+	});
+	return count.load();
+}
+
+void hd_compositor::submit_tiles(std::span<const hd_tile> tiles, usize) {
+	this->accepted = !this->pending.load(std::memory_order_acquire);
+	if (this->accepted) std::copy(tiles.begin(), tiles.end(), this->tiles.begin());
+}
+
+void hd_compositor::submit(std::span<const u32> pixels, const frame_digest&, usize) {
+	if (!this->accepted) {
+		this->dropped++;
+		return;
+	}
+	this->accepted = false;
+	std::copy(pixels.begin(), pixels.begin() + std::min(pixels.size(), this->pixels.size()), this->pixels.begin());
+	this->pending.store(true, std::memory_order_release);
+	this->pending.notify_one();
+}
+
+void hd_compositor::compose_loop() {
+	using clock = std::chrono::steady_clock;
+
+	while (true) {
+		this->pending.wait(false, std::memory_order_acquire);
+		if (this->stopping.load()) return;
+
+		video_frame& out = this->outputs.back();
+
+		auto start = clock::now();
+		usize count = this->compose(this->pixels, this->tiles, out.pixels.data());
+		std::chrono::duration<double, std::milli> elapsed = clock::now() - start;
+
+		out.width = 256 * this->pack.get_scale();
+		out.height = 240 * this->pack.get_scale();
+		this->outputs.publish();
+
+		double average = this->average_ms.load();
+		this->average_ms.store(average == 0.0 ? elapsed.count() : average * 0.9 + elapsed.count() * 0.1);
+		this->replaced.store(count);
+		this->composed++;
+		this->pending.store(false, std::memory_order_release);
+	}
+}
@@ -0,0 +1,83 @@
+#include "../header/hd_pack.h"
+#include "../header/frame_hash.h"
+
+#include <bit>
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+
+usize hd_pack::slot_of(u64 tile, u32 palette, usize slot_count) {
+	return static_cast<usize>(frame_hash::mix(tile ^ (static_cast<u64>(palette) * frame_hash::SEED))) & (slot_count - 1);
+}
+
+hd_pack::hd_pack(const std::string& path) :
+	file(path, mapped_file_mode::read_only),
+	header(nullptr),
+	slots(nullptr),
+	images(nullptr),
+	image_pixels(0)
+{
+	std::span<const u8> bytes = this->file.bytes();
+	if (bytes.size() < sizeof(hd_pack_header)) throw std::runtime_error(path + " is not an HD pack");
+
+	this->header = reinterpret_cast<const hd_pack_header*>(bytes.data());
+	const hd_pack_header& h = *this->header;
+	if (h.magic != hd_pack_header::MAGIC || h.version != hd_pack_header::VERSION) throw std::runtime_error(path + " is not an HD pack");
+	if (h.scale == 0 || h.scale > MAX_SCALE || h.slot_count == 0 || !std::has_single_bit(h.slot_count)) {
+		throw std::runtime_error(path + " has an unsupported layout");
+	}
+
+	this->image_pixels = static_cast<usize>(h.scale) * 8 * h.scale * 8;
+	u64 slots_end = h.slot_offset + static_cast<u64>(h.slot_count) * sizeof(hd_pack_slot);
+	u64 images_end = h.image_offset + static_cast<u64>(h.image_count) * this->image_pixels * sizeof(u32);
+	if (slots_end > bytes.size() || images_end > bytes.size() || h.slot_offset % 8 != 0 || h.image_offset % 4 != 0) {
+		throw std::runtime_error(path + " is truncated");
+	}
+	this->slots = reinterpret_cast<const hd_pack_slot*>(bytes.data() + h.slot_offset);
+	this->images = reinterpret_cast<const u32*>(bytes.data() + h.image_offset);
+}
+
+const u32* hd_pack::find(u64 tile, u32 palette) const {
+	usize mask = this->header->slot_count - 1;
+	for (usize slot = slot_of(tile, palette, this->header->slot_count), probes = 0; probes <= mask; slot = (slot + 1) & mask, ++probes) {
+		const hd_pack_slot& entry = this->slots[slot];
+		if (entry.image == 0) return nullptr;
+		if (entry.tile == tile && entry.palette == palette) {
+			return entry.image <= this->header->image_count ? this->images + (entry.image - 1) * this->image_pixels : nullptr;
+		}
+	}
+	return nullptr;
+}
+
+void hd_pack::write(const std::string& path, usize scale, std::span<const hd_pack_entry> entries) {
+	if (scale == 0 || scale > MAX_SCALE) throw std::runtime_error("HD pack scale must be between 1 and 8");
+	usize image_pixels = scale * 8 * scale * 8;
+
+	// At most half full keeps probe runs short
+	usize slot_count = std::bit_ceil(std::max<usize>(entries.size() * 2, 16));
+	std::vector<hd_pack_slot> slots(slot_count, hd_pack_slot{ 0, 0, 0 });
+	for (usize i = 0; i < entries.size(); ++i) {
+		if (entries[i].image.size() != image_pixels) throw std::runtime_error("HD pack image with the wrong size");
+		usize slot = slot_of(entries[i].tile, entries[i].palette, slot_count);
+		while (slots[slot].image != 0) slot = (slot + 1) & (slot_count - 1);
+		slots[slot] = hd_pack_slot{ entries[i].tile, entries[i].palette, static_cast<u32>(i + 1) };
+	}
+
+	hd_pack_header header{};
+	header.magic = hd_pack_header::MAGIC;
+	header.version = hd_pack_header::VERSION;
+	header.scale = static_cast<u32>(scale);
+	header.slot_count = static_cast<u32>(slot_count);
+	header.image_count = static_cast<u32>(entries.size());
+	header.slot_offset = sizeof(hd_pack_header);
+	header.image_offset = header.slot_offset + slot_count * sizeof(hd_pack_slot);
+
+	std::ofstream out(path, std::ios::binary | std::ios::trunc);
+	if (!out) throw std::runtime_error("Cannot write " + path);
+	out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	out.write(reinterpret_cast<const char*>(slots.data()), static_cast<std::streamsize>(slots.size() * sizeof(hd_pack_slot)));
+	for (const hd_pack_entry& entry : entries) {
+		out.write(reinterpret_cast<const char*>(entry.image.data()), static_cast<std::streamsize>(image_pixels * sizeof(u32)));
+	}
+	if (!out) throw std::runtime_error("Cannot write " + path);
+}
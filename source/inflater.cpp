@@ -0,0 +1,245 @@
+#include "../header/inflater.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+static constexpr u16 LENGTH_BASE[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static constexpr u8 LENGTH_EXTRA[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static constexpr u16 DISTANCE_BASE[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static constexpr u8 DISTANCE_EXTRA[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+// Order the code length code lengths come in
+static constexpr u8 CODE_LENGTH_ORDER[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+inflater::inflater(std::span<const u8> compressed) :
+	input(compressed),
+	position(0),
+	bits(0),
+	bit_count(0),
+	padding(0),
+	state(inflater_state::block_header),
+	last_block(false),
+	stored_remaining(0),
+	literals(),
+	distances(),
+	window(WINDOW_SIZE),
+	written(0),
+	consumed(0)
+{}
+
+void inflater::refill() {
+	while (this->bit_count <= 56) {
+		u8 byte = 0;
+		if (this->position < this->input.size()) byte = this->input[this->position];
+		else this->padding++;
+		this->position++;
+		this->bits |= static_cast<u64>(byte) << this->bit_count;
+		this->bit_count += 8;
+	}
+}
+
+u32 inflater::take(const usize count) {
+	if (this->bit_count < count) this->refill();
+	u32 value = static_cast<u32>(this->bits & ((1_u32 << count) - 1));
+	this->bits >>= count;
+	this->bit_count -= count;
+	if (this->padding * 8 > this->bit_count) throw std::runtime_error("Truncated DEFLATE stream");
+	return value;
+}
+
+u16 inflater::decode(const inflater_table& table) {
+	if (this->bit_count < 16) this->refill();
+	u16 entry = table.fast[this->bits & ((1 << inflater_table::FAST_BITS) - 1)];
+	if (entry != 0) {
+		this->take(entry & 0xF);
+		return entry >> 4;
+	}
+	// Codes are stored most significant bit first, opposite to everything else in the stream
+	int code = 0, first = 0, index = 0;
+	for (usize length = 1; length < 16; ++length) {
+		code |= static_cast<int>(this->take(1));
+		int count = table.counts[length];
+		if (code - first < count) return table.symbols[index + (code - first)];
+		index += count;
+		first = (first + count) << 1;
+		code <<= 1;
+	}
+	throw std::runtime_error("Bad Huffman code in DEFLATE stream");
+}
+
+void inflater::build(inflater_table& table, const u8* lengths, const usize count) {
+	table.fast.fill(0);
+	table.counts.fill(0);
+	for (usize symbol = 0; symbol < count; ++symbol) table.counts[lengths[symbol]]++;
+	table.counts[0] = 0;
+
+	// More codes of a length than there is room for is damage, fewer is allowed (a single distance code)
+	int left = 1;
+	std::array<u16, 16> offsets = {};
+	for (usize length = 1; length < 16; ++length) {
+		left = (left << 1) - table.counts[length];
+		if (left < 0) throw std::runtime_error("Over-subscribed Huffman code in DEFLATE stream");
+		offsets[length] = (length == 1) ? 0 : static_cast<u16>(offsets[length - 1] + table.counts[length - 1]);
+	}
+
+	// Canonical codes: by length, then by symbol
+	std::array<u16, 16> next = offsets;
+	std::array<u32, 16> next_code = {};
+	u32 code = 0;
+	for (usize length = 1; length < 16; ++length) {
+		code = (code + table.counts[length - 1]) << 1;
+		next_code[length] = code;
+	}
+	for (usize symbol = 0; symbol < count; ++symbol) {
+		u8 length = lengths[symbol];
+		if (length == 0) continue;
+		table.symbols[next[length]++] = static_cast<u16>(symbol);
+
+		u32 assigned = next_code[length]++;
+		if (length > inflater_table::FAST_BITS) continue;
+		u32 reversed = 0;
+		for (usize bit = 0; bit < length; ++bit) reversed |= ((assigned >> bit) & 1) << (length - 1 - bit);
+		for (u32 fill = reversed; fill < (1u << inflater_table::FAST_BITS); fill += 1u << length) {
+			table.fast[fill] = static_cast<u16>((symbol << 4) | length);
+		}
+	}
+}
+
+void inflater::read_dynamic_tables() {
+	usize literal_count = this->take(5) + 257;
+	usize distance_count = this->take(5) + 1;
+	usize code_length_count = this->take(4) + 4;
+	if (literal_count > 286 || distance_count > 30) throw std::runtime_error("Bad DEFLATE block header");
+
+	u8 lengths[288 + 32] = {};
+	for (usize i = 0; i < code_length_count; ++i) lengths[CODE_LENGTH_ORDER[i]] = static_cast<u8>(this->take(3));
+	inflater_table code_lengths;
+	build(code_lengths, lengths, 19);
+
+	// Literal / length and distance code lengths form one run-length coded sequence
+	std::fill(std::begin(lengths), std::end(lengths), 0_u8);
+	usize total = literal_count + distance_count;
+	for (usize i = 0; i < total;) {
+		u16 symbol = this->decode(code_lengths);
+		if (symbol < 16) {
+			lengths[i++] = static_cast<u8>(symbol);
+			continue;
+		}
+		u8 repeated = 0;
+		usize times;
+		if (symbol == 16) {
+			if (i == 0) throw std::runtime_error("Bad DEFLATE code lengths");
+			repeated = lengths[i - 1];
+			times = 3 + this->take(2);
+		}
+		else if (symbol == 17) times = 3 + this->take(3);
+		else times = 11 + this->take(7);
+		if (i + times > total) throw std::runtime_error("Bad DEFLATE code lengths");
+		while (times-- > 0) lengths[i++] = repeated;
+	}
+	if (lengths[256] == 0) throw std::runtime_error("DEFLATE block without an end code");
+	build(this->literals, lengths, literal_count);
+	build(this->distances, lengths + literal_count, distance_count);
+}
+
+void inflater::read_block_header() {
+	this->last_block = this->take(1) != 0;
+	switch (this->take(2)) {
+	case 0: {
+		// Stored: byte aligned, length and its complement
+		this->take(this->bit_count % 8);
+		u32 length = this->take(16);
+		if ((length ^ 0xFFFF) != this->take(16)) throw std::runtime_error("Bad stored block in DEFLATE stream");
+		this->stored_remaining = length;
+		this->state = inflater_state::stored_block;
+		return;
+	}
+	case 1: {
+		u8 lengths[288 + 30];
+		std::fill(lengths, lengths + 144, 8_u8);
+		std::fill(lengths + 144, lengths + 256, 9_u8);
+		std::fill(lengths + 256, lengths + 280, 7_u8);
+		std::fill(lengths + 280, lengths + 288, 8_u8);
+		std::fill(lengths + 288, lengths + 318, 5_u8);
+		build(this->literals, lengths, 288);
+		build(this->distances, lengths + 288, 30);
+		break;
+	}
+	case 2:
+		this->read_dynamic_tables();
+		break;
+	default:
+		throw std::runtime_error("Bad block type in DEFLATE stream");
+	}
+	this->state = inflater_state::huffman_block;
+}
+
+// Decodes until the window holds about half its size of unread output; matches reach back at most 32 KiB
+void inflater::fill() {
+	const usize mask = WINDOW_SIZE - 1;
+	u8* window = this->window.data();
+	while (this->written - this->consumed + MAX_MATCH <= WINDOW_SIZE - MAX_DISTANCE) {
+		switch (this->state) {
+		case inflater_state::block_header:
+			this->read_block_header();
+			break;
+		case inflater_state::stored_block:
+			if (this->stored_remaining == 0) {
+				this->state = this->last_block ? inflater_state::stream_end : inflater_state::block_header;
+				break;
+			}
+			window[this->written++ & mask] = static_cast<u8>(this->take(8));
+			this->stored_remaining--;
+			break;
+		case inflater_state::huffman_block: {
+			u16 symbol = this->decode(this->literals);
+			if (symbol < 256) {
+				window[this->written++ & mask] = static_cast<u8>(symbol);
+				break;
+			}
+			if (symbol == 256) {
+				this->state = this->last_block ? inflater_state::stream_end : inflater_state::block_header;
+				break;
+			}
+			symbol -= 257;
+			if (symbol >= 29) throw std::runtime_error("Bad length code in DEFLATE stream");
+			usize length = LENGTH_BASE[symbol] + this->take(LENGTH_EXTRA[symbol]);
+			u16 code = this->decode(this->distances);
+			if (code >= 30) throw std::runtime_error("Bad distance code in DEFLATE stream");
+			usize distance = DISTANCE_BASE[code] + this->take(DISTANCE_EXTRA[code]);
+			if (distance > this->written) throw std::runtime_error("DEFLATE match before the start of the stream");
+			// Overlapping matches repeat the bytes just written, byte by byte is what makes that work
+			for (usize i = 0; i < length; ++i, ++this->written) window[this->written & mask] = window[(this->written - distance) & mask];
+			break;
+		}
+		case inflater_state::stream_end:
+			return;
+		}
+	}
+}
+
+usize inflater::read(std::span<u8> out) {
+	const usize mask = WINDOW_SIZE - 1;
+	usize done = 0;
+	while (done < out.size()) {
+		if (this->written == this->consumed) {
+			if (this->state == inflater_state::stream_end) break;
+			this->fill();
+			continue;
+		}
+		usize start = this->consumed & mask;
+		usize count = std::min({ out.size() - done, static_cast<usize>(this->written - this->consumed), WINDOW_SIZE - start });
+		std::memcpy(out.data() + done, this->window.data() + start, count);
+		done += count;
+		this->consumed += count;
+	}
+	return done;
+}
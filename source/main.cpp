@@ -12,6 +12,16 @@
 #include "../header/utility.h"
 #include "../header/cpu.h"
 #include "../header/palette.h"
+#include "../header/benchmark.h"
+#include "../header/ppu_pipeline.h"
+#include "../header/run_ahead.h"
+#include "../header/shared_frame_ring.h"
+#include "../header/hd_compositor.h"
+#include "../header/capture.h"
+#include "../header/emulation_server.h"
+#include "../header/rom_library.h"
+#include <csignal>
+#include <cfloat>
 #include <cmath>
 #include <span>
 #include <fstream>
@@ -49,6 +59,7 @@ typedef struct ui_gui_context {
 		std::filesystem::path game_path_opened, game_path_loaded;
 		cartridge* game_opened;
 		cartridge* game_loaded;
+		std::string message;
 
 		ui_rom() :
 			hide(true),
@@ -58,11 +69,60 @@ typedef struct ui_gui_context {
 			game_loaded(nullptr),
 			game_path_opened(),
 			game_path_loaded(),
+			message(),
 			show_chr(false),
 			show_prg(false)
 		{}
 	} m_rom;
 
+	struct ui_library {
+		bool hide;
+		char directory[256];
+		rom_library* library;
+		// The scan fills scanned on its own thread, the window takes it over once finished is set
+		rom_library* scanned;
+		std::jthread scanner;
+		std::atomic<usize> progress;
+		std::atomic<bool> finished;
+		rom_scan_stats stats;
+		std::string scan_error;
+		std::string message;
+		ImGuiTextFilter filter;
+
+		ui_library() :
+			hide(true),
+			directory("."),
+			library(nullptr),
+			scanned(nullptr),
+			scanner(),
+			progress(0),
+			finished(false),
+			stats(),
+			scan_error(),
+			message(),
+			filter()
+		{}
+	} m_library;
+
+	struct ui_cheats {
+		struct ui_cheat {
+			std::string code;
+			cheat parsed;
+			bool enabled;
+		};
+		bool hide;
+		char code[32];
+		std::vector<ui_cheat> list;
+		std::string message;
+
+		ui_cheats() :
+			hide(true),
+			code(""),
+			list(),
+			message()
+		{}
+	} m_cheats;
+
 	struct ui_cpu {
 		struct ui_bus {
 			bool show;
@@ -160,7 +220,7 @@ typedef struct ui_gui_context {
 			w_x(0),
 			cycles(0),
 			scanlines(0),
-			vram(0x0000_u16, 0x07FF_u16),
+			vram(0x0000_u16, 0x0FFF_u16),
 			register_view(false)
 		{}
 	} m_ppu;
@@ -168,30 +228,137 @@ typedef struct ui_gui_context {
 	struct ui_screen {
 		bool hide;
 		bool raw;
+		bool pipelined;
+		cartridge* pipelined_rom;
+		// Run-ahead on a second instance, which also owns the frame sinks while it runs
+		bool second_instance;
+		cartridge* second_instance_rom;
 		GLuint canvas;
-		class ppu* ppu;
+		latest_frame_sink sink;
+		shared_frame_ring* shared;
+		screenshot_sink screenshots;
+		capture_sink* recording;
+		// Connected to an emulation server, the screen shows its frames instead of the local ppu's
+		emulation_client* client;
+		u64 client_shown;
+		char server_name[64];
+		std::string client_error;
+		upscaler* scaler;
+		ntsc_filter* ntsc;
+		hd_compositor* hd;
+		std::string hd_error;
+		GLuint scaled_canvas;
+		usize scaled_width, scaled_height;
+		// What the canvas texture currently holds, rows only get uploaded when their hash changed
+		frame_digest uploaded;
+		bool has_uploaded;
+		// Input to photon, a frame sink of the producer and told by the pads about every latch while measuring
+		latency_probe latency;
 		//struct _ram raw_buffer_bytes;
 		ui_screen() :
 			canvas(0),
 			raw(false),
+			pipelined(false),
+			pipelined_rom(nullptr),
+			second_instance(false),
+			second_instance_rom(nullptr),
 			hide(true),
-			ppu(nullptr)
+			sink(),
+			shared(nullptr),
+			screenshots(),
+			recording(nullptr),
+			client(nullptr),
+			client_shown(0),
+			server_name("nes-server"),
+			client_error(),
+			scaler(nullptr),
+			ntsc(nullptr),
+			hd(nullptr),
+			hd_error(),
+			scaled_canvas(0),
+			scaled_width(0),
+			scaled_height(0),
+			uploaded(),
+			has_uploaded(false),
+			latency()
 			//raw_buffer_bytes(0x0000_u16, 0xefff_u16)
 		{}
 	} m_screen;
 
+	struct ui_audio {
+		// 0 when no device could be opened
+		SDL_AudioDeviceID device;
+		bool muted;
+		audio_ring_sink speaker;
+
+		ui_audio() :
+			device(0),
+			muted(false),
+			speaker()
+		{}
+	} m_audio;
+
+	struct ui_benchmark {
+		bool hide;
+		int frames;
+		std::array<benchmark_result, 2> timing_modes;
+		std::array<benchmark_result, 3> pipelined_rendering;
+		int skip_interval;
+		std::array<benchmark_result, 2> frameskip_rendering;
+		frameskip_check frameskip_verification;
+		std::array<benchmark_result, upscale::FILTER_COUNT> upscale_filters;
+		benchmark_result ntsc_composite;
+		std::array<benchmark_result, 3> bank_switching;
+		std::array<benchmark_result, 2> mmc3_irq;
+		irq_check mmc3_verification;
+		snapshot_check snapshots;
+		std::array<benchmark_result, 4> run_ahead_overhead;
+		int latency_presses;
+		int latency_ahead;
+		bool latency_delay;
+		latency_report latency;
+
+		ui_benchmark() :
+			hide(true),
+			frames(600),
+			timing_modes(),
+			pipelined_rendering(),
+			skip_interval(1),
+			frameskip_rendering(),
+			frameskip_verification(),
+			upscale_filters(),
+			ntsc_composite(),
+			bank_switching(),
+			mmc3_irq(),
+			mmc3_verification(),
+			snapshots(),
+			run_ahead_overhead(),
+			latency_presses(30),
+			latency_ahead(0),
+			latency_delay(false),
+			latency()
+		{}
+	} m_benchmark;
+
 	ui_gui_context() : 
 		m_rom(),
+		m_library(),
+		m_cheats(),
 		m_cpu(),
 		m_ppu(),
-		m_screen()
+		m_screen(),
+		m_audio(),
+		m_benchmark()
 	{}
 } ui_gui_context;
 inline bool static memory_viewer(const char* label, u8 id, u32* start, u32* end, u32* look_for, u16 max, std::span<u8> view, int visible_rows);
 void ppu_window(ui_gui_context::ui_ppu*, ppu*);
 void rom_window(ui_gui_context::ui_rom*, cpu*);
+void library_window(ui_gui_context::ui_library*, ui_gui_context::ui_rom*);
+void cheats_window(ui_gui_context::ui_cheats*, cpu*, run_ahead*);
 void cpu_window(ui_gui_context::ui_cpu*, cpu*);
 void screen_window(ui_gui_context::ui_screen*);
+void benchmark_window(ui_gui_context::ui_benchmark*, cartridge*);
 
 inline void static gui_fetch(ui_gui_context::ui_cpu*, cpu*);
 inline void static gui_decode(ui_gui_context::ui_cpu*, cpu*);
@@ -245,15 +412,137 @@ bool InputHex(const char* label, u32* value, int step = 1, int step_fast = 16, i
 	return to_ret;
 }
 
+// Pad 1 from the keyboard: X = A, Z = B, right shift = Select, enter = Start, arrows; nothing while a widget has focus
+static u8 keyboard_buttons(const bool captured) {
+	constexpr SDL_Scancode BUTTONS[8] = {
+		SDL_SCANCODE_X, SDL_SCANCODE_Z, SDL_SCANCODE_RSHIFT, SDL_SCANCODE_RETURN,
+		SDL_SCANCODE_UP, SDL_SCANCODE_DOWN, SDL_SCANCODE_LEFT, SDL_SCANCODE_RIGHT
+	};
+	if (captured) return 0;
+	const Uint8* keys = SDL_GetKeyboardState(nullptr);
+	u8 buttons = 0;
+	for (usize button = 0; button < 8; ++button) buttons |= static_cast<u8>(keys[BUTTONS[button]] ? 1 << button : 0);
+	return buttons;
+}
+
+// The ppu holding the frame sinks: the pipeline's replica, the run-ahead instance or the emulation ppu itself
+static ppu* frame_producer(ppu* PPU, ppu_pipeline* PIPELINE, run_ahead* RUN_AHEAD) {
+	if (PIPELINE->is_running()) return PIPELINE->get_renderer();
+	if (RUN_AHEAD->is_second_running()) return RUN_AHEAD->get_second_ppu();
+	return PPU;
+}
+
+// Per stage mean, median, 95th percentile and worst case, the total as a histogram
+inline void static latency_results(const latency_report& report) {
+	for (usize stage = 0; stage < latency_report::STAGES; ++stage) {
+		const latency_histogram& histogram = report.stages[stage];
+		ImGui::Text("%-16s %6.2f ms  p50 %3.0f  p95 %3.0f  max %6.2f", latency_report::STAGE_NAMES[stage], histogram.mean_ms(), histogram.percentile_ms(0.5), histogram.percentile_ms(0.95), histogram.max_ms);
+	}
+	const latency_histogram& total = report.stages[latency_stage::input_to_swap];
+	std::array<float, latency_histogram::BUCKETS> counts;
+	for (usize bucket = 0; bucket < latency_histogram::BUCKETS; ++bucket) counts[bucket] = static_cast<float>(total.counts[bucket]);
+	ImGui::PlotHistogram("##latency", counts.data(), static_cast<int>(counts.size()), 0, "Input to swap, 1 ms buckets", 0.f, FLT_MAX, ImVec2(360.f, 60.f));
+	ImGui::TextDisabled("%zu presses, %zu lost", total.samples, report.lost);
+}
+
+static emulation_server* serving = nullptr;
+
+// Headless mode: no window, the game runs until a client sends quit or the process is interrupted
+static int run_server(const std::string& rom_path, const std::string& name) {
+	try {
+		// The library index, when one covers the rom, has the header already corrected
+		std::optional<rom_entry> indexed = rom_library::lookup(rom_path);
+		cartridge game(rom_image::open(rom_path), indexed ? &indexed->header : nullptr);
+		std::string save_path;
+		if (game.has_battery()) save_path = rom_image::save_path(rom_path);
+		emulation_server server(name, game, save_path);
+		serving = &server;
+		std::signal(SIGINT, [](int) { serving->stop(); });
+		std::signal(SIGTERM, [](int) { serving->stop(); });
+
+		std::cout << "Serving " << rom_path << " as " << name << ", control socket " << emulation_server::socket_path(name) << std::endl;
+		server.run();
+		std::cout << server.get_frames() << " frames" << std::endl;
+		serving = nullptr;
+	}
+	catch (const std::runtime_error& error) {
+		std::cerr << error.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
+
+// Offline audio: runs the game as fast as it goes for a number of frames and writes what the apu played
+static int run_wav(const std::string& rom_path, const std::string& wav_path, usize frames) {
+	try {
+		std::optional<rom_entry> indexed = rom_library::lookup(rom_path);
+		cartridge game(rom_image::open(rom_path), indexed ? &indexed->header : nullptr);
+		std::vector<u32> pixel_buffer1(256 * 240, 0xFF000000);
+		std::vector<u32> pixel_buffer2(256 * 240, 0xFF000000);
+		bus machine_bus;
+		cpu machine_cpu;
+		ppu machine_ppu;
+		machine_cpu.connect(&machine_bus);
+		machine_ppu.connect(&machine_bus);
+		machine_ppu.set_pixel_buffers(pixel_buffer1, pixel_buffer2);
+		machine_bus.connect(&machine_cpu);
+		machine_bus.connect(&machine_ppu);
+
+		wav_sink output(wav_path);
+		machine_bus.get_apu().add_sink(&output);
+		machine_cpu.load(&game);
+		machine_cpu.reset();
+		while (machine_ppu.get_frames() < frames && !machine_cpu.get_halted()) machine_cpu.step();
+		machine_bus.get_apu().remove_sink(&output);
+
+		std::cout << machine_ppu.get_frames() << " frames, " << output.get_samples() << " samples at " << machine_bus.get_apu().get_sample_rate() << " Hz to " << wav_path << std::endl;
+		if (output.has_failed()) throw std::runtime_error("Cannot write " + wav_path);
+	}
+	catch (const std::runtime_error& error) {
+		std::cerr << error.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
+
+// Input to photon against a fake 60 Hz display, no window or rom needed
+static int run_latency(usize presses, usize run_ahead_frames, bool frame_delay) {
+	latency_report report = benchmarks::input_latency(presses, run_ahead_frames, frame_delay);
+	std::cout << "Run-ahead " << run_ahead_frames << ", frame delay " << (frame_delay ? "on" : "off") << std::endl;
+	for (usize stage = 0; stage < latency_report::STAGES; ++stage) {
+		const latency_histogram& histogram = report.stages[stage];
+		printf("%-16s mean %6.2f ms  p50 %3.0f  p95 %3.0f  max %6.2f\n", latency_report::STAGE_NAMES[stage], histogram.mean_ms(), histogram.percentile_ms(0.5), histogram.percentile_ms(0.95), histogram.max_ms);
+	}
+	const latency_histogram& total = report.stages[latency_stage::input_to_swap];
+	for (usize bucket = 0; bucket < latency_histogram::BUCKETS; ++bucket) {
+		if (total.counts[bucket] == 0) continue;
+		printf("%3zu ms %5zu %s\n", bucket, total.counts[bucket], std::string(std::min<usize>(total.counts[bucket], 60), '#').c_str());
+	}
+	std::cout << total.samples << " presses, " << report.lost << " lost" << std::endl;
+	return total.samples > 0 ? 0 : 1;
+}
+
 int main(int argc, char* argv[]) {
 
+	if (argc >= 3 && std::string(argv[1]) == "--server") {
+		return run_server(argv[2], argc >= 4 ? argv[3] : "nes-server");
+	}
+	if (argc >= 4 && std::string(argv[1]) == "--wav") {
+		return run_wav(argv[2], argv[3], argc >= 5 ? static_cast<usize>(std::strtoull(argv[4], nullptr, 10)) : 600);
+	}
+	if (argc >= 2 && std::string(argv[1]) == "--latency") {
+		usize presses = argc >= 3 ? static_cast<usize>(std::strtoull(argv[2], nullptr, 10)) : 60;
+		usize ahead = argc >= 4 ? static_cast<usize>(std::strtoull(argv[3], nullptr, 10)) : 0;
+		return run_latency(presses, ahead, argc >= 5 && std::string(argv[4]) == "1");
+	}
+
 	ui_gui_context* ctx = new ui_gui_context();
 
 	// SDL Context
 #ifdef _WIN32
 	::SetProcessDPIAware();
 #endif
-	if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER) != 0) {
+	if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER | SDL_INIT_AUDIO) != 0) {
 		printf("Error during SDL Context initialization: %s", SDL_GetError());
 		return 1;
 	}
@@ -325,15 +614,26 @@ int main(int argc, char* argv[]) {
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 256, 240, 0, GL_BGRA, GL_UNSIGNED_BYTE, pixel_buffer1.data());
 	glBindTexture(GL_TEXTURE_2D, 0);
 
+	GLuint scaled_texture;
+	glGenTextures(1, &scaled_texture);
+	glBindTexture(GL_TEXTURE_2D, scaled_texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
 	bus* BUS = new bus();
 	cpu* CPU = new cpu();
 	ppu* PPU = new ppu();
+	ppu_pipeline* PIPELINE = new ppu_pipeline();
+	run_ahead* RUN_AHEAD = new run_ahead();
 
 	CPU->connect(BUS);
 	PPU->connect(BUS);
 	PPU->set_pixel_buffers(pixel_buffer1, pixel_buffer2);
 	BUS->connect(CPU);
 	BUS->connect(PPU);
+	RUN_AHEAD->connect(CPU, BUS, PPU);
+	CPU->set_frame_callback([RUN_AHEAD](cpu&) { RUN_AHEAD->frame_done(); });
 
 	ctx->m_cpu.wram.view = CPU->get_wram();
 	update_cpu_registers(&ctx->m_cpu, CPU);
@@ -343,7 +643,33 @@ int main(int argc, char* argv[]) {
 	ctx->m_ppu.oam_memory = PPU->get_oam_memory();
 
 	ctx->m_screen.canvas = canvas_texture;
-	ctx->m_screen.ppu = PPU;
+	ctx->m_screen.scaled_canvas = scaled_texture;
+	PPU->add_sink(&ctx->m_screen.sink);
+	PPU->add_sink(&ctx->m_screen.screenshots);
+
+	// The callback runs on SDL's audio thread and only ever takes from the ring
+	SDL_AudioSpec wanted = {};
+	wanted.freq = 48000;
+	wanted.format = AUDIO_S16SYS;
+	wanted.channels = 1;
+	wanted.samples = 512;
+	wanted.userdata = &ctx->m_audio.speaker;
+	wanted.callback = [](void* speaker, Uint8* stream, int length) {
+		static_cast<audio_ring_sink*>(speaker)->read(std::span<i16>(reinterpret_cast<i16*>(stream), static_cast<usize>(length) / sizeof(i16)));
+	};
+	SDL_AudioSpec obtained = {};
+	ctx->m_audio.device = SDL_OpenAudioDevice(nullptr, 0, &wanted, &obtained, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+	if (ctx->m_audio.device == 0) {
+		printf("No audio: %s\n", SDL_GetError());
+	}
+	else {
+		BUS->get_apu().set_sample_rate(static_cast<u32>(obtained.freq));
+		BUS->get_apu().add_sink(&ctx->m_audio.speaker);
+		// The sound card's clock paces the emulation, video pacing only when there is no device
+		CPU->get_pacer().set_speaker(&ctx->m_audio.speaker);
+		CPU->get_pacer().set_mode(pacing_mode::audio_clock);
+		SDL_PauseAudioDevice(ctx->m_audio.device, 0);
+	}
 
 	auto ppu_ctx = &(ctx->m_ppu);
 
@@ -357,6 +683,15 @@ int main(int argc, char* argv[]) {
 		SDL_Event event;
 		while (SDL_PollEvent(&event)) {
 			ImGui_ImplSDL2_ProcessEvent(&event);
+			// Straight into the pads' atomic word, the game picks it up at its next strobe
+			if (event.type == SDL_KEYDOWN || event.type == SDL_KEYUP) {
+				controller_ports& pads = BUS->get_controllers();
+				u8 buttons = keyboard_buttons(io.WantCaptureKeyboard);
+				if (buttons != pads.get_buttons(0)) {
+					pads.set_buttons(0, buttons);
+					ctx->m_screen.latency.input(pads.get_all_buttons());
+				}
+			}
 			if (event.type == SDL_KEYDOWN) {
 				switch (event.key.keysym.sym) {
 				case SDLK_ESCAPE:
@@ -397,6 +732,12 @@ int main(int argc, char* argv[]) {
 				if (ImGui::MenuItem(ctx->m_rom.hide ? "Show" : "Hide")) {
 					ctx->m_rom.hide = !ctx->m_rom.hide;
 				}
+				if (ImGui::MenuItem("Library", nullptr, !ctx->m_library.hide)) {
+					ctx->m_library.hide = !ctx->m_library.hide;
+				}
+				if (ImGui::MenuItem("Cheats", nullptr, !ctx->m_cheats.hide)) {
+					ctx->m_cheats.hide = !ctx->m_cheats.hide;
+				}
 				ImGui::EndMenu();
 			}
 
@@ -417,6 +758,36 @@ int main(int argc, char* argv[]) {
 				ImGui::MenuItem("Registers view", nullptr, &ctx->m_ppu.register_view, !ctx->m_ppu.hide);
 				ImGui::Separator();
 				ImGui::MenuItem("VRAM view", nullptr, &ctx->m_ppu.vram.show, !ctx->m_ppu.hide);
+				ImGui::Separator();
+				// The emulation thread calls through both on every tick, they only change while it is stopped
+				bool can_retime = (CPU->get_paused() || CPU->get_halted()) && !ctx->m_screen.pipelined;
+				bool dot_timing = PPU->get_timing() == ppu_timing::dot;
+				if (ImGui::MenuItem("Dot accurate timing", nullptr, &dot_timing, can_retime)) {
+					CPU->wait_idle();
+					PPU->set_timing(dot_timing ? ppu_timing::dot : ppu_timing::scanline);
+				}
+				bool per_fetch = PPU->get_a12_mode() == a12_mode::per_fetch;
+				if (ImGui::MenuItem("Per fetch MMC3 IRQ", nullptr, &per_fetch, can_retime)) {
+					CPU->wait_idle();
+					PPU->set_a12_mode(per_fetch ? a12_mode::per_fetch : a12_mode::predicted);
+				}
+				if (ImGui::BeginMenu("Frame skip")) {
+					frameskip& skipper = PPU->get_frameskip();
+					for (usize mode = 0; mode < 3; ++mode) {
+						if (ImGui::MenuItem(frameskip::MODE_NAMES[mode], nullptr, skipper.get_mode() == mode)) {
+							skipper.set_mode(static_cast<frameskip_mode>(mode));
+						}
+					}
+					ImGui::Separator();
+					int interval = static_cast<int>(skipper.get_interval());
+					ImGui::SetNextItemWidth(80.f);
+					if (ImGui::SliderInt("Fixed skip", &interval, 1, 9)) skipper.set_interval(static_cast<usize>(interval));
+					int max_skip = static_cast<int>(skipper.get_max_skip());
+					ImGui::SetNextItemWidth(80.f);
+					if (ImGui::SliderInt("Adaptive max", &max_skip, 1, 9)) skipper.set_max_skip(static_cast<usize>(max_skip));
+					ImGui::Text("Skipped %zu frames", skipper.get_skipped());
+					ImGui::EndMenu();
+				}
 				ImGui::EndMenu();
 			}
 
@@ -427,16 +798,341 @@ int main(int argc, char* argv[]) {
 				}
 				ImGui::Separator();
 				ImGui::MenuItem("Raw bytes", nullptr, &ctx->m_screen.raw, !ctx->m_screen.hide);
+				ImGui::Separator();
+				bool can_switch = CPU->get_rom_loaded() && (CPU->get_paused() || CPU->get_halted()) && PPU->get_timing() == ppu_timing::scanline && !RUN_AHEAD->is_second_running();
+				if (ImGui::MenuItem("Threaded rendering", nullptr, &ctx->m_screen.pipelined, can_switch)) {
+					if (ctx->m_screen.pipelined) {
+						PIPELINE->start(PPU, ctx->m_rom.game_loaded, pixel_buffer1, pixel_buffer2);
+						ctx->m_screen.pipelined_rom = ctx->m_rom.game_loaded;
+					}
+					else {
+						PIPELINE->stop();
+					}
+				}
+				ImGui::Separator();
+				bool shared_output = ctx->m_screen.shared != nullptr;
+				if (ImGui::MenuItem("Shared memory output", nullptr, &shared_output)) {
+					ppu* producer = frame_producer(PPU, PIPELINE, RUN_AHEAD);
+					if (shared_output) {
+						try {
+							ctx->m_screen.shared = new shared_frame_ring("nes-frames", 4);
+							producer->add_sink(ctx->m_screen.shared);
+						}
+						catch (const std::runtime_error& error) {
+							std::cerr << error.what() << std::endl;
+						}
+					}
+					else {
+						producer->remove_sink(ctx->m_screen.shared);
+						delete ctx->m_screen.shared;
+						ctx->m_screen.shared = nullptr;
+					}
+				}
+				if (ctx->m_screen.shared != nullptr) {
+					ImGui::TextDisabled("%s, %llu frames", ctx->m_screen.shared->get_name().c_str(), static_cast<unsigned long long>(ctx->m_screen.shared->get_published()));
+				}
+				if (ImGui::BeginMenu("Emulation server")) {
+					emulation_client*& client = ctx->m_screen.client;
+					if (client == nullptr) {
+						ImGui::InputText("Name", ctx->m_screen.server_name, sizeof(ctx->m_screen.server_name));
+						if (ImGui::MenuItem("Connect")) {
+							try {
+								client = new emulation_client(ctx->m_screen.server_name);
+								ctx->m_screen.client_shown = 0;
+								ctx->m_screen.client_error.clear();
+							}
+							catch (const std::runtime_error& error) {
+								ctx->m_screen.client_error = error.what();
+							}
+						}
+					}
+					else {
+						shared_frame_reader& frames = client->get_frames();
+						u32 status = frames.get_status();
+						u64 sequence = frames.get_published();
+						const shared_frame_slot* slot = sequence > 0 ? frames.slot(sequence) : nullptr;
+						if (slot != nullptr) {
+							shared_machine_state machine = slot->machine;
+							u64 frame = slot->frame;
+							if (frames.still_valid(sequence)) {
+								ImGui::TextDisabled("frame %llu, PC $%04X, A $%02X X $%02X Y $%02X", static_cast<unsigned long long>(frame), machine.pc, machine.a, machine.x, machine.y);
+							}
+						}
+						const char* COMMANDS[4] = { (status & shared_frame_header::STATUS_PAUSED) ? "resume" : "pause", "step", "reset", "quit" };
+						const char* LABELS[4] = { (status & shared_frame_header::STATUS_PAUSED) ? "Resume" : "Pause", "Step frame", "Reset", "Stop server" };
+						for (usize command = 0; command < 4; ++command) {
+							if (ImGui::MenuItem(LABELS[command], nullptr, false, command != 1 || (status & shared_frame_header::STATUS_PAUSED))) {
+								try {
+									client->request(COMMANDS[command]);
+								}
+								catch (const std::runtime_error& error) {
+									ctx->m_screen.client_error = error.what();
+								}
+							}
+						}
+						if (ImGui::MenuItem("Disconnect")) {
+							delete client;
+							client = nullptr;
+							ctx->m_screen.has_uploaded = false;
+						}
+					}
+					if (!ctx->m_screen.client_error.empty()) ImGui::TextDisabled("%s", ctx->m_screen.client_error.c_str());
+					ImGui::EndMenu();
+				}
+				ImGui::Separator();
+				if (ImGui::MenuItem("Screenshot", nullptr, false, CPU->get_rom_loaded())) {
+					ctx->m_screen.screenshots.request("screenshot-" + std::to_string(PPU->get_frames()) + ".png");
+				}
+				std::string screenshot_status = ctx->m_screen.screenshots.get_status();
+				if (!screenshot_status.empty()) ImGui::TextDisabled("%s", screenshot_status.c_str());
+				if (ImGui::BeginMenu("Record")) {
+					ppu* producer = frame_producer(PPU, PIPELINE, RUN_AHEAD);
+					capture_sink*& recording = ctx->m_screen.recording;
+					constexpr const char* TARGETS[3] = { "capture.y4m", "capture.rgba", "|ffmpeg -y -loglevel error -f yuv4mpegpipe -i - capture.mp4" };
+					constexpr const char* LABELS[3] = { "Y4M to capture.y4m", "Raw RGBA to capture.rgba", "Pipe to ffmpeg (capture.mp4)" };
+					constexpr capture_format FORMATS[3] = { capture_format::y4m, capture_format::raw_rgba, capture_format::y4m };
+					for (usize target = 0; target < 3; ++target) {
+						if (ImGui::MenuItem(LABELS[target], nullptr, recording != nullptr && recording->get_target() == TARGETS[target], recording == nullptr)) {
+							try {
+								recording = new capture_sink(TARGETS[target], FORMATS[target]);
+								producer->add_sink(recording);
+								BUS->get_apu().add_sink(recording);
+							}
+							catch (const std::runtime_error& error) {
+								std::cerr << error.what() << std::endl;
+							}
+						}
+					}
+					if (ImGui::MenuItem("Stop", nullptr, false, recording != nullptr)) {
+						producer->remove_sink(recording);
+						BUS->get_apu().remove_sink(recording);
+						delete recording;
+						recording = nullptr;
+					}
+					if (recording != nullptr) {
+						ImGui::Separator();
+						ImGui::TextDisabled("%zu written, %zu dropped, %.1f MiB", recording->get_written(), recording->get_dropped(), static_cast<double>(recording->get_bytes()) / (1024.0 * 1024.0));
+						ImGui::TextDisabled("queue %zu/%zu (peak %zu), %.3f ms/frame%s", recording->get_queued(), recording->get_slot_count(), recording->get_peak_queued(), recording->get_ms_per_frame(), recording->has_failed() ? ", target failed" : "");
+					}
+					ImGui::EndMenu();
+				}
+				ImGui::Separator();
+				if (ImGui::BeginMenu("Filter")) {
+					ppu* producer = frame_producer(PPU, PIPELINE, RUN_AHEAD);
+					upscaler*& scaler = ctx->m_screen.scaler;
+					ntsc_filter*& ntsc = ctx->m_screen.ntsc;
+					auto remove_filters = [&] {
+						if (scaler != nullptr) { producer->remove_sink(scaler); delete scaler; scaler = nullptr; }
+						if (ntsc != nullptr) { producer->remove_sink(ntsc); delete ntsc; ntsc = nullptr; }
+						if (ctx->m_screen.hd != nullptr) { producer->remove_sink(ctx->m_screen.hd); delete ctx->m_screen.hd; ctx->m_screen.hd = nullptr; }
+						ctx->m_screen.scaled_width = 0;
+						ctx->m_screen.scaled_height = 0;
+					};
+					if (ImGui::MenuItem("None", nullptr, scaler == nullptr && ntsc == nullptr && ctx->m_screen.hd == nullptr)) {
+						remove_filters();
+					}
+					for (usize filter = 0; filter < upscale::FILTER_COUNT; ++filter) {
+						if (ImGui::MenuItem(upscale::NAMES[filter], nullptr, scaler != nullptr && scaler->get_filter() == filter)) {
+							if (scaler == nullptr) {
+								remove_filters();
+								scaler = new upscaler(static_cast<upscale_filter>(filter), worker_pool::default_helpers());
+								producer->add_sink(scaler);
+							}
+							else scaler->set_filter(static_cast<upscale_filter>(filter));
+						}
+					}
+					if (ImGui::MenuItem("NTSC composite", nullptr, ntsc != nullptr) && ntsc == nullptr) {
+						remove_filters();
+						ntsc = new ntsc_filter(worker_pool::default_helpers());
+						producer->add_sink(ntsc);
+					}
+					if (ImGui::MenuItem("HD pack...", nullptr, ctx->m_screen.hd != nullptr)) {
+						remove_filters();
+						IGFD::FileDialogConfig config;
+						config.path = ".";
+						ImGuiFileDialog::Instance()->OpenDialog("choose-hd-pack", "Choose HD pack", ".hdpk", config);
+					}
+					if (scaler != nullptr) {
+						ImGui::Separator();
+						ImGui::TextDisabled("%.3f ms/frame on %zu threads, %zu dropped", scaler->get_ms_per_frame(scaler->get_filter()), scaler->get_bands(), scaler->get_dropped());
+					}
+					if (ntsc != nullptr) {
+						ImGui::Separator();
+						ImGui::TextDisabled("%.3f ms/frame on %zu threads, %zu dropped", ntsc->get_ms_per_frame(), ntsc->get_bands(), ntsc->get_dropped());
+					}
+					if (ctx->m_screen.hd != nullptr) {
+						hd_compositor* hd = ctx->m_screen.hd;
+						ImGui::Separator();
+						ImGui::TextDisabled("%zux, %zu images, %zu tile rows replaced", hd->get_scale(), hd->get_pack().get_image_count(), hd->get_replaced());
+						ImGui::TextDisabled("%.3f ms/frame, %zu dropped", hd->get_ms_per_frame(), hd->get_dropped());
+					}
+					if (!ctx->m_screen.hd_error.empty()) {
+						ImGui::Separator();
+						ImGui::TextDisabled("%s", ctx->m_screen.hd_error.c_str());
+					}
+					ImGui::EndMenu();
+				}
+				ImGui::EndMenu();
+			}
+
+			if (ImGui::BeginMenu("Input")) {
+				controller_ports& pads = BUS->get_controllers();
+				bool four_score = pads.get_four_score();
+				if (ImGui::MenuItem("Four Score", nullptr, &four_score)) pads.set_four_score(four_score);
+				ImGui::Separator();
+				ImGui::TextDisabled("Pad 1: X, Z, right shift, enter, arrows");
+				for (usize port = 0; port < (four_score ? controller_ports::PORTS : 2); ++port) {
+					u8 buttons = pads.get_buttons(port);
+					char held[9] = "ABsSUDLR";
+					for (usize button = 0; button < 8; ++button) if (!(buttons & (1 << button))) held[button] = '.';
+					ImGui::TextDisabled("Pad %zu  %s", port + 1, held);
+				}
+				ImGui::Separator();
+				if (ImGui::BeginMenu("Run-ahead")) {
+					int ahead = static_cast<int>(RUN_AHEAD->get_frames());
+					ImGui::SetNextItemWidth(80.f);
+					if (ImGui::SliderInt("Frames", &ahead, 0, static_cast<int>(run_ahead::MAX_FRAMES))) RUN_AHEAD->set_frames(static_cast<usize>(ahead));
+					bool can_switch = CPU->get_rom_loaded() && (CPU->get_paused() || CPU->get_halted()) && !PIPELINE->is_running();
+					if (ImGui::MenuItem("Second instance", nullptr, &ctx->m_screen.second_instance, can_switch)) {
+						if (ctx->m_screen.second_instance) {
+							RUN_AHEAD->start_second(ctx->m_rom.game_loaded, pixel_buffer1, pixel_buffer2);
+							ctx->m_screen.second_instance_rom = ctx->m_rom.game_loaded;
+						}
+						else {
+							RUN_AHEAD->stop_second();
+						}
+					}
+					ImGui::Separator();
+					if (PIPELINE->is_running()) ImGui::TextDisabled("Off while rendering is threaded");
+					else if (RUN_AHEAD->get_frames() > 0 || RUN_AHEAD->is_second_running()) {
+						ImGui::TextDisabled("%zu byte state, save %.2f us, load %.2f us", RUN_AHEAD->get_state_size(), RUN_AHEAD->get_save_us(), RUN_AHEAD->get_load_us());
+						ImGui::TextDisabled("Ahead %.3f ms/frame%s", RUN_AHEAD->get_ahead_us() / 1000.0, RUN_AHEAD->is_second_running() ? " on its own thread" : "");
+						if (RUN_AHEAD->is_second_running()) ImGui::TextDisabled("%zu states dropped", RUN_AHEAD->get_dropped());
+					}
+					ImGui::EndMenu();
+				}
+				if (ImGui::BeginMenu("Latency")) {
+					latency_probe& probe = ctx->m_screen.latency;
+					bool measuring = probe.get_enabled();
+					if (ImGui::MenuItem("Measure input to photon", nullptr, &measuring)) {
+						ppu* producer = frame_producer(PPU, PIPELINE, RUN_AHEAD);
+						if (measuring) {
+							producer->add_sink(&probe);
+							BUS->get_controllers().set_probe(&probe);
+						}
+						else {
+							BUS->get_controllers().set_probe(nullptr);
+							producer->remove_sink(&probe);
+						}
+						probe.set_enabled(measuring);
+					}
+					if (ImGui::MenuItem("Clear")) probe.clear();
+					ImGui::Separator();
+					ImGui::TextDisabled("Pad 1 presses, timed from delivery to the swap");
+					latency_results(probe.get_report());
+					ImGui::EndMenu();
+				}
+				ImGui::EndMenu();
+			}
+
+			if (ImGui::BeginMenu("Audio")) {
+				if (ImGui::MenuItem("Mute", nullptr, &ctx->m_audio.muted, ctx->m_audio.device != 0)) {
+					SDL_PauseAudioDevice(ctx->m_audio.device, ctx->m_audio.muted ? 1 : 0);
+				}
+				frame_pacer& pacer = CPU->get_pacer();
+				if (ImGui::BeginMenu("Pacing")) {
+					for (usize mode = 0; mode < 3; ++mode) {
+						bool available = mode != pacing_mode::audio_clock || ctx->m_audio.device != 0;
+						if (ImGui::MenuItem(frame_pacer::MODE_NAMES[mode], nullptr, pacer.get_mode() == mode, available)) {
+							pacer.set_mode(static_cast<pacing_mode>(mode));
+						}
+					}
+					ImGui::Separator();
+					frame_delay& delay = pacer.get_frame_delay();
+					bool delay_enabled = delay.get_enabled();
+					if (ImGui::MenuItem("Frame delay", nullptr, &delay_enabled, pacer.get_mode() != pacing_mode::unthrottled)) delay.set_enabled(delay_enabled);
+					bool auto_tune = delay.get_auto_tune();
+					if (ImGui::MenuItem("Auto-tune margin", nullptr, &auto_tune)) delay.set_auto_tune(auto_tune);
+					float margin = static_cast<float>(delay.get_base_margin() * 1000.0);
+					ImGui::SetNextItemWidth(80.f);
+					if (ImGui::SliderFloat("Margin ms", &margin, 0.f, 8.f, "%.1f")) delay.set_margin(static_cast<double>(margin) / 1000.0);
+					if (delay.get_enabled()) {
+						if (delay.get_display_period() > 0.0) ImGui::TextDisabled("Display %.2f Hz, frame work %.2f ms", 1.0 / delay.get_display_period(), delay.get_work() * 1000.0);
+						else ImGui::TextDisabled("Waiting for the screen window");
+						ImGui::TextDisabled("Delay %.2f ms, margin %.2f ms, %zu missed", delay.get_delay() * 1000.0, delay.get_margin() * 1000.0, delay.get_misses());
+					}
+					ImGui::EndMenu();
+				}
+				if (ctx->m_audio.device != 0) {
+					audio_ring_sink& speaker = ctx->m_audio.speaker;
+					u32 rate = BUS->get_apu().get_sample_rate();
+					ImGui::Separator();
+					ImGui::TextDisabled("%u Hz, %zu/%zu queued (%.1f ms)", rate, speaker.get_queued(), speaker.get_capacity(), 1000.0 * static_cast<double>(speaker.get_queued()) / rate);
+					ImGui::TextDisabled("%zu dropped, %zu underruns", speaker.get_dropped(), speaker.get_underruns());
+					const char* clock_name = (pacer.get_mode() == pacing_mode::unthrottled) ? "nothing" : pacer.is_audio_clocked() ? "audio" : "video";
+					ImGui::TextDisabled("Rate %+.3f%%, paced by %s", (pacer.get_rate_adjust() - 1.0) * 100.0, clock_name);
+				}
+				else ImGui::TextDisabled("No audio device");
+				ImGui::EndMenu();
+			}
+
+			if (ImGui::BeginMenu("Benchmark")) {
+				if (ImGui::MenuItem(ctx->m_benchmark.hide ? "Show" : "Hide")) {
+					ctx->m_benchmark.hide = !ctx->m_benchmark.hide;
+				}
 				ImGui::EndMenu();
 			}
 
 			ImGui::EndMainMenuBar();
 		}
 
+		if (ImGuiFileDialog::Instance()->Display("choose-hd-pack")) {
+			if (ImGuiFileDialog::Instance()->IsOk()) {
+				ppu* producer = frame_producer(PPU, PIPELINE, RUN_AHEAD);
+				try {
+					ctx->m_screen.hd = new hd_compositor(ImGuiFileDialog::Instance()->GetFilePathName(), worker_pool::default_helpers());
+					producer->add_sink(ctx->m_screen.hd);
+					ctx->m_screen.hd_error.clear();
+				}
+				catch (const std::runtime_error& error) {
+					ctx->m_screen.hd_error = error.what();
+				}
+			}
+			ImGuiFileDialog::Instance()->Close();
+		}
+
+		if (ctx->m_screen.client != nullptr) {
+			try {
+				ctx->m_screen.client->set_input(0, keyboard_buttons(io.WantCaptureKeyboard));
+			}
+			catch (const std::runtime_error& error) {
+				ctx->m_screen.client_error = error.what();
+				delete ctx->m_screen.client;
+				ctx->m_screen.client = nullptr;
+				ctx->m_screen.has_uploaded = false;
+			}
+		}
+
+		if (PIPELINE->is_running() && ctx->m_screen.pipelined_rom != ctx->m_rom.game_loaded) {
+			PIPELINE->stop();
+			ctx->m_screen.pipelined = false;
+		}
+		if (RUN_AHEAD->is_second_running() && ctx->m_screen.second_instance_rom != ctx->m_rom.game_loaded) {
+			RUN_AHEAD->stop_second();
+			ctx->m_screen.second_instance = false;
+		}
+
 		if (!ctx->m_cpu.hide) { cpu_window(&(ctx->m_cpu), CPU); }
 		if (!ctx->m_rom.hide) { rom_window(&(ctx->m_rom), CPU); }
+		if (!ctx->m_library.hide) { library_window(&(ctx->m_library), &(ctx->m_rom)); }
+		if (!ctx->m_cheats.hide) { cheats_window(&(ctx->m_cheats), CPU, RUN_AHEAD); }
 		if (!ctx->m_ppu.hide) { ppu_window(&(ctx->m_ppu), PPU); }
-		if (!ctx->m_screen.hide) { screen_window(&(ctx->m_screen)); }
+		if (!ctx->m_screen.hide) {
+			// The frame delay aims each frame's end at the moment the screen takes it
+			CPU->get_pacer().get_frame_delay().display_latched();
+			screen_window(&(ctx->m_screen));
+		}
+		if (!ctx->m_benchmark.hide) { benchmark_window(&(ctx->m_benchmark), ctx->m_rom.game_loaded); }
 
 		/* * * * * * * * * * Main Window End * * * * * * * * * */
 
@@ -446,14 +1142,27 @@ int main(int argc, char* argv[]) {
 		glClear(GL_COLOR_BUFFER_BIT);
 		ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 		SDL_GL_SwapWindow(window);
+		ctx->m_screen.latency.swapped();
 	}
 
-	// Cleanup
+	// Cleanup, the CPU first so the emulation thread is joined before anything it writes to goes away
+	delete CPU;
+	delete RUN_AHEAD;
+	delete PIPELINE;
+	delete PPU;
+	if (ctx->m_screen.shared != nullptr) { delete ctx->m_screen.shared; }
+	if (ctx->m_screen.scaler != nullptr) { delete ctx->m_screen.scaler; }
+	if (ctx->m_screen.ntsc != nullptr) { delete ctx->m_screen.ntsc; }
+	if (ctx->m_screen.hd != nullptr) { delete ctx->m_screen.hd; }
+	if (ctx->m_screen.recording != nullptr) { delete ctx->m_screen.recording; }
+	if (ctx->m_screen.client != nullptr) { delete ctx->m_screen.client; }
 	if (ctx->m_rom.game_opened != nullptr) { delete ctx->m_rom.game_opened; }
 	if (ctx->m_rom.game_loaded != nullptr) { delete ctx->m_rom.game_loaded; }
+	if (ctx->m_audio.device != 0) { SDL_CloseAudioDevice(ctx->m_audio.device); }
+	if (ctx->m_library.scanner.joinable()) { ctx->m_library.scanner.join(); }
+	if (ctx->m_library.scanned != nullptr) { delete ctx->m_library.scanned; }
+	if (ctx->m_library.library != nullptr) { delete ctx->m_library.library; }
 	delete ctx;
-	delete PPU;
-	delete CPU;
 	delete BUS;
 	ImGui_ImplOpenGL3_Shutdown();
 	ImGui_ImplSDL2_Shutdown();
@@ -634,16 +1343,25 @@ void rom_window(ui_gui_context::ui_rom* ctx, cpu* cpu) {
 	if (ImGui::Button("Open")) {
 		IGFD::FileDialogConfig config;
 		config.path = ".";
-		ImGuiFileDialog::Instance()->OpenDialog("choose-file", "Choose Rom", ".nes,.txt", config);
+		ImGuiFileDialog::Instance()->OpenDialog("choose-file", "Choose Rom", "Roms{.nes,.zip,.gz},.nes,.zip,.gz,.txt", config);
 	}
 	if (ImGuiFileDialog::Instance()->Display("choose-file")) {
 		if (ImGuiFileDialog::Instance()->IsOk()) {
 			std::string s = ImGuiFileDialog::Instance()->GetFilePathName();
-			ctx->game_path_opened = std::filesystem::path(s);
-			std::vector<u8> x = read_file(s);
-			ctx->game_opened = new cartridge(x);
-			ctx->inserted = true;
-			ctx->loaded = false;
+			try {
+				// Opening maps the file, loading then shares the mapping instead of copying the rom again
+				std::optional<rom_entry> indexed = rom_library::lookup(s);
+				cartridge* opened = new cartridge(rom_image::open(s), indexed ? &indexed->header : nullptr);
+				if (ctx->game_opened != nullptr) delete ctx->game_opened;
+				ctx->game_opened = opened;
+				ctx->game_path_opened = std::filesystem::path(s);
+				ctx->inserted = true;
+				ctx->loaded = false;
+				ctx->message.clear();
+			}
+			catch (const std::runtime_error& error) {
+				ctx->message = error.what();
+			}
 		}
 
 		ImGuiFileDialog::Instance()->Close();
@@ -651,10 +1369,35 @@ void rom_window(ui_gui_context::ui_rom* ctx, cpu* cpu) {
 
 	if (ctx->inserted && !ctx->loaded) {
 		ImGui::SameLine(); ImGui::Spacing(); ImGui::SameLine();
-		if (ImGui::Button("Load")) {
+		bool supported = mapper::is_supported(ctx->game_opened->get_mapper());
+		ImGui::BeginDisabled(!supported);
+		bool load = ImGui::Button("Load");
+		ImGui::EndDisabled();
+		if (!supported) {
+			ImGui::SameLine();
+			ImGui::TextDisabled("Mapper %d is not supported", static_cast<int>(ctx->game_opened->get_mapper()));
+		}
+		if (load) {
+			cartridge* previous = ctx->game_loaded;
 			ctx->game_loaded = new cartridge(*ctx->game_opened);
 			ctx->game_path_loaded = ctx->game_path_opened;
+			ctx->message.clear();
+			if (ctx->game_loaded->has_battery()) {
+				// The save sits next to the rom, a game without one still runs but forgets on exit
+				std::filesystem::path save_path = rom_image::save_path(ctx->game_path_loaded.string());
+				try {
+					ctx->game_loaded->attach_save(save_path.string());
+					ctx->message = "Save: " + save_path.filename().string();
+				}
+				catch (const std::runtime_error& error) {
+					ctx->message = error.what();
+				}
+			}
+			// The emulation thread may still be inside the old mapper and its PRG-RAM, both go with the load
+			cpu->pause();
+			cpu->wait_idle();
 			cpu->load(ctx->game_loaded);
+			if (previous != nullptr) delete previous;
 			
 			cpu->reset();
 			ctx->loaded = true;
@@ -663,13 +1406,18 @@ void rom_window(ui_gui_context::ui_rom* ctx, cpu* cpu) {
 		ImGui::Text("Rom name: %s", ctx->game_path_opened.filename().string().c_str());
 	}
 
+	if (!ctx->message.empty()) ImGui::TextWrapped("%s", ctx->message.c_str());
+
 	ImGui::SeparatorText("Currently loaded Rom");
 	
 	if (ctx->game_loaded != nullptr) {
 		ImGui::Text("Name: %s", ctx->game_path_loaded.filename().string().c_str());
-		ImGui::Text("Mapper: %d", static_cast<int>(ctx->game_loaded->get_mapper()));
+		u16 mapper_number = ctx->game_loaded->get_mapper();
+		ImGui::Text("Mapper: %d (%s)", static_cast<int>(mapper_number), mapper_number < 8 ? mapper::NAMES[mapper_number] : "");
 		int mirroring = ctx->game_loaded->get_mirroring();
 		ImGui::Text("Screen mirroring: %d (%s)", mirroring, cartridge::SCREEN_MIRRORING_NAMES[mirroring]);
+		const std::shared_ptr<const rom_image>& image = ctx->game_loaded->get_image();
+		ImGui::Text("Image: %s, %ld users", image->is_mapped() ? "mapped" : "in memory", image.use_count());
 
 		if (ctx->show_prg = ImGui::TreeNode("Prg content")) {
 
@@ -764,6 +1512,170 @@ void rom_window(ui_gui_context::ui_rom* ctx, cpu* cpu) {
 	ImGui::End();
 }
 
+void library_window(ui_gui_context::ui_library* ctx, ui_gui_context::ui_rom* rom) {
+	if (ctx->finished.load(std::memory_order_acquire)) {
+		ctx->scanner.join();
+		ctx->finished.store(false);
+		if (ctx->scanned != nullptr) {
+			if (ctx->library != nullptr) delete ctx->library;
+			ctx->library = ctx->scanned;
+			ctx->scanned = nullptr;
+			char summary[128];
+			std::snprintf(summary, sizeof(summary), "%zu roms, %zu hashed (%.1f MiB) in %.2f s", ctx->stats.files, ctx->stats.hashed, ctx->stats.hashed_bytes / (1024.0 * 1024.0), ctx->stats.seconds);
+			ctx->message = summary;
+		}
+		else ctx->message = ctx->scan_error;
+	}
+
+	ImGui::SetNextWindowSize(ImVec2{ 640.f, 400.f }, ImGuiCond_FirstUseEver);
+	if (!ImGui::Begin("Library")) {
+		ImGui::End();
+		return;
+	}
+
+	bool scanning = ctx->scanner.joinable();
+	ImGui::InputText("Directory", ctx->directory, sizeof(ctx->directory));
+	ImGui::SameLine();
+	ImGui::BeginDisabled(scanning);
+	if (ImGui::Button("Scan")) {
+		ctx->progress.store(0);
+		std::string directory = ctx->directory;
+		// Unchanged files keep their index entry, only new and modified ones get hashed
+		ctx->scanner = std::jthread([ctx, directory] {
+			try {
+				std::unique_ptr<rom_library> library = std::make_unique<rom_library>(directory);
+				ctx->stats = library->scan(worker_pool::default_helpers(), &ctx->progress);
+				ctx->scanned = library.release();
+			}
+			catch (const std::runtime_error& error) {
+				ctx->scan_error = error.what();
+			}
+			ctx->finished.store(true, std::memory_order_release);
+		});
+	}
+	ImGui::EndDisabled();
+
+	if (scanning) ImGui::Text("Scanning, %zu files done", ctx->progress.load(std::memory_order_relaxed));
+	else if (!ctx->message.empty()) ImGui::TextWrapped("%s", ctx->message.c_str());
+
+	if (ctx->library == nullptr) {
+		ImGui::End();
+		return;
+	}
+	ctx->filter.Draw("Filter");
+
+	std::vector<const rom_entry*> shown;
+	for (const rom_entry& entry : ctx->library->get_entries()) {
+		if (ctx->filter.PassFilter(entry.title.c_str()) || ctx->filter.PassFilter(entry.path.c_str())) shown.push_back(&entry);
+	}
+	if (ImGui::BeginTable("library-table", 6, ImGuiTableFlags_RowBg | ImGuiTableFlags_Borders | ImGuiTableFlags_ScrollY | ImGuiTableFlags_Resizable)) {
+		ImGui::TableSetupScrollFreeze(0, 1);
+		ImGui::TableSetupColumn("Title");
+		ImGui::TableSetupColumn("Mapper");
+		ImGui::TableSetupColumn("PRG / CHR");
+		ImGui::TableSetupColumn("CRC32");
+		ImGui::TableSetupColumn("Header");
+		ImGui::TableSetupColumn("");
+		ImGui::TableHeadersRow();
+
+		// Thousands of rows, only the visible ones are laid out
+		ImGuiListClipper clipper;
+		clipper.Begin(static_cast<int>(shown.size()));
+		while (clipper.Step()) {
+			for (int row = clipper.DisplayStart; row < clipper.DisplayEnd; ++row) {
+				const rom_entry& entry = *shown[row];
+				ImGui::PushID(row);
+				ImGui::TableNextRow();
+				ImGui::TableNextColumn();
+				ImGui::TextUnformatted(entry.title.c_str());
+				if (ImGui::IsItemHovered()) ImGui::SetTooltip("%s", entry.path.c_str());
+				ImGui::TableNextColumn();
+				if (entry.valid) ImGui::Text("%d%s", static_cast<int>(entry.header.mapper), mapper::is_supported(entry.header.mapper) ? "" : " (unsupported)");
+				ImGui::TableNextColumn();
+				if (entry.valid) ImGui::Text("%zuK / %zuK", entry.header.prg_rom_size >> 10, entry.header.chr_rom_size >> 10);
+				ImGui::TableNextColumn();
+				ImGui::Text("%08X", entry.crc32);
+				ImGui::TableNextColumn();
+				if (!entry.valid) ImGui::TextDisabled("Invalid");
+				else ImGui::Text("%s%s", entry.header.nes2 ? "NES 2.0" : "iNES", entry.corrected ? ", corrected" : entry.in_database ? ", verified" : "");
+				ImGui::TableNextColumn();
+				ImGui::BeginDisabled(!entry.valid || !mapper::is_supported(entry.header.mapper));
+				if (ImGui::SmallButton("Open")) {
+					std::string path = ctx->library->full_path(entry);
+					try {
+						// A file changed since the scan gets its own header, the indexed one may not fit it anymore
+						bool current = ctx->library->is_current(entry);
+						cartridge* opened = new cartridge(rom_image::open(path), current ? &entry.header : nullptr);
+						if (rom->game_opened != nullptr) delete rom->game_opened;
+						rom->game_opened = opened;
+						rom->game_path_opened = std::filesystem::path(path);
+						rom->inserted = true;
+						rom->loaded = false;
+						rom->message = !current ? "Changed since the last scan" : entry.corrected ? "Header corrected from the game database" : "";
+						rom->hide = false;
+					}
+					catch (const std::runtime_error& error) {
+						rom->message = error.what();
+					}
+				}
+				ImGui::EndDisabled();
+				ImGui::PopID();
+			}
+		}
+		ImGui::EndTable();
+	}
+	ImGui::End();
+}
+
+void cheats_window(ui_gui_context::ui_cheats* ctx, cpu* CPU, run_ahead* RUN_AHEAD) {
+	ImGui::SetNextWindowSize(ImVec2{ 320.f, 300.f }, ImGuiCond_FirstUseEver);
+	if (!ImGui::Begin("Cheats")) {
+		ImGui::End();
+		return;
+	}
+
+	bool changed = false;
+	bool add = ImGui::InputText("Code", ctx->code, sizeof(ctx->code), ImGuiInputTextFlags_EnterReturnsTrue);
+	ImGui::SameLine();
+	add |= ImGui::Button("Add");
+	if (add && ctx->code[0] != '\0') {
+		try {
+			cheat parsed = cheats::parse(ctx->code);
+			ctx->list.push_back({ ctx->code, parsed, true });
+			ctx->code[0] = '\0';
+			ctx->message.clear();
+			changed = true;
+		}
+		catch (const std::runtime_error& error) {
+			ctx->message = error.what();
+		}
+	}
+	ImGui::TextDisabled("Game Genie, AAAA=VV or AAAA?CC=VV");
+	if (!ctx->message.empty()) ImGui::TextWrapped("%s", ctx->message.c_str());
+
+	for (usize i = 0; i < ctx->list.size(); ++i) {
+		ImGui::PushID(static_cast<int>(i));
+		changed |= ImGui::Checkbox("##enabled", &ctx->list[i].enabled);
+		ImGui::SameLine();
+		ImGui::Text("%-10s %s", ctx->list[i].code.c_str(), cheats::format(ctx->list[i].parsed).c_str());
+		ImGui::SameLine();
+		if (ImGui::SmallButton("Remove")) {
+			ctx->list.erase(ctx->list.begin() + static_cast<std::ptrdiff_t>(i));
+			changed = true;
+		}
+		ImGui::PopID();
+	}
+
+	// Only the pages the changed cheats touch get remapped, at the next vblank
+	if (changed) {
+		std::vector<cheat> active;
+		for (const auto& entry : ctx->list) if (entry.enabled) active.push_back(entry.parsed);
+		RUN_AHEAD->set_cheats(active);
+		CPU->set_cheats(std::move(active));
+	}
+	ImGui::End();
+}
+
 void cpu_window(ui_gui_context::ui_cpu* ctx, cpu* CPU) {
 
 	float height = 100.f + (ctx->register_view ? 110.f : 0.f) + (ctx->instruction_view ? 90.f : 0.f) + (ctx->stack_view ? 30.f : 0.f);
@@ -999,24 +1911,71 @@ void cpu_window(ui_gui_context::ui_cpu* ctx, cpu* CPU) {
 
 void screen_window(ui_gui_context::ui_screen* ctx) {
 
-	ImGui::SetNextWindowSize(ImVec2(270.f, 275.f));
+	const video_frame* scaled_frame;
+	bool fresh = (ctx->scaler != nullptr && ctx->scaler->take(scaled_frame))
+		|| (ctx->ntsc != nullptr && ctx->ntsc->take(scaled_frame))
+		|| (ctx->hd != nullptr && ctx->hd->take(scaled_frame));
+	if (fresh) {
+		glBindTexture(GL_TEXTURE_2D, ctx->scaled_canvas);
+		if (scaled_frame->width != ctx->scaled_width || scaled_frame->height != ctx->scaled_height) {
+			ctx->scaled_width = scaled_frame->width;
+			ctx->scaled_height = scaled_frame->height;
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, static_cast<GLsizei>(ctx->scaled_width), static_cast<GLsizei>(ctx->scaled_height), 0, GL_RGBA, GL_UNSIGNED_BYTE, scaled_frame->pixels.data());
+		}
+		else {
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, static_cast<GLsizei>(ctx->scaled_width), static_cast<GLsizei>(ctx->scaled_height), GL_RGBA, GL_UNSIGNED_BYTE, scaled_frame->pixels.data());
+		}
+		glBindTexture(GL_TEXTURE_2D, 0);
+		ctx->latency.uploaded(ctx->sink.get_frame());
+	}
+	bool scaled = (ctx->scaler != nullptr || ctx->ntsc != nullptr || ctx->hd != nullptr) && ctx->scaled_width > 0 && ctx->client == nullptr;
+	ImVec2 display_size = scaled
+		? ImVec2(static_cast<float>(ctx->scaled_width), static_cast<float>(ctx->scaled_height))
+		: ImVec2(256.f * 1.f, 240.f * 1.f);
+	// Composite output keeps 240 lines, stretched back to the 4:3 picture
+	if (scaled && ctx->ntsc != nullptr) display_size.y *= 2.f;
+
+	ImGui::SetNextWindowSize(ImVec2(display_size.x + 14.f, display_size.y + 35.f));
 	if (!ImGui::Begin("Screen")) {
 		ImGui::End();
 		return;
 	}
-	ImVec2 display_size(256.f * 1.f, 240.f * 1.f);
 
-	if (ctx->ppu->is_frame_ready()) {
-		std::span<u32> pixel_buffer = ctx->ppu->get_last_screen();
-		ctx->ppu->reset_frame_ready();
-		glBindTexture(GL_TEXTURE_2D, ctx->canvas);
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 256, 240, GL_RGBA, GL_UNSIGNED_BYTE, pixel_buffer.data());
-		glBindTexture(GL_TEXTURE_2D, 0);
+	const latest_frame* latest;
+	if (ctx->client != nullptr) {
+		// Only the newest frame is worth uploading, whatever was published in between is skipped
+		shared_frame_reader& frames = ctx->client->get_frames();
+		u64 sequence = frames.get_published();
+		std::span<const u32> pixels = sequence > ctx->client_shown ? frames.pixels(sequence) : std::span<const u32>();
+		if (!pixels.empty()) {
+			glBindTexture(GL_TEXTURE_2D, ctx->canvas);
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 256, 240, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+			glBindTexture(GL_TEXTURE_2D, 0);
+			// Overwritten during the upload, the next publish replaces it soon anyway
+			if (frames.still_valid(sequence)) ctx->client_shown = sequence;
+		}
+	}
+	else if (ctx->sink.take(latest)) {
+		// Rows are skipped for good once uploaded, so they come from the sink's copy and never from the ppu's buffer
+		row_bitmap dirty = ctx->has_uploaded ? frame_hash::dirty_rows(ctx->uploaded, latest->digest) : row_bitmap().set();
+		if (dirty.any()) {
+			glBindTexture(GL_TEXTURE_2D, ctx->canvas);
+			for (usize row = 0; row < 240;) {
+				if (!dirty[row]) { ++row; continue; }
+				usize first = row;
+				while (row < 240 && dirty[row]) ++row;
+				glTexSubImage2D(GL_TEXTURE_2D, 0, 0, static_cast<GLint>(first), 256, static_cast<GLsizei>(row - first), GL_RGBA, GL_UNSIGNED_BYTE, latest->pixels.data() + first * 256);
+			}
+			glBindTexture(GL_TEXTURE_2D, 0);
+			ctx->uploaded = latest->digest;
+			ctx->has_uploaded = true;
+		}
+		ctx->latency.uploaded(latest->frame);
 	}
 
 
 	ImGui::Image(
-		(ImTextureID)(intptr_t)(ctx->canvas),
+		(ImTextureID)(intptr_t)(scaled ? ctx->scaled_canvas : ctx->canvas),
 		display_size
 	);
 
@@ -1030,6 +1989,132 @@ void screen_window(ui_gui_context::ui_screen* ctx) {
 	ImGui::End();
 }
 
+inline void static benchmark_results(std::span<const benchmark_result> results) {
+	for (const auto& result : results) {
+		if (result.frames == 0) continue;
+		ImGui::Text("%-13s %6zu frames  %8.1f fps  %6.3f ms/frame", result.name, result.frames, result.frames_per_second(), result.ms_per_frame());
+	}
+}
+
+void benchmark_window(ui_gui_context::ui_benchmark* ctx, cartridge* rom) {
+
+	ImGui::SetNextWindowSize(ImVec2(400.f, 1000.f));
+	if (!ImGui::Begin("Benchmark", nullptr, ImGuiWindowFlags_NoResize)) {
+		ImGui::End();
+		return;
+	}
+
+	ImGui::SeparatorText("PPU timing modes");
+	ImGui::SetNextItemWidth(120.f);
+	ImGui::InputInt("Frames", &ctx->frames, 60, 600);
+	ctx->frames = std::clamp(ctx->frames, 1, 60000);
+
+	ImGui::SameLine(); ImGui::Spacing(); ImGui::SameLine();
+	ImGui::BeginDisabled(rom == nullptr);
+	if (ImGui::Button("Run")) {
+		ctx->timing_modes = benchmarks::ppu_timing_modes(*rom, static_cast<usize>(ctx->frames));
+	}
+	ImGui::EndDisabled();
+	benchmark_results(ctx->timing_modes);
+
+	ImGui::SeparatorText("Threaded rendering");
+	ImGui::BeginDisabled(rom == nullptr);
+	if (ImGui::Button("Run##pipelined")) {
+		ctx->pipelined_rendering = benchmarks::pipelined_rendering(*rom, static_cast<usize>(ctx->frames));
+	}
+	ImGui::EndDisabled();
+	benchmark_results(ctx->pipelined_rendering);
+
+	ImGui::SeparatorText("Frame skip");
+	ImGui::SetNextItemWidth(120.f);
+	ImGui::SliderInt("Skip", &ctx->skip_interval, 1, 9);
+	ImGui::SameLine(); ImGui::Spacing(); ImGui::SameLine();
+	ImGui::BeginDisabled(rom == nullptr);
+	if (ImGui::Button("Run##frameskip")) {
+		ctx->frameskip_rendering = benchmarks::frameskip_rendering(*rom, static_cast<usize>(ctx->frames), static_cast<usize>(ctx->skip_interval));
+	}
+	ImGui::SameLine();
+	if (ImGui::Button("Verify")) {
+		ctx->frameskip_verification = benchmarks::verify_frameskip(*rom, static_cast<usize>(ctx->frames), static_cast<usize>(ctx->skip_interval), ppu_timing::scanline);
+	}
+	ImGui::EndDisabled();
+	benchmark_results(ctx->frameskip_rendering);
+	const frameskip_check& check = ctx->frameskip_verification;
+	if (check.frames > 0) {
+		if (check.passed()) ImGui::Text("Identical: %zu of %zu frames compared", check.compared, check.frames);
+		else ImGui::Text("%zu mismatches, first at frame %zu", check.mismatches, check.first_mismatch);
+	}
+
+	ImGui::SeparatorText("Upscale filters");
+	ImGui::BeginDisabled(rom == nullptr);
+	if (ImGui::Button("Run##upscale")) {
+		ctx->upscale_filters = benchmarks::upscale_filters(*rom, static_cast<usize>(ctx->frames), worker_pool::default_helpers());
+	}
+	ImGui::EndDisabled();
+	benchmark_results(ctx->upscale_filters);
+
+	ImGui::SeparatorText("NTSC composite");
+	ImGui::BeginDisabled(rom == nullptr);
+	if (ImGui::Button("Run##ntsc")) {
+		ctx->ntsc_composite = benchmarks::ntsc_composite(*rom, static_cast<usize>(ctx->frames), worker_pool::default_helpers());
+	}
+	ImGui::EndDisabled();
+	benchmark_results(std::span<const benchmark_result>(&ctx->ntsc_composite, 1));
+
+	ImGui::SeparatorText("Bank switching");
+	if (ImGui::Button("Run##banks")) {
+		ctx->bank_switching = benchmarks::bank_switching(static_cast<usize>(ctx->frames));
+	}
+	benchmark_results(ctx->bank_switching);
+
+	ImGui::SeparatorText("MMC3 scanline IRQ");
+	if (ImGui::Button("Run##irq")) {
+		ctx->mmc3_irq = benchmarks::mmc3_irq(static_cast<usize>(ctx->frames));
+	}
+	ImGui::SameLine();
+	if (ImGui::Button("Verify##irq")) {
+		ctx->mmc3_verification = benchmarks::verify_mmc3_irq(static_cast<usize>(ctx->frames));
+	}
+	benchmark_results(ctx->mmc3_irq);
+	const irq_check& irqs = ctx->mmc3_verification;
+	if (irqs.frames > 0) {
+		if (irqs.passed()) ImGui::Text("Identical: %zu IRQs over %zu frames", irqs.irqs, irqs.frames);
+		else if (irqs.mismatches > 0) ImGui::Text("%zu mismatches, first at frame %zu", irqs.mismatches, irqs.first_mismatch);
+		else ImGui::Text("No IRQ taken in %zu frames", irqs.frames);
+	}
+
+	ImGui::SeparatorText("Snapshots and run-ahead");
+	ImGui::BeginDisabled(rom == nullptr);
+	if (ImGui::Button("Run##snapshots")) {
+		ctx->snapshots = benchmarks::machine_snapshots(*rom, static_cast<usize>(ctx->frames));
+		ctx->run_ahead_overhead = benchmarks::run_ahead_overhead(*rom, static_cast<usize>(ctx->frames));
+	}
+	ImGui::EndDisabled();
+	const snapshot_check& snapshots = ctx->snapshots;
+	if (snapshots.bytes > 0) {
+		ImGui::Text("%zu bytes, save %.2f us, load %.2f us", snapshots.bytes, snapshots.save_us, snapshots.load_us);
+		if (snapshots.passed()) ImGui::Text("Replayed %zu frames identically", snapshots.compared);
+		else ImGui::Text("%zu of %zu replayed frames differ", snapshots.mismatches, snapshots.compared);
+	}
+	benchmark_results(ctx->run_ahead_overhead);
+
+	ImGui::SeparatorText("Input latency, fake display");
+	ImGui::SetNextItemWidth(80.f);
+	ImGui::InputInt("Presses", &ctx->latency_presses, 10, 50);
+	ctx->latency_presses = std::clamp(ctx->latency_presses, 1, 600);
+	ImGui::SameLine();
+	ImGui::SetNextItemWidth(60.f);
+	ImGui::SliderInt("Ahead", &ctx->latency_ahead, 0, static_cast<int>(run_ahead::MAX_FRAMES));
+	ImGui::SameLine();
+	ImGui::Checkbox("Delay", &ctx->latency_delay);
+	if (ImGui::Button("Run##latency")) {
+		ctx->latency = benchmarks::input_latency(static_cast<usize>(ctx->latency_presses), static_cast<usize>(ctx->latency_ahead), ctx->latency_delay);
+	}
+	if (ctx->latency.stages[latency_stage::input_to_swap].samples > 0) latency_results(ctx->latency);
+
+	ImGui::End();
+}
+
 inline void static gui_fetch(ui_gui_context::ui_cpu* ctx, cpu* CPU) {
 	CPU->fetch();
 	ctx->opcode.fetched = true;
@@ -0,0 +1,118 @@
+#include "../header/mapped_file.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+mapped_file::mapped_file(const std::string& path, mapped_file_mode mode, usize size) :
+	path(path),
+	mapping(nullptr),
+	mapping_size(0),
+	mode(mode),
+#ifdef _WIN32
+	file_handle(INVALID_HANDLE_VALUE),
+	mapping_handle(nullptr)
+#else
+	descriptor(-1)
+#endif
+{
+	bool writable = mode == mapped_file_mode::read_write;
+
+#ifdef _WIN32
+	this->file_handle = CreateFileA(
+		path.c_str(), writable ? (GENERIC_READ | GENERIC_WRITE) : GENERIC_READ, FILE_SHARE_READ, nullptr,
+		writable ? OPEN_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr
+	);
+	if (this->file_handle == INVALID_HANDLE_VALUE) throw std::runtime_error("Cannot open " + path);
+
+	LARGE_INTEGER file_size;
+	GetFileSizeEx(this->file_handle, &file_size);
+	this->mapping_size = std::max(static_cast<usize>(file_size.QuadPart), writable ? size : 0_usize);
+	if (this->mapping_size == 0) {
+		this->release();
+		throw std::runtime_error(path + " is empty");
+	}
+
+	this->mapping_handle = CreateFileMappingA(
+		this->file_handle, nullptr, writable ? PAGE_READWRITE : PAGE_READONLY,
+		static_cast<DWORD>(static_cast<u64>(this->mapping_size) >> 32), static_cast<DWORD>(this->mapping_size & 0xFFFFFFFF), nullptr
+	);
+	if (this->mapping_handle == nullptr) {
+		this->release();
+		throw std::runtime_error("Cannot map " + path);
+	}
+	this->mapping = static_cast<u8*>(MapViewOfFile(this->mapping_handle, writable ? FILE_MAP_ALL_ACCESS : FILE_MAP_READ, 0, 0, this->mapping_size));
+	if (this->mapping == nullptr) {
+		this->release();
+		throw std::runtime_error("Cannot map " + path);
+	}
+#else
+	this->descriptor = open(path.c_str(), writable ? (O_RDWR | O_CREAT) : O_RDONLY, 0644);
+	if (this->descriptor < 0) throw std::runtime_error("Cannot open " + path);
+
+	struct stat info;
+	if (fstat(this->descriptor, &info) != 0) {
+		this->release();
+		throw std::runtime_error("Cannot stat " + path);
+	}
+	this->mapping_size = static_cast<usize>(info.st_size);
+	if (writable && this->mapping_size < size) {
+		if (ftruncate(this->descriptor, static_cast<off_t>(size)) != 0) {
+			this->release();
+			throw std::runtime_error("Cannot grow " + path);
+		}
+		this->mapping_size = size;
+	}
+	if (this->mapping_size == 0) {
+		this->release();
+		throw std::runtime_error(path + " is empty");
+	}
+
+	void* view = mmap(nullptr, this->mapping_size, writable ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, this->descriptor, 0);
+	if (view == MAP_FAILED) {
+		this->release();
+		throw std::runtime_error("Cannot map " + path);
+	}
+	this->mapping = static_cast<u8*>(view);
+#endif
+}
+
+mapped_file::~mapped_file() {
+	this->release();
+}
+
+void mapped_file::release() {
+#ifdef _WIN32
+	if (this->mapping != nullptr) UnmapViewOfFile(this->mapping);
+	if (this->mapping_handle != nullptr) CloseHandle(this->mapping_handle);
+	if (this->file_handle != INVALID_HANDLE_VALUE) CloseHandle(this->file_handle);
+	this->mapping_handle = nullptr;
+	this->file_handle = INVALID_HANDLE_VALUE;
+#else
+	if (this->mapping != nullptr) munmap(this->mapping, this->mapping_size);
+	if (this->descriptor >= 0) close(this->descriptor);
+	this->descriptor = -1;
+#endif
+	this->mapping = nullptr;
+}
+
+void mapped_file::flush() {
+	if (this->mapping == nullptr || this->mode != mapped_file_mode::read_write) return;
+#ifdef _WIN32
+	FlushViewOfFile(this->mapping, this->mapping_size);
+	FlushFileBuffers(this->file_handle);
+#else
+	msync(this->mapping, this->mapping_size, MS_SYNC);
+#endif
+}
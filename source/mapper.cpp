@@ -0,0 +1,379 @@
+#include "../header/mapper.h"
+
+#include "../header/bus.h"
+#include "../header/ppu.h"
+#include <stdexcept>
+#include <string>
+
+void mapper::attach(bus* cpu_bus, ppu* video, cartridge* rom) {
+	this->cpu_bus = cpu_bus;
+	this->video = video;
+	this->rom = rom;
+	this->prg_pages = rom->get_prg_rom().size() / PRG_PAGE_SIZE;
+	this->chr_pages = rom->get_chr_rom().size() / 0x0400;
+	this->cpu_bus->map_prg_ram(nullptr, false);
+}
+
+void mapper::map_prg(const usize page, const usize bank) {
+	if (this->prg_pages == 0) {
+		this->cpu_bus->map_prg(page, nullptr);
+		return;
+	}
+	this->cpu_bus->map_prg(page, this->rom->get_prg_rom().data() + (bank % this->prg_pages) * PRG_PAGE_SIZE);
+}
+
+void mapper::map_chr(const usize page, const usize bank, const usize size_kib) {
+	for (usize i = 0; i < size_kib; ++i) this->video->map_chr(page + i, bank * size_kib + i);
+}
+
+void mapper::map_nametables(const enum mirroring mirroring) { this->video->map_nametables(mirroring); }
+
+void mapper::map_prg_ram(const bool enabled, const bool writable) {
+	this->cpu_bus->map_prg_ram(enabled ? this->rom->get_prg_ram().data() : nullptr, writable);
+}
+
+void mapper::set_irq(const bool asserted) { this->cpu_bus->set_irq(asserted); }
+
+// Mapper 0: up to 32 KiB PRG (16 KiB mirrored), 8 KiB CHR, fixed
+class nrom : public mapper {
+public:
+	void reset() override {
+		for (usize page = 0; page < 4; ++page) this->map_prg(page, page);
+		this->map_chr(0, 0, 8);
+	}
+	void write(const u16, const u8) override {}
+};
+
+/* Mapper 1: registers are loaded serially, five writes of bit 0 with the register picked by the address of the
+ * last one; bit 7 set resets the shift register. 512 KiB boards (SUROM) take the 256 KiB half from CHR bank 0 bit 4.
+ */
+class mmc1 : public mapper {
+
+private:
+	u8 shift;
+	u8 shift_count;
+	u8 control;
+	u8 chr_bank0;
+	u8 chr_bank1;
+	u8 prg_bank;
+
+	void map_prg_16k(const usize slot, const usize bank) {
+		this->map_prg(slot * 2, bank * 2);
+		this->map_prg(slot * 2 + 1, bank * 2 + 1);
+	}
+
+	void apply() {
+		constexpr enum mirroring MIRRORING[4] = {
+			mirroring::single_screen_lower, mirroring::single_screen_upper, mirroring::vertical, mirroring::horizontal
+		};
+		this->map_nametables(MIRRORING[this->control & 0b11]);
+
+		if (this->control & 0b10000) {
+			this->map_chr(0, this->chr_bank0, 4);
+			this->map_chr(4, this->chr_bank1, 4);
+		}
+		else {
+			this->map_chr(0, this->chr_bank0 >> 1, 8);
+		}
+
+		usize outer = (this->prg_pages > 32) ? (this->chr_bank0 & 0b10000) : 0;
+		usize bank = outer | (this->prg_bank & 0b1111);
+		switch ((this->control >> 2) & 0b11) {
+		case 0:
+		case 1:
+			this->map_prg_16k(0, bank & ~1_usize);
+			this->map_prg_16k(1, bank | 1);
+			break;
+		case 2:
+			this->map_prg_16k(0, outer);
+			this->map_prg_16k(1, bank);
+			break;
+		case 3:
+			this->map_prg_16k(0, bank);
+			this->map_prg_16k(1, outer | 0b1111);
+			break;
+		}
+		this->map_prg_ram((this->prg_bank & 0b10000) == 0, true);
+	}
+
+public:
+	mmc1() :
+		shift(0),
+		shift_count(0),
+		control(0x0C),
+		chr_bank0(0),
+		chr_bank1(0),
+		prg_bank(0)
+	{}
+
+	void reset() override {
+		this->shift = 0;
+		this->shift_count = 0;
+		this->control = 0x0C;
+		this->chr_bank0 = 0;
+		this->chr_bank1 = 0;
+		this->prg_bank = 0;
+		this->apply();
+	}
+
+	void write(const u16 address, const u8 value) override {
+		if (value & 0x80) {
+			this->shift = 0;
+			this->shift_count = 0;
+			this->control |= 0x0C;
+			this->apply();
+			return;
+		}
+		this->shift |= (value & 1) << this->shift_count;
+		if (++this->shift_count < 5) return;
+
+		switch ((address >> 13) & 0b11) {
+		case 0: this->control = this->shift; break;
+		case 1: this->chr_bank0 = this->shift; break;
+		case 2: this->chr_bank1 = this->shift; break;
+		case 3: this->prg_bank = this->shift; break;
+		}
+		this->shift = 0;
+		this->shift_count = 0;
+		this->apply();
+	}
+
+	void save_state(state& out) const override { pack(out, this->shift, this->shift_count, this->control, this->chr_bank0, this->chr_bank1, this->prg_bank); }
+	void load_state(const state& in) override { unpack(in, this->shift, this->shift_count, this->control, this->chr_bank0, this->chr_bank1, this->prg_bank); }
+};
+
+// Mapper 2: 16 KiB switchable at $8000, the last 16 KiB fixed at $C000, CHR-RAM
+class uxrom : public mapper {
+public:
+	void reset() override {
+		this->map_prg(0, 0);
+		this->map_prg(1, 1);
+		this->map_prg(2, this->last_prg_bank() - 1);
+		this->map_prg(3, this->last_prg_bank());
+		this->map_chr(0, 0, 8);
+	}
+	void write(const u16, const u8 value) override {
+		this->map_prg(0, static_cast<usize>(value) * 2);
+		this->map_prg(1, static_cast<usize>(value) * 2 + 1);
+	}
+};
+
+// Mapper 3: fixed PRG like NROM, 8 KiB CHR switchable
+class cnrom : public mapper {
+public:
+	void reset() override {
+		for (usize page = 0; page < 4; ++page) this->map_prg(page, page);
+		this->map_chr(0, 0, 8);
+	}
+	void write(const u16, const u8 value) override {
+		this->map_chr(0, value, 8);
+	}
+};
+
+/* Mapper 4: eight bank registers written through $8000 / $8001, two PRG and two CHR layouts, and a scanline
+ * counter clocked by A12 rises that raises /IRQ when it reaches zero with IRQs enabled.
+ * The counter is only brought up to date when something looks at it: an IRQ register write, a $2000 / $2001
+ * change or the event posted at the rise that takes it to zero. Rises in between are counted from the A12
+ * pattern that was current since the last sync.
+ */
+class mmc3 : public mapper {
+
+private:
+	u8 bank_select;
+	std::array<u8, 8> registers;
+	u8 irq_latch;
+	u8 irq_counter;
+	bool irq_reload;
+	bool irq_enabled;
+	a12_pattern pattern;
+	ppu_position synced;
+
+	// Walks stay short when nothing needs the counter for a while
+	static constexpr u64 RESYNC_DOTS = 341 * 262;
+
+	void apply_prg() {
+		usize second_last = this->last_prg_bank() - 1;
+		bool swapped = (this->bank_select & 0x40) != 0;
+		this->map_prg(0, swapped ? second_last : this->registers[6]);
+		this->map_prg(1, this->registers[7]);
+		this->map_prg(2, swapped ? this->registers[6] : second_last);
+		this->map_prg(3, this->last_prg_bank());
+	}
+	void apply_chr() {
+		// Bit 7 swaps the 2 KiB and the 1 KiB halves
+		usize inversion = (this->bank_select & 0x80) ? 4 : 0;
+		this->map_chr(inversion ^ 0, this->registers[0] >> 1, 2);
+		this->map_chr(inversion ^ 2, this->registers[1] >> 1, 2);
+		for (usize bank = 0; bank < 4; ++bank) this->map_chr((inversion ^ 4) + bank, this->registers[2 + bank], 1);
+	}
+
+	void clock_counter(usize clocks) {
+		while (clocks > 0) {
+			if (this->irq_counter == 0 || this->irq_reload) {
+				this->irq_counter = this->irq_latch;
+				this->irq_reload = false;
+			}
+			else {
+				this->irq_counter--;
+			}
+			clocks--;
+			if (this->irq_counter == 0) {
+				if (this->irq_enabled) this->set_irq(true);
+				// From zero the counter comes back to zero every latch + 1 clocks
+				clocks %= static_cast<usize>(this->irq_latch) + 1;
+			}
+		}
+	}
+	void sync() {
+		ppu_position now = this->video->get_position();
+		if (this->pattern.predictable) {
+			usize rises = 0;
+			ppu::walk_a12_rises(this->pattern, this->synced, now.dot_clock, [&rises](u64) { rises++; return true; });
+			this->clock_counter(rises);
+		}
+		this->synced = now;
+	}
+	// Posts the rise that takes the counter to zero, call right after sync
+	void predict() {
+		this->pattern = this->video->get_a12_pattern();
+		this->video->track_a12(!this->pattern.predictable);
+
+		u64 event = this->synced.dot_clock + RESYNC_DOTS;
+		if (this->pattern.predictable && this->irq_enabled) {
+			usize clocks = (this->irq_counter == 0 || this->irq_reload) ? static_cast<usize>(this->irq_latch) + 1 : this->irq_counter;
+			ppu::walk_a12_rises(this->pattern, this->synced, event, [&](u64 rise) {
+				if (--clocks > 0) return true;
+				event = rise;
+				return false;
+			});
+		}
+		this->video->schedule(event);
+	}
+
+public:
+	mmc3() :
+		bank_select(0),
+		registers({ 0, 2, 4, 5, 6, 7, 0, 1 }),
+		irq_latch(0),
+		irq_counter(0),
+		irq_reload(false),
+		irq_enabled(false),
+		pattern(),
+		synced()
+	{}
+
+	void reset() override {
+		this->bank_select = 0;
+		this->registers = { 0, 2, 4, 5, 6, 7, 0, 1 };
+		this->irq_latch = 0;
+		this->irq_counter = 0;
+		this->irq_reload = false;
+		this->irq_enabled = false;
+		this->set_irq(false);
+		this->apply_prg();
+		this->apply_chr();
+		this->map_prg_ram(true, true);
+		this->synced = this->video->get_position();
+		this->predict();
+	}
+
+	void write(const u16 address, const u8 value) override {
+		switch (address & 0xE001) {
+		case 0x8000: {
+			// Games select a register before every bank write, only a layout change remaps anything
+			u8 changed = this->bank_select ^ value;
+			this->bank_select = value;
+			if (changed & 0x40) this->apply_prg();
+			if (changed & 0x80) this->apply_chr();
+			break;
+		}
+		case 0x8001: {
+			usize target = this->bank_select & 0b111;
+			usize inversion = (this->bank_select & 0x80) ? 4 : 0;
+			this->registers[target] = value;
+			if (target <= 1) this->map_chr(inversion ^ (target * 2), value >> 1, 2);
+			else if (target <= 5) this->map_chr((inversion ^ 4) + target - 2, value, 1);
+			else if (target == 6) this->map_prg((this->bank_select & 0x40) ? 2 : 0, value);
+			else this->map_prg(1, value);
+			break;
+		}
+		case 0xA000:
+			if (this->rom->get_mirroring() != mirroring::four_screen) {
+				this->map_nametables((value & 1) ? mirroring::horizontal : mirroring::vertical);
+			}
+			break;
+		case 0xA001: this->map_prg_ram((value & 0x80) != 0, (value & 0x40) == 0); break;
+		case 0xC000:
+			this->sync();
+			this->irq_latch = value;
+			this->predict();
+			break;
+		case 0xC001:
+			this->sync();
+			this->irq_counter = 0;
+			this->irq_reload = true;
+			this->predict();
+			break;
+		case 0xE000:
+			this->sync();
+			this->irq_enabled = false;
+			this->set_irq(false);
+			this->predict();
+			break;
+		case 0xE001:
+			this->sync();
+			this->irq_enabled = true;
+			this->predict();
+			break;
+		}
+	}
+
+	void a12_rise() override { this->clock_counter(1); }
+	void timed_event() override {
+		this->sync();
+		this->predict();
+	}
+	void ppu_changed() override {
+		this->sync();
+		this->predict();
+	}
+
+	// The posted event and A12 tracking are restored with the ppu
+	void save_state(state& out) const override {
+		pack(out, this->bank_select, this->registers, this->irq_latch, this->irq_counter, this->irq_reload, this->irq_enabled, this->pattern, this->synced);
+	}
+	void load_state(const state& in) override {
+		unpack(in, this->bank_select, this->registers, this->irq_latch, this->irq_counter, this->irq_reload, this->irq_enabled, this->pattern, this->synced);
+	}
+};
+
+// Mapper 7: 32 KiB switchable PRG, one screen mirroring picked by bit 4, CHR-RAM
+class axrom : public mapper {
+public:
+	void reset() override {
+		for (usize page = 0; page < 4; ++page) this->map_prg(page, page);
+		this->map_chr(0, 0, 8);
+		this->map_nametables(mirroring::single_screen_lower);
+	}
+	void write(const u16, const u8 value) override {
+		usize bank = value & 0b111;
+		for (usize page = 0; page < 4; ++page) this->map_prg(page, bank * 4 + page);
+		this->map_nametables((value & 0x10) ? mirroring::single_screen_upper : mirroring::single_screen_lower);
+	}
+};
+
+bool mapper::is_supported(const u16 number) {
+	return number == 0 || number == 1 || number == 2 || number == 3 || number == 4 || number == 7;
+}
+
+std::unique_ptr<mapper> mapper::create(const u16 number) {
+	switch (number) {
+	case 0: return std::make_unique<nrom>();
+	case 1: return std::make_unique<mmc1>();
+	case 2: return std::make_unique<uxrom>();
+	case 3: return std::make_unique<cnrom>();
+	case 4: return std::make_unique<mmc3>();
+	case 7: return std::make_unique<axrom>();
+	default: throw std::runtime_error("Mapper " + std::to_string(number) + " is not supported");
+	}
+}
@@ -0,0 +1,204 @@
+#include "../header/ntsc_filter.h"
+
+#include <chrono>
+#include <cmath>
+#include <numbers>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define NTSC_SSE2
+#endif
+
+// Voltages of the low / high half of the wave for levels 0-3, from measurements of a 2C02
+static constexpr std::array<float, 4> LEVELS_LOW = { 0.350f, 0.518f, 0.962f, 1.550f };
+static constexpr std::array<float, 4> LEVELS_HIGH = { 1.094f, 1.506f, 1.962f, 1.962f };
+static constexpr float BLACK = 0.518f;
+static constexpr float WHITE = 1.962f;
+static constexpr float EMPHASIS_ATTENUATION = 0.746f;
+
+// Fitted so flat colors land close to NES_HARDWARE_PALETTE
+static constexpr float HUE = 4.0f;
+static constexpr float SATURATION = 1.5f;
+
+// Sample of the wave for a 9 bit index at one of the 12 subcarrier phases, 0 is black and 1 white
+static float composite_sample(const usize index, const usize phase) {
+	usize color = index & 0xF;
+	usize level = (index >> 4) & 0x3;
+	usize emphasis = index >> 6;
+	if (color > 13) level = 1;
+
+	float low = LEVELS_LOW[level];
+	float high = LEVELS_HIGH[level];
+	if (color == 0) low = high;
+	if (color > 12) high = low;
+
+	auto in_phase = [phase](usize color) { return (color + phase) % 12 < 6; };
+	float signal = in_phase(color) ? high : low;
+	if (((emphasis & 1) && in_phase(0)) || ((emphasis & 2) && in_phase(4)) || ((emphasis & 4) && in_phase(8))) {
+		signal *= EMPHASIS_ATTENUATION;
+	}
+	return (signal - BLACK) / (WHITE - BLACK);
+}
+
+ntsc_filter::ntsc_filter(usize helpers) :
+	kernels(PHASES * INDICES * KERNEL),
+	window_begin(),
+	window_end(),
+	window_scale(),
+	pool(helpers),
+	scratch(),
+	indices(256 * 240),
+	line_phases(),
+	outputs(),
+	pending(false),
+	stopping(false),
+	average_ms(0.0),
+	filtered(0),
+	dropped(0)
+{
+	this->build_kernels();
+	this->scratch.resize(this->pool.get_bands());
+	for (video_frame& out : this->outputs.all()) {
+		out.pixels = std::vector<u32>(OUTPUT_WIDTH * OUTPUT_HEIGHT);
+	}
+	this->worker = std::jthread([this] { this->filter_loop(); });
+}
+
+ntsc_filter::~ntsc_filter() {
+	this->stopping.store(true);
+	this->pending.store(true, std::memory_order_release);
+	this->pending.notify_one();
+	this->worker.join();
+}
+
+void ntsc_filter::build_kernels() {
+	for (usize phase = 0; phase < PHASES; ++phase) {
+		for (usize index = 0; index < INDICES; ++index) {
+			float* kernel = &this->kernels[(phase * INDICES + index) * KERNEL];
+			for (usize k = 0; k < SAMPLES_PER_DOT; ++k) {
+				float sample = composite_sample(index, (phase + k) % 12);
+				float angle = std::numbers::pi_v<float> * (static_cast<float>(phase + k) + HUE) / 6.0f;
+				kernel[k] = sample;
+				kernel[SAMPLES_PER_DOT + k] = sample * std::cos(angle) * SATURATION;
+				kernel[2 * SAMPLES_PER_DOT + k] = sample * std::sin(angle) * SATURATION;
+			}
+		}
+	}
+
+	// One subcarrier period (12 samples) around each output pixel's center
+	for (usize x = 0; x < OUTPUT_WIDTH; ++x) {
+		usize center = x * LINE_SAMPLES / OUTPUT_WIDTH;
+		usize begin = center < 6 ? 0 : center - 6;
+		usize end = std::min(center + 6, LINE_SAMPLES);
+		this->window_begin[x] = static_cast<u16>(begin);
+		this->window_end[x] = static_cast<u16>(end);
+		this->window_scale[x] = 1.0f / static_cast<float>(end - begin);
+	}
+}
+
+void ntsc_filter::render_line(const u16* indices, u8 line_phase, u32* out, line_scratch& scratch) const {
+	// Prefix sums of the line's samples, sum[n] holds samples [0, n)
+	float* y = scratch.y.data();
+	float* i = scratch.i.data();
+	float* q = scratch.q.data();
+	float sum_y = 0.0f, sum_i = 0.0f, sum_q = 0.0f;
+	y[0] = i[0] = q[0] = 0.0f;
+
+	usize phase = (line_phase * SAMPLES_PER_DOT) % 12;
+	for (usize dot = 0; dot < 256; ++dot) {
+		const float* kernel = &this->kernels[(phase * INDICES + (indices[dot] & (INDICES - 1))) * KERNEL];
+		usize base = dot * SAMPLES_PER_DOT + 1;
+		for (usize k = 0; k < SAMPLES_PER_DOT; ++k) {
+			sum_y += kernel[k];
+			sum_i += kernel[SAMPLES_PER_DOT + k];
+			sum_q += kernel[2 * SAMPLES_PER_DOT + k];
+			y[base + k] = sum_y;
+			i[base + k] = sum_i;
+			q[base + k] = sum_q;
+		}
+		phase = (phase + SAMPLES_PER_DOT) % 12;
+	}
+
+	usize x = 0;
+#ifdef NTSC_SSE2
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 full = _mm_set1_ps(255.0f);
+	const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xFF000000u));
+	for (; x + 4 <= OUTPUT_WIDTH; x += 4) {
+		const u16* b = &this->window_begin[x];
+		const u16* e = &this->window_end[x];
+		__m128 scale = _mm_loadu_ps(&this->window_scale[x]);
+		__m128 wy = _mm_mul_ps(_mm_sub_ps(_mm_set_ps(y[e[3]], y[e[2]], y[e[1]], y[e[0]]), _mm_set_ps(y[b[3]], y[b[2]], y[b[1]], y[b[0]])), scale);
+		__m128 wi = _mm_mul_ps(_mm_sub_ps(_mm_set_ps(i[e[3]], i[e[2]], i[e[1]], i[e[0]]), _mm_set_ps(i[b[3]], i[b[2]], i[b[1]], i[b[0]])), scale);
+		__m128 wq = _mm_mul_ps(_mm_sub_ps(_mm_set_ps(q[e[3]], q[e[2]], q[e[1]], q[e[0]]), _mm_set_ps(q[b[3]], q[b[2]], q[b[1]], q[b[0]])), scale);
+
+		__m128 r = _mm_add_ps(wy, _mm_add_ps(_mm_mul_ps(wi, _mm_set1_ps(0.946882f)), _mm_mul_ps(wq, _mm_set1_ps(0.623557f))));
+		__m128 g = _mm_add_ps(wy, _mm_add_ps(_mm_mul_ps(wi, _mm_set1_ps(-0.274788f)), _mm_mul_ps(wq, _mm_set1_ps(-0.635691f))));
+		__m128 bl = _mm_add_ps(wy, _mm_add_ps(_mm_mul_ps(wi, _mm_set1_ps(-1.108545f)), _mm_mul_ps(wq, _mm_set1_ps(1.709007f))));
+
+		__m128i r8 = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(r, full), zero), full));
+		__m128i g8 = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(g, full), zero), full));
+		__m128i b8 = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(bl, full), zero), full));
+		__m128i rgba = _mm_or_si128(_mm_or_si128(r8, _mm_slli_epi32(g8, 8)), _mm_or_si128(_mm_slli_epi32(b8, 16), alpha));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), rgba);
+	}
+#endif
+	auto channel = [](float value) -> u32 {
+		return static_cast<u32>(std::lround(std::clamp(value * 255.0f, 0.0f, 255.0f)));
+	};
+	for (; x < OUTPUT_WIDTH; ++x) {
+		usize b = this->window_begin[x], e = this->window_end[x];
+		float wy = (y[e] - y[b]) * this->window_scale[x];
+		float wi = (i[e] - i[b]) * this->window_scale[x];
+		float wq = (q[e] - q[b]) * this->window_scale[x];
+		u32 r = channel(wy + 0.946882f * wi + 0.623557f * wq);
+		u32 g = channel(wy - 0.274788f * wi - 0.635691f * wq);
+		u32 bl = channel(wy - 1.108545f * wi + 1.709007f * wq);
+		out[x] = r | (g << 8) | (bl << 16) | 0xFF000000;
+	}
+}
+
+void ntsc_filter::render(std::span<const u16> indices, std::span<const u8> line_phases, u32* out) {
+	this->pool.run([this, indices, line_phases, out](usize band, usize bands) {
+		usize first = OUTPUT_HEIGHT * band / bands;
+		usize last = OUTPUT_HEIGHT * (band + 1) / bands;
+		for (usize line = first; line < last; ++line) {
+			this->render_line(indices.data() + line * 256, line_phases[line], out + line * OUTPUT_WIDTH, this->scratch[band]);
+		}
+	});
+}
+
+void ntsc_filter::submit_indices(std::span<const u16> indices, std::span<const u8> line_phases, usize) {
+	if (this->pending.load(std::memory_order_acquire)) {
+		this->dropped++;
+		return;
+	}
+	std::copy(indices.begin(), indices.end(), this->indices.begin());
+	std::copy(line_phases.begin(), line_phases.end(), this->line_phases.begin());
+	this->pending.store(true, std::memory_order_release);
+	this->pending.notify_one();
+}
+
+void ntsc_filter::filter_loop() {
+	using clock = std::chrono::steady_clock;
+
+	while (true) {
+		this->pending.wait(false, std::memory_order_acquire);
+		if (this->stopping.load()) return;
+
+		video_frame& out = this->outputs.back();
+
+		auto start = clock::now();
+		this->render(this->indices, this->line_phases, out.pixels.data());
+		std::chrono::duration<double, std::milli> elapsed = clock::now() - start;
+
+		out.width = OUTPUT_WIDTH;
+		out.height = OUTPUT_HEIGHT;
+		this->outputs.publish();
+
+		double average = this->average_ms.load();
+		this->average_ms.store(average == 0.0 ? elapsed.count() : average * 0.9 + elapsed.count() * 0.1);
+		this->filtered++;
+		this->pending.store(false, std::memory_order_release);
+	}
+}
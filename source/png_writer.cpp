@@ -0,0 +1,189 @@
+#include "../header/png_writer.h"
+#include "../header/checksum.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <stdexcept>
+
+static constexpr std::array<u16, 29> LENGTH_BASE = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static constexpr std::array<u8, 29> LENGTH_EXTRA = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static constexpr std::array<u16, 30> DISTANCE_BASE = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097,
+	6145, 8193, 12289, 16385, 24577
+};
+static constexpr std::array<u8, 30> DISTANCE_EXTRA = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+static constexpr usize WINDOW = 32768;
+static constexpr usize MAX_MATCH = 258;
+static constexpr usize HASH_BITS = 15;
+
+// Deflate packs bits from the least significant end, Huffman codes go in most significant bit first
+class bit_writer {
+
+private:
+	std::vector<u8>& out;
+	u64 bits;
+	usize count;
+
+public:
+	explicit bit_writer(std::vector<u8>& out) :
+		out(out),
+		bits(0),
+		count(0)
+	{}
+
+	void put(u32 value, usize length) {
+		this->bits |= static_cast<u64>(value) << this->count;
+		this->count += length;
+		while (this->count >= 8) {
+			this->out.push_back(static_cast<u8>(this->bits));
+			this->bits >>= 8;
+			this->count -= 8;
+		}
+	}
+	void put_code(u32 code, usize length) {
+		u32 reversed = 0;
+		for (usize i = 0; i < length; ++i) reversed |= ((code >> i) & 1) << (length - 1 - i);
+		this->put(reversed, length);
+	}
+	void flush() {
+		if (this->count > 0) this->out.push_back(static_cast<u8>(this->bits));
+		this->bits = 0;
+		this->count = 0;
+	}
+};
+
+static void put_literal(bit_writer& writer, u32 symbol) {
+	if (symbol < 144) writer.put_code(0x30 + symbol, 8);
+	else if (symbol < 256) writer.put_code(0x190 + (symbol - 144), 9);
+	else if (symbol < 280) writer.put_code(symbol - 256, 7);
+	else writer.put_code(0xC0 + (symbol - 280), 8);
+}
+
+static void put_match(bit_writer& writer, usize length, usize distance) {
+	usize l = (length == MAX_MATCH) ? 28 : static_cast<usize>(std::upper_bound(LENGTH_BASE.begin(), LENGTH_BASE.end() - 1, length) - LENGTH_BASE.begin()) - 1;
+	put_literal(writer, static_cast<u32>(257 + l));
+	writer.put(static_cast<u32>(length - LENGTH_BASE[l]), LENGTH_EXTRA[l]);
+
+	usize d = static_cast<usize>(std::upper_bound(DISTANCE_BASE.begin(), DISTANCE_BASE.end(), distance) - DISTANCE_BASE.begin()) - 1;
+	writer.put_code(static_cast<u32>(d), 5);
+	writer.put(static_cast<u32>(distance - DISTANCE_BASE[d]), DISTANCE_EXTRA[d]);
+}
+
+std::vector<u8> png::deflate(std::span<const u8> data) {
+	std::vector<u8> out;
+	out.reserve(data.size() / 4 + 64);
+	bit_writer writer(out);
+	writer.put(1, 1); // last block
+	writer.put(1, 2); // fixed Huffman codes
+
+	// Last position + 1 each hash was seen at, 0 for never
+	std::vector<usize> head(1_usize << HASH_BITS, 0);
+	auto hash = [&data](usize at) {
+		u32 key = static_cast<u32>(data[at]) << 16 | static_cast<u32>(data[at + 1]) << 8 | data[at + 2];
+		return static_cast<usize>((key * 2654435761u) >> (32 - HASH_BITS));
+	};
+
+	usize i = 0;
+	while (i < data.size()) {
+		if (i + 3 <= data.size()) {
+			usize h = hash(i);
+			usize candidate = head[h];
+			head[h] = i + 1;
+			if (candidate != 0 && i - (candidate - 1) <= WINDOW) {
+				usize from = candidate - 1;
+				usize limit = std::min(MAX_MATCH, data.size() - i);
+				usize length = 0;
+				while (length < limit && data[from + length] == data[i + length]) ++length;
+				if (length >= 3) {
+					put_match(writer, length, i - from);
+					for (usize k = 1; k < length && i + k + 3 <= data.size(); ++k) head[hash(i + k)] = i + k + 1;
+					i += length;
+					continue;
+				}
+			}
+		}
+		put_literal(writer, data[i]);
+		++i;
+	}
+	put_literal(writer, 256);
+	writer.flush();
+	return out;
+}
+
+static void put_u32(std::vector<u8>& out, u32 value) {
+	out.push_back(static_cast<u8>(value >> 24));
+	out.push_back(static_cast<u8>(value >> 16));
+	out.push_back(static_cast<u8>(value >> 8));
+	out.push_back(static_cast<u8>(value));
+}
+
+std::vector<u8> png::zlib(std::span<const u8> data) {
+	std::vector<u8> out = { 0x78, 0x01 };
+	std::vector<u8> body = png::deflate(data);
+	out.insert(out.end(), body.begin(), body.end());
+	put_u32(out, checksum::adler32(data));
+	return out;
+}
+
+static void put_chunk(std::vector<u8>& out, const char* type, std::span<const u8> data) {
+	put_u32(out, static_cast<u32>(data.size()));
+	usize start = out.size();
+	out.insert(out.end(), type, type + 4);
+	out.insert(out.end(), data.begin(), data.end());
+	put_u32(out, checksum::crc32(std::span<const u8>(out.data() + start, out.size() - start)));
+}
+
+std::vector<u8> png::encode(std::span<const u32> pixels, usize width, usize height) {
+	usize stride = width * 3;
+	std::vector<u8> filtered;
+	filtered.reserve((stride + 1) * height);
+
+	std::vector<u8> previous(stride, 0), current(stride);
+	std::array<std::vector<u8>, 3> candidates = { std::vector<u8>(stride), std::vector<u8>(stride), std::vector<u8>(stride) };
+	for (usize y = 0; y < height; ++y) {
+		for (usize x = 0; x < width; ++x) {
+			u32 pixel = pixels[y * width + x];
+			current[x * 3] = static_cast<u8>(pixel);
+			current[x * 3 + 1] = static_cast<u8>(pixel >> 8);
+			current[x * 3 + 2] = static_cast<u8>(pixel >> 16);
+		}
+		// None, Sub, Up; the smallest sum of the bytes taken as signed usually compresses best
+		std::array<usize, 3> costs = {};
+		for (usize i = 0; i < stride; ++i) {
+			candidates[0][i] = current[i];
+			candidates[1][i] = static_cast<u8>(current[i] - (i >= 3 ? current[i - 3] : 0));
+			candidates[2][i] = static_cast<u8>(current[i] - previous[i]);
+			for (usize f = 0; f < 3; ++f) costs[f] += static_cast<usize>(std::abs(static_cast<int>(static_cast<i8>(candidates[f][i]))));
+		}
+		usize best = static_cast<usize>(std::min_element(costs.begin(), costs.end()) - costs.begin());
+		filtered.push_back(static_cast<u8>(best));
+		filtered.insert(filtered.end(), candidates[best].begin(), candidates[best].end());
+		std::swap(previous, current);
+	}
+
+	std::vector<u8> out = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	std::vector<u8> header;
+	put_u32(header, static_cast<u32>(width));
+	put_u32(header, static_cast<u32>(height));
+	header.insert(header.end(), { 8, 2, 0, 0, 0 }); // 8 bit, RGB, deflate, adaptive filters, no interlace
+	put_chunk(out, "IHDR", header);
+	put_chunk(out, "IDAT", png::zlib(filtered));
+	put_chunk(out, "IEND", {});
+	return out;
+}
+
+void png::write_file(const std::string& path, std::span<const u32> pixels, usize width, usize height) {
+	std::vector<u8> data = png::encode(pixels, width, height);
+	std::ofstream out(path, std::ios::binary | std::ios::trunc);
+	if (!out) throw std::runtime_error("Cannot write " + path);
+	out.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+	if (!out) throw std::runtime_error("Cannot write " + path);
+}
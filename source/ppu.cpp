@@ -1,4 +1,5 @@
 #include "../header/ppu.h"
 
 #include "../header/bus.h"
-void ppu::request_nmi() { return this->cpu_bus->request_nmi(); }
\ No newline at end of file
+void ppu::request_nmi() { if (this->cpu_bus != nullptr) this->cpu_bus->request_nmi(); }
+void ppu::vblank_started() { if (this->cpu_bus != nullptr) this->cpu_bus->vblank_started(); }
\ No newline at end of file
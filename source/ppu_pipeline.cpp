@@ -0,0 +1,83 @@
+#include "../header/ppu_pipeline.h"
+
+ppu_pipeline::~ppu_pipeline() {
+	if (this->worker.joinable()) {
+		this->worker.request_stop();
+		while (!this->log.try_push(ppu_log_entry{ 0, ppu_log_kind::stop_replay, 0, 0 })) { std::this_thread::yield(); }
+		this->log.notify();
+		this->worker.join();
+	}
+	if (this->rom != nullptr) { delete this->rom; }
+}
+
+void ppu_pipeline::start(ppu* source, cartridge* game, std::vector<u32>& buffer1, std::vector<u32>& buffer2) {
+	if (this->is_running()) this->stop();
+
+	this->rom = new cartridge(*game);
+	this->renderer.load(this->rom);
+	this->renderer.set_pixel_buffers(buffer1, buffer2);
+	this->renderer.sync_from(*source);
+
+	this->source = source;
+	this->source->set_deferred(&this->log);
+	this->source->move_sinks_to(this->renderer);
+
+	this->dma_remaining = 0;
+
+	this->worker = std::jthread([this](std::stop_token st) {
+		// Taken in bulk like the source hands them over, one pair of atomics per batch
+		std::array<ppu_log_entry, 256> entries;
+		while (!st.stop_requested()) {
+			usize count = this->log.pop(entries);
+			if (count == 0) {
+				this->log.wait_for_data();
+				continue;
+			}
+			for (usize i = 0; i < count; ++i) {
+				if (entries[i].kind == ppu_log_kind::stop_replay) return;
+				this->replay(entries[i]);
+			}
+		}
+	});
+}
+
+void ppu_pipeline::stop() {
+	if (!this->is_running()) return;
+
+	this->source->set_deferred(nullptr);
+
+	this->worker.request_stop();
+	while (!this->log.try_push(ppu_log_entry{ 0, ppu_log_kind::stop_replay, 0, 0 })) { std::this_thread::yield(); }
+	this->log.notify();
+	this->worker.join();
+
+	ppu_log_entry entry;
+	while (this->log.try_pop(entry)) {}
+
+	this->renderer.move_sinks_to(*this->source);
+	this->source = nullptr;
+
+	delete this->rom;
+	this->rom = nullptr;
+}
+
+void ppu_pipeline::replay(const ppu_log_entry& entry) {
+	// The page of an oam_dma entry, its dot is the one of the oam_dma entry the replica already ticked to
+	if (this->dma_remaining > 0) {
+		std::copy(entry.payload.begin(), entry.payload.end(), this->dma_page.begin() + (OAM_DMA_ENTRIES - this->dma_remaining) * entry.payload.size());
+		if (--this->dma_remaining == 0) this->renderer.write_oam_dma(this->dma_page.data());
+		return;
+	}
+
+	u64 now = this->renderer.get_dot_clock();
+	if (entry.dot > now) this->renderer.tick(static_cast<usize>(entry.dot - now));
+
+	switch (entry.kind) {
+	case ppu_log_kind::write_register: this->renderer.write(entry.address, entry.data); break;
+	case ppu_log_kind::read_register: this->renderer.read(entry.address, 0); break;
+	case ppu_log_kind::map_chr: this->renderer.map_chr(entry.address, entry.data); break;
+	case ppu_log_kind::map_nametables: this->renderer.map_nametables(static_cast<enum mirroring>(entry.data)); break;
+	case ppu_log_kind::oam_dma: this->dma_remaining = OAM_DMA_ENTRIES; break;
+	default: break;
+	}
+}
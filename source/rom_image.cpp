@@ -0,0 +1,62 @@
+#include "../header/rom_image.h"
+#include "../header/archive.h"
+
+#include <mutex>
+#include <unordered_map>
+
+rom_image::rom_image(const std::string& path) :
+	path(path),
+	file(std::make_unique<mapped_file>(path, mapped_file_mode::read_only)),
+	modified(std::filesystem::last_write_time(path)),
+	owned(),
+	data(file->bytes())
+{}
+
+rom_image::rom_image(std::vector<u8> bytes, const std::string& path, std::filesystem::file_time_type modified) :
+	path(path),
+	file(),
+	modified(modified),
+	owned(std::move(bytes)),
+	data(owned)
+{}
+
+std::shared_ptr<const rom_image> rom_image::open(const std::string& path) {
+	static std::mutex mtx;
+	static std::unordered_map<std::string, std::weak_ptr<const rom_image>> open_images;
+
+	auto [file_path, member] = archive::split(path);
+	bool archived = archive::is_archive(file_path);
+
+	std::error_code error;
+	std::filesystem::path canonical = std::filesystem::weakly_canonical(file_path, error);
+	std::string file_key = error ? file_path : canonical.string();
+	std::filesystem::file_time_type modified = std::filesystem::last_write_time(file_key, error);
+	std::string key = archived ? file_key + archive::MEMBER_SEPARATOR + member : file_key;
+
+	std::lock_guard<std::mutex> lock(mtx);
+	std::erase_if(open_images, [](const auto& entry) { return entry.second.expired(); });
+	auto found = open_images.find(key);
+	if (found != open_images.end()) {
+		std::shared_ptr<const rom_image> image = found->second.lock();
+		// A file rewritten since gets a fresh image, the games still running keep the old one
+		if (image && !error && image->modified == modified) return image;
+	}
+	std::shared_ptr<const rom_image> image;
+	if (archived) {
+		archive source(file_key);
+		const archive_member* found = source.find(member);
+		if (found == nullptr) throw std::runtime_error(member.empty() ? "No rom in " + file_key : "No " + member + " in " + file_key);
+		image = std::make_shared<const rom_image>(source.extract(*found), file_key + archive::MEMBER_SEPARATOR + found->name, modified);
+	}
+	else image = std::make_shared<const rom_image>(key);
+	open_images[key] = image;
+	return image;
+}
+
+std::string rom_image::save_path(const std::string& path) {
+	auto [file_path, member] = archive::split(path);
+	std::filesystem::path save = archive::is_archive(file_path)
+		? std::filesystem::path(file_path).parent_path() / std::filesystem::path(member.empty() ? std::filesystem::path(file_path).stem() : std::filesystem::path(member).filename())
+		: std::filesystem::path(file_path);
+	return save.replace_extension(".sav").string();
+}
@@ -0,0 +1,354 @@
+#include "../header/rom_library.h"
+#include "../header/archive.h"
+#include "../header/game_database.h"
+#include "../header/mapped_file.h"
+#include "../header/worker_pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <unordered_map>
+
+static_assert(sizeof(rom_index_record) == 96, "rom_index_record is written as is");
+
+static u64 file_ticks(const std::filesystem::file_time_type& time) {
+	return static_cast<u64>(time.time_since_epoch().count());
+}
+
+static bool is_rom(const std::filesystem::path& file) {
+	std::string extension = file.extension().string();
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](char c) { return static_cast<char>(std::tolower(static_cast<unsigned char>(c))); });
+	return extension == ".nes";
+}
+
+// Entries of an index file, empty when it is missing or damaged
+static std::vector<rom_entry> read_index(const std::filesystem::path& path) {
+	std::vector<rom_entry> entries;
+	std::error_code error;
+	if (!std::filesystem::is_regular_file(path, error)) return entries;
+
+	try {
+		mapped_file file(path.string(), mapped_file_mode::read_only);
+		std::span<const u8> bytes = file.bytes();
+		if (bytes.size() < sizeof(rom_index_header)) return entries;
+
+		rom_index_header header;
+		std::memcpy(&header, bytes.data(), sizeof(header));
+		u64 records_end = sizeof(rom_index_header) + static_cast<u64>(header.entry_count) * sizeof(rom_index_record);
+		if (header.magic != rom_index_header::MAGIC || header.version != rom_index_header::VERSION
+			|| records_end > header.string_offset || header.string_offset + header.string_size > bytes.size()) {
+			return entries;
+		}
+		std::span<const u8> strings = bytes.subspan(header.string_offset, header.string_size);
+		auto text = [&strings](u32 offset, u32 size) {
+			if (static_cast<u64>(offset) + size > strings.size()) throw std::runtime_error("Bad string in the index");
+			return std::string(reinterpret_cast<const char*>(strings.data()) + offset, size);
+		};
+
+		entries.reserve(header.entry_count);
+		for (usize i = 0; i < header.entry_count; ++i) {
+			rom_index_record record;
+			std::memcpy(&record, bytes.data() + sizeof(rom_index_header) + i * sizeof(rom_index_record), sizeof(record));
+
+			rom_entry entry = {};
+			entry.path = text(record.path_offset, record.path_size);
+			entry.title = text(record.title_offset, record.title_size);
+			entry.size = record.size;
+			entry.modified = record.modified;
+			entry.crc32 = record.crc32;
+			std::copy(std::begin(record.sha1), std::end(record.sha1), entry.sha1.begin());
+			entry.valid = 0 != (record.flags & rom_index_record::VALID);
+			entry.in_database = 0 != (record.flags & rom_index_record::IN_DATABASE);
+			entry.corrected = 0 != (record.flags & rom_index_record::CORRECTED);
+			entry.header.nes2 = 0 != (record.flags & rom_index_record::NES2);
+			entry.header.battery = 0 != (record.flags & rom_index_record::BATTERY);
+			entry.header.trainer = 0 != (record.flags & rom_index_record::TRAINER);
+			entry.header.mapper = record.mapper;
+			entry.header.submapper = record.submapper;
+			entry.header.screen_mirroring = static_cast<enum mirroring>(std::min<u8>(record.mirroring, mirroring::single_screen_upper));
+			entry.header.timing = static_cast<enum console_timing>(record.timing & 0b11);
+			entry.header.prg_rom_size = record.prg_rom_size;
+			entry.header.chr_rom_size = record.chr_rom_size;
+			entry.header.prg_ram_size = record.prg_ram_size;
+			entry.header.prg_nvram_size = record.prg_nvram_size;
+			entry.header.chr_ram_size = record.chr_ram_size;
+			entries.push_back(std::move(entry));
+		}
+	}
+	catch (const std::runtime_error&) {
+		entries.clear();
+	}
+	return entries;
+}
+
+rom_library::rom_library(const std::string& directory) :
+	directory(directory),
+	entries(read_index(std::filesystem::path(directory) / INDEX_NAME))
+{}
+
+// Takes the rom a piece at a time: the header, then the hashes of everything after it
+typedef struct rom_hasher {
+	std::array<u8, nes_header::SIZE> header;
+	usize header_bytes;
+	u64 size;
+	u32 crc32;
+	checksum::sha1_hasher sha1;
+
+	void update(std::span<const u8> piece) {
+		this->size += piece.size();
+		usize taken = std::min(piece.size(), this->header.size() - this->header_bytes);
+		std::copy(piece.begin(), piece.begin() + taken, this->header.begin() + this->header_bytes);
+		this->header_bytes += taken;
+		piece = piece.subspan(taken);
+		this->crc32 = checksum::crc32(piece, this->crc32);
+		this->sha1.update(piece);
+	}
+} rom_hasher;
+
+static rom_entry describe(const std::string& relative, rom_hasher& hasher) {
+	rom_entry entry = {};
+	entry.path = relative;
+	auto [file_path, member] = archive::split(relative);
+	entry.title = std::filesystem::path(member.empty() ? file_path : member).stem().string();
+	if (!nes_header::parse(std::span<const u8>(hasher.header.data(), hasher.header_bytes), entry.header)) return entry;
+
+	entry.crc32 = hasher.crc32;
+	entry.sha1 = hasher.sha1.finish();
+	entry.valid = entry.header.file_size() <= hasher.size;
+
+	const game_database_entry* known = game_database::find(entry.crc32);
+	if (known != nullptr) {
+		entry.in_database = true;
+		entry.corrected = game_database::differs(entry.header, *known);
+		entry.header = game_database::correct(entry.header, *known);
+		entry.title = known->title;
+	}
+	return entry;
+}
+
+static rom_entry hash_file(const std::filesystem::path& file, const std::string& relative) {
+	mapped_file mapping(file.string(), mapped_file_mode::read_only);
+	rom_hasher hasher = {};
+	hasher.update(mapping.bytes());
+	return describe(relative, hasher);
+}
+
+static rom_entry hash_member(const archive& source, const archive_member& member, const std::string& relative) {
+	rom_hasher hasher = {};
+	source.stream(member, 0x10000, [&hasher](std::span<const u8> piece) { hasher.update(piece); });
+	return describe(relative, hasher);
+}
+
+// The roms of an archive: its .nes members, or the one member of a gzip file whatever it is called
+static std::vector<std::string> archive_roms(const archive& source) {
+	std::vector<std::string> names;
+	for (const archive_member& member : source.get_members()) {
+		std::filesystem::path name(member.name);
+		std::string extension = name.extension().string();
+		std::transform(extension.begin(), extension.end(), extension.begin(), [](char c) { return static_cast<char>(std::tolower(static_cast<unsigned char>(c))); });
+		if (extension == ".nes") names.push_back(member.name);
+	}
+	if (names.empty() && source.get_members().size() == 1) names.push_back(source.get_members()[0].name);
+	return names;
+}
+
+rom_scan_stats rom_library::scan(usize helpers, std::atomic<usize>* progress) {
+	using clock = std::chrono::steady_clock;
+	auto start = clock::now();
+	rom_scan_stats stats = {};
+
+	// By file, an archive has an entry per rom in it
+	std::unordered_map<std::string, std::vector<const rom_entry*>> known;
+	for (const rom_entry& entry : this->entries) known[archive::split(entry.path).first].push_back(&entry);
+
+	// The walk only stats; files that kept their size and time keep their entry
+	std::vector<rom_entry> found;
+	std::vector<usize> stale;
+	std::error_code error;
+	std::filesystem::recursive_directory_iterator walk(this->directory, std::filesystem::directory_options::skip_permission_denied, error);
+	if (error) throw std::runtime_error("Cannot read " + this->directory.string());
+	for (; walk != std::filesystem::recursive_directory_iterator(); walk.increment(error)) {
+		if (error) break;
+		const std::filesystem::directory_entry& file = *walk;
+		bool archived = archive::is_archive(file.path());
+		if (!file.is_regular_file(error) || !(archived || is_rom(file.path()))) continue;
+
+		rom_entry entry = {};
+		entry.path = std::filesystem::relative(file.path(), this->directory, error).generic_string();
+		entry.size = file.file_size(error);
+		entry.modified = file_ticks(file.last_write_time(error));
+		if (error) continue;
+
+		auto previous = known.find(entry.path);
+		if (previous != known.end() && std::all_of(previous->second.begin(), previous->second.end(), [&entry](const rom_entry* old) {
+			return old->size == entry.size && old->modified == entry.modified;
+		})) {
+			for (const rom_entry* old : previous->second) found.push_back(*old);
+			stats.reused += previous->second.size();
+			if (progress != nullptr) progress->fetch_add(previous->second.size(), std::memory_order_relaxed);
+			continue;
+		}
+
+		// Listing an archive only reads its directory, the members get inflated by the workers
+		std::vector<std::string> names;
+		if (archived) {
+			try {
+				names = archive_roms(archive(file.path().string()));
+			}
+			catch (const std::runtime_error&) {}
+		}
+		if (names.empty()) names.push_back(std::string());
+		for (const std::string& name : names) {
+			rom_entry member = entry;
+			if (!name.empty()) member.path += archive::MEMBER_SEPARATOR + name;
+			stale.push_back(found.size());
+			found.push_back(std::move(member));
+		}
+	}
+
+	// Files are handed out one at a time, roms range from 24 KiB to several MiB
+	std::atomic<usize> next = 0;
+	std::atomic<u64> bytes = 0;
+	worker_pool pool(std::min(helpers, stale.size() > 1 ? stale.size() - 1 : 0));
+	pool.run([&](usize, usize) {
+		// Members of one archive are next to each other, a worker keeps the last archive it opened
+		std::string opened_path;
+		std::unique_ptr<archive> opened;
+		for (usize i = next.fetch_add(1, std::memory_order_relaxed); i < stale.size(); i = next.fetch_add(1, std::memory_order_relaxed)) {
+			rom_entry& entry = found[stale[i]];
+			u64 size = entry.size, modified = entry.modified;
+			auto [file_path, member] = archive::split(entry.path);
+			try {
+				std::filesystem::path file = this->directory / std::filesystem::path(file_path);
+				if (member.empty() && archive::is_archive(file_path)) throw std::runtime_error("No rom in " + file_path);
+				if (member.empty()) entry = hash_file(file, entry.path);
+				else {
+					if (opened_path != file_path) {
+						opened.reset();
+						opened_path = file_path;
+						opened = std::make_unique<archive>(file.string());
+					}
+					const archive_member* found_member = opened->find(member);
+					if (found_member == nullptr) throw std::runtime_error("No " + member + " in " + file_path);
+					entry = hash_member(*opened, *found_member, entry.path);
+					bytes.fetch_add(found_member->size, std::memory_order_relaxed);
+				}
+				if (member.empty()) bytes.fetch_add(size, std::memory_order_relaxed);
+			}
+			catch (const std::runtime_error&) {
+				entry.valid = false;
+				entry.title = std::filesystem::path(member.empty() ? file_path : member).stem().string();
+			}
+			entry.size = size;
+			entry.modified = modified;
+			if (progress != nullptr) progress->fetch_add(1, std::memory_order_relaxed);
+		}
+	});
+
+	std::sort(found.begin(), found.end(), [](const rom_entry& a, const rom_entry& b) { return a.path < b.path; });
+	this->entries = std::move(found);
+	this->save();
+
+	stats.files = this->entries.size();
+	stats.hashed = stale.size();
+	stats.hashed_bytes = bytes.load();
+	stats.seconds = std::chrono::duration<double>(clock::now() - start).count();
+	return stats;
+}
+
+void rom_library::save() const {
+	std::vector<rom_index_record> records;
+	std::string strings;
+	records.reserve(this->entries.size());
+	for (const rom_entry& entry : this->entries) {
+		rom_index_record record = {};
+		record.size = entry.size;
+		record.modified = entry.modified;
+		record.prg_rom_size = entry.header.prg_rom_size;
+		record.chr_rom_size = entry.header.chr_rom_size;
+		record.prg_ram_size = static_cast<u32>(entry.header.prg_ram_size);
+		record.prg_nvram_size = static_cast<u32>(entry.header.prg_nvram_size);
+		record.chr_ram_size = static_cast<u32>(entry.header.chr_ram_size);
+		record.crc32 = entry.crc32;
+		record.path_offset = static_cast<u32>(strings.size());
+		record.path_size = static_cast<u32>(entry.path.size());
+		strings += entry.path;
+		record.title_offset = static_cast<u32>(strings.size());
+		record.title_size = static_cast<u32>(entry.title.size());
+		strings += entry.title;
+		record.mapper = entry.header.mapper;
+		record.submapper = entry.header.submapper;
+		record.mirroring = static_cast<u8>(entry.header.screen_mirroring);
+		record.timing = static_cast<u8>(entry.header.timing);
+		record.flags = (entry.valid ? rom_index_record::VALID : 0) | (entry.in_database ? rom_index_record::IN_DATABASE : 0)
+			| (entry.corrected ? rom_index_record::CORRECTED : 0) | (entry.header.nes2 ? rom_index_record::NES2 : 0)
+			| (entry.header.battery ? rom_index_record::BATTERY : 0) | (entry.header.trainer ? rom_index_record::TRAINER : 0);
+		std::copy(entry.sha1.begin(), entry.sha1.end(), record.sha1);
+		records.push_back(record);
+	}
+
+	rom_index_header header = {};
+	header.magic = rom_index_header::MAGIC;
+	header.version = rom_index_header::VERSION;
+	header.entry_count = static_cast<u32>(records.size());
+	header.string_offset = sizeof(rom_index_header) + records.size() * sizeof(rom_index_record);
+	header.string_size = strings.size();
+
+	std::filesystem::path path = this->directory / INDEX_NAME;
+	std::filesystem::path temporary = path;
+	temporary += ".tmp";
+	{
+		std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+		if (!out) throw std::runtime_error("Cannot write " + temporary.string());
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		out.write(reinterpret_cast<const char*>(records.data()), static_cast<std::streamsize>(records.size() * sizeof(rom_index_record)));
+		out.write(strings.data(), static_cast<std::streamsize>(strings.size()));
+		if (!out) throw std::runtime_error("Cannot write " + temporary.string());
+	}
+	std::error_code error;
+	std::filesystem::rename(temporary, path, error);
+	if (error) throw std::runtime_error("Cannot replace " + path.string());
+}
+
+bool rom_library::is_current(const rom_entry& entry) const {
+	std::error_code error;
+	std::filesystem::path file = this->directory / std::filesystem::path(archive::split(entry.path).first);
+	u64 size = std::filesystem::file_size(file, error);
+	u64 modified = file_ticks(std::filesystem::last_write_time(file, error));
+	return !error && size == entry.size && modified == entry.modified;
+}
+
+std::optional<rom_entry> rom_library::lookup(const std::string& rom_path) {
+	auto [file_path, member] = archive::split(rom_path);
+	std::error_code error;
+	std::filesystem::path rom = std::filesystem::weakly_canonical(file_path, error);
+	if (error) return std::nullopt;
+	u64 size = std::filesystem::file_size(rom, error);
+	u64 modified = file_ticks(std::filesystem::last_write_time(rom, error));
+	if (error) return std::nullopt;
+
+	// Nearest index up the tree, a library scanned from a parent directory covers its subdirectories
+	for (std::filesystem::path directory = rom.parent_path(); !directory.empty(); directory = directory.parent_path()) {
+		std::filesystem::path index = directory / INDEX_NAME;
+		if (std::filesystem::is_regular_file(index, error)) {
+			std::string relative = std::filesystem::relative(rom, directory, error).generic_string();
+			std::vector<rom_entry> entries = read_index(index);
+			// An archive named without a member stands for its rom when it has just one
+			if (member.empty() && archive::is_archive(rom)) {
+				relative += archive::MEMBER_SEPARATOR;
+				std::erase_if(entries, [&relative](const rom_entry& entry) { return !entry.path.starts_with(relative); });
+				if (entries.size() == 1 && entries[0].size == size && entries[0].modified == modified) return entries[0];
+				return std::nullopt;
+			}
+			if (!member.empty()) relative += archive::MEMBER_SEPARATOR + member;
+			for (rom_entry& entry : entries) {
+				if (entry.path == relative && entry.size == size && entry.modified == modified) return entry;
+			}
+			return std::nullopt;
+		}
+		if (directory == directory.root_path()) break;
+	}
+	return std::nullopt;
+}
@@ -0,0 +1,163 @@
+#include "../header/run_ahead.h"
+
+#include <chrono>
+
+run_ahead::ahead_machine::ahead_machine(const cartridge& rom, const ppu& source, std::vector<u32>& buffer1, std::vector<u32>& buffer2) :
+	game(rom),
+	BUS(),
+	CPU(),
+	PPU()
+{
+	this->CPU.connect(&this->BUS);
+	this->PPU.connect(&this->BUS);
+	this->PPU.set_pixel_buffers(buffer1, buffer2);
+	this->PPU.set_timing(source.get_timing());
+	this->PPU.set_a12_mode(source.get_a12_mode());
+	this->BUS.connect(&this->CPU);
+	this->BUS.connect(&this->PPU);
+
+	this->CPU.load(&this->game);
+	// Only the source is heard
+	this->BUS.get_apu().set_silent(true);
+}
+
+run_ahead::~run_ahead() {
+	this->stop_second();
+}
+
+void run_ahead::run_frame(cpu& machine, ppu& video) {
+	usize frame = video.get_frames();
+	while (video.get_frames() == frame && !machine.get_halted()) {
+		machine.step();
+	}
+}
+
+void run_ahead::frame_done() {
+	using clock = std::chrono::steady_clock;
+	using micro = std::chrono::duration<double, std::micro>;
+
+	if (this->second != nullptr) {
+		auto start = clock::now();
+		{
+			std::lock_guard<std::mutex> lock(this->handoff_mutex);
+			if (this->has_pending) this->dropped.fetch_add(1, std::memory_order_relaxed);
+			this->source_cpu->save_state(this->pending);
+			this->pending_buttons = this->source_bus->get_controllers().get_all_buttons();
+			this->pending_four_score = this->source_bus->get_controllers().get_four_score();
+			this->pending_timing = this->source_ppu->get_timing();
+			this->has_pending = true;
+			this->state_size.store(this->pending.size(), std::memory_order_relaxed);
+		}
+		this->save_us.store(micro(clock::now() - start).count(), std::memory_order_relaxed);
+		this->handoff.notify_one();
+		return;
+	}
+
+	usize ahead = this->frames.load(std::memory_order_relaxed);
+	// A deferred ppu feeds its register log to the pipeline's replica, which cannot go back in time
+	if (ahead == 0 || this->source_ppu->is_deferred()) {
+		this->source_ppu->set_hidden(false);
+		return;
+	}
+
+	apu& audio = this->source_bus->get_apu();
+	auto start = clock::now();
+	this->source_cpu->save_state(this->saved);
+	auto saved_at = clock::now();
+
+	audio.set_silent(true);
+	for (usize frame = 1; frame <= ahead; ++frame) {
+		this->source_ppu->set_hidden(frame != ahead);
+		run_ahead::run_frame(*this->source_cpu, *this->source_ppu);
+	}
+	auto ran_at = clock::now();
+
+	this->source_cpu->load_state(this->saved);
+	auto loaded_at = clock::now();
+	audio.set_silent(false);
+	// Its picture was already shown
+	this->source_ppu->set_hidden(true);
+
+	this->save_us.store(micro(saved_at - start).count(), std::memory_order_relaxed);
+	this->state_size.store(this->saved.size(), std::memory_order_relaxed);
+	this->ahead_us.store(micro(ran_at - saved_at).count(), std::memory_order_relaxed);
+	this->load_us.store(micro(loaded_at - ran_at).count(), std::memory_order_relaxed);
+}
+
+void run_ahead::start_second(cartridge* game, std::vector<u32>& buffer1, std::vector<u32>& buffer2) {
+	if (this->is_second_running()) this->stop_second();
+
+	this->second = std::make_unique<ahead_machine>(*game, *this->source_ppu, buffer1, buffer2);
+	this->second->BUS.set_cheats(this->cheats);
+	// Its pads read the input first
+	this->second->BUS.get_controllers().set_probe(this->source_bus->get_controllers().get_probe());
+	this->has_pending = false;
+	this->dropped.store(0, std::memory_order_relaxed);
+	this->runs.store(0, std::memory_order_relaxed);
+	this->busy_us.store(0.0, std::memory_order_relaxed);
+
+	this->source_ppu->move_sinks_to(this->second->PPU);
+	this->source_ppu->set_hidden(true);
+
+	this->worker = std::jthread([this](std::stop_token st) { this->run_second(st); });
+}
+
+void run_ahead::stop_second() {
+	if (!this->is_second_running()) return;
+
+	{
+		// Under the lock so the worker cannot miss it between its check and its wait
+		std::lock_guard<std::mutex> lock(this->handoff_mutex);
+		this->worker.request_stop();
+	}
+	this->handoff.notify_one();
+	this->worker.join();
+
+	this->second->PPU.move_sinks_to(*this->source_ppu);
+	this->source_ppu->set_hidden(false);
+	this->second.reset();
+}
+
+void run_ahead::run_second(std::stop_token st) {
+	using clock = std::chrono::steady_clock;
+	using micro = std::chrono::duration<double, std::micro>;
+
+	ahead_machine& ahead = *this->second;
+	controller_ports& pads = ahead.BUS.get_controllers();
+	machine_state state;
+
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(this->handoff_mutex);
+			this->handoff.wait(lock, [this, &st] { return st.stop_requested() || this->has_pending; });
+			if (st.stop_requested()) return;
+			std::swap(state, this->pending);
+			pads.set_all_buttons(this->pending_buttons);
+			pads.set_four_score(this->pending_four_score);
+			if (ahead.PPU.get_timing() != this->pending_timing) ahead.PPU.set_timing(this->pending_timing);
+			this->has_pending = false;
+		}
+		ahead.PPU.set_a12_mode(this->source_ppu->get_a12_mode());
+
+		auto start = clock::now();
+		ahead.CPU.load_state(state);
+		auto loaded_at = clock::now();
+
+		usize count = std::max<usize>(this->frames.load(std::memory_order_relaxed), 1);
+		for (usize frame = 1; frame <= count; ++frame) {
+			ahead.PPU.set_hidden(frame != count);
+			run_ahead::run_frame(ahead.CPU, ahead.PPU);
+		}
+
+		auto ran_at = clock::now();
+		this->load_us.store(micro(loaded_at - start).count(), std::memory_order_relaxed);
+		this->ahead_us.store(micro(ran_at - loaded_at).count(), std::memory_order_relaxed);
+		this->busy_us.store(this->busy_us.load(std::memory_order_relaxed) + micro(ran_at - start).count(), std::memory_order_relaxed);
+		this->runs.fetch_add(1, std::memory_order_release);
+	}
+}
+
+void run_ahead::set_cheats(const std::vector<cheat>& cheats) {
+	this->cheats = cheats;
+	if (this->second != nullptr) this->second->BUS.set_cheats(cheats);
+}
@@ -0,0 +1,266 @@
+#include "../header/shared_frame_ring.h"
+
+#include <new>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <climits>
+#include <ctime>
+#endif
+#endif
+
+usize shared_frame_ring::slot_stride() {
+	return shared_frame_ring::PIXEL_OFFSET + shared_frame_ring::WIDTH * shared_frame_ring::HEIGHT * sizeof(u32);
+}
+
+shared_frame_ring::shared_frame_ring(const std::string& name, usize slot_count) :
+	name(name),
+	mapping(nullptr),
+	mapping_size(SLOT_OFFSET + slot_count * shared_frame_ring::slot_stride()),
+	sequence(0),
+#ifdef _WIN32
+	mapping_handle(nullptr),
+	wake_event(nullptr)
+#else
+	descriptor(-1)
+#endif
+{
+	if (slot_count < 2) throw std::runtime_error("A shared frame ring needs at least two slots");
+
+#ifdef _WIN32
+	std::string object_name = "Local\\" + name;
+	this->mapping_handle = CreateFileMappingA(
+		INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+		static_cast<DWORD>(static_cast<u64>(this->mapping_size) >> 32), static_cast<DWORD>(this->mapping_size & 0xFFFFFFFF),
+		object_name.c_str()
+	);
+	if (this->mapping_handle == nullptr) throw std::runtime_error("Cannot create the shared frame mapping");
+
+	this->mapping = static_cast<u8*>(MapViewOfFile(this->mapping_handle, FILE_MAP_ALL_ACCESS, 0, 0, this->mapping_size));
+	if (this->mapping == nullptr) {
+		CloseHandle(this->mapping_handle);
+		throw std::runtime_error("Cannot map the shared frame mapping");
+	}
+	this->wake_event = CreateEventA(nullptr, FALSE, FALSE, (object_name + ".wake").c_str());
+#else
+	std::string object_name = "/" + name;
+	this->descriptor = shm_open(object_name.c_str(), O_CREAT | O_RDWR, 0600);
+	if (this->descriptor < 0) throw std::runtime_error("Cannot create the shared frame object");
+
+	if (ftruncate(this->descriptor, static_cast<off_t>(this->mapping_size)) != 0) {
+		close(this->descriptor);
+		shm_unlink(object_name.c_str());
+		throw std::runtime_error("Cannot size the shared frame object");
+	}
+	void* view = mmap(nullptr, this->mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, this->descriptor, 0);
+	if (view == MAP_FAILED) {
+		close(this->descriptor);
+		shm_unlink(object_name.c_str());
+		throw std::runtime_error("Cannot map the shared frame object");
+	}
+	this->mapping = static_cast<u8*>(view);
+#endif
+
+	shared_frame_header* header = new (this->mapping) shared_frame_header{};
+	header->version = shared_frame_header::VERSION;
+	header->width = static_cast<u32>(WIDTH);
+	header->height = static_cast<u32>(HEIGHT);
+	header->slot_count = static_cast<u32>(slot_count);
+	header->slot_offset = static_cast<u32>(SLOT_OFFSET);
+	header->slot_stride = static_cast<u32>(shared_frame_ring::slot_stride());
+	header->pixel_offset = static_cast<u32>(PIXEL_OFFSET);
+	for (usize i = 0; i < slot_count; ++i) {
+		new (this->mapping + SLOT_OFFSET + i * shared_frame_ring::slot_stride()) shared_frame_slot{};
+	}
+	// Readers check the magic last, everything above is visible once they see it
+	std::atomic_thread_fence(std::memory_order_release);
+	header->magic = shared_frame_header::MAGIC;
+}
+
+shared_frame_ring::~shared_frame_ring() {
+#ifdef _WIN32
+	if (this->wake_event != nullptr) CloseHandle(this->wake_event);
+	UnmapViewOfFile(this->mapping);
+	CloseHandle(this->mapping_handle);
+#else
+	munmap(this->mapping, this->mapping_size);
+	close(this->descriptor);
+	shm_unlink(("/" + this->name).c_str());
+#endif
+}
+
+void shared_frame_ring::submit(std::span<const u32> pixels, const frame_digest& digest, usize frame) {
+	this->publish(pixels, digest, frame, shared_machine_state{});
+}
+
+void shared_frame_ring::publish(std::span<const u32> pixels, const frame_digest& digest, usize frame, const shared_machine_state& machine) {
+	static_assert(sizeof(shared_frame_slot) <= PIXEL_OFFSET, "The slot header overlaps the pixels");
+	static_assert(sizeof(shared_frame_header) <= SLOT_OFFSET, "The ring header overlaps the first slot");
+
+	shared_frame_header* header = this->header();
+	u64 next = this->sequence + 1;
+	u8* base = this->mapping + SLOT_OFFSET + (next % header->slot_count) * shared_frame_ring::slot_stride();
+	shared_frame_slot* slot = reinterpret_cast<shared_frame_slot*>(base);
+
+	slot->sequence.store(0, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	slot->frame = frame;
+	slot->hash = digest.hash;
+	slot->machine = machine;
+	std::memcpy(base + PIXEL_OFFSET, pixels.data(), std::min(pixels.size(), WIDTH * HEIGHT) * sizeof(u32));
+	slot->sequence.store(next, std::memory_order_release);
+
+	header->published.store(next, std::memory_order_release);
+	this->sequence = next;
+	this->wake_consumers();
+}
+
+void shared_frame_ring::set_status(u32 status) {
+	this->header()->status.store(status, std::memory_order_release);
+	this->wake_consumers();
+}
+
+void shared_frame_ring::wake_consumers() {
+	shared_frame_header* header = this->header();
+	header->wake.fetch_add(1, std::memory_order_release);
+#ifdef _WIN32
+	if (this->wake_event != nullptr) SetEvent(this->wake_event);
+#elif defined(__linux__)
+	if (header->waiters.load(std::memory_order_acquire) > 0) {
+		syscall(SYS_futex, reinterpret_cast<u32*>(&header->wake), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+	}
+#endif
+}
+
+shared_frame_reader::shared_frame_reader(const std::string& name) :
+	mapping(nullptr),
+	mapping_size(0),
+#ifdef _WIN32
+	mapping_handle(nullptr),
+	wake_event(nullptr)
+#else
+	descriptor(-1)
+#endif
+{
+#ifdef _WIN32
+	std::string object_name = "Local\\" + name;
+	this->mapping_handle = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, object_name.c_str());
+	if (this->mapping_handle == nullptr) throw std::runtime_error("No shared frame mapping with this name");
+
+	this->mapping = static_cast<u8*>(MapViewOfFile(this->mapping_handle, FILE_MAP_ALL_ACCESS, 0, 0, 0));
+	if (this->mapping == nullptr) {
+		CloseHandle(this->mapping_handle);
+		throw std::runtime_error("Cannot map the shared frame mapping");
+	}
+	MEMORY_BASIC_INFORMATION info;
+	VirtualQuery(this->mapping, &info, sizeof(info));
+	this->mapping_size = info.RegionSize;
+	this->wake_event = OpenEventA(SYNCHRONIZE, FALSE, (object_name + ".wake").c_str());
+#else
+	this->descriptor = shm_open(("/" + name).c_str(), O_RDWR, 0600);
+	if (this->descriptor < 0) throw std::runtime_error("No shared frame object with this name");
+
+	struct stat info;
+	if (fstat(this->descriptor, &info) != 0 || info.st_size < static_cast<off_t>(shared_frame_ring::SLOT_OFFSET)) {
+		close(this->descriptor);
+		throw std::runtime_error("The shared frame object is too small");
+	}
+	this->mapping_size = static_cast<usize>(info.st_size);
+	void* view = mmap(nullptr, this->mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, this->descriptor, 0);
+	if (view == MAP_FAILED) {
+		close(this->descriptor);
+		throw std::runtime_error("Cannot map the shared frame object");
+	}
+	this->mapping = static_cast<u8*>(view);
+#endif
+
+	const shared_frame_header* header = this->header();
+	bool valid = header->magic == shared_frame_header::MAGIC
+		&& header->version == shared_frame_header::VERSION
+		&& header->slot_count >= 2
+		&& static_cast<usize>(header->slot_offset) + static_cast<usize>(header->slot_count) * header->slot_stride <= this->mapping_size;
+	std::atomic_thread_fence(std::memory_order_acquire);
+	if (!valid) {
+#ifdef _WIN32
+		if (this->wake_event != nullptr) CloseHandle(this->wake_event);
+		UnmapViewOfFile(this->mapping);
+		CloseHandle(this->mapping_handle);
+#else
+		munmap(this->mapping, this->mapping_size);
+		close(this->descriptor);
+#endif
+		throw std::runtime_error("Unknown shared frame layout");
+	}
+}
+
+shared_frame_reader::~shared_frame_reader() {
+#ifdef _WIN32
+	if (this->wake_event != nullptr) CloseHandle(this->wake_event);
+	UnmapViewOfFile(this->mapping);
+	CloseHandle(this->mapping_handle);
+#else
+	munmap(this->mapping, this->mapping_size);
+	close(this->descriptor);
+#endif
+}
+
+bool shared_frame_reader::wait_for(u64 sequence, u32 timeout_ms) {
+	using clock = std::chrono::steady_clock;
+
+	shared_frame_header* header = this->header();
+	auto deadline = clock::now() + std::chrono::milliseconds(timeout_ms);
+	while (true) {
+		u32 observed = header->wake.load(std::memory_order_acquire);
+		if (header->published.load(std::memory_order_acquire) >= sequence) return true;
+
+		auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - clock::now());
+		if (remaining.count() <= 0) return false;
+
+#ifdef _WIN32
+		if (this->wake_event != nullptr) WaitForSingleObject(this->wake_event, static_cast<DWORD>(remaining.count()));
+		else std::this_thread::sleep_for(std::chrono::milliseconds(1));
+#elif defined(__linux__)
+		timespec timeout = { static_cast<time_t>(remaining.count() / 1000), static_cast<long>((remaining.count() % 1000) * 1000000) };
+		header->waiters.fetch_add(1, std::memory_order_acq_rel);
+		syscall(SYS_futex, reinterpret_cast<u32*>(&header->wake), FUTEX_WAIT, observed, &timeout, nullptr, 0);
+		header->waiters.fetch_sub(1, std::memory_order_acq_rel);
+#else
+		(void)observed;
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+#endif
+	}
+}
+
+const shared_frame_slot* shared_frame_reader::slot(u64 sequence) const {
+	const shared_frame_header* header = this->header();
+	return reinterpret_cast<const shared_frame_slot*>(this->mapping + header->slot_offset + (sequence % header->slot_count) * header->slot_stride);
+}
+
+std::span<const u32> shared_frame_reader::pixels(u64 sequence) const {
+	const shared_frame_header* header = this->header();
+	const shared_frame_slot* slot = this->slot(sequence);
+	if (slot->sequence.load(std::memory_order_acquire) != sequence) return {};
+	const u8* base = reinterpret_cast<const u8*>(slot) + header->pixel_offset;
+	return std::span<const u32>(reinterpret_cast<const u32*>(base), static_cast<usize>(header->width) * header->height);
+}
+
+bool shared_frame_reader::still_valid(u64 sequence) const {
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return this->slot(sequence)->sequence.load(std::memory_order_relaxed) == sequence;
+}
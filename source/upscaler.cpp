@@ -0,0 +1,335 @@
+#include "../header/upscaler.h"
+
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define UPSCALE_SSE2
+#endif
+
+#ifdef UPSCALE_SSE2
+inline static __m128i choose(__m128i mask, __m128i a, __m128i b) {
+	return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+#endif
+
+// Pixels are RGBA in memory, so red is the low byte
+inline static bool differs(u32 a, u32 b) {
+	if (a == b) return false;
+	int dr = static_cast<int>(a & 0xFF) - static_cast<int>(b & 0xFF);
+	int dg = static_cast<int>((a >> 8) & 0xFF) - static_cast<int>((b >> 8) & 0xFF);
+	int db = static_cast<int>((a >> 16) & 0xFF) - static_cast<int>((b >> 16) & 0xFF);
+	int y = (dr * 299 + dg * 587 + db * 114) / 1000;
+	int u = (-dr * 169 - dg * 331 + db * 500) / 1000;
+	int v = (dr * 500 - dg * 419 - db * 81) / 1000;
+	return std::abs(y) > 48 || std::abs(u) > 7 || std::abs(v) > 6;
+}
+
+// Per channel (weight_a * a + weight_b * b + weight_c * c) / 4
+inline static u32 blend(u32 a, u32 b, u32 c, u32 weight_a, u32 weight_b, u32 weight_c) {
+	u32 result = 0;
+	for (u32 shift = 0; shift < 32; shift += 8) {
+		u32 channel = (((a >> shift) & 0xFF) * weight_a + ((b >> shift) & 0xFF) * weight_b + ((c >> shift) & 0xFF) * weight_c) >> 2;
+		result |= channel << shift;
+	}
+	return result;
+}
+
+inline static void nearest2x_row(const upscale::padded_frame& src, usize y, u32* out0, u32* out1) {
+	const u32* row = src.row(y);
+	usize x = 0;
+#ifdef UPSCALE_SSE2
+	for (; x + 4 <= src.width; x += 4) {
+		__m128i e = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x));
+		__m128i lo = _mm_unpacklo_epi32(e, e);
+		__m128i hi = _mm_unpackhi_epi32(e, e);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out0 + 2 * x), lo);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out0 + 2 * x + 4), hi);
+	}
+#endif
+	for (; x < src.width; ++x) {
+		out0[2 * x] = row[x];
+		out0[2 * x + 1] = row[x];
+	}
+	std::memcpy(out1, out0, src.width * 2 * sizeof(u32));
+}
+
+inline static void nearest3x_row(const upscale::padded_frame& src, usize y, u32* out0, u32* out1, u32* out2) {
+	const u32* row = src.row(y);
+	for (usize x = 0; x < src.width; ++x) {
+		out0[3 * x] = row[x];
+		out0[3 * x + 1] = row[x];
+		out0[3 * x + 2] = row[x];
+	}
+	std::memcpy(out1, out0, src.width * 3 * sizeof(u32));
+	std::memcpy(out2, out0, src.width * 3 * sizeof(u32));
+}
+
+/*  A B C
+ *  D E F   ->  E0 E1
+ *  G H I       E2 E3
+ */
+inline static void scale2x_row(const upscale::padded_frame& src, usize y, u32* out0, u32* out1) {
+	const u32* row = src.row(y);
+	const u32* up = row - src.stride();
+	const u32* down = row + src.stride();
+	usize x = 0;
+#ifdef UPSCALE_SSE2
+	const __m128i ones = _mm_set1_epi32(-1);
+	for (; x + 4 <= src.width; x += 4) {
+		__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(up + x));
+		__m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i*>(down + x));
+		__m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x - 1));
+		__m128i e = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x));
+		__m128i f = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x + 1));
+
+		__m128i active = _mm_andnot_si128(_mm_or_si128(_mm_cmpeq_epi32(b, h), _mm_cmpeq_epi32(d, f)), ones);
+		__m128i e0 = choose(_mm_and_si128(active, _mm_cmpeq_epi32(d, b)), d, e);
+		__m128i e1 = choose(_mm_and_si128(active, _mm_cmpeq_epi32(b, f)), f, e);
+		__m128i e2 = choose(_mm_and_si128(active, _mm_cmpeq_epi32(d, h)), d, e);
+		__m128i e3 = choose(_mm_and_si128(active, _mm_cmpeq_epi32(h, f)), f, e);
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out0 + 2 * x), _mm_unpacklo_epi32(e0, e1));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out0 + 2 * x + 4), _mm_unpackhi_epi32(e0, e1));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out1 + 2 * x), _mm_unpacklo_epi32(e2, e3));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out1 + 2 * x + 4), _mm_unpackhi_epi32(e2, e3));
+	}
+#endif
+	for (; x < src.width; ++x) {
+		u32 b = up[x], h = down[x], d = row[x - 1], e = row[x], f = row[x + 1];
+		bool active = b != h && d != f;
+		out0[2 * x] = (active && d == b) ? d : e;
+		out0[2 * x + 1] = (active && b == f) ? f : e;
+		out1[2 * x] = (active && d == h) ? d : e;
+		out1[2 * x + 1] = (active && h == f) ? f : e;
+	}
+}
+
+/*  A B C       E0 E1 E2
+ *  D E F   ->  E3 E4 E5
+ *  G H I       E6 E7 E8
+ */
+inline static void scale3x_pixel(u32 a, u32 b, u32 c, u32 d, u32 e, u32 f, u32 g, u32 h, u32 i, u32* out0, u32* out1, u32* out2) {
+	if (b == h || d == f) {
+		out0[0] = out0[1] = out0[2] = e;
+		out1[0] = out1[1] = out1[2] = e;
+		out2[0] = out2[1] = out2[2] = e;
+		return;
+	}
+	out0[0] = d == b ? d : e;
+	out0[1] = ((d == b && e != c) || (b == f && e != a)) ? b : e;
+	out0[2] = b == f ? f : e;
+	out1[0] = ((d == b && e != g) || (d == h && e != a)) ? d : e;
+	out1[1] = e;
+	out1[2] = ((b == f && e != i) || (h == f && e != c)) ? f : e;
+	out2[0] = d == h ? d : e;
+	out2[1] = ((d == h && e != i) || (h == f && e != g)) ? h : e;
+	out2[2] = h == f ? f : e;
+}
+
+inline static void scale3x_row(const upscale::padded_frame& src, usize y, u32* out0, u32* out1, u32* out2) {
+	const u32* row = src.row(y);
+	const u32* up = row - src.stride();
+	const u32* down = row + src.stride();
+	usize x = 0;
+#ifdef UPSCALE_SSE2
+	const __m128i ones = _mm_set1_epi32(-1);
+	alignas(16) u32 result[9][4];
+	for (; x + 4 <= src.width; x += 4) {
+		__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(up + x - 1));
+		__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(up + x));
+		__m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(up + x + 1));
+		__m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x - 1));
+		__m128i e = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x));
+		__m128i f = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x + 1));
+		__m128i g = _mm_loadu_si128(reinterpret_cast<const __m128i*>(down + x - 1));
+		__m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i*>(down + x));
+		__m128i i = _mm_loadu_si128(reinterpret_cast<const __m128i*>(down + x + 1));
+
+		__m128i active = _mm_andnot_si128(_mm_or_si128(_mm_cmpeq_epi32(b, h), _mm_cmpeq_epi32(d, f)), ones);
+		__m128i db = _mm_and_si128(active, _mm_cmpeq_epi32(d, b));
+		__m128i bf = _mm_and_si128(active, _mm_cmpeq_epi32(b, f));
+		__m128i dh = _mm_and_si128(active, _mm_cmpeq_epi32(d, h));
+		__m128i hf = _mm_and_si128(active, _mm_cmpeq_epi32(h, f));
+		__m128i not_a = _mm_andnot_si128(_mm_cmpeq_epi32(e, a), ones);
+		__m128i not_c = _mm_andnot_si128(_mm_cmpeq_epi32(e, c), ones);
+		__m128i not_g = _mm_andnot_si128(_mm_cmpeq_epi32(e, g), ones);
+		__m128i not_i = _mm_andnot_si128(_mm_cmpeq_epi32(e, i), ones);
+
+		_mm_store_si128(reinterpret_cast<__m128i*>(result[0]), choose(db, d, e));
+		_mm_store_si128(reinterpret_cast<__m128i*>(result[1]), choose(_mm_or_si128(_mm_and_si128(db, not_c), _mm_and_si128(bf, not_a)), b, e));
+		_mm_store_si128(reinterpret_cast<__m128i*>(result[2]), choose(bf, f, e));
+		_mm_store_si128(reinterpret_cast<__m128i*>(result[3]), choose(_mm_or_si128(_mm_and_si128(db, not_g), _mm_and_si128(dh, not_a)), d, e));
+		_mm_store_si128(reinterpret_cast<__m128i*>(result[4]), e);
+		_mm_store_si128(reinterpret_cast<__m128i*>(result[5]), choose(_mm_or_si128(_mm_and_si128(bf, not_i), _mm_and_si128(hf, not_c)), f, e));
+		_mm_store_si128(reinterpret_cast<__m128i*>(result[6]), choose(dh, d, e));
+		_mm_store_si128(reinterpret_cast<__m128i*>(result[7]), choose(_mm_or_si128(_mm_and_si128(dh, not_i), _mm_and_si128(hf, not_g)), h, e));
+		_mm_store_si128(reinterpret_cast<__m128i*>(result[8]), choose(hf, f, e));
+
+		for (usize lane = 0; lane < 4; ++lane) {
+			usize column = 3 * (x + lane);
+			out0[column] = result[0][lane]; out0[column + 1] = result[1][lane]; out0[column + 2] = result[2][lane];
+			out1[column] = result[3][lane]; out1[column + 1] = result[4][lane]; out1[column + 2] = result[5][lane];
+			out2[column] = result[6][lane]; out2[column + 1] = result[7][lane]; out2[column + 2] = result[8][lane];
+		}
+	}
+#endif
+	for (; x < src.width; ++x) {
+		scale3x_pixel(
+			up[x - 1], up[x], up[x + 1],
+			row[x - 1], row[x], row[x + 1],
+			down[x - 1], down[x], down[x + 1],
+			out0 + 3 * x, out1 + 3 * x, out2 + 3 * x
+		);
+	}
+}
+
+// One corner of the output pixel: side1 / side2 are the edge neighbours next to it, corner the diagonal one
+inline static u32 hq2x_corner(u32 e, u32 side1, u32 side2, u32 corner) {
+	if (differs(side1, side2) || !differs(e, side1)) return e;
+	// An edge runs between the two sides: blend hard if the corner belongs to them, softly if it belongs to e
+	return differs(e, corner) ? blend(e, side1, side2, 2, 1, 1) : blend(e, side1, side2, 3, 1, 0);
+}
+
+inline static void hq2x_row(const upscale::padded_frame& src, usize y, u32* out0, u32* out1) {
+	const u32* row = src.row(y);
+	const u32* up = row - src.stride();
+	const u32* down = row + src.stride();
+	auto pixel = [&](usize x) {
+		u32 a = up[x - 1], b = up[x], c = up[x + 1];
+		u32 d = row[x - 1], e = row[x], f = row[x + 1];
+		u32 g = down[x - 1], h = down[x], i = down[x + 1];
+		out0[2 * x] = hq2x_corner(e, b, d, a);
+		out0[2 * x + 1] = hq2x_corner(e, b, f, c);
+		out1[2 * x] = hq2x_corner(e, h, d, g);
+		out1[2 * x + 1] = hq2x_corner(e, h, f, i);
+	};
+	usize x = 0;
+#ifdef UPSCALE_SSE2
+	// A pixel equal to its four edge neighbours keeps e in every corner; only the others need the YUV rules
+	for (; x + 4 <= src.width; x += 4) {
+		__m128i e = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x));
+		__m128i flat = _mm_and_si128(
+			_mm_and_si128(_mm_cmpeq_epi32(e, _mm_loadu_si128(reinterpret_cast<const __m128i*>(up + x))), _mm_cmpeq_epi32(e, _mm_loadu_si128(reinterpret_cast<const __m128i*>(down + x)))),
+			_mm_and_si128(_mm_cmpeq_epi32(e, _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x - 1))), _mm_cmpeq_epi32(e, _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x + 1))))
+		);
+		int lanes = _mm_movemask_ps(_mm_castsi128_ps(flat));
+		if (lanes == 0xF) {
+			__m128i lo = _mm_unpacklo_epi32(e, e);
+			__m128i hi = _mm_unpackhi_epi32(e, e);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out0 + 2 * x), lo);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out0 + 2 * x + 4), hi);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out1 + 2 * x), lo);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out1 + 2 * x + 4), hi);
+			continue;
+		}
+		for (usize lane = 0; lane < 4; ++lane) {
+			if ((lanes >> lane) & 1) {
+				u32 flat_pixel = row[x + lane];
+				out0[2 * (x + lane)] = out0[2 * (x + lane) + 1] = flat_pixel;
+				out1[2 * (x + lane)] = out1[2 * (x + lane) + 1] = flat_pixel;
+			}
+			else pixel(x + lane);
+		}
+	}
+#endif
+	for (; x < src.width; ++x) pixel(x);
+}
+
+void upscale::pad(std::span<const u32> src, padded_frame& dst) {
+	usize stride = dst.stride();
+	for (usize y = 0; y < dst.height; ++y) {
+		const u32* in = src.data() + y * dst.width;
+		u32* out = dst.pixels.data() + (y + 1) * stride;
+		out[0] = in[0];
+		std::memcpy(out + 1, in, dst.width * sizeof(u32));
+		out[dst.width + 1] = in[dst.width - 1];
+	}
+	std::memcpy(dst.pixels.data(), dst.pixels.data() + stride, stride * sizeof(u32));
+	std::memcpy(dst.pixels.data() + (dst.height + 1) * stride, dst.pixels.data() + dst.height * stride, stride * sizeof(u32));
+}
+
+void upscale::run(upscale_filter filter, const padded_frame& src, u32* dst, usize first, usize last) {
+	usize factor = upscale::FACTORS[filter];
+	usize out_stride = src.width * factor;
+	for (usize y = first; y < last; ++y) {
+		u32* out = dst + y * factor * out_stride;
+		switch (filter) {
+		case upscale_filter::nearest2x: nearest2x_row(src, y, out, out + out_stride); break;
+		case upscale_filter::nearest3x: nearest3x_row(src, y, out, out + out_stride, out + 2 * out_stride); break;
+		case upscale_filter::scale2x: scale2x_row(src, y, out, out + out_stride); break;
+		case upscale_filter::scale3x: scale3x_row(src, y, out, out + out_stride, out + 2 * out_stride); break;
+		case upscale_filter::hq2x: hq2x_row(src, y, out, out + out_stride); break;
+		default: break;
+		}
+	}
+}
+
+void upscale::run(upscale_filter filter, const padded_frame& src, u32* dst, worker_pool& pool) {
+	pool.run([filter, &src, dst](usize band, usize bands) {
+		usize first = src.height * band / bands;
+		usize last = src.height * (band + 1) / bands;
+		upscale::run(filter, src, dst, first, last);
+	});
+}
+
+upscaler::upscaler(upscale_filter filter, usize helpers) :
+	filter(filter),
+	pool(helpers),
+	input(256, 240),
+	outputs(),
+	pending(false),
+	stopping(false),
+	average_ms(),
+	filtered(0),
+	dropped(0)
+{
+	for (video_frame& out : this->outputs.all()) {
+		out.pixels = std::vector<u32>(256 * 3 * 240 * 3);
+	}
+	this->worker = std::jthread([this] { this->filter_loop(); });
+}
+
+upscaler::~upscaler() {
+	this->stopping.store(true);
+	this->pending.store(true, std::memory_order_release);
+	this->pending.notify_one();
+	this->worker.join();
+}
+
+void upscaler::submit(std::span<const u32> pixels, const frame_digest&, usize) {
+	if (this->pending.load(std::memory_order_acquire)) {
+		this->dropped++;
+		return;
+	}
+	upscale::pad(pixels, this->input);
+	this->pending.store(true, std::memory_order_release);
+	this->pending.notify_one();
+}
+
+void upscaler::filter_loop() {
+	using clock = std::chrono::steady_clock;
+
+	while (true) {
+		this->pending.wait(false, std::memory_order_acquire);
+		if (this->stopping.load()) return;
+
+		upscale_filter filter = this->filter.load();
+		video_frame& out = this->outputs.back();
+
+		auto start = clock::now();
+		upscale::run(filter, this->input, out.pixels.data(), this->pool);
+		std::chrono::duration<double, std::milli> elapsed = clock::now() - start;
+
+		out.width = this->input.width * upscale::FACTORS[filter];
+		out.height = this->input.height * upscale::FACTORS[filter];
+		this->outputs.publish();
+
+		double average = this->average_ms[filter].load();
+		this->average_ms[filter].store(average == 0.0 ? elapsed.count() : average * 0.9 + elapsed.count() * 0.1);
+		this->filtered++;
+		this->pending.store(false, std::memory_order_release);
+	}
+}